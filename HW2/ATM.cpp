@@ -4,162 +4,192 @@
  *  Created on: May 27, 2017
  *      Author: dror
  */
-#include <sstream>
 #include <unistd.h>
-#include <iterator>
-#include <algorithm>
 #include "ATM.h"
+#include "Fiber.h"
 #include "defs.h"
 
-typedef vector<string> line_tokens;
+//*****************************************************************ATM class API**********************************************************
+
+
+/********************************************
+// function name: 	ATM::ATM
+// Description	: 	Constructor.
+//					Check if file path is real, if yes - parses the file contents (in a single pass over the mapped file), if not - throws an ifstream::failure exception.
+//					In streaming mode the file is only opened, and is parsed by a background I/O thread while the ATM runs
+// Parameters	: 	file_path - the path to the commands file
+//					bank - a reference to a bank (a Bank, or a SharedBank), where the ATM will send its requests
+//					atm_id - the id of the ATM
+//					load_mode - ATM_LOAD_PRELOAD or ATM_LOAD_STREAM (default: ATM_LOAD_PRELOAD)
+// Returns		: 	None
+// Exception	: 	std::ifstream::failure in case file_path doesn't exist
+*/
+ATM::ATM(string file_path, bank_service* bank_ref, int atm_id, atm_load_mode load_mode) :	m_atm_id(atm_id),
+																							m_file_path(file_path),
+																							m_bank_ref(bank_ref),
+																							m_stream(NULL),
+																							m_next(0),
+																							m_chunk(NULL),
+																							m_chunk_passwords(NULL),
+																							m_chunk_size(0) {
+	if (load_mode == ATM_LOAD_STREAM) {
+		m_stream = new CommandStream(m_file_path); //throws in case the file doesn't exist
+		return;
+	}
+
+	CommandFile file(m_file_path); //throws in case the file doesn't exist
+
+	//parse the file, chunk by chunk, right into the commands array (a command line is rarely shorter than 16 characters)
+	m_commands.reserve(file.Size() / 16);
+	size_t num_parsed = 0;
+	do {
+		size_t old_size = m_commands.size();
+		m_commands.resize(old_size + ATM_LOAD_CHUNK);
+		num_parsed = file.Read(&m_commands[old_size], ATM_LOAD_CHUNK, m_passwords);
+		m_commands.resize(old_size + num_parsed);
+	} while (num_parsed > 0);
+
+	//give back the room of the last chunk (with many short files, it would cost far more than the commands themselves)
+	m_commands.shrink_to_fit();
+}
 
 /********************************************
-// function name: 	tokenize
-// Description	: 	Breaks a line into tokens 
-//					
-// Parameters	: 	file_path - the path to the path
-//					file__ - a reference to a parsed_file object, where the file contents will be filled
+// function name: 	ATM::~ATM
+// Description	: 	Destructor.
+//					Stops the stream of the file, if there is one
+// Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
-void tokenazie(string line, vector<string>& tokens){
-	tokens.clear();
-	stringstream ss(line);
-	string token;
-	while(ss >> token) tokens.push_back(token);
+ATM::~ATM(){
+	delete m_stream;
 }
 
 
+
 /********************************************
-// function name: 	__parse_file
-// Description	: 	Parses a file to vector on broken lines (vectors ot tokens)
-//					
-// Parameters	: 	file_path - the path to the path
-//					file__ - a reference to a parsed_file object, where the file contents will be filled
+// function name: 	ATM::Main
+// Description	: 	Main method of the class. 
+//					Reads every 100 mili-sec a line from the parsed file contents (or from the stream of the file), and sends a request to the bank 
+// Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
-void __parse_file(string const& file_path, parsed_file& file__){
-	file__.clear();
-	ifstream file_stream(file_path);
-	if(!file_stream.is_open()) return;
-	
-	//count the number of lines inside the file
-	file_stream.unsetf(std::ios_base::skipws);
-	unsigned num_file_lines = std::count(istream_iterator<char>(file_stream), istream_iterator<char>(), '\n'); // count the number of lines inside the file
-	
-	//reset fstream settings
-	file_stream.clear();
-	file_stream.setf(std::ios_base::skipws);
-	file_stream.seekg(0, ios::beg);
-
-	//parse the file
-	file__.reserve(num_file_lines);
-	string line;
-
-	//read the file line by line
-	while (getline(file_stream, line)) {
-		vector<string> line_tokens;
-		
-		//break the line into tokens
-		tokenazie(line, line_tokens);
-		
-		//push the tokens as a new entry
-		file__.push_back(line_tokens);
+void ATM::Main(){
+	atm_command const* command = NULL;
+	password_table const* passwords = NULL;
+	while (__next(command, passwords)) {
+		__execute(*command, *passwords);
+
+		//sleep for 0.1 seconds, then operate (a fiber ATM is suspended instead)
+		fiber_sleep(HUNDRED_MILI_SEC);
 	}
 
-	file_stream.close();
+	//signal to the bank that commands processing has finished
+	m_bank_ref->__signal_finished();
+	return;
 }
 
-//helper
-
-//*****************************************************************ATM class API**********************************************************
+/********************************************
+// function name: 	ATM::Step
+// Description	: 	Sends the request of the next command to the bank (the ATM as a task of an Executor - instead of sleeping 100 mili-sec
+//					between the commands, the ATM asks the executor to run its next step 100 mili-sec later)
+// Parameters	: 	None
+// Returns		: 	int - HUNDRED_MILI_SEC, or EXECUTOR_TASK_DONE once all of the commands were executed (the bank is signaled then)
+// Exception	: 	None
+*/
+int ATM::Step(){
+	atm_command const* command = NULL;
+	password_table const* passwords = NULL;
+	if (__next(command, passwords)) {
+		__execute(*command, *passwords);
+		return HUNDRED_MILI_SEC;
+	}
 
+	m_bank_ref->__signal_finished();
+	return EXECUTOR_TASK_DONE;
+}
 
 /********************************************
-// function name: 	ATM::ATM
-// Description	: 	Constructor.
-//					Check if file path is real, if yes - parses the file contents, if not - throws an ifstream::failure exception
-// Parameters	: 	file_path - the path to the commands file
-//					bank - a reference to a Bank object, where the ATM will send its requests
-// Returns		: 	None
-// Exception	: 	std::ifstream::failure in case file_path doesn't exist
+// function name: 	ATM::__next
+// Description	: 	Fetches the next command of the ATM - from the parsed commands, or from the stream of the file
+//					(a consumed chunk of the stream is released, and the next one is acquired)
+// Parameters	: 	command - set to the next command
+//					passwords - set to the password table the command's password id refers to
+// Returns		: 	bool - false once all of the commands were fetched, true otherwise
+// Exception	: 	None
 */
-ATM::ATM(string file_path, Bank* bank_ref, int atm_id) : m_atm_id(atm_id), m_file_path(file_path), m_bank_ref(bank_ref){
-	ifstream file(file_path);
-	if (!file.is_open()) {
-		stringstream error;
-		error << __func__ << " LINE " <<  __LINE__ << ": file at path " << file_path << " does not exist" << endl;
-		throw std::ifstream::failure(error.str());
+bool ATM::__next(atm_command const*& command, password_table const*& passwords){
+	if (!m_stream) {
+		if (m_next == m_commands.size())
+			return false;
+
+		command = &m_commands[m_next++];
+		passwords = &m_passwords;
+		return true;
 	}
-	file.close();
 
-	//parse the file
-	__parse_file(m_file_path, m_file_contents);
-}
+	if (m_chunk && m_next == m_chunk_size) {
+		m_stream->Release();
+		m_chunk = NULL;
+	}
 
+	if (!m_chunk) {
+		m_chunk_size = m_stream->Acquire(m_chunk, m_chunk_passwords);
+		m_next = 0;
+		if (m_chunk_size == 0) {
+			m_chunk = NULL;
+			return false;
+		}
+	}
 
+	command = &m_chunk[m_next++];
+	passwords = m_chunk_passwords;
+	return true;
+}
 
 /********************************************
-// function name: 	ATM::Main
-// Description	: 	Main method of the class. 
-//					Reads every 100 mili-sec a line from the parsed file contents, and sends a request to the bank 
-// Parameters	: 	None
+// function name: 	ATM::__execute
+// Description	: 	Sends the request of a single command to the bank
+// Parameters	: 	command - the command
+//					passwords - the password table the command's password id refers to
 // Returns		: 	None
 // Exception	: 	None
 */
-void ATM::Main(){
-	//read contents of the tokenized file
-	for(unsigned i = 0; i < m_file_contents.size(); ++i){
-		line_tokens& tokens = m_file_contents.at(i);
-		char op = tokens[0][0];
-		int account_no = atoi(tokens[1].c_str());
-		string password = tokens[2];
-		switch (op) {
-			case 'O':{
-				int amount = atoi(tokens[3].c_str());
-				m_bank_ref->OpenAccount(account_no, password, amount, m_atm_id);
-				break;
-			}
-
-			case 'D': {
-				int amount = atoi(tokens[3].c_str());
-				m_bank_ref->Deposit(account_no, password, amount, m_atm_id);
-				break;
-			}
-
-			case 'W':{
-				int amount = atoi(tokens[3].c_str());
-				m_bank_ref->Withdraw(account_no, password, amount, m_atm_id);
-				break;
-			}
-
-			case 'B':{
-				m_bank_ref->Balance(account_no, password, m_atm_id);
-				break;
-			}
-
-			case 'Q':{
-				m_bank_ref->RemoveAccount(account_no, password, m_atm_id);
-				break;
-			}
-
-			case 'T':{
-				int account_target = atoi(tokens[3].c_str());
-				int amount = atoi(tokens[4].c_str());
-
-				m_bank_ref->Transfer(account_no, password, account_target, amount, m_atm_id);
-				break;
-			}
-			default:
-				break;
+void ATM::__execute(atm_command const& command, password_table const& passwords){
+	int account_no = command.m_account;
+	string const& password = passwords.Get(command.m_password);
+	switch (command.m_op) {
+		case ATM_OP_OPEN:{
+			m_bank_ref->OpenAccount(account_no, password, command.m_amount, m_atm_id);
+			break;
 		}
 
-		//sleep for 0.1 seconds, then operate
-		usleep(HUNDRED_MILI_SEC);
-	}
+		case ATM_OP_DEPOSIT: {
+			m_bank_ref->Deposit(account_no, password, command.m_amount, m_atm_id);
+			break;
+		}
 
-	//signal to the bank that commands processing has finished
-	m_bank_ref->__signal_finished();
-	return;
+		case ATM_OP_WITHDRAW:{
+			m_bank_ref->Withdraw(account_no, password, command.m_amount, m_atm_id);
+			break;
+		}
+
+		case ATM_OP_BALANCE:{
+			m_bank_ref->Balance(account_no, password, m_atm_id);
+			break;
+		}
+
+		case ATM_OP_CLOSE:{
+			m_bank_ref->RemoveAccount(account_no, password, m_atm_id);
+			break;
+		}
+
+		case ATM_OP_TRANSFER:{
+			m_bank_ref->Transfer(account_no, password, command.m_target, command.m_amount, m_atm_id);
+			break;
+		}
+		default:
+			break;
+	}
 }
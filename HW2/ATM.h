@@ -10,11 +10,16 @@
 
 #include <fstream>
 #include <string>
-#include "Bank.h"
+#include <vector>
+#include "BankService.h"
+#include "CommandFile.h"
+#include "CommandStream.h"
+#include "Options.h"
+#include "Executor.h"
 
 using namespace std;
 
-typedef vector<vector<string>> parsed_file;
+#define ATM_LOAD_CHUNK 4096 //the number of commands parsed from the file at a time
 
 /********************************************
 // 	class name	: 	ATM
@@ -22,25 +27,43 @@ typedef vector<vector<string>> parsed_file;
 //
 //	Members		:	m_atm_id - a unique identifir of the ATM
 //					m_file_path - the file path where the ATM will read its operations from
-//					m_bank_ref - a reference (pointer) to a Bank object, where the ATM will send it's requests
-//					m_file_contents - a word-broken file. This is required since reading line by line from a file while executing with getline
+//					m_bank_ref - a reference (pointer) to a bank (a Bank, or a SharedBank), where the ATM will send it's requests
+//					m_commands - the parsed commands of the file (compact records). This is required since reading line by line from a file while executing with getline
 //										causes data race conflicts, so the file is parsed at initialization (on the main thread), 
 //										before ATM is sent to execution on a seperate thread
+//					m_passwords - the passwords of the commands, interned (a command holds the id of its password)
+//					m_stream - in streaming mode, the stream the commands are read from while the ATM runs (NULL when the file is preloaded)
+//					m_next - the index of the next command (of m_commands, or of the current chunk of the stream)
+//					m_chunk / m_chunk_passwords / m_chunk_size - the chunk of the stream that is currently executed (m_chunk is NULL if there is none)
 //					
 //	Methods		:	Main - the Main thread of ATM in which the ATM will execute its commands according to the file contents
+//					Step - executes a single command (the ATM as a task of an Executor)
 */
-class ATM {
+class ATM : public executor_task {
 public:	
 	/********************************************
 	// function name: 	ATM::ATM
 	// Description	: 	Constructor.
-	//					Check if file path is real, if yes - parses the file contents, if not - throws an ifstream::failure exception
+	//					Check if file path is real, if yes - parses the file contents (in a single pass over the mapped file), if not - throws an ifstream::failure exception.
+	//					In streaming mode the file is only opened, and is parsed by a background I/O thread while the ATM runs
 	// Parameters	: 	file_path - the path to the commands file
-	//					bank - a reference to a Bank object, where the ATM will send its requests
+	//					bank - a reference to a bank (a Bank, or a SharedBank), where the ATM will send its requests
+	//					atm_id - the id of the ATM
+	//					load_mode - ATM_LOAD_PRELOAD or ATM_LOAD_STREAM (default: ATM_LOAD_PRELOAD)
 	// Returns		: 	None
 	// Exception	: 	std::ifstream::failure in case file_path doesn't exist
 	*/
-	ATM(string file_path, Bank* bank_ref, int atm_id);
+	ATM(string file_path, bank_service* bank_ref, int atm_id, atm_load_mode load_mode = ATM_LOAD_PRELOAD);
+
+	/********************************************
+	// function name: 	ATM::~ATM
+	// Description	: 	Destructor.
+	//					Stops the stream of the file, if there is one
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual ~ATM();
 
 	/********************************************
 	// function name: 	ATM::Main
@@ -52,11 +75,35 @@ public:
 	*/
 	void Main();
 
+	/********************************************
+	// function name: 	ATM::Step
+	// Description	: 	Sends the request of the next command to the bank (the ATM as a task of an Executor - instead of sleeping 100 mili-sec
+	//					between the commands, the ATM asks the executor to run its next step 100 mili-sec later)
+	// Parameters	: 	None
+	// Returns		: 	int - HUNDRED_MILI_SEC, or EXECUTOR_TASK_DONE once all of the commands were executed (the bank is signaled then)
+	// Exception	: 	None
+	*/
+	virtual int Step();
+
+private:
+	bool __next(atm_command const*& command, password_table const*& passwords);
+	void __execute(atm_command const& command, password_table const& passwords);
+
+private: //do not allow the user to copy the object
+	ATM(ATM const&);
+	ATM& operator=(ATM const&);
+
 private:
 	int m_atm_id;
 	string m_file_path; //No need for a lock, only reading and only from one source
-	Bank* m_bank_ref;
-	parsed_file m_file_contents; //since getline causes data race conflicts, parse the file at initialization, before sent to thread
+	bank_service* m_bank_ref;
+	vector<atm_command> m_commands; //since getline causes data race conflicts, parse the file at initialization, before sent to thread
+	password_table m_passwords;
+	CommandStream* m_stream;
+	size_t m_next;
+	atm_command const* m_chunk;
+	password_table const* m_chunk_passwords;
+	size_t m_chunk_size;
 };
 
 
@@ -6,9 +6,22 @@
  */
 
 #include "ATM_manager.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <fstream>
+#include <sstream>
+#include <iostream>
 #include <exception>
+#include <map>
 #include <pthread.h>
+#include "Executor.h"
+#include "Fiber.h"
 
 //atm main thread method
 void* ATM_main(void* patm){
@@ -17,24 +30,41 @@ void* ATM_main(void* patm){
 	pthread_exit((void*)0);
 }
 
-
 /********************************************
 // function name: 	ATM_manager::ATM_manager
 // Description	: 	Constructor.
-//					Initializes N ATMs 
+//					Initializes N ATMs (in processes mode, only checks that their files exist - the ATMs are created by their processes)
 // Parameters	: 	atm_files - a list of file paths for the ATMs files
-//					bank - a reference to a Bank object, to be passed to the ATM contructor
+//					bank - a reference to a bank, to be passed to the ATM contructor
+//					options - the options of the run (the ATMs' load mode, the id of the first ATM, and the bank's segment in processes mode)
 // Returns		: 	None
 // Exception	: 	Propagates std::ifstream::failure from ATM::ATM ctor, if needed
 */
-ATM_manager::ATM_manager(vector<string> const& atm_files, Bank* bank){
+ATM_manager::ATM_manager(vector<string> const& atm_files, bank_service* bank, system_options const& options) :	m_run_mode(options.m_run_mode),
+																													m_num_workers(options.m_num_workers),
+																													m_bank(bank),
+																													m_options(options) {
+	if (m_run_mode == ATM_RUN_PROCESSES) {
+		for (unsigned i = 0; i < atm_files.size(); ++i) {
+			if (!ifstream(atm_files[i].c_str())) {
+				stringstream error;
+				error << __func__ << " LINE " <<  __LINE__ << ": file at path " << atm_files[i] << " does not exist" << endl;
+				throw std::ifstream::failure(error.str());
+			}
+		}
+
+		m_atm_files = atm_files;
+		bank->__set_num_atms(m_atm_files.size());
+		return;
+	}
+
 	m_atms.reserve(atm_files.size());
 
 	//create the atms
 	for (unsigned i = 0; i < atm_files.size(); ++i) {
 		//try to create a new ATM, catch the exception if file doesn't exist
 		try {
-			m_atms.push_back(new ATM(atm_files[i], bank, i + 1));
+			m_atms.push_back(new ATM(atm_files[i], bank, options.m_first_atm_id + i, options.m_load_mode));
 		}
 
 		catch (std::ifstream::failure& e) {
@@ -46,8 +76,8 @@ ATM_manager::ATM_manager(vector<string> const& atm_files, Bank* bank){
 		}
 	}
 
-	//set the counter top to be the number of ATMs in the system
-	bank->__set_counter_top(m_atms.size());
+	//the bank's latch is opened by the last of the ATMs in the system
+	bank->__set_num_atms(m_atms.size());
 }
 
 /********************************************
@@ -69,12 +99,41 @@ ATM_manager::~ATM_manager(){
 /********************************************
 // function name: 	ATM_manager::Main
 // Description	: 	Main method of the class. 
-//					Creates N new joinable threads, runs ATM::Main inside each one of them, and waits for them to finish
+//					Creates N new joinable threads, runs ATM::Main inside each one of them, and waits for them to finish.
+//					In executor mode, submits the ATMs to an Executor and runs it until all of the ATMs are done (in fibers mode,
+//					a fiber that runs ATM::Main is submitted for every ATM). In processes mode, runs the ATMs as processes (see __run_processes)
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
 void ATM_manager::Main(){
+	if (m_run_mode == ATM_RUN_PROCESSES) {
+		__run_processes();
+		return;
+	}
+
+	if (m_run_mode == ATM_RUN_EXECUTOR) {
+		Executor executor(m_num_workers);
+		for (unsigned i = 0; i < m_atms.size(); ++i)
+			executor.Submit(m_atms[i]);
+		executor.Run();
+		return;
+	}
+
+	if (m_run_mode == ATM_RUN_FIBERS) {
+		vector<Fiber*> fibers;
+		CreateFibers(fibers);
+
+		Executor executor(m_num_workers);
+		for (unsigned i = 0; i < fibers.size(); ++i)
+			executor.Submit(fibers[i]);
+		executor.Run();
+
+		for (unsigned i = 0; i < fibers.size(); ++i)
+			delete fibers[i];
+		return;
+	}
+
 	//initialize the threads metadata
 	vector<pthread_t> atm_threads;
 	atm_threads.resize(m_atms.size());
@@ -94,3 +153,90 @@ void ATM_manager::Main(){
 
 	return;
 }
+
+/********************************************
+// function name: 	ATM_manager::CreateFibers
+// Description	: 	Creates a fiber that runs ATM::Main for every ATM (to be run by an Executor or by a VirtualClock)
+// Parameters	: 	fibers - the fibers are appended to it (owned by the caller)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void ATM_manager::CreateFibers(vector<Fiber*>& fibers) const {
+	fibers.reserve(fibers.size() + m_atms.size());
+	for (unsigned i = 0; i < m_atms.size(); ++i)
+		fibers.push_back(new_method_fiber(m_atms[i], &ATM::Main));
+}
+
+/********************************************
+// function name: 	ATM_manager::__run_processes
+// Description	: 	Starts a process for every ATM - the program itself, attached to the bank's segment, running the single ATM with its
+//					id - and reaps the processes until all of them have exited. The bank is signaled for every process that exits,
+//					whether it has finished its file or crashed (a crash is reported to stderr). The processes are killed if the
+//					bank's process dies
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ATM_manager::__run_processes(){
+	//the command lines are built before forking - the child only calls async-signal-safe functions until it executes the program
+	vector<vector<string> > args(m_atm_files.size());
+	for (unsigned i = 0; i < m_atm_files.size(); ++i) {
+		stringstream atm_id;
+		atm_id << "--atm-id=" << m_options.m_first_atm_id + i;
+		args[i].push_back("Bank");
+		args[i].push_back("--attach=" + m_options.m_shm_name);
+		args[i].push_back(atm_id.str());
+		if (m_options.m_load_mode == ATM_LOAD_STREAM)
+			args[i].push_back("--stream");
+		args[i].push_back("1");
+		args[i].push_back(m_atm_files[i]);
+	}
+
+	map<pid_t, int> running; //pid -> the id of the ATM
+	for (unsigned i = 0; i < m_atm_files.size(); ++i) {
+		vector<char*> argv;
+		for (unsigned j = 0; j < args[i].size(); ++j)
+			argv.push_back(const_cast<char*>(args[i][j].c_str()));
+		argv.push_back(NULL);
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			prctl(PR_SET_PDEATHSIG, SIGKILL); //an ATM doesn't outlive the bank
+			execv("/proc/self/exe", &argv[0]);
+			_exit(EXIT_FAILURE);
+		}
+
+		if (pid < 0) {
+			perror("fork");
+			m_bank->__signal_finished(); //the ATM never runs
+			continue;
+		}
+		running[pid] = m_options.m_first_atm_id + i;
+	}
+
+	//reap the processes in the order they exit
+	while (!running.empty()) {
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break; //no children are left
+		}
+
+		map<pid_t, int>::iterator atm = running.find(pid);
+		if (atm == running.end())
+			continue;
+
+		if (WIFSIGNALED(status))
+			cerr << "ATM " << atm->second << " (process " << pid << ") was killed by signal " << WTERMSIG(status) << endl;
+		else if (WEXITSTATUS(status) != EXIT_SUCCESS)
+			cerr << "ATM " << atm->second << " (process " << pid << ") exited with status " << WEXITSTATUS(status) << endl;
+
+		running.erase(atm);
+		m_bank->__signal_finished();
+	}
+
+	for (unsigned i = 0; i < running.size(); ++i)
+		m_bank->__signal_finished(); //lost track of them, don't keep the bank waiting
+}
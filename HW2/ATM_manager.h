@@ -8,9 +8,14 @@
  /*
 	Module Name : ATM_manager
 	Description : A wrapper around an std::vector<ATM*> that allocates and frees N ATMs.
-					Also, the manager will spawn N threads, each thread for each ATM.
+					Also, the manager will spawn N threads, each thread for each ATM (or, in executor mode, run the ATMs as the tasks
+					of a work-stealing pool with a worker per core, so N ATMs don't cost N threads. In fibers mode, every ATM runs
+					as a fiber on the pool, and its sleeps and lock waits suspend the fiber instead of blocking a worker. In processes mode,
+					the manager starts a process for every ATM - the program itself, attached to the bank's shared memory segment - and
+					reaps the processes as they exit, so an ATM that crashes is only reported, and counted as done).
 	Main methods: 	1. ATM_manager::ATM_manager - allocates N ATMs
-					2. ATM_manager::Main - creates and runs N different threads (a thread for each ATM)
+					2. ATM_manager::Main - creates and runs N different threads (a thread for each ATM), runs the ATMs on an Executor,
+						or runs them as processes
  */
 
 #ifndef ATM_MANAGER_H_
@@ -18,7 +23,9 @@
 
 
 #include "ATM.h"
-#include "Bank.h"
+#include "BankService.h"
+#include "Options.h"
+#include "Fiber.h"
 #include <vector>
 #include <string>
 
@@ -30,6 +37,10 @@ using namespace std;
 //					The class spawns N independant threads, each one operates a single unique ATM, using ATM::Main()
 //
 //	Members		:	m_atms : a container that holds N dynamically allocated ATMs
+//					m_run_mode : a thread per ATM, the ATMs as the tasks of an Executor, or as fibers on an Executor
+//					m_num_workers : the number of workers of the Executor (0 - a worker per core)
+//					m_bank : the bank the ATMs send their requests to
+//					m_atm_files / m_options : in processes mode - the files of the ATMs, and the options their processes are started with
 //					
 //	Methods		:	Main - the Main thread of ATM_manager that creates another N new joinable threads that operate all the ATMs
 */
@@ -38,13 +49,14 @@ public:
 	/********************************************
 	// function name: 	ATM_manager::ATM_manager
 	// Description	: 	Constructor.
-	//					Initializes N ATMs 
+	//					Initializes N ATMs (in processes mode, only checks that their files exist - the ATMs are created by their processes)
 	// Parameters	: 	atm_files - a list of file paths for the ATMs files
-	//					bank - a reference to a Bank object, to be passed to the ATM contructor
+	//					bank - a reference to a bank, to be passed to the ATM contructor
+	//					options - the options of the run (the ATMs' load mode, the id of the first ATM, and the bank's segment in processes mode)
 	// Returns		: 	None
 	// Exception	: 	Propagates std::ifstream::failure from ATM::ATM ctor, if needed
 	*/
-	ATM_manager(vector<string> const& atm_files, Bank* bank);
+	ATM_manager(vector<string> const& atm_files, bank_service* bank, system_options const& options = system_options());
 	
 	/********************************************
 	// function name: 	ATM_manager::~ATM_manager
@@ -59,15 +71,44 @@ public:
 	/********************************************
 	// function name: 	ATM_manager::Main
 	// Description	: 	Main method of the class. 
-	//					Creates N new joinable threads, runs ATM::Main inside each one of them, and waits for them to finish
+	//					Creates N new joinable threads, runs ATM::Main inside each one of them, and waits for them to finish.
+	//					In executor mode, submits the ATMs to an Executor and runs it until all of the ATMs are done (in fibers mode,
+	//					a fiber that runs ATM::Main is submitted for every ATM). In processes mode, runs the ATMs as processes (see __run_processes)
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
 	void Main();
+
+	/********************************************
+	// function name: 	ATM_manager::CreateFibers
+	// Description	: 	Creates a fiber that runs ATM::Main for every ATM (to be run by an Executor or by a VirtualClock)
+	// Parameters	: 	fibers - the fibers are appended to it (owned by the caller)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void CreateFibers(vector<Fiber*>& fibers) const;
+
+private:
+	/********************************************
+	// function name: 	ATM_manager::__run_processes
+	// Description	: 	Starts a process for every ATM - the program itself, attached to the bank's segment, running the single ATM with its
+	//					id - and reaps the processes until all of them have exited. The bank is signaled for every process that exits,
+	//					whether it has finished its file or crashed (a crash is reported to stderr). The processes are killed if the
+	//					bank's process dies
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __run_processes();
 	
 private:
 	vector<ATM*> m_atms;
+	atm_run_mode m_run_mode;
+	unsigned m_num_workers;
+	bank_service* m_bank;
+	vector<string> m_atm_files;
+	system_options m_options;
 };
 
 
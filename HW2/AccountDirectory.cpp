@@ -0,0 +1,180 @@
+/*
+ * AccountDirectory.cpp
+ *
+ *  Created on: Jun 2, 2017
+ *      Author: dror
+ *
+ *	An implementation of the AccountDirectory class
+ */
+
+#include "AccountDirectory.h"
+
+#define HASH_MULTIPLIER 2654435761u //Knuth's multiplicative hash, spreads sequential account numbers over the shards
+
+/********************************************
+// function name: 	AccountDirectory::AccountDirectory
+// Description	: 	Constructor.
+//					Allocates the shards and initializes their locks
+// Parameters	: 	num_shards - the number of shards, rounded up to a power of 2 (default: DEFAULT_NUM_SHARDS)
+//					sleep_period - the sleeping period (in micro-seconds) of the shards' locks (default: 0)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+AccountDirectory::AccountDirectory(unsigned num_shards, unsigned sleep_period) : m_shard_mask(0) {
+	//round the number of shards up to a power of 2
+	unsigned n = 1;
+	while (n < num_shards) n <<= 1;
+	m_shard_mask = n - 1;
+
+	m_shards.reserve(n);
+	lock_site* site = lock_site_get("directory.shard"); //NULL while the instrumentation is off
+	try {
+		for (unsigned i = 0; i < n; ++i)
+			m_shards.push_back(new bucket(sleep_period, site));
+	}
+	catch (std::bad_alloc& e) {
+		for (int i = m_shards.size() - 1; i >= 0; --i)
+			delete m_shards[i];
+
+		m_shards.clear();
+		throw;
+	}
+}
+
+/********************************************
+// function name: 	AccountDirectory::~AccountDirectory
+// Description	: 	Destructor.
+//					Deletes all of the accounts that are still stored inside the directory, and the shards
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+AccountDirectory::~AccountDirectory() {
+	for (int i = (int)(m_shards.size() - 1); i >= 0; --i) {
+		bucket* s = m_shards[i];
+		s->m_lock.WriteLock();
+
+		for (auto it = s->m_accounts.begin(); it != s->m_accounts.end(); ++it)
+			delete it->second;
+
+		s->m_accounts.clear();
+		s->m_lock.WriteUnlock(false); //do not sleep
+
+		delete s;
+	}
+
+	m_shards.clear();
+}
+
+/********************************************
+// function name: 	AccountDirectory::ShardOf
+// Description	: 	Returns the index of the shard that holds (or will hold) a certain account
+// Parameters	: 	account_no - the account number
+// Returns		: 	unsigned - the index of the shard
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+unsigned AccountDirectory::ShardOf(int account_no) const {
+	//take the high bits of the product, they are the best mixed ones
+	unsigned hash = static_cast<unsigned>(account_no) * HASH_MULTIPLIER;
+	return (hash >> 16) & m_shard_mask;
+}
+
+/********************************************
+// function name: 	AccountDirectory::ShardLock
+// Description	: 	Returns the lock that protects a certain shard
+// Parameters	: 	shard - the index of the shard
+// Returns		: 	rwlock& - the lock of the shard
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+rwlock& AccountDirectory::ShardLock(unsigned shard) const {
+	return m_shards[shard]->m_lock;
+}
+
+/********************************************
+// function name: 	AccountDirectory::NumShards
+// Description	: 	Returns the number of shards of the directory
+// Parameters	: 	None
+// Returns		: 	unsigned - the number of shards
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+unsigned AccountDirectory::NumShards() const {
+	return m_shards.size();
+}
+
+/********************************************
+// function name: 	AccountDirectory::Find
+// Description	: 	Finds an account according to its account number
+// Parameters	: 	account_no - the account number
+// Returns		: 	BankAccount* - the account, NULL if there is no such account
+// Exception	: 	None
+// Thread-safety:	The caller must hold (at least) a shared lock on the account's shard
+*/
+BankAccount* AccountDirectory::Find(int account_no) const {
+	bucket const* s = m_shards[ShardOf(account_no)];
+	auto found = s->m_accounts.find(account_no);
+
+	return (found == s->m_accounts.end()) ? NULL : found->second;
+}
+
+/********************************************
+// function name: 	AccountDirectory::Insert
+// Description	: 	Inserts a new account to the directory. The directory takes ownership of the account
+// Parameters	: 	account - the account to be inserted
+// Returns		: 	bool - false in case an account with the same number already exists, true otherwise
+// Exception	: 	std::bad_alloc
+// Thread-safety:	The caller must hold a unique lock on the account's shard
+*/
+bool AccountDirectory::Insert(BankAccount* account) {
+	bucket* s = m_shards[ShardOf(account->AccountNumber())];
+	return s->m_accounts.insert(make_pair(account->AccountNumber(), account)).second;
+}
+
+/********************************************
+// function name: 	AccountDirectory::Reserve
+// Description	: 	Makes room for a number of accounts (spread evenly between the shards), so inserting them doesn't rehash the shards
+// Parameters	: 	num_accounts - the number of accounts
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	The caller must hold unique locks on all of the shards
+*/
+void AccountDirectory::Reserve(size_t num_accounts) {
+	for (unsigned i = 0; i < m_shards.size(); ++i)
+		m_shards[i]->m_accounts.reserve(num_accounts / m_shards.size() + 1);
+}
+
+/********************************************
+// function name: 	AccountDirectory::Erase
+// Description	: 	Removes an account from the directory. The account is not deleted, the ownership is passed to the caller
+// Parameters	: 	account_no - the account number
+// Returns		: 	BankAccount* - the removed account, NULL if there is no such account
+// Exception	: 	None
+// Thread-safety:	The caller must hold a unique lock on the account's shard
+*/
+BankAccount* AccountDirectory::Erase(int account_no) {
+	bucket* s = m_shards[ShardOf(account_no)];
+	auto found = s->m_accounts.find(account_no);
+	if (found == s->m_accounts.end())
+		return NULL;
+
+	BankAccount* account = found->second;
+	s->m_accounts.erase(found);
+	return account;
+}
+
+/********************************************
+// function name: 	AccountDirectory::Collect
+// Description	: 	Appends all of the accounts of a certain shard to a container (in no particular order)
+// Parameters	: 	shard - the index of the shard
+//					accounts - the container where the accounts will be appended
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	The caller must hold (at least) a shared lock on the shard
+*/
+void AccountDirectory::Collect(unsigned shard, vector<BankAccount*>& accounts) const {
+	auto const& table = m_shards[shard]->m_accounts;
+	for (auto it = table.begin(); it != table.end(); ++it)
+		accounts.push_back(it->second);
+}
@@ -0,0 +1,180 @@
+/*
+ * AccountDirectory.h
+ *
+ *  Created on: Jun 2, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : AccountDirectory
+	Description : A concurrent, hash-indexed directory of the bank's accounts.
+					The accounts are spread over a fixed number of shards (buckets) according to a hash of the account number.
+					Every shard holds its own hash table and its own rwlock, so operations on accounts that live in different
+					shards never contend on the same lock, and a lookup costs O(1) regardless of the number of accounts.
+	Main methods: 	1. ShardOf / ShardLock - map an account number to its shard and the lock protecting it
+					2. Find / Insert / Erase - lookup and modification of a shard's table (the caller holds the shard's lock)
+					3. Collect - gathers the accounts of a shard into a container
+ */
+
+#ifndef ACCOUNTDIRECTORY_H_
+#define ACCOUNTDIRECTORY_H_
+
+#include <vector>
+#include <unordered_map>
+
+#include "BankAccount.h"
+#include "rwlock.h"
+#include "defs.h"
+
+using namespace std;
+
+#define DEFAULT_NUM_SHARDS 64 	//must be a power of 2
+
+
+/********************************************
+// 	class name	: 	AccountDirectory
+// 	Description	: 	A sharded hash table of BankAccount pointers, keyed by the account number.
+//					The directory owns the accounts stored in it (they are deleted by the destructor).
+//					The directory itself doesn't lock anything - every shard exposes its rwlock and the caller
+//					is responsible to hold it (shared for Find/Collect, unique for Insert/Erase).
+//					When more than one shard has to be locked, the shards must be locked in ascending index order
+//					in order to avoid deadlocks.
+//
+//	Members		:	m_shards 	 - the shards of the directory. Every shard is allocated separately and padded to a cache line,
+//								   so the locks of two neighbouring shards never share a cache line
+//					m_shard_mask - num_shards - 1, used to map a hash value to a shard index
+//
+//	Methods		:	ShardOf 	- returns the index of the shard that holds a certain account number
+//					ShardLock 	- returns the lock of a certain shard
+//					NumShards	- returns the number of shards
+//					Find		- finds an account inside its shard
+//					Insert		- inserts a new account to its shard
+//					Erase		- removes an account from its shard (without deleting it)
+//					Collect		- appends the accounts of a shard to a container
+*/
+class AccountDirectory {
+public:
+	/********************************************
+	// function name: 	AccountDirectory::AccountDirectory
+	// Description	: 	Constructor.
+	//					Allocates the shards and initializes their locks
+	// Parameters	: 	num_shards - the number of shards, rounded up to a power of 2 (default: DEFAULT_NUM_SHARDS)
+	//					sleep_period - the sleeping period (in micro-seconds) of the shards' locks (default: 0)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	AccountDirectory(unsigned num_shards = DEFAULT_NUM_SHARDS, unsigned sleep_period = 0);
+
+	/********************************************
+	// function name: 	AccountDirectory::~AccountDirectory
+	// Description	: 	Destructor.
+	//					Deletes all of the accounts that are still stored inside the directory, and the shards
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~AccountDirectory();
+
+public: //API
+	/********************************************
+	// function name: 	AccountDirectory::ShardOf
+	// Description	: 	Returns the index of the shard that holds (or will hold) a certain account
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	unsigned - the index of the shard
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	unsigned ShardOf(int account_no) const;
+
+	/********************************************
+	// function name: 	AccountDirectory::ShardLock
+	// Description	: 	Returns the lock that protects a certain shard
+	// Parameters	: 	shard - the index of the shard
+	// Returns		: 	rwlock& - the lock of the shard
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	rwlock& ShardLock(unsigned shard) const;
+
+	/********************************************
+	// function name: 	AccountDirectory::NumShards
+	// Description	: 	Returns the number of shards of the directory
+	// Parameters	: 	None
+	// Returns		: 	unsigned - the number of shards
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	unsigned NumShards() const;
+
+	/********************************************
+	// function name: 	AccountDirectory::Find
+	// Description	: 	Finds an account according to its account number
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	BankAccount* - the account, NULL if there is no such account
+	// Exception	: 	None
+	// Thread-safety:	The caller must hold (at least) a shared lock on the account's shard
+	*/
+	BankAccount* Find(int account_no) const;
+
+	/********************************************
+	// function name: 	AccountDirectory::Insert
+	// Description	: 	Inserts a new account to the directory. The directory takes ownership of the account
+	// Parameters	: 	account - the account to be inserted
+	// Returns		: 	bool - false in case an account with the same number already exists, true otherwise
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	The caller must hold a unique lock on the account's shard
+	*/
+	bool Insert(BankAccount* account);
+
+	/********************************************
+	// function name: 	AccountDirectory::Reserve
+	// Description	: 	Makes room for a number of accounts (spread evenly between the shards), so inserting them doesn't rehash the shards
+	// Parameters	: 	num_accounts - the number of accounts
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	The caller must hold unique locks on all of the shards
+	*/
+	void Reserve(size_t num_accounts);
+
+	/********************************************
+	// function name: 	AccountDirectory::Erase
+	// Description	: 	Removes an account from the directory. The account is not deleted, the ownership is passed to the caller
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	BankAccount* - the removed account, NULL if there is no such account
+	// Exception	: 	None
+	// Thread-safety:	The caller must hold a unique lock on the account's shard
+	*/
+	BankAccount* Erase(int account_no);
+
+	/********************************************
+	// function name: 	AccountDirectory::Collect
+	// Description	: 	Appends all of the accounts of a certain shard to a container (in no particular order)
+	// Parameters	: 	shard - the index of the shard
+	//					accounts - the container where the accounts will be appended
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	The caller must hold (at least) a shared lock on the shard
+	*/
+	void Collect(unsigned shard, vector<BankAccount*>& accounts) const;
+
+private: //do not allow the user to copy the object
+	AccountDirectory(AccountDirectory const&);
+	AccountDirectory& operator=(AccountDirectory const&);
+
+private:
+	struct bucket {
+		bucket(unsigned sleep_period, lock_site* site) : m_lock(sleep_period) {
+			m_lock.SetSite(site);
+		}
+
+		unordered_map<int, BankAccount*> m_accounts;
+		mutable rwlock m_lock;
+		char m_pad[CACHE_LINE_SIZE]; //keep the next allocation away from this shard's lock
+	};
+
+	vector<bucket*> m_shards;
+	unsigned m_shard_mask;
+};
+
+
+#endif /* ACCOUNTDIRECTORY_H_ */
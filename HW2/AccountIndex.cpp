@@ -0,0 +1,416 @@
+/*
+ * AccountIndex.cpp
+ *
+ *  Created on: Jun 10, 2017
+ *      Author: dror
+ *
+ *	An implementation of the AccountIndex class
+ */
+
+#include <new>
+#include "AccountIndex.h"
+#include "futex.h"
+#include "Fiber.h"
+
+#define SKIPLIST_RANDOM_SEED 2463534242u //any non-zero seed will do, the levels only have to be spread
+
+
+/********************************************
+// function name: 	AccountIndex::AccountIndex
+// Description	: 	Constructor.
+//					Allocates the head of the skiplist
+// Parameters	: 	epochs - the epoch manager the removed nodes are retired to (default: NULL - the nodes are deleted at once,
+//							 so the index may be used by a single thread only)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+AccountIndex::AccountIndex(epoch_manager* epochs) :	m_head(NULL),
+													m_level(1),
+													m_size(0),
+													m_epochs(epochs) {
+	m_head = __new_node(INT_MIN, NULL, SKIPLIST_MAX_LEVEL);
+	m_head->m_linked.store(true, memory_order_relaxed);
+}
+
+/********************************************
+// function name: 	AccountIndex::~AccountIndex
+// Description	: 	Destructor.
+//					Deletes the linked nodes of the skiplist (but not the accounts - and not the retired nodes, the epoch manager does)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+AccountIndex::~AccountIndex() {
+	node* n = m_head;
+	while (n) {
+		node* next = n->m_next[0].load(memory_order_relaxed);
+		__delete_node(n);
+		n = next;
+	}
+}
+
+/********************************************
+// function name: 	AccountIndex::Size
+// Description	: 	Returns the number of accounts in the index
+// Parameters	: 	None
+// Returns		: 	size_t - the number of accounts
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+size_t AccountIndex::Size() const {
+	return m_size.load(memory_order_relaxed);
+}
+
+/********************************************
+// function name: 	AccountIndex::Find
+// Description	: 	Finds an account according to its account number, in O(log n)
+// Parameters	: 	account_no - the account number
+// Returns		: 	BankAccount* - the account, NULL if there is no such account
+// Exception	: 	None
+// Thread-safety:	Yes (lock-free). The caller must be inside an epoch critical section
+*/
+BankAccount* AccountIndex::Find(int account_no) const {
+	node* found = __lower_bound(account_no);
+	bool present = found && found->m_key == account_no && found->m_linked.load(memory_order_acquire) &&
+				   !found->m_marked.load(memory_order_acquire);
+	return present ? found->m_account : NULL;
+}
+
+/********************************************
+// function name: 	AccountIndex::Insert
+// Description	: 	Inserts an account to the index, in O(log n)
+// Parameters	: 	account - the account to be inserted
+// Returns		: 	bool - false in case an account with the same number already exists, true otherwise
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes (locks the predecessors of the new node only). The caller must be inside an epoch critical section
+*/
+bool AccountIndex::Insert(BankAccount* account) {
+	int key = account->AccountNumber();
+	node* preds[SKIPLIST_MAX_LEVEL];
+	node* succs[SKIPLIST_MAX_LEVEL];
+
+	//allocated up front, so no allocation fails while the predecessors are locked
+	node* n = __new_node(key, account, __random_level());
+	unsigned level = n->m_level;
+
+	while (true) {
+		int found = __find(key, preds, succs);
+		if (found != -1) {
+			node* existing = succs[found];
+			if (!existing->m_marked.load(memory_order_acquire)) {
+				//the number is taken - wait until its node is linked, so the failure is ordered after the insertion
+				while (!existing->m_linked.load(memory_order_acquire))
+					cpu_relax();
+				__delete_node(n);
+				return false;
+			}
+			continue; //the existing node is being unlinked - retry once it is gone
+		}
+
+		//lock the predecessors from the bottom up, and make sure they are still linked to the successors
+		bool valid = true;
+		unsigned num_locked = 0;
+		for (; valid && num_locked < level; ++num_locked) {
+			node* pred = preds[num_locked];
+			node* succ = succs[num_locked];
+			if (num_locked == 0 || pred != preds[num_locked - 1])
+				__lock(pred);
+
+			valid = !pred->m_marked.load(memory_order_acquire) && (!succ || !succ->m_marked.load(memory_order_acquire)) &&
+					pred->m_next[num_locked].load(memory_order_acquire) == succ;
+		}
+
+		if (!valid) {
+			__unlock_preds(preds, num_locked);
+			continue;
+		}
+
+		//raised before the node is linked, so a traversal that sees the node starts high enough to find it at its top level
+		unsigned top = m_level.load();
+		while (top < level && !m_level.compare_exchange_weak(top, level))
+			;
+
+		for (unsigned i = 0; i < level; ++i)
+			n->m_next[i].store(succs[i], memory_order_relaxed);
+		for (unsigned i = 0; i < level; ++i)
+			preds[i]->m_next[i].store(n, memory_order_release);
+		n->m_linked.store(true, memory_order_release);
+
+		__unlock_preds(preds, level);
+		m_size.fetch_add(1, memory_order_relaxed);
+		return true;
+	}
+}
+
+/********************************************
+// function name: 	AccountIndex::Load
+// Description	: 	Builds the index from accounts sorted by their numbers, in O(n) - every account is linked after the previous
+//					one at all of its levels, without searching (used to restore the bank from a checkpoint)
+// Parameters	: 	accounts - the accounts, in ascending order of their numbers (no number twice)
+//					num_accounts - the number of accounts
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	No - the index must be empty, and not used by other threads meanwhile
+*/
+void AccountIndex::Load(BankAccount* const* accounts, size_t num_accounts) {
+	//the last node of every level so far
+	node* tails[SKIPLIST_MAX_LEVEL];
+	for (unsigned i = 0; i < SKIPLIST_MAX_LEVEL; ++i)
+		tails[i] = m_head;
+
+	for (size_t k = 0; k < num_accounts; ++k) {
+		node* n = __new_node(accounts[k]->AccountNumber(), accounts[k], __random_level());
+		for (unsigned i = 0; i < n->m_level; ++i) {
+			tails[i]->m_next[i].store(n, memory_order_relaxed);
+			tails[i] = n;
+		}
+		n->m_linked.store(true, memory_order_relaxed);
+		if (n->m_level > m_level.load(memory_order_relaxed))
+			m_level.store(n->m_level, memory_order_relaxed);
+	}
+
+	m_size.fetch_add(num_accounts, memory_order_release); //publishes the nodes
+}
+
+/********************************************
+// function name: 	AccountIndex::Erase
+// Description	: 	Removes an account from the index, in O(log n). The account itself is not deleted
+// Parameters	: 	account_no - the account number
+// Returns		: 	BankAccount* - the removed account, NULL if there is no such account
+// Exception	: 	None
+// Thread-safety:	Yes (locks the removed node and its predecessors only). The caller must be inside an epoch critical section
+*/
+BankAccount* AccountIndex::Erase(int account_no) {
+	node* preds[SKIPLIST_MAX_LEVEL];
+	node* succs[SKIPLIST_MAX_LEVEL];
+	node* victim = NULL;
+
+	while (true) {
+		int found = __find(account_no, preds, succs);
+		if (!victim) {
+			//only a node that is fully linked (and found at its top level) may be removed
+			if (found == -1)
+				return NULL;
+			node* candidate = succs[found];
+			if (!candidate->m_linked.load(memory_order_acquire) || candidate->m_marked.load(memory_order_acquire))
+				return NULL;
+			if ((int)candidate->m_level - 1 != found)
+				continue; //the traversal started below the node's top level (a stale m_level) - search again
+
+			//mark the node under its lock - from now on no writer links a node after it
+			__lock(candidate);
+			if (candidate->m_marked.load(memory_order_relaxed)) {
+				__unlock(candidate);
+				return NULL; //removed by another thread meanwhile
+			}
+			candidate->m_marked.store(true, memory_order_release);
+			victim = candidate;
+		}
+
+		//lock the predecessors from the bottom up, and make sure they still point to the node
+		unsigned level = victim->m_level;
+		bool valid = true;
+		unsigned num_locked = 0;
+		for (; valid && num_locked < level; ++num_locked) {
+			node* pred = preds[num_locked];
+			if (num_locked == 0 || pred != preds[num_locked - 1])
+				__lock(pred);
+
+			valid = !pred->m_marked.load(memory_order_acquire) && pred->m_next[num_locked].load(memory_order_acquire) == victim;
+		}
+
+		if (!valid) {
+			__unlock_preds(preds, num_locked);
+			continue;
+		}
+
+		//unlink from the top down, so the node stays reachable from level 0 until it is gone from all of the levels
+		for (int i = (int)level - 1; i >= 0; --i)
+			preds[i]->m_next[i].store(victim->m_next[i].load(memory_order_relaxed), memory_order_release);
+
+		__unlock(victim);
+		__unlock_preds(preds, level);
+		m_size.fetch_sub(1, memory_order_relaxed);
+
+		BankAccount* account = victim->m_account;
+		if (m_epochs)
+			m_epochs->Retire(victim); //traversals of other threads may still stand on it
+		else
+			__delete_node(victim);
+		return account;
+	}
+}
+
+/********************************************
+// function name: 	AccountIndex::Range
+// Description	: 	Appends the accounts whose numbers are in [first, last] to a container, in ascending order of their numbers.
+//					Costs O(log n + k), where k is the number of accounts in the range
+// Parameters	: 	accounts - the container where the accounts will be appended
+//					first - the lowest account number of the range (default: INT_MIN)
+//					last - the highest account number of the range (default: INT_MAX)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes (lock-free). The caller must be inside an epoch critical section. Accounts that are inserted or erased
+//					concurrently may or may not be appended
+*/
+void AccountIndex::Range(vector<BankAccount*>& accounts, int first, int last) const {
+	for (node* n = __lower_bound(first); n && n->m_key <= last; n = n->m_next[0].load(memory_order_acquire)) {
+		if (n->m_linked.load(memory_order_acquire) && !n->m_marked.load(memory_order_acquire))
+			accounts.push_back(n->m_account);
+	}
+}
+
+/********************************************
+// function name: 	AccountIndex::__new_node
+// Description	: 	Allocates a node with room for its pointers (all of them NULL), unlocked, unmarked and not linked yet
+// Parameters	: 	key - the account number
+//					account - the account
+//					level - the number of levels the node is linked in
+// Returns		: 	node* - the new node
+// Exception	: 	std::bad_alloc
+*/
+AccountIndex::node* AccountIndex::__new_node(int key, BankAccount* account, unsigned level) {
+	void* memory = ::operator new(sizeof(node) + (level - 1) * sizeof(atomic<node*>));
+	node* n = static_cast<node*>(memory);
+
+	n->m_key = key;
+	n->m_account = account;
+	n->m_level = level;
+	n->m_lock.store(0, memory_order_relaxed);
+	n->m_marked.store(false, memory_order_relaxed);
+	n->m_linked.store(false, memory_order_relaxed);
+	for (unsigned i = 0; i < level; ++i)
+		n->m_next[i].store(NULL, memory_order_relaxed);
+
+	return n;
+}
+
+void AccountIndex::__delete_node(node* n) {
+	::operator delete(static_cast<void*>(n));
+}
+
+/********************************************
+// function name: 	AccountIndex::__lock / __unlock
+// Description	: 	Lock and unlock a node. The lock is held only while a few pointers are validated and swapped (never across
+//					a sleep), so a waiter spins first - and parks only in case the holder has been preempted.
+//					An unlocking thread wakes a waiter only if the lock was marked contended
+// Parameters	: 	n - the node
+// Returns		: 	None
+// Exception	: 	None
+*/
+void AccountIndex::__lock(node* n) {
+	for (unsigned i = 0; i < RWLOCK_SPIN_COUNT; ++i) {
+		uint32_t expected = 0;
+		if (n->m_lock.load(memory_order_relaxed) == 0 && n->m_lock.compare_exchange_weak(expected, 1, memory_order_acquire))
+			return;
+		cpu_relax();
+	}
+
+	while (n->m_lock.exchange(2, memory_order_acquire) != 0) {
+		if (!fiber_park()) //a fiber is suspended for a while instead, so it never blocks its worker
+			futex_wait(n->m_lock, 2);
+	}
+}
+
+void AccountIndex::__unlock(node* n) {
+	if (n->m_lock.exchange(0, memory_order_release) == 2)
+		futex_wake(n->m_lock, 1);
+}
+
+/********************************************
+// function name: 	AccountIndex::__unlock_preds
+// Description	: 	Unlocks the predecessors of the lowest levels (a node that precedes several levels is locked once)
+// Parameters	: 	preds - the predecessors, from level 0 up
+//					num_levels - the number of levels whose predecessors are locked
+// Returns		: 	None
+// Exception	: 	None
+*/
+void AccountIndex::__unlock_preds(node* const* preds, unsigned num_levels) {
+	for (unsigned i = 0; i < num_levels; ++i) {
+		if (i == 0 || preds[i] != preds[i - 1])
+			__unlock(preds[i]);
+	}
+}
+
+/********************************************
+// function name: 	AccountIndex::__random_level
+// Description	: 	Draws the level of a new node - every level above the first is taken with a probability of 1/4
+//					(a xorshift generator per thread, so the writers don't contend on a shared generator)
+// Parameters	: 	None
+// Returns		: 	unsigned - the level (1 to SKIPLIST_MAX_LEVEL)
+// Exception	: 	None
+*/
+unsigned AccountIndex::__random_level() {
+	static thread_local uint32_t t_random = 0;
+	if (t_random == 0)
+		t_random = SKIPLIST_RANDOM_SEED ^ (uint32_t)(uintptr_t)&t_random; //spread the threads apart
+	if (t_random == 0)
+		t_random = SKIPLIST_RANDOM_SEED;
+
+	t_random ^= t_random << 13;
+	t_random ^= t_random >> 17;
+	t_random ^= t_random << 5;
+
+	unsigned level = 1;
+	for (uint32_t bits = t_random; level < SKIPLIST_MAX_LEVEL && (bits & 3) == 0; bits >>= 2)
+		++level;
+
+	return level;
+}
+
+/********************************************
+// function name: 	AccountIndex::__find
+// Description	: 	Finds the position of a key in every level, without locking. The levels above m_level are assumed empty
+//					(a writer that relies on it validates the head's pointers under the head's lock)
+// Parameters	: 	key - the key
+//					preds - filled with the last node before the position of the key in every level
+//					succs - filled with the node that follows preds in every level (NULL if none)
+// Returns		: 	int - the highest level in which a node with the key was found, -1 if there is no such node
+// Exception	: 	None
+*/
+int AccountIndex::__find(int key, node** preds, node** succs) const {
+	int found = -1;
+	node* pred = m_head;
+	int top = (int)m_level.load(memory_order_acquire);
+
+	for (int i = SKIPLIST_MAX_LEVEL - 1; i >= top; --i) {
+		preds[i] = m_head;
+		succs[i] = NULL;
+	}
+
+	for (int i = top - 1; i >= 0; --i) {
+		node* curr = pred->m_next[i].load(memory_order_acquire);
+		while (curr && curr->m_key < key) {
+			pred = curr;
+			curr = pred->m_next[i].load(memory_order_acquire);
+		}
+
+		if (found == -1 && curr && curr->m_key == key)
+			found = i;
+		preds[i] = pred;
+		succs[i] = curr;
+	}
+
+	return found;
+}
+
+/********************************************
+// function name: 	AccountIndex::__lower_bound
+// Description	: 	Finds the first node whose key is not lower than a given key, without locking
+// Parameters	: 	key - the key
+// Returns		: 	node* - the found node, NULL if all of the keys are lower than key. The node may be marked, or not linked yet
+// Exception	: 	None
+*/
+AccountIndex::node* AccountIndex::__lower_bound(int key) const {
+	node* x = m_head;
+
+	for (int i = (int)m_level.load(memory_order_acquire) - 1; i >= 0; --i) {
+		node* next = x->m_next[i].load(memory_order_acquire);
+		while (next && next->m_key < key) {
+			x = next;
+			next = x->m_next[i].load(memory_order_acquire);
+		}
+	}
+
+	return x->m_next[0].load(memory_order_acquire);
+}
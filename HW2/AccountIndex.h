@@ -0,0 +1,180 @@
+/*
+ * AccountIndex.h
+ *
+ *  Created on: Jun 10, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : AccountIndex
+	Description : An ordered index of the bank's accounts, keyed by the account number.
+					The index is a skiplist, maintained incrementally - opening or closing an account costs O(log n) -
+					so the accounts can be iterated in sorted order, or scanned by a range of account numbers, without sorting.
+					The skiplist is concurrent (a lazy skiplist) - lookups take no lock, and an insertion or a removal locks only the nodes
+					around its own position, so accounts of different shards are opened and closed in parallel.
+	Main methods: 	1. Find / Insert / Erase - lookup and modification of the index
+					2. Range - gathers the accounts of a range of account numbers, in ascending order
+ */
+
+#ifndef ACCOUNTINDEX_H_
+#define ACCOUNTINDEX_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <vector>
+#include <atomic>
+
+#include "BankAccount.h"
+#include "epoch.h"
+
+using namespace std;
+
+#define SKIPLIST_MAX_LEVEL 16 //a level is taken with a probability of 1/4, so 16 levels keep O(log n) up to 2^32 accounts
+
+
+/********************************************
+// 	class name	: 	AccountIndex
+// 	Description	: 	A skiplist of BankAccount pointers, sorted by the account number.
+//					Every node is linked in level 0, and in every level above it with a probability of 1/4, so a search
+//					skips over most of the nodes. The index doesn't own the accounts (the accounts' directory does).
+//					The readers traverse the nodes without locking. A writer locks only the predecessors of its node (and the node it
+//					removes), validates that they are still linked to each other and retries otherwise. A removed node is first marked
+//					and then unlinked, and it is retired to the epoch manager - so the callers have to be inside an epoch critical section.
+//
+//	Members		:	m_head - the head of the skiplist, linked in all of the levels (holds no account)
+//					m_level - the highest level a node has been linked in (only raised - the traversals start from it)
+//					m_size - the number of accounts in the index
+//					m_epochs - the epoch manager the removed nodes are retired to (NULL - they are deleted at once, single thread only)
+//
+//	Methods		:	Size	- returns the number of accounts in the index
+//					Find	- finds an account
+//					Insert	- inserts an account
+//					Erase	- removes an account (without deleting it)
+//					Range	- appends the accounts of a range to a container, in ascending order
+*/
+class AccountIndex {
+public:
+	/********************************************
+	// function name: 	AccountIndex::AccountIndex
+	// Description	: 	Constructor.
+	//					Allocates the head of the skiplist
+	// Parameters	: 	epochs - the epoch manager the removed nodes are retired to (default: NULL - the nodes are deleted at once,
+	//							 so the index may be used by a single thread only)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	AccountIndex(epoch_manager* epochs = NULL);
+
+	/********************************************
+	// function name: 	AccountIndex::~AccountIndex
+	// Description	: 	Destructor.
+	//					Deletes the linked nodes of the skiplist (but not the accounts - and not the retired nodes, the epoch manager does)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~AccountIndex();
+
+public: //API
+	/********************************************
+	// function name: 	AccountIndex::Size
+	// Description	: 	Returns the number of accounts in the index
+	// Parameters	: 	None
+	// Returns		: 	size_t - the number of accounts
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	size_t Size() const;
+
+	/********************************************
+	// function name: 	AccountIndex::Find
+	// Description	: 	Finds an account according to its account number, in O(log n)
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	BankAccount* - the account, NULL if there is no such account
+	// Exception	: 	None
+	// Thread-safety:	Yes (lock-free). The caller must be inside an epoch critical section
+	*/
+	BankAccount* Find(int account_no) const;
+
+	/********************************************
+	// function name: 	AccountIndex::Insert
+	// Description	: 	Inserts an account to the index, in O(log n)
+	// Parameters	: 	account - the account to be inserted
+	// Returns		: 	bool - false in case an account with the same number already exists, true otherwise
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes (locks the predecessors of the new node only). The caller must be inside an epoch critical section
+	*/
+	bool Insert(BankAccount* account);
+
+	/********************************************
+	// function name: 	AccountIndex::Load
+	// Description	: 	Builds the index from accounts sorted by their numbers, in O(n) - every account is linked after the previous
+	//					one at all of its levels, without searching (used to restore the bank from a checkpoint)
+	// Parameters	: 	accounts - the accounts, in ascending order of their numbers (no number twice)
+	//					num_accounts - the number of accounts
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	No - the index must be empty, and not used by other threads meanwhile
+	*/
+	void Load(BankAccount* const* accounts, size_t num_accounts);
+
+	/********************************************
+	// function name: 	AccountIndex::Erase
+	// Description	: 	Removes an account from the index, in O(log n). The account itself is not deleted
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	BankAccount* - the removed account, NULL if there is no such account
+	// Exception	: 	None
+	// Thread-safety:	Yes (locks the removed node and its predecessors only). The caller must be inside an epoch critical section
+	*/
+	BankAccount* Erase(int account_no);
+
+	/********************************************
+	// function name: 	AccountIndex::Range
+	// Description	: 	Appends the accounts whose numbers are in [first, last] to a container, in ascending order of their numbers.
+	//					Costs O(log n + k), where k is the number of accounts in the range
+	// Parameters	: 	accounts - the container where the accounts will be appended
+	//					first - the lowest account number of the range (default: INT_MIN)
+	//					last - the highest account number of the range (default: INT_MAX)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes (lock-free). The caller must be inside an epoch critical section. Accounts that are inserted or erased
+	//					concurrently may or may not be appended
+	*/
+	void Range(vector<BankAccount*>& accounts, int first = INT_MIN, int last = INT_MAX) const;
+
+private:
+	struct node {
+		int m_key;
+		BankAccount* m_account;
+		unsigned m_level;
+		atomic<uint32_t> m_lock;	//held by the writers that link or unlink nodes after this one (a futex word - 0 free, 1 held, 2 contended)
+		atomic<bool> m_marked;		//removed - being unlinked
+		atomic<bool> m_linked;		//linked in all of its levels
+		atomic<node*> m_next[1]; 	//m_level pointers, allocated with the node
+
+		static void operator delete(void* memory) { ::operator delete(memory); } //the node is larger than sizeof(node)
+	};
+
+	static node* __new_node(int key, BankAccount* account, unsigned level);
+	static void __delete_node(node* n);
+	static void __lock(node* n);
+	static void __unlock(node* n);
+	static void __unlock_preds(node* const* preds, unsigned num_levels);
+
+	static unsigned __random_level();
+	int __find(int key, node** preds, node** succs) const; //the highest level the key is linked in (-1 if none)
+	node* __lower_bound(int key) const; //the first node whose key is >= key (NULL if none)
+
+private: //do not allow the user to copy the object
+	AccountIndex(AccountIndex const&);
+	AccountIndex& operator=(AccountIndex const&);
+
+private:
+	node* m_head;
+	atomic<unsigned> m_level;
+	atomic<size_t> m_size;
+	epoch_manager* m_epochs;
+};
+
+
+#endif /* ACCOUNTINDEX_H_ */
@@ -0,0 +1,447 @@
+/*
+ * AccountStore.cpp
+ *
+ *  Created on: Jun 20, 2017
+ *      Author: dror
+ *
+ *	An implementation of the arena and of the AccountStore class
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <cmath>
+#include <new>
+#include "futex.h"
+#include "AccountStore.h"
+
+
+//*****************************************************arena*****************************************************
+
+arena::arena(size_t block_size) : m_block_size(block_size), m_next(NULL), m_end(NULL), m_reserved(0), m_used(0) {
+}
+
+arena::~arena() {
+	for (unsigned i = 0; i < m_blocks.size(); ++i)
+		munmap(m_blocks[i].first, m_blocks[i].second);
+}
+
+/********************************************
+// function name: 	arena::Allocate
+// Description	: 	Allocates memory from the current block (a new block is mapped in case it doesn't fit). The memory is zeroed
+// Parameters	: 	size - the number of bytes
+//					alignment - the alignment of the memory, a power of 2 (default: CACHE_LINE_SIZE)
+// Returns		: 	void* - the memory
+// Exception	: 	std::bad_alloc in case a block can't be mapped
+*/
+void* arena::Allocate(size_t size, size_t alignment) {
+	char* start = (char*)(((uintptr_t)m_next + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (!m_next || start + size > m_end) {
+		//the rest of the current block is left unused. The blocks are page aligned, so the alignment is kept
+		size_t block_size = max(m_block_size, size);
+		void* block = mmap(NULL, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			throw bad_alloc();
+		m_blocks.push_back(make_pair((char*)block, block_size));
+		m_reserved += block_size;
+		m_next = start = (char*)block;
+		m_end = m_next + block_size;
+	}
+
+	m_used += start + size - m_next;
+	m_next = start + size;
+	return start; //fresh anonymous memory is zeroed
+}
+
+
+//*****************************************************AccountStore*****************************************************
+
+/********************************************
+// function name: 	AccountStore::AccountStore
+// Description	: 	Constructor.
+//					An empty store - no segments, and an empty hash table
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+AccountStore::AccountStore() : m_num_slots(0), m_size(0) {
+	index_entry empty = {0, STORE_EMPTY_SLOT};
+	m_index.assign(STORE_INITIAL_INDEX_SIZE, empty);
+	m_lock.SetSite(lock_site_get("store")); //NULL while the instrumentation is off
+}
+
+/********************************************
+// function name: 	AccountStore::Open
+// Description	: 	Opens an account, in a free slot (a new one in case there is none)
+// Parameters	: 	account_no - the account number
+//					password - the password of the account (only its hash is kept)
+//					balance - the opening balance
+// Returns		: 	store_status - STORE_ACCOUNT_EXISTS in case there is an account with the same number, STORE_OK otherwise
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+store_status AccountStore::Open(int account_no, string const& password, int balance) {
+	m_lock.WriteLock();
+	//critical section
+	size_t position = __probe(account_no);
+	if (m_index[position].m_slot != STORE_EMPTY_SLOT) {
+		m_lock.WriteUnlock(false); //do not sleep
+		return STORE_ACCOUNT_EXISTS;
+	}
+
+	uint32_t slot = __new_slot();
+	segment const& s = __segment(slot);
+	unsigned offset = slot % STORE_SEGMENT_SIZE;
+	s.m_numbers[offset] = account_no;
+	s.m_credentials[offset] = __credential(password);
+	s.m_balances[offset].store(balance, memory_order_relaxed);
+
+	index_entry entry = {account_no, slot};
+	m_index[position] = entry;
+	++m_size;
+	if (m_size * 2 > m_index.size())
+		__grow_index();
+	//end of critical section
+	m_lock.WriteUnlock(false);
+
+	return STORE_OK;
+}
+
+/********************************************
+// function name: 	AccountStore::Close
+// Description	: 	Closes an account - it's removed from the table, and its slot is freed
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					balance - set to the balance of the account at the closure (default: NULL)
+// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+store_status AccountStore::Close(int account_no, string const& password, int* balance) {
+	m_lock.WriteLock();
+	//critical section - no other thread touches the store, the slot's lock word is free
+	uint32_t slot;
+	store_status status = __find(account_no, password, slot);
+	if (status == STORE_OK) {
+		int old_balance = __segment(slot).m_balances[slot % STORE_SEGMENT_SIZE].exchange(STORE_FREE_SLOT, memory_order_relaxed);
+		if (balance)
+			*balance = old_balance;
+
+		__erase_entry(__probe(account_no));
+		m_free_slots.push_back(slot);
+		--m_size;
+	}
+	//end of critical section
+	m_lock.WriteUnlock(false); //do not sleep
+
+	return status;
+}
+
+/********************************************
+// function name: 	AccountStore::Deposit
+// Description	: 	Deposits an amount to an account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount
+//					balance - set to the new balance (default: NULL)
+// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+store_status AccountStore::Deposit(int account_no, string const& password, int amount, int* balance) {
+	m_lock.ReadLock();
+	uint32_t slot;
+	store_status status = __find(account_no, password, slot);
+	if (status == STORE_OK) {
+		atomic<int32_t>& cell = __segment(slot).m_balances[slot % STORE_SEGMENT_SIZE];
+		__lock_slot(slot);
+		int new_balance = cell.load(memory_order_relaxed) + amount;
+		cell.store(new_balance, memory_order_relaxed);
+		__unlock_slot(slot);
+
+		if (balance)
+			*balance = new_balance;
+	}
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return status;
+}
+
+/********************************************
+// function name: 	AccountStore::Withdraw
+// Description	: 	Withdraws an amount from an account (the amount must not be larger than the balance)
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount
+//					balance - set to the new balance (default: NULL)
+// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_INSUFFICIENT_FUNDS / STORE_OK
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+store_status AccountStore::Withdraw(int account_no, string const& password, int amount, int* balance) {
+	m_lock.ReadLock();
+	uint32_t slot;
+	store_status status = __find(account_no, password, slot);
+	if (status == STORE_OK) {
+		atomic<int32_t>& cell = __segment(slot).m_balances[slot % STORE_SEGMENT_SIZE];
+		__lock_slot(slot);
+		int new_balance = cell.load(memory_order_relaxed) - amount;
+		if (new_balance < 0)
+			status = STORE_INSUFFICIENT_FUNDS;
+		else
+			cell.store(new_balance, memory_order_relaxed);
+		__unlock_slot(slot);
+
+		if (balance && status == STORE_OK)
+			*balance = new_balance;
+	}
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return status;
+}
+
+/********************************************
+// function name: 	AccountStore::Balance
+// Description	: 	Reads the balance of an account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					balance - set to the balance
+// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+store_status AccountStore::Balance(int account_no, string const& password, int* balance) const {
+	m_lock.ReadLock();
+	uint32_t slot;
+	store_status status = __find(account_no, password, slot);
+	if (status == STORE_OK)
+		*balance = __segment(slot).m_balances[slot % STORE_SEGMENT_SIZE].load(memory_order_relaxed); //a single word - no lock needed
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return status;
+}
+
+/********************************************
+// function name: 	AccountStore::SumBalances
+// Description	: 	Sums the balances of all of the open accounts - a sequential pass over the balance column of every segment.
+//					The balances are read without locking the slots (each one is read atomically, the sum is not a snapshot)
+// Parameters	: 	None
+// Returns		: 	int64_t - the sum
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+int64_t AccountStore::SumBalances() const {
+	int64_t sum = 0;
+
+	m_lock.ReadLock();
+	for (uint32_t first = 0; first < m_num_slots; first += STORE_SEGMENT_SIZE) {
+		atomic<int32_t> const* balances = __segment(first).m_balances;
+		unsigned num_slots = min((uint32_t)STORE_SEGMENT_SIZE, m_num_slots - first);
+		for (unsigned i = 0; i < num_slots; ++i) {
+			int balance = balances[i].load(memory_order_relaxed);
+			if (balance != STORE_FREE_SLOT)
+				sum += balance;
+		}
+	}
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return sum;
+}
+
+/********************************************
+// function name: 	AccountStore::ChargeCommission
+// Description	: 	Charges a commission from every open account, by the same rule as BankAccount::ChargeCommission (the balance
+//					is reduced by balance * interest, rounded, unless the commission isn't lower than the balance)
+// Parameters	: 	interest - the interest rate of the commission
+// Returns		: 	int64_t - the total commission charged
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+int64_t AccountStore::ChargeCommission(float interest) {
+	int64_t total = 0;
+
+	m_lock.ReadLock();
+	for (uint32_t first = 0; first < m_num_slots; first += STORE_SEGMENT_SIZE) {
+		atomic<int32_t>* balances = __segment(first).m_balances;
+		unsigned num_slots = min((uint32_t)STORE_SEGMENT_SIZE, m_num_slots - first);
+		for (unsigned i = 0; i < num_slots; ++i) {
+			//a free slot stays free as long as the store is locked - it's skipped without locking it
+			if (balances[i].load(memory_order_relaxed) == STORE_FREE_SLOT)
+				continue;
+
+			__lock_slot(first + i);
+			int balance = balances[i].load(memory_order_relaxed);
+			int commission = static_cast<int>(roundf(balance * interest));
+			if (commission < balance) {
+				balances[i].store(balance - commission, memory_order_relaxed);
+				total += commission;
+			}
+			__unlock_slot(first + i);
+		}
+	}
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return total;
+}
+
+size_t AccountStore::Size() const {
+	m_lock.ReadLock();
+	size_t size = m_size;
+	m_lock.ReadUnlock(false); //do not sleep
+	return size;
+}
+
+/********************************************
+// function name: 	AccountStore::Footprint
+// Description	: 	Returns the memory taken by the store
+// Parameters	: 	None
+// Returns		: 	store_footprint - the memory of the columns, of the table and of the free list
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+store_footprint AccountStore::Footprint() const {
+	m_lock.ReadLock();
+	store_footprint footprint;
+	footprint.m_accounts = m_size;
+	footprint.m_slots = m_segments.size() * STORE_SEGMENT_SIZE;
+	footprint.m_columns = m_arena.Used();
+	footprint.m_arena_reserved = m_arena.Reserved();
+	footprint.m_index = m_index.capacity() * sizeof(index_entry) + m_segments.capacity() * sizeof(segment);
+	footprint.m_free_slots = m_free_slots.capacity() * sizeof(uint32_t);
+	m_lock.ReadUnlock(false); //do not sleep
+
+	return footprint;
+}
+
+//a 64-bit FNV-1a hash of a password
+uint64_t AccountStore::__credential(string const& password) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned i = 0; i < password.size(); ++i)
+		hash = (hash ^ (unsigned char)password[i]) * 1099511628211ull;
+	return hash;
+}
+
+//the home position of an account number in the table (a multiplicative hash - consecutive numbers are spread)
+size_t AccountStore::__hash(int account_no) {
+	return (size_t)(((uint64_t)(uint32_t)account_no * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/********************************************
+// function name: 	AccountStore::__lock_slot
+// Description	: 	Locks the lock word of a slot (a futex mutex - 0 free, 1 locked, 2 locked with waiters). A waiting thread spins for
+//					a while before it sleeps on the word
+// Parameters	: 	slot - the slot
+// Returns		: 	None
+// Exception	: 	None
+*/
+void AccountStore::__lock_slot(uint32_t slot) const {
+	atomic<uint32_t>& word = __segment(slot).m_locks[slot % STORE_SEGMENT_SIZE];
+	uint32_t expected = 0;
+	if (word.compare_exchange_strong(expected, 1, memory_order_acquire))
+		return;
+
+	for (unsigned i = 0; i < RWLOCK_SPIN_COUNT; ++i) {
+		cpu_relax();
+		expected = 0;
+		if (word.load(memory_order_relaxed) == 0 && word.compare_exchange_weak(expected, 1, memory_order_acquire))
+			return;
+	}
+
+	//mark the word as waited for, and sleep until it's released
+	while (word.exchange(2, memory_order_acquire) != 0)
+		futex_wait(word, 2);
+}
+
+//releases the lock word of a slot, and wakes a waiter (if any)
+void AccountStore::__unlock_slot(uint32_t slot) const {
+	atomic<uint32_t>& word = __segment(slot).m_locks[slot % STORE_SEGMENT_SIZE];
+	if (word.exchange(0, memory_order_release) == 2)
+		futex_wake(word, 1);
+}
+
+/********************************************
+// function name: 	AccountStore::__find
+// Description	: 	Looks up an account, and verifies its password. The caller holds the store's lock
+// Parameters	: 	account_no - the account number
+//					password - the password
+//					slot - set to the slot of the account
+// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+// Exception	: 	None
+*/
+store_status AccountStore::__find(int account_no, string const& password, uint32_t& slot) const {
+	slot = m_index[__probe(account_no)].m_slot;
+	if (slot == STORE_EMPTY_SLOT)
+		return STORE_NO_ACCOUNT;
+	return __segment(slot).m_credentials[slot % STORE_SEGMENT_SIZE] == __credential(password) ? STORE_OK : STORE_WRONG_PASSWORD;
+}
+
+//the position of an account in the table, or of the empty entry it would take (the table is never full)
+size_t AccountStore::__probe(int account_no) const {
+	size_t mask = m_index.size() - 1;
+	size_t position = __hash(account_no) & mask;
+	while (m_index[position].m_slot != STORE_EMPTY_SLOT && m_index[position].m_account_no != account_no)
+		position = (position + 1) & mask;
+	return position;
+}
+
+/********************************************
+// function name: 	AccountStore::__erase_entry
+// Description	: 	Removes the entry at a position of the table. The following entries of its run that could have been placed at the
+//					position are shifted back into it (backward shift deletion), so the lookups need no tombstones
+// Parameters	: 	position - the position of the entry
+// Returns		: 	None
+// Exception	: 	None
+*/
+void AccountStore::__erase_entry(size_t position) {
+	size_t mask = m_index.size() - 1;
+	size_t next = (position + 1) & mask;
+	while (m_index[next].m_slot != STORE_EMPTY_SLOT) {
+		//the entry at next may move to position only if its home isn't cyclically in (position, next]
+		size_t home = __hash(m_index[next].m_account_no) & mask;
+		if (((next - home) & mask) >= ((next - position) & mask)) {
+			m_index[position] = m_index[next];
+			position = next;
+		}
+		next = (next + 1) & mask;
+	}
+	m_index[position].m_slot = STORE_EMPTY_SLOT;
+}
+
+//doubles the table, and re-inserts its entries
+void AccountStore::__grow_index() {
+	vector<index_entry> old_index;
+	old_index.swap(m_index);
+	index_entry empty = {0, STORE_EMPTY_SLOT};
+	m_index.assign(old_index.size() * 2, empty);
+
+	for (size_t i = 0; i < old_index.size(); ++i) {
+		if (old_index[i].m_slot != STORE_EMPTY_SLOT)
+			m_index[__probe(old_index[i].m_account_no)] = old_index[i];
+	}
+}
+
+/********************************************
+// function name: 	AccountStore::__new_slot
+// Description	: 	Returns a slot for a new account - a free one, or the next one (a new segment is allocated from the arena in case
+//					the last one is full - its columns are cache line aligned)
+// Parameters	: 	None
+// Returns		: 	uint32_t - the slot
+// Exception	: 	std::bad_alloc
+*/
+uint32_t AccountStore::__new_slot() {
+	if (!m_free_slots.empty()) {
+		uint32_t slot = m_free_slots.back();
+		m_free_slots.pop_back();
+		return slot;
+	}
+
+	if (m_num_slots == m_segments.size() * STORE_SEGMENT_SIZE) {
+		segment s;
+		s.m_numbers = (int32_t*)m_arena.Allocate(STORE_SEGMENT_SIZE * sizeof(int32_t));
+		s.m_balances = (atomic<int32_t>*)m_arena.Allocate(STORE_SEGMENT_SIZE * sizeof(atomic<int32_t>));
+		s.m_credentials = (uint64_t*)m_arena.Allocate(STORE_SEGMENT_SIZE * sizeof(uint64_t));
+		s.m_locks = (atomic<uint32_t>*)m_arena.Allocate(STORE_SEGMENT_SIZE * sizeof(atomic<uint32_t>));
+		m_segments.push_back(s);
+	}
+
+	return m_num_slots++;
+}
@@ -0,0 +1,273 @@
+/*
+ * AccountStore.h
+ *
+ *  Created on: Jun 20, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : AccountStore
+	Description : A compact storage engine for accounts, an alternative to the one-object-per-account layout of the bank
+					(a BankAccount with its own std::string password and rwlock, allocated on its own, plus an entry in the directory
+					and in the index). The accounts are kept as a structure of arrays - the account numbers, the balances, the
+					credentials (a 64-bit hash of the password instead of the password itself) and the lock words are separate columns,
+					allocated in segments from an arena, and a number is mapped to its slot by an open-addressing hash table.
+					An account takes 20 bytes of columns and ~16 bytes of the table, instead of hundreds of bytes spread across the heap,
+					and a pass over all of the balances (a commission, a sum) reads the balance column alone, sequentially.
+					A slot is locked by a single futex word (a mutex, not a read-write lock - a balance is read in a few cycles).
+	Main methods: 	1. Open / Close - add an account to the store / remove it (its slot is reused)
+					2. Deposit / Withdraw / Balance - the operations of an account, after its password is verified
+					3. SumBalances / ChargeCommission - passes over all of the accounts
+					4. Footprint - the memory taken by the store
+ */
+
+#ifndef ACCOUNTSTORE_H_
+#define ACCOUNTSTORE_H_
+
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "defs.h"
+#include "rwlock.h"
+
+using namespace std;
+
+#define STORE_SEGMENT_SIZE 4096 		//the number of slots of a segment (every column of a segment is a whole number of cache lines)
+#define ARENA_BLOCK_SIZE (2 << 20) 	//the size of the blocks the arena maps (a huge page)
+#define STORE_FREE_SLOT INT_MIN 		//the balance of a free slot (the passes skip it)
+#define STORE_EMPTY_SLOT UINT32_MAX 	//the slot of an empty entry of the hash table
+#define STORE_INITIAL_INDEX_SIZE 1024	//the initial number of entries of the hash table (a power of 2)
+
+//the result of an operation of the store
+typedef enum {STORE_OK, STORE_NO_ACCOUNT, STORE_WRONG_PASSWORD, STORE_INSUFFICIENT_FUNDS, STORE_ACCOUNT_EXISTS} store_status;
+
+//the memory taken by a store, in bytes
+struct store_footprint {
+	size_t m_accounts;			//the number of open accounts
+	size_t m_slots;				//the number of slots of the segments (open accounts + free slots + the unused rest of the last segment)
+	size_t m_columns;			//the columns of the segments
+	size_t m_arena_reserved;	//the memory mapped by the arena (the columns, and the unused rest of the last block)
+	size_t m_index;				//the hash table
+	size_t m_free_slots;		//the list of the free slots
+};
+
+
+/********************************************
+// 	class name	: 	arena
+// 	Description	: 	A bump allocator - memory is handed out of large blocks mapped from the system, and it is all returned at once when
+//					the arena is destroyed (the blocks are never freed one by one). Allocations are aligned to cache lines by default.
+//					Not thread-safe - the owner serializes the allocations
+//
+//	Members		:	m_block_size - the size of a block (a larger allocation gets a block of its own)
+//					m_blocks - the mapped blocks (address and size)
+//					m_next / m_end - the free part of the current block
+//					m_reserved / m_used - the bytes mapped / the bytes handed out (with the alignment padding)
+*/
+class arena {
+public:
+	arena(size_t block_size = ARENA_BLOCK_SIZE);
+	~arena();
+
+public: //API
+	/********************************************
+	// function name: 	arena::Allocate
+	// Description	: 	Allocates memory from the current block (a new block is mapped in case it doesn't fit). The memory is zeroed
+	// Parameters	: 	size - the number of bytes
+	//					alignment - the alignment of the memory, a power of 2 (default: CACHE_LINE_SIZE)
+	// Returns		: 	void* - the memory
+	// Exception	: 	std::bad_alloc in case a block can't be mapped
+	*/
+	void* Allocate(size_t size, size_t alignment = CACHE_LINE_SIZE);
+
+	size_t Reserved() const {
+		return m_reserved;
+	}
+
+	size_t Used() const {
+		return m_used;
+	}
+
+private: //do not allow the user to copy the object
+	arena(arena const&);
+	arena& operator=(arena const&);
+
+private:
+	size_t m_block_size;
+	vector<pair<char*, size_t> > m_blocks;
+	char* m_next;
+	char* m_end;
+	size_t m_reserved;
+	size_t m_used;
+};
+
+
+/********************************************
+// 	class name	: 	AccountStore
+// 	Description	: 	Accounts in columns. The slot of an account is its position in the columns (slot / STORE_SEGMENT_SIZE is its
+//					segment), and it doesn't move as long as the account is open - segments are added as the store grows, and the
+//					existing ones are never copied.
+//					The store's lock is held shared by the operations of the accounts and by the passes (they only touch the slots of
+//					accounts that are already open), and unique by Open and Close (they change the table and the slots). The balance of
+//					a slot is changed only under the slot's lock word, and read without it (the balance column is atomic)
+//
+//	Members		:	m_arena - the memory of the segments
+//					m_segments - the segments (the columns of STORE_SEGMENT_SIZE slots each)
+//					m_num_slots - the number of slots handed out so far
+//					m_free_slots - the slots of closed accounts, reused by the next openings
+//					m_index - the hash table - account number -> slot (linear probing, at most half full)
+//					m_size - the number of open accounts
+//					m_lock - the lock of the store
+//
+//	Methods		:	Open / Close - open an account / close it
+//					Deposit / Withdraw / Balance - the operations of an account
+//					SumBalances - sums the balances of all of the accounts
+//					ChargeCommission - charges a commission from all of the accounts
+//					Size - the number of open accounts
+//					Footprint - the memory taken by the store
+*/
+class AccountStore {
+public:
+	AccountStore();
+	~AccountStore() {}
+
+public: //API
+	/********************************************
+	// function name: 	AccountStore::Open
+	// Description	: 	Opens an account, in a free slot (a new one in case there is none)
+	// Parameters	: 	account_no - the account number
+	//					password - the password of the account (only its hash is kept)
+	//					balance - the opening balance
+	// Returns		: 	store_status - STORE_ACCOUNT_EXISTS in case there is an account with the same number, STORE_OK otherwise
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	store_status Open(int account_no, string const& password, int balance);
+
+	/********************************************
+	// function name: 	AccountStore::Close
+	// Description	: 	Closes an account - it's removed from the table, and its slot is freed
+	// Parameters	: 	account_no - the account number
+	//					password - the password of the account
+	//					balance - set to the balance of the account at the closure (default: NULL)
+	// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	store_status Close(int account_no, string const& password, int* balance = NULL);
+
+	/********************************************
+	// function name: 	AccountStore::Deposit / AccountStore::Withdraw
+	// Description	: 	Deposits an amount to an account / withdraws an amount from an account (the amount must not be larger than
+	//					the balance)
+	// Parameters	: 	account_no - the account number
+	//					password - the password of the account
+	//					amount - the amount
+	//					balance - set to the new balance (default: NULL)
+	// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_INSUFFICIENT_FUNDS (Withdraw) / STORE_OK
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	store_status Deposit(int account_no, string const& password, int amount, int* balance = NULL);
+	store_status Withdraw(int account_no, string const& password, int amount, int* balance = NULL);
+
+	/********************************************
+	// function name: 	AccountStore::Balance
+	// Description	: 	Reads the balance of an account
+	// Parameters	: 	account_no - the account number
+	//					password - the password of the account
+	//					balance - set to the balance
+	// Returns		: 	store_status - STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD / STORE_OK
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	store_status Balance(int account_no, string const& password, int* balance) const;
+
+	/********************************************
+	// function name: 	AccountStore::SumBalances
+	// Description	: 	Sums the balances of all of the open accounts - a sequential pass over the balance column of every segment.
+	//					The balances are read without locking the slots (each one is read atomically, the sum is not a snapshot)
+	// Parameters	: 	None
+	// Returns		: 	int64_t - the sum
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	int64_t SumBalances() const;
+
+	/********************************************
+	// function name: 	AccountStore::ChargeCommission
+	// Description	: 	Charges a commission from every open account, by the same rule as BankAccount::ChargeCommission (the balance
+	//					is reduced by balance * interest, rounded, unless the commission isn't lower than the balance)
+	// Parameters	: 	interest - the interest rate of the commission
+	// Returns		: 	int64_t - the total commission charged
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	int64_t ChargeCommission(float interest);
+
+	size_t Size() const;
+
+	/********************************************
+	// function name: 	AccountStore::Footprint
+	// Description	: 	Returns the memory taken by the store
+	// Parameters	: 	None
+	// Returns		: 	store_footprint - the memory of the columns, of the table and of the free list
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	store_footprint Footprint() const;
+
+private:
+	//the columns of STORE_SEGMENT_SIZE slots. Every column starts at a cache line, so no line holds two columns
+	struct segment {
+		int32_t* m_numbers;
+		atomic<int32_t>* m_balances;
+		uint64_t* m_credentials;
+		atomic<uint32_t>* m_locks; //0 - free, 1 - locked, 2 - locked and waited for
+	};
+
+	//an entry of the hash table (m_slot == STORE_EMPTY_SLOT - an empty entry)
+	struct index_entry {
+		int32_t m_account_no;
+		uint32_t m_slot;
+	};
+
+	static uint64_t __credential(string const& password);
+	static size_t __hash(int account_no);
+
+	//locks / unlocks the lock word of a slot
+	void __lock_slot(uint32_t slot) const;
+	void __unlock_slot(uint32_t slot) const;
+
+	//the slot of an account whose password matches (the caller holds the store's lock). Returns STORE_NO_ACCOUNT / STORE_WRONG_PASSWORD
+	store_status __find(int account_no, string const& password, uint32_t& slot) const;
+	//the position of an account in the table, or of the empty entry it would take
+	size_t __probe(int account_no) const;
+	//removes the entry at a position of the table (the following entries of its run are shifted back)
+	void __erase_entry(size_t position);
+	//doubles the table
+	void __grow_index();
+	//a new slot (a free one, or the next one - in a new segment in case the last one is full)
+	uint32_t __new_slot();
+
+	segment const& __segment(uint32_t slot) const {
+		return m_segments[slot / STORE_SEGMENT_SIZE];
+	}
+
+private: //do not allow the user to copy the object
+	AccountStore(AccountStore const&);
+	AccountStore& operator=(AccountStore const&);
+
+private:
+	arena m_arena;
+	vector<segment> m_segments;
+	uint32_t m_num_slots;
+	vector<uint32_t> m_free_slots;
+	vector<index_entry> m_index;
+	size_t m_size;
+	mutable rwlock m_lock;
+};
+
+
+#endif /* ACCOUNTSTORE_H_ */
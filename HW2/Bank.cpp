@@ -10,69 +10,30 @@
 #include <math.h>
 #include <random>
 #include <ctime>
-#include <sstream>
 #include <pthread.h>
 #include <unistd.h>
 #include <iomanip>
+#include <sstream>
 #include "Bank.h"
+#include "Checkpoint.h"
+#include "Fiber.h"
 #include "defs.h"
 
-
-#define HIGHEST_INTEREST 0.04
-#define LOWEST_INTEREST 0.02
-#define NUM_BANK_INDEPENDENT_THREADS 2
-
-typedef void* (*thread_fn)(void*);
-
-
-//**************************************Thread functions***************************
-void* print_bank_stats(void* arg){
-	Bank& bank = *reinterpret_cast<Bank*>(arg);
-	bank.PrintBankStats();
-	pthread_exit((void*)0);
-}
-
-void* charge_commissions(void* arg){
-	Bank& bank = *reinterpret_cast<Bank*>(arg);
-	bank.ChargeCommissions();
-	pthread_exit((void*)0);
-}
+thread_local bank_reply* Bank::t_reply = NULL;
 
 //***************************************Helper Functors***************************
 
 /********************************************
-// function name	: 	CompAccs
-// Description	: 	a functor that helps the sorting process according to accounts' account numbers
+// function name	: 	CompLegs
+// Description	: 	a functor that helps the sorting process of a transaction's legs according to their account numbers
 // Members		: 	None
 // Methods		: 	operator() - makes the object CALLABLE. returns bool - TRUE if fst account number is lesser than sec account number
 */
-bool CompAccs(BankAccount* fst, BankAccount* sec){
-	return fst->AccountNumber() < sec->AccountNumber();
+bool CompLegs(transaction_leg const& fst, transaction_leg const& sec){
+	return fst.m_account_no < sec.m_account_no;
 }
 
 
-/********************************************
-// class name	: 	FindAccount
-// Description	: 	a functor that helps to find a bank account according to its account number
-// Members		: 	m_account_number - the number of the account that find_if tries to find
-// Methods		: 	operator() - makes the object CALLABLE. returns bool - TRUE if looked up account number equals account[i]'s account number
-*/
-class FindAccount {
-public:
-	FindAccount(int account_no) :
-			m_account_number(account_no) {
-	}
-
-	bool operator()(BankAccount* paccount) {
-		return m_account_number == paccount->AccountNumber();
-	}
-
-private:
-	int m_account_number;
-};
-
-
-
 /********************************************
 // class name	: 	AccumulateCommision
 // Description	: 	a functor that helps to accumulate the bank total commission from the bank accounts and reduces the charged amount from the account's balance
@@ -88,19 +49,17 @@ public:
 	}
 
 	int operator()(int sum, BankAccount* paccount) {
-		//calculate the commission charged from the account
-		int commision = static_cast<int>(roundf(paccount->Balance(false) * m_commision_interest)); //do not sleep, just get the data
-		
-		//withdraw the commission from the account
-		paccount->Withdraw(commision, false); // do not sleep
+		//calculate and withdraw the commission from the account (atomically, do not sleep)
+		int commision = paccount->ChargeCommission(m_commision_interest, false);
+		if (commision == ACCOUNT_CLOSED)
+			return sum; //the account is being closed, skip it
 
 		//print the message to the log
-		stringstream msg;
-		msg 	<< "Bank: commissions of " << (int)roundf(100*m_commision_interest)
-				<< " % were charged, the bank gained " << commision
-				<< " $ from account " << paccount->AccountNumber() << std::endl;
+		message_arg args[] = {(int)roundf(100*m_commision_interest), commision, paccount->AccountNumber()};
+		message_buffer msg(&m_logger);
+		msg.Format(MSG_COMMISSION, args, 3);
 
-		m_logger << msg.str(); //thread-safe logging
+		m_logger.Write(msg.Data(), msg.Size()); //thread-safe logging
 		return sum + commision;
 	}
 
@@ -110,150 +69,451 @@ private:
 };
 //*********************************************************************************
 
+/********************************************
+// class name	: 	Bank::wal_recovery
+// Description	: 	a visitor that replays the records of the write-ahead log into the bank, while it's being constructed (no other
+//					thread can access the bank yet, so nothing is locked). Every record holds the balances after its mutation, so a
+//					balance is simply overwritten by the last record of its account
+// Members		: 	m_bank - the recovered bank
+//					m_bank_balance - the sum of the replayed commissions
+// Methods		: 	Apply - replays a record
+*/
+class Bank::wal_recovery : public wal_visitor {
+public:
+	wal_recovery(Bank& bank) : m_bank(bank), m_bank_balance(0) {
+	}
+
+	void Apply(wal_record_type type, wal_entry const* entries, unsigned num_entries, string const& password) {
+		if (type == WAL_OPEN) {
+			if (m_bank.m_accounts.Find(entries[0].m_account_no))
+				return;
+			BankAccount* account = new BankAccount(entries[0].m_account_no, password, entries[0].m_balance, &m_bank.m_versions,
+												   m_bank.m_wal, m_bank.m_lock_free);
+			m_bank.m_index.Insert(account);
+			m_bank.m_accounts.Insert(account);
+			return;
+		}
+
+		if (type == WAL_CLOSE) {
+			BankAccount* account = m_bank.m_accounts.Find(entries[0].m_account_no);
+			if (account) {
+				m_bank.m_accounts.Erase(account->AccountNumber());
+				m_bank.m_index.Erase(account->AccountNumber());
+				delete account;
+			}
+			return;
+		}
+
+		if (type == WAL_COMMISSION)
+			m_bank_balance += entries[0].m_amount;
+
+		version_write_guard write(&m_bank.m_versions);
+		for (unsigned i = 0; i < num_entries; ++i) {
+			BankAccount* account = m_bank.m_accounts.Find(entries[i].m_account_no);
+			if (account)
+				account->LockedStore(entries[i].m_balance, write.Version());
+		}
+	}
+
+	int BankBalance() const {
+		return m_bank_balance;
+	}
+
+private:
+	Bank& m_bank;
+	int m_bank_balance;
+};
+
 /********************************************
 // function name: 	Bank::Bank
 // Description	: 	Constructor.
-//					Initializes the bank's balance to 0, no accounts, logger to "log.txt", and the atm counter to 0.
-//					Also initializes to lock of the accounts' data structure.
-// Parameters	: 	None
+//					Initializes the bank's balance to 0, no accounts, logger to the options' log path ("log.txt" by default,
+//					with the options' flush interval and durability),
+//					and the latch of the ATMs closed (until the number of ATMs is set).
+//					Also initializes the locks of the accounts' directory shards.
+//					In case the options give a checkpoint and a write-ahead log, the accounts and the bank's balance are restored from the
+//					checkpoint, and recovered from the records of the log after it
+// Parameters	: 	options - the options of the run (default: the default options). On a virtual clock, the commissions are charged
+//							  by a single worker (there are no other threads to charge them in parallel)
 // Returns		: 	None
-// Exception	: 	None
+// Exception	: 	std::ofstream::failure in case the log or the write-ahead log can't be opened, or the checkpoint is invalid
 */
-Bank::Bank() : m_accs_lock(ONE_SEC), m_logger("./log.txt"), m_bank_balance(0) {
-	m_accounts.clear();
+Bank::Bank(system_options const& options) :	m_accounts(DEFAULT_NUM_SHARDS),
+											m_index(&m_epochs),
+											m_logger(options.m_log_path, options.m_log_interval ? options.m_log_interval : LOG_FLUSH_INTERVAL,
+													 options.m_log_sync ? LOG_DATA_SYNC : LOG_WRITE_BACK),
+											m_wal(NULL),
+											m_checkpoint_path(options.m_checkpoint_path),
+											m_checkpoint_period(max(1u, options.m_checkpoint_period) * (uint64_t)ONE_SEC),
+											m_lock_free(options.m_lock_free),
+											m_bank_balance(0, 0),
+											m_num_commission_workers(1),
+											m_seed(options.m_seed),
+											m_atms_done(UINT32_MAX) {
+	//on a virtual clock, a fiber that waits for a sync blocks the clock's thread - the real time of the sync must not change the simulated time
+	if (!options.m_wal_path.empty())
+		m_wal = new WriteAheadLog(options.m_wal_path, options.m_wal_mode, options.m_wal_interval, options.m_run_mode != ATM_RUN_VIRTUAL_CLOCK);
+
+	//restore the checkpoint, then recover the mutations that followed it from the log
+	int bank_balance = 0;
+	uint64_t checkpoint_lsn = 0;
+	CheckpointFile checkpoint;
+	if (!m_checkpoint_path.empty() && checkpoint.Open(m_checkpoint_path)) {
+		__restore(checkpoint);
+		bank_balance = checkpoint.BankBalance();
+		checkpoint_lsn = checkpoint.Lsn();
+	}
+	if (m_wal) {
+		wal_recovery recovery(*this);
+		m_wal->Replay(recovery, checkpoint_lsn);
+		bank_balance += recovery.BankBalance();
+	}
+	if (bank_balance) {
+		version_write_guard write(&m_versions);
+		m_bank_balance.Store(bank_balance, write.Version());
+	}
+
+	if (options.m_run_mode == ATM_RUN_VIRTUAL_CLOCK)
+		return;
 
+	//charge the commissions with a thread per core (but no more threads than shards)
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores > 1)
+		m_num_commission_workers = min((unsigned)num_cores, m_accounts.NumShards());
 }
 
 /********************************************
 // function name: 	Bank::~Bank
-// Description	: 	Destructor.
+// Description	: 	Destructor. Syncs and closes the write-ahead log
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
 Bank::~Bank() {
-	m_accs_lock.WriteLock();
-
-	for (unsigned i = 0; i < m_accounts.size(); ++i)
-		delete m_accounts[i];
-
-	m_accounts.clear();
-
-	m_accs_lock.WriteUnlock(false);
-	
+	delete m_wal;
+	//the accounts are released by the directory's destructor
 }
 
 /********************************************
 // function name: 	Bank::Main
-// Description	: 	Spawns the two main threads of the bank (charging commissions & status printing). 
-//					Waits for the two threads to end (created as joinable)
+// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second, the commission passes every
+//					3 seconds and the checkpoints every checkpoint period (if the bank has a checkpoint) - one at a time, so a checkpoint
+//					never overlaps a commission pass. Returns the moment the last ATM is done (the jobs' thread sleeps on the latch of
+//					the ATMs between the runs), after the final status is printed and the last checkpoint is taken.
+//					Runs as a thread of the system (or as a fiber of a virtual clock)
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
 void Bank::Main(){
-	pthread_t bank_threads[NUM_BANK_INDEPENDENT_THREADS];
-	thread_fn bank_funcs[NUM_BANK_INDEPENDENT_THREADS] = {print_bank_stats, charge_commissions};
+	std::srand(m_seed ? m_seed : std::time(NULL));
 
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	TimerWheel jobs;
+	jobs.Schedule(new_method_timer_job(this, &Bank::PrintBankStats), HALF_SEC);
+	jobs.Schedule(new_method_timer_job(this, &Bank::ChargeCommissionPass), THREE_SEC);
+	if (!m_checkpoint_path.empty())
+		jobs.Schedule(new_method_timer_job(this, &Bank::Checkpoint), m_checkpoint_period, m_checkpoint_period);
 
-	//function pointer array of bank threads
+	jobs.Run(m_atms_done);
 
-	//create the threads
-	for(unsigned i = 0; i < NUM_BANK_INDEPENDENT_THREADS; ++i)
-		pthread_create(&bank_threads[i], &attr, bank_funcs[i], (void*)this);
+	//the ATMs are done - the log is written (synced, with --log-sync) before the final status is printed, then the last checkpoint is taken
+	m_logger.Flush();
+	PrintBankStats();
+	if (!m_checkpoint_path.empty())
+		Checkpoint();
+}
+
+/********************************************
+// function name: 	Bank::ChargeCommissionPass
+// Description	: 	A commission pass, run by Main every 3 seconds - draws an interest rate (2%-4%), charges it from all of the accounts
+//					(the shards are split between the commission workers, a thread per core), adds the total to the bank's balance, and
+//					reclaims the accounts that were closed since the last pass.
+//					No lock is held over the whole directory, so ATM operations keep running during a pass
+// Parameters	: 	None
+// Returns		: 	int - the total commission charged in the pass
+// Exception	: 	None
+*/
+int Bank::ChargeCommissionPass() {
+	//create a new interest rate between 0.02 and 0.04
+	float interest = (HIGHEST_INTEREST - LOWEST_INTEREST) * fabsf(static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) + LOWEST_INTEREST;
+
+	//charge and accumulate the commission from all the bank accounts, the workers split the shards between them
+	atomic<unsigned> next_shard(0);
+	int tot_commision = 0;
+	if (m_num_commission_workers == 1)
+		tot_commision = __charge_shards(interest, next_shard); //a single worker - charge the shards right here
+	else {
+		vector<commission_worker> workers(m_num_commission_workers);
+		vector<pthread_t> worker_threads(m_num_commission_workers);
+		for (unsigned i = 0; i < m_num_commission_workers; ++i) {
+			commission_worker worker = {this, interest, &next_shard, 0};
+			workers[i] = worker;
+			pthread_create(&worker_threads[i], NULL, __commission_worker_main, (void*)&workers[i]);
+		}
 
-	pthread_attr_destroy(&attr);
+		for (unsigned i = 0; i < m_num_commission_workers; ++i) {
+			pthread_join(worker_threads[i], NULL);
+			tot_commision += workers[i].m_total;
+		}
+	}
+	{
+		version_write_guard write(&m_versions);
+		m_bank_balance.Store(m_bank_balance.Load() + tot_commision, write.Version());
+	}
+	__commit(); //the commissions of the whole pass are synced together
 
-	for(unsigned i = 0; i < NUM_BANK_INDEPENDENT_THREADS; ++i)
-		pthread_join(bank_threads[i], NULL);
-	//return to main thread
-	return;
+	//delete the accounts that were closed since the last pass, if no thread can reference them anymore
+	m_epochs.Reclaim();
+	return tot_commision;
 }
 
 /********************************************
-// function name: 	Bank::ChargeCommissions
-// Description	: 	Charges commissions (with an interest rate of 2%-4%) from the bank's accounts every 3 seconds 
-//					Runs as an independant thread
+// function name: 	Bank::__commission_worker_main
+// Description	: 	The routine of a commission charging thread. Runs Bank::__charge_shards
+// Parameters	: 	worker - a void* to a commission_worker, the result is stored in it
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* Bank::__commission_worker_main(void* worker) {
+	commission_worker& args = *reinterpret_cast<commission_worker*>(worker);
+	args.m_total = args.m_bank->__charge_shards(args.m_interest, *args.m_next_shard);
+	pthread_exit((void*)0);
+}
+
+/********************************************
+// function name: 	Bank::__charge_shards
+// Description	: 	Charges the commissions from the accounts of the shards, taking the next uncharged shard until none is left.
+//					A shard is locked (shared) only while its accounts are collected, the accounts are charged one by one afterwards
+// Parameters	: 	interest - the interest rate of the commission
+//					next_shard - the next shard to be charged (shared by all the workers of the pass)
+// Returns		: 	int - the total commission charged by this worker
+// Exception	: 	None
+*/
+int Bank::__charge_shards(float interest, atomic<unsigned>& next_shard) {
+	int total = 0;
+	vector<BankAccount*> shard_accounts;
+
+	for (unsigned shard = next_shard++; shard < m_accounts.NumShards(); shard = next_shard++) {
+		//the collected accounts are kept alive by the epoch guard, even if they are closed during the pass
+		epoch_guard guard(m_epochs);
+
+		rwlock& shard_lock = m_accounts.ShardLock(shard);
+		shard_lock.ReadLock();
+		shard_accounts.clear();
+		m_accounts.Collect(shard, shard_accounts);
+		shard_lock.ReadUnlock(false); //do not sleep
+
+		total = accumulate(shard_accounts.begin(), shard_accounts.end(), total, AccumulateCommision(interest, m_logger));
+	}
+
+	return total;
+}
+
+/********************************************
+// function name: 	Bank::Snapshot
+// Description	: 	Takes a consistent point-in-time snapshot of the bank - the accounts that were open at the snapshot (in a range of
+//					account numbers), their balances and the bank's balance. The shards are read-locked only while the accounts are
+//					collected and no account is locked at all, so ATM operations keep running (and are not reflected in the snapshot)
+// Parameters	: 	accounts - filled with the accounts at the snapshot, sorted by their account numbers
+//					first - the lowest account number of the range (default: INT_MIN)
+//					last - the highest account number of the range (default: INT_MAX)
+// Returns		: 	int - the bank's balance at the snapshot
+// Exception	: 	None
+*/
+int Bank::Snapshot(vector<account_snapshot>& accounts, int first, int last) const {
+	epoch_guard guard(m_epochs); //the collected accounts must stay alive until their balances are read
+
+	//no account is opened or unlinked while the version advances and the accounts are collected (both happen under their
+	//shard's unique lock), so the collected accounts are exactly the ones that were open at the snapshot (plus the ones closed after it)
+	vector<BankAccount*> collected;
+	for (unsigned shard = 0; shard < m_accounts.NumShards(); ++shard)
+		m_accounts.ShardLock(shard).ReadLock(); //in the order of the shards
+	uint32_t snapshot = m_versions.TakeSnapshot();
+	m_index.Range(collected, first, last);
+	for (unsigned shard = 0; shard < m_accounts.NumShards(); ++shard)
+		m_accounts.ShardLock(shard).ReadUnlock(false); //do not sleep
+
+	accounts.clear();
+	for (unsigned i = 0; i < collected.size(); ++i) {
+		int balance = collected[i]->SnapshotBalance(snapshot);
+		if (balance == ACCOUNT_CLOSED)
+			continue; //closed before the snapshot
+
+		account_snapshot account = {collected[i]->AccountNumber(), balance, collected[i]->Password()};
+		accounts.push_back(account);
+	}
+	int bank_balance = m_bank_balance.Load(snapshot);
+
+	m_versions.ReleaseSnapshot();
+	return bank_balance;
+}
+
+/********************************************
+// function name: 	Bank::Checkpoint
+// Description	: 	Takes a checkpoint of the bank - a snapshot of the accounts and of the bank's balance is written to the checkpoint file
+//					(see CheckpointFile), then the records of the write-ahead log the checkpoint reflects are cut off the log.
+//					The checkpoint is fuzzy with respect to the log - the LSN is read before the snapshot is taken, so every record up to it
+//					is reflected, and the records after it that are reflected too are replayed again on restore (harmlessly, a record holds
+//					the balances after its mutation). The ATMs keep running during a checkpoint.
+//					Must not run at the same time as a commission pass (the bank's balance at the snapshot must reflect exactly the
+//					commission records up to the LSN)
 // Parameters	: 	None
+// Returns		: 	bool - false in case the bank has no checkpoint path, or the checkpoint couldn't be written
+// Exception	: 	std::bad_alloc
+*/
+bool Bank::Checkpoint() {
+	if (m_checkpoint_path.empty())
+		return false;
+
+	//a record is appended after its balances are stored, so the records up to the LSN are all visible to the snapshot
+	uint64_t lsn = m_wal ? m_wal->LastLsn() : 0;
+	vector<account_snapshot> accounts;
+	int bank_balance = Snapshot(accounts);
+
+	if (!CheckpointFile::Write(m_checkpoint_path, accounts, bank_balance, lsn)) {
+		perror("checkpoint failed");
+		return false;
+	}
+
+	if (m_wal)
+		m_wal->Truncate(lsn);
+	return true;
+}
+
+/********************************************
+// function name: 	Bank::__restore
+// Description	: 	Restores the accounts from a checkpoint, while the bank is being constructed. The accounts are created from the mapped
+//					records, the shards are sized in advance and the ordered index is built in one pass (the records are sorted)
+// Parameters	: 	checkpoint - an open checkpoint
 // Returns		: 	None
-// Exception	: 	None
+// Exception	: 	std::bad_alloc
 */
-void Bank::ChargeCommissions() {
-	std::srand(std::time(NULL));
-
-	while(true){
-		//create a new interest rate between 0.02 and 0.04
-		float interest = (HIGHEST_INTEREST - LOWEST_INTEREST) * fabsf(static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) + LOWEST_INTEREST;
-		
-		m_accs_lock.WriteLock();
-		//charge and accumulate the commission from all the bank accounts
-		int tot_commision = accumulate(m_accounts.begin(), m_accounts.end(), 0, AccumulateCommision(interest, m_logger));
-		//int tot_commision = 0;
-		m_bank_balance += tot_commision;
-
-		m_accs_lock.WriteUnlock(false);
-
-		//check if atm's have finished their work. If yes, finish execution
-		if(m_finished_atms.HasReachedTop())
-			return;
+void Bank::__restore(CheckpointFile const& checkpoint) {
+	size_t num_accounts = checkpoint.NumAccounts();
+	if (!num_accounts)
+		return;
+
+	vector<BankAccount*> accounts(num_accounts);
+	m_accounts.Reserve(num_accounts);
+
+	//the accounts are created by a thread per core (but no more threads than chunks)
+	atomic<size_t> next_chunk(0);
+	restore_worker worker = {this, &checkpoint, &accounts[0], &next_chunk};
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_workers = min((size_t)max(num_cores, 1L), (num_accounts + RESTORE_CHUNK_SIZE - 1) / RESTORE_CHUNK_SIZE);
+	if (num_workers == 1)
+		__restore_chunks(worker); //a single worker - restore the accounts right here
+	else {
+		vector<pthread_t> worker_threads(num_workers);
+		for (size_t i = 0; i < num_workers; ++i)
+			pthread_create(&worker_threads[i], NULL, __restore_worker_main, (void*)&worker);
+		for (size_t i = 0; i < num_workers; ++i)
+			pthread_join(worker_threads[i], NULL);
+	}
 
+	m_index.Load(&accounts[0], num_accounts);
+}
+
+/********************************************
+// function name: 	Bank::__restore_worker_main
+// Description	: 	The routine of a restoring thread. Runs Bank::__restore_chunks
+// Parameters	: 	worker - a void* to a restore_worker
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* Bank::__restore_worker_main(void* worker) {
+	restore_worker const& args = *reinterpret_cast<restore_worker*>(worker);
+	args.m_bank->__restore_chunks(args);
+	pthread_exit((void*)0);
+}
 
-		//sleep for three seconds
-		usleep(THREE_SEC);
+/********************************************
+// function name: 	Bank::__restore_chunks
+// Description	: 	Creates the accounts of the checkpoint's records and inserts them to their shards, taking the next chunk of
+//					RESTORE_CHUNK_SIZE records until none is left. A shard is locked (unique) only for an insertion
+// Parameters	: 	worker - the checkpoint, where to store the accounts, and the next chunk
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void Bank::__restore_chunks(restore_worker const& worker) {
+	CheckpointFile const& checkpoint = *worker.m_checkpoint;
+	size_t num_accounts = checkpoint.NumAccounts();
+
+	for (size_t first = (*worker.m_next_chunk)++ * RESTORE_CHUNK_SIZE; first < num_accounts;
+		 first = (*worker.m_next_chunk)++ * RESTORE_CHUNK_SIZE) {
+		size_t last = min(first + RESTORE_CHUNK_SIZE, num_accounts);
+
+		//the accounts of the chunk are all created before they are inserted (twice as fast as interleaving the allocations of the
+		//accounts with those of the shards' entries - the accounts stay contiguous in memory)
+		for (size_t i = first; i < last; ++i) {
+			checkpoint_account const& record = checkpoint.Account(i);
+			worker.m_accounts[i] = new BankAccount(record.m_account_no, string(checkpoint.Password(i), record.m_password_len),
+												   record.m_balance, &m_versions, m_wal, m_lock_free);
+		}
 
+		for (size_t i = first; i < last; ++i) {
+			rwlock& shard_lock = m_accounts.ShardLock(m_accounts.ShardOf(checkpoint.Account(i).m_account_no));
+			shard_lock.WriteLock();
+			m_accounts.Insert(worker.m_accounts[i]);
+			shard_lock.WriteUnlock(false); //do not sleep
+		}
 	}
 }
 
 /********************************************
 // function name: 	Bank::PrintBankStats
 // Description	: 	Prints a snapshot of the banks' status (including stats of the accounts)
-//					Exclusive access is acquired via WriteLock (not really changing the status of the bank, but a write lock is an exclusive lock)
-//					Runs as an independant thread
+//					The snapshot comes sorted from the ordered index, it is rendered without holding any lock and printed with a single write
+//					Run by Main every half a second, and once more when the ATMs are done
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
 void Bank::PrintBankStats() const {
+	vector<account_snapshot> accounts;
+	ostringstream screen;
 
-	while(true){
-		m_accs_lock.WriteLock(); //NOTE: write lock acquires an exclusive lock on the container, so no account will be changed by other threads
-
-		//sort the bank accounts according to their account id
-		BankAccount** _begin = &m_accounts[0];
-		sort(_begin, _begin + m_accounts.size(), CompAccs);
-		
-		printf("\033[H\033[J");   //clear the screen
-		printf("\033[1;1H"); //move the cursor to the top left corner of the screen
-		cout << "Current Bank Status" << endl;
-		
-		//loop all over the accounts and print their stats
-		for (unsigned i = 0; i < m_accounts.size(); ++i) {
-			//print the account's stats
-			auto* account = m_accounts[i];
-			cout << "Account " << account->AccountNumber() << ": Balance - "
-					<< account->Balance(false) << " $ ," << "Account Password - " //do not sleep while getting information
-					<< account->Password() << endl;
-		}
-
-		cout << "The Bank has " << m_bank_balance << " $" << endl;
+	int bank_balance = Snapshot(accounts); //sorted according to the account id
 
-		m_accs_lock.WriteUnlock(false);
-		
-		//sleep for half a second
-		//check if atm's have finished their work. If yes, finish execution
-		if(m_finished_atms.HasReachedTop())
-			return;
+	screen << "\033[H\033[J";   //clear the screen
+	screen << "\033[1;1H"; //move the cursor to the top left corner of the screen
+	screen << "Current Bank Status" << endl;
 
-		usleep(HALF_SEC);
+	//loop all over the accounts and print their stats
+	for (unsigned i = 0; i < accounts.size(); ++i) {
+		screen << "Account " << accounts[i].m_account_number << ": Balance - "
+				<< accounts[i].m_balance << " $ ," << "Account Password - "
+				<< accounts[i].m_password << endl;
 	}
 
+	screen << "The Bank has " << bank_balance << " $" << endl;
+
+	cout << screen.str() << flush;
 }
 
 
 //*******************************API for usage by ATMs************************************************************************
+//NOTE: the ATM operations hold the lock of an account's shard only while looking the account up (or linking/unlinking it).
+//The account itself is kept alive by the epoch guard of the operation, so a closure of one account never blocks
+//operations on other accounts, and an operation that found an account which was closed meanwhile fails with ACCOUNT_CLOSED
+
+/********************************************
+// function name: 	Bank::__find_account
+// Description	: 	Looks up an account in its shard (the shard is locked only for the lookup)
+// Parameters	: 	account_no - the account number
+// Returns		: 	BankAccount* - the account, NULL if there is no such account
+// Exception	: 	None
+// Thread-safety:	The caller must be inside an epoch critical section (epoch_guard) as long as it uses the account
+*/
+BankAccount* Bank::__find_account(int account_no) const {
+	rwlock& shard_lock = m_accounts.ShardLock(m_accounts.ShardOf(account_no));
+
+	shard_lock.ReadLock();
+	BankAccount* account = m_accounts.Find(account_no);
+	shard_lock.ReadUnlock(false); //do not sleep
+
+	return account;
+}
 
 /********************************************
 // function name: 	Bank::OpenAccount
@@ -266,29 +526,39 @@ void Bank::PrintBankStats() const {
 //					Else return true
 // Exception	: 	None (exits if std::bad_alloc occurs)
 */
-bool Bank::OpenAccount(int account_no, string password, int balance, int atm_id) {
-	//Acquire an exclusive lock over the accounts' structure because this operation changes it's internal structure
-	m_accs_lock.WriteLock();
-	
+bool Bank::OpenAccount(int account_no, string const& password, int balance, int atm_id) {
+	//Acquire an exclusive lock over the account's shard because this operation changes it's internal structure
+	rwlock& shard_lock = m_accounts.ShardLock(m_accounts.ShardOf(account_no));
+	shard_lock.WriteLock();
+
 	//find if there's already an account with the account_no number
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
+	BankAccount* found_account = m_accounts.Find(account_no);
 
 	//if there is already an account with the same id, return false
-	if (m_accounts.end() != found_account) {
-		m_accs_lock.WriteUnlock(true);//sleep for a second
+	if (found_account) {
+		shard_lock.WriteUnlock(false);
+		fiber_sleep(ONE_SEC); //sleep for a second
 
 		//write to the log
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
+		__report(METRIC_OPEN, MSG_ACCOUNT_EXISTS, atm_id);
 
 		return false; //account already exists
 	}
 
-	//else push a new account to the bank
+	//else push a new account to the bank - to its shard and to the ordered index.
+	//The account is created and linked under the shard's lock, so a snapshot either sees it with its opening balance or doesn't see it at all.
+	//The index itself is concurrent - only the nodes around the new one are locked, so accounts of other shards are opened in parallel
 	try {
-		m_accounts.push_back(new BankAccount(account_no, password, balance));
-
+		epoch_guard guard(m_epochs); //the index's nodes that are traversed must stay alive
+		BankAccount* account = new BankAccount(account_no, password, balance, &m_versions, m_wal, m_lock_free);
+		m_index.Insert(account);
+		m_accounts.Insert(account);
+
+		//logged under the shard's lock - before any other operation can find the account
+		if (m_wal) {
+			wal_entry entry = {account_no, balance, balance};
+			m_wal->Append(WAL_OPEN, &entry, 1, &password);
+		}
 	}
 	//bad alloc handling
 	catch (bad_alloc& e) {
@@ -297,15 +567,14 @@ bool Bank::OpenAccount(int account_no, string password, int balance, int atm_id)
 		exit(EXIT_FAILURE);
 	}
 
-	m_accs_lock.WriteUnlock(true); //sleep for a second before unlocking
+	shard_lock.WriteUnlock(false);
+	fiber_sleep(ONE_SEC); //sleep for a second
+	__commit();
 
 	//Post operation
-	
-	//write to the log
-	stringstream msg;
-	msg << atm_id << ": New account id is " << account_no << " with password " << password << " and initial balance " << balance << endl;
 
-	m_logger << msg.str(); //thread-safe logging
+	//write to the log
+	__report(METRIC_OPEN, MSG_OPENED, atm_id, account_no, password, balance);
 	return true;
 }
 
@@ -313,6 +582,8 @@ bool Bank::OpenAccount(int account_no, string password, int balance, int atm_id)
 /********************************************
 // function name: 	Bank::RemoveAccount
 // Description	: 	Remove an account from the bank
+//					The account is closed first (so operations that have already found it fail), then unlinked from its shard,
+//					and finally retired - it is deleted once no operation can reference it anymore
 // Parameters	: 	account_no - the account number
 //					password - the password of the account
 //					atm_id - the id of the atm that requested this operations
@@ -320,50 +591,58 @@ bool Bank::OpenAccount(int account_no, string password, int balance, int atm_id)
 //					Else return true
 // Exception	: 	None
 */
-bool Bank::RemoveAccount(int account_no, string password, int atm_id) {
-	//Acquire an exclusive lock over the accounts' structure because this operation changes it's internal structure
-	m_accs_lock.WriteLock();
-	bool password_correct = true;
-	
+bool Bank::RemoveAccount(int account_no, string const& password, int atm_id) {
+	epoch_guard guard(m_epochs);
+
 	//find the account according to it's ID
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
+	BankAccount* found_account = __find_account(account_no);
 
-	//if account wasn't found
-	if (found_account == m_accounts.end()) {
-		m_accs_lock.WriteUnlock(true); //sleep for a second before unlocking the structure
+	//check if password is correct
+	bool password_correct = found_account && found_account->Password() == password;
+	int balance = ACCOUNT_CLOSED;
+	if (password_correct)
+		balance = found_account->Close(true); //sleep for a second before unlocking the account
+	else
+		fiber_sleep(ONE_SEC); //sleep for a second
+
+	if (password_correct && balance != ACCOUNT_CLOSED)
+		__commit();
 
+	//if account wasn't found (or has been closed by another thread meanwhile)
+	if (!found_account || (password_correct && balance == ACCOUNT_CLOSED)) {
 		//post operation - write to log
 		//write 'account not-existent' error to log
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
+		__report(METRIC_CLOSE, MSG_NO_ACCOUNT, atm_id);
 
 		return false;
 	}
-	//check if password is correct
-	password_correct = (*found_account)->Password() == password;
-	int balance = (*found_account)->Balance(false); //do not sleep before unlocking
-	if(password_correct){
-		//if password is correct, remove the account
-		delete (*found_account); // delete the account from the heap
-		m_accounts.erase(found_account); //delete the iterator
+
+	if (password_correct) {
+		//unlink the account from its shard and from the ordered index, the shard is locked only for the unlinking
+		//(the index locks only the nodes around the account's node)
+		rwlock& shard_lock = m_accounts.ShardLock(m_accounts.ShardOf(account_no));
+		shard_lock.WriteLock();
+		if (m_accounts.Find(account_no) == found_account) {
+			m_accounts.Erase(account_no);
+			m_index.Erase(account_no);
+		}
+		shard_lock.WriteUnlock(false); //do not sleep
+
+		//delete the account from the heap once no thread can reference it
+		m_epochs.Retire(found_account);
 	}
-	m_accs_lock.WriteUnlock(true); //sleep for a second before unlocking the structure
 
 	//post operation - write to the log
-	stringstream msg;
 	if(password_correct)
-		msg << atm_id << ": Account " << account_no << " is now closed. Balance was " << balance << endl;
+		__report(METRIC_CLOSE, MSG_CLOSED, atm_id, account_no, balance);
 	else
-		msg << "Error " << atm_id << ": Your transaction failed - password for account id " << account_no << " is incorrect" << endl;
-
-	m_logger << msg.str();//thread-safe logging
+		__report(METRIC_CLOSE, MSG_WRONG_PASSWORD, atm_id, account_no);
 
 	return password_correct;
 }
 
 /********************************************
-// function name: 	Bank::Deposit	
+// function name: 	Bank::Deposit
 // Description	: 	Deposit money to a certain account
 // Parameters	: 	account_no - the account number
 //					password - the password of the account
@@ -371,38 +650,35 @@ bool Bank::RemoveAccount(int account_no, string password, int atm_id) {
 //					atm_id - the id of the atm that requested this operations
 // Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
 //					Else return true
-// Exception	: 	None 
+// Exception	: 	None
 */
-bool Bank::Deposit(int account_no, string password, int amount, int atm_id) {
-	m_accs_lock.ReadLock();
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
-	if (m_accounts.end() == found_account) {
-		m_accs_lock.ReadUnlock(true); //sleep for one second
+bool Bank::Deposit(int account_no, string const& password, int amount, int atm_id) {
+	epoch_guard guard(m_epochs);
+	BankAccount* found_account = __find_account(account_no);
+
+	int new_balance = ACCOUNT_CLOSED;
+	bool password_correct = found_account && found_account->Password() == password;
+	if (password_correct)
+		new_balance = found_account->Deposit(amount,true); //sleep for one second, true -> sleep
+	else
+		fiber_sleep(ONE_SEC); //sleep for one second
+
+	if (password_correct && new_balance != ACCOUNT_CLOSED)
+		__commit();
 
+	//if account wasn't found (or has been closed meanwhile)
+	if (!found_account || (password_correct && new_balance == ACCOUNT_CLOSED)) {
 		//write to the log
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
+		__report(METRIC_DEPOSIT, MSG_NO_ACCOUNT, atm_id);
 		return false;
 	}
 
-	int new_balance = 0;
-	bool password_correct = (*found_account)->Password() == password;
-	if (password_correct){
-		new_balance = (*found_account)->Deposit(amount,true); //sleep for one second, true -> sleep
-		m_accs_lock.ReadUnlock(false); //do not sleep after sleeping after depositing
-	}
-	else m_accs_lock.ReadUnlock(true); //sleep for one second
-
 	//POST OPERATION: write to the log
 
-	stringstream msg;
 	if (password_correct)
-		msg << atm_id << ": Account " << account_no << " new balance is " << new_balance << " after " << amount << "$ was deposited" << endl;
+		__report(METRIC_DEPOSIT, MSG_DEPOSITED, atm_id, account_no, new_balance, amount);
 	else
-		msg << "Error " << atm_id << ": Your transaction failed - password for account id " << account_no << " is incorrect" << endl;
-
-	m_logger << msg.str(); //thread-safe logging
+		__report(METRIC_DEPOSIT, MSG_WRONG_PASSWORD, atm_id, account_no);
 
 	return password_correct;
 }
@@ -417,47 +693,37 @@ bool Bank::Deposit(int account_no, string password, int amount, int atm_id) {
 // Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect or withdrawl failed, return false
 //					Else return true
 // Exception	: 	None
-*/	
-bool Bank::Withdraw(int account_no, string password, int amount, int atm_id) {
-	m_accs_lock.ReadLock();
+*/
+bool Bank::Withdraw(int account_no, string const& password, int amount, int atm_id) {
+	epoch_guard guard(m_epochs);
 	//find the account
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
-	
-	//if account wasn't found
-	if (m_accounts.end() == found_account) {
-		m_accs_lock.ReadUnlock(true); //sleep for one second before unlocking
-
-		//TODO: ADD log writing here
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
-		return false;
-	}
+	BankAccount* found_account = __find_account(account_no);
 
-	bool password_correct = (*found_account)->Password() == password;
-	int balance = 0;
-	if (password_correct){
-		balance = (*found_account)->Withdraw(amount, true); //sleep for one second before unlocking the account
+	bool password_correct = found_account && found_account->Password() == password;
+	int balance = ACCOUNT_CLOSED;
+	if (password_correct)
+		balance = found_account->Withdraw(amount, true); //sleep for one second before unlocking the account
+	else
+		fiber_sleep(ONE_SEC); //sleep for a second
 
+	if (password_correct && balance > -1)
+		__commit();
 
-		m_accs_lock.ReadUnlock(false); //do not sleep
+	//if account wasn't found (or has been closed meanwhile)
+	if (!found_account || (password_correct && balance == ACCOUNT_CLOSED)) {
+		__report(METRIC_WITHDRAW, MSG_NO_ACCOUNT, atm_id);
+		return false;
 	}
 
-	else m_accs_lock.ReadUnlock(true); //sleep for a second
-
 	//post operation: Write to log
-	//TODO: ADD log writing here
-	stringstream msg;
 	if (password_correct){
 		if (balance > -1)
-			msg << atm_id << ": Account " << account_no << " new balance is " << balance << " after " << amount << "$ was withdrawn" << endl;
+			__report(METRIC_WITHDRAW, MSG_WITHDRAWN, atm_id, account_no, balance, amount);
 		else
-			msg << "Error: " << atm_id << ": Your transaction failed - account id " << account_no << " balance is lower than " << amount << endl;
+			__report(METRIC_WITHDRAW, MSG_WITHDRAW_LOW_BALANCE, atm_id, account_no, amount);
 	}
 	else
-		msg << "Error: " << atm_id << ": Your transaction failed - password for account id " << account_no << " is incorrect" << endl;
-
-	m_logger << msg.str(); //thread-safe logging
+		__report(METRIC_WITHDRAW, MSG_WITHDRAW_WRONG_PASSWORD, atm_id, account_no);
 
 	return password_correct && (balance > -1);
 }
@@ -472,45 +738,133 @@ bool Bank::Withdraw(int account_no, string password, int amount, int atm_id) {
 //					Else return true
 // Exception	: 	None
 */
-bool Bank::Balance(int account_no, string password,int atm_id)  {
-	m_accs_lock.ReadLock();
+bool Bank::Balance(int account_no, string const& password,int atm_id)  {
+	epoch_guard guard(m_epochs);
 	//find the account
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
-	
-	//if account wasn't found
-	if (m_accounts.end() == found_account) {
-		m_accs_lock.ReadUnlock(true); //sleep for one second
-
-		//TODO: ADD log writing here
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
-		return false;
-	}
+	BankAccount* found_account = __find_account(account_no);
+
 	//check if password is correct
-	bool password_correct = (*found_account)->Password() == password;
-	int balance;
-	if (password_correct){
-		balance = (*found_account)->Balance(true); //sleep for one second before unlocking the account
-		m_accs_lock.ReadUnlock(false); //already slept in the balance operation
+	bool password_correct = found_account && found_account->Password() == password;
+	int balance = ACCOUNT_CLOSED;
+	if (password_correct)
+		balance = found_account->Balance(true); //sleep for one second before unlocking the account
+	else
+		fiber_sleep(ONE_SEC); //sleep for one second
+
+	//if account wasn't found (or has been closed meanwhile)
+	if (!found_account || (password_correct && balance == ACCOUNT_CLOSED)) {
+		__report(METRIC_BALANCE, MSG_NO_ACCOUNT, atm_id);
+		return false;
 	}
-	else m_accs_lock.ReadUnlock(true); //sleep for one second
 
 	//POST process:
-	//TODO: ADD log writing here
-	stringstream msg;
 	if(password_correct)
-		msg << atm_id << ": Account " << account_no << " balance is " << balance << endl;
+		__report(METRIC_BALANCE, MSG_BALANCE, atm_id, account_no, balance);
 	else
-		msg << "Error " << atm_id << ": Your transaction failed - password for account id " << account_no << " is incorrect" << endl;
+		__report(METRIC_BALANCE, MSG_WRONG_PASSWORD, atm_id, account_no);
 
-	m_logger << msg.str();
 	return password_correct;
 }
 
 /********************************************
-// function name: 	Bank::Transfer	
+// function name: 	Bank::Execute
+// Description	: 	Executes a transaction - applies a set of debits and credits to several accounts atomically.
+//					The accounts are locked in ascending order of their numbers (so two transactions never deadlock, and no retry is needed),
+//					validated, and written with a single version (so a snapshot sees either all of the legs or none of them)
+// Parameters	: 	legs - the legs of the transaction. Reordered by account number, and on commit every leg is filled with the new balance of its account
+//					num_legs - the number of legs (up to TXN_MAX_LEGS, several legs may refer to the same account)
+//					failed_account - if not NULL, filled with the number of the account that failed the transaction
+//					is_sleep - tells the accounts' locks to sleep (once, before unlocking) or not (default: true)
+// Returns		: 	TXN_COMMITTED on success, TXN_NO_ACCOUNT if an account doesn't exist (or has been closed), TXN_INSUFFICIENT_FUNDS if
+//					an account's debits are not lower than its balance, TXN_TOO_MANY_LEGS. Nothing is applied unless committed
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+txn_status Bank::Execute(transaction_leg* legs, unsigned num_legs, int* failed_account, bool is_sleep) {
+	if (num_legs > TXN_MAX_LEGS)
+		return TXN_TOO_MANY_LEGS;
+
+	epoch_guard guard(m_epochs);
+
+	//order the legs by their account numbers, this is the locking order
+	sort(legs, legs + num_legs, CompLegs);
+
+	//find the accounts, and sum the legs of every account - the net change, and the debits alone (a debit is checked against the
+	//balance before the account's credits, so a transfer from an account to itself is checked the way a withdrawal is)
+	BankAccount* accounts[TXN_MAX_LEGS];
+	int balances[TXN_MAX_LEGS];
+	int64_t debits[TXN_MAX_LEGS];
+	unsigned num_accounts = 0;
+	for (unsigned i = 0; i < num_legs; ++i) {
+		int64_t debit = legs[i].m_amount < 0 ? -(int64_t)legs[i].m_amount : 0;
+		if (num_accounts > 0 && accounts[num_accounts - 1]->AccountNumber() == legs[i].m_account_no) {
+			balances[num_accounts - 1] += legs[i].m_amount;
+			debits[num_accounts - 1] += debit;
+			continue;
+		}
+
+		BankAccount* account = __find_account(legs[i].m_account_no);
+		if (!account) {
+			if (failed_account) *failed_account = legs[i].m_account_no;
+			return TXN_NO_ACCOUNT;
+		}
+
+		accounts[num_accounts] = account;
+		debits[num_accounts] = debit;
+		balances[num_accounts++] = legs[i].m_amount;
+	}
+
+	for (unsigned i = 0; i < num_accounts; ++i)
+		accounts[i]->WriteLock();
+
+	//validate the transaction - same rules as Withdraw (a debit must be lower than the balance)
+	txn_status status = TXN_COMMITTED;
+	for (unsigned i = 0; i < num_accounts && status == TXN_COMMITTED; ++i) {
+		int balance = accounts[i]->LockedBalance();
+		if (balance == ACCOUNT_CLOSED)
+			status = TXN_NO_ACCOUNT;
+		else if (debits[i] > 0 && debits[i] >= balance)
+			status = TXN_INSUFFICIENT_FUNDS;
+		else
+			balances[i] += balance; //the new balance
+
+		if (status != TXN_COMMITTED && failed_account)
+			*failed_account = accounts[i]->AccountNumber();
+	}
+
+	//commit - all of the accounts are written with the same version, and logged as a single record (so a recovery applies all of the legs or none)
+	if (status == TXN_COMMITTED) {
+		wal_entry entries[TXN_MAX_LEGS];
+		for (unsigned i = 0; i < num_accounts; ++i) {
+			wal_entry entry = {accounts[i]->AccountNumber(), balances[i] - accounts[i]->LockedBalance(), balances[i]};
+			entries[i] = entry;
+		}
+
+		version_write_guard write(&m_versions);
+		for (unsigned i = 0; i < num_accounts; ++i)
+			accounts[i]->LockedStore(balances[i], write.Version());
+		if (m_wal)
+			m_wal->Append(WAL_TRANSFER, entries, num_accounts);
+
+		for (unsigned i = 0, j = 0; i < num_legs; ++i) {
+			while (accounts[j]->AccountNumber() != legs[i].m_account_no) ++j;
+			legs[i].m_balance = balances[j];
+		}
+	}
+
+	//unlock in reverse order. The first unlocking sleeps (if told so) while all of the accounts are still locked
+	for (int i = (int)num_accounts - 1; i >= 0; --i)
+		accounts[i]->WriteUnlock(is_sleep && i == (int)num_accounts - 1);
+
+	if (status == TXN_COMMITTED)
+		__commit();
+	return status;
+}
+
+/********************************************
+// function name: 	Bank::Transfer
 // Description	: 	Transfer money from a certain account to another
+//					The withdrawal and the deposit are a single transaction (Bank::Execute), so the money is never seen in neither or in both accounts
 // Parameters	: 	account_no - the account number
 //					password - the password of the account
 //					account_target - the target account number
@@ -520,64 +874,93 @@ bool Bank::Balance(int account_no, string password,int atm_id)  {
 //					Else return true
 // Exception	: 	None
 */
-bool Bank::Transfer(int account_no, string password, int account_target, int amount, int atm_id) {
-	m_accs_lock.ReadLock();
-	//find the account
-	auto found_account = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_no));
+bool Bank::Transfer(int account_no, string const& password, int account_target, int amount, int atm_id) {
+	epoch_guard guard(m_epochs);
+	//find the account and the target account
+	BankAccount* found_account = __find_account(account_no);
+	BankAccount* found_target = found_account ? __find_account(account_target) : NULL;
 
-	if (m_accounts.end() == found_account) {
-		m_accs_lock.ReadUnlock(true); //sleep for one second
+	//check the password of the account
+	int balance = -1, tar_balance = ACCOUNT_CLOSED, failed_account = 0;
+	txn_status status = TXN_NO_ACCOUNT;
+	bool password_correct = found_account && found_target && found_account->Password() == password;
 
-		//TODO: ADD log writing here
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account with the same id exists" << endl;
-		m_logger << error.str(); //thread safe logging
-		return false;
+	if(password_correct) { //if password is correct, withdraw the money and deposit it atomically (sleep for one second)
+		transaction_leg legs[2] = {{account_no, -amount, 0}, {account_target, amount, 0}};
+		status = Execute(legs, 2, &failed_account, true);
+
+		for (unsigned i = 0; i < 2; ++i) {
+			if (legs[i].m_account_no == account_no) balance = legs[i].m_balance;
+			if (legs[i].m_account_no == account_target) tar_balance = legs[i].m_balance;
+		}
 	}
+	else
+		fiber_sleep(ONE_SEC); //sleep for one second
 
-	//find the target account
-	auto found_target = find_if(m_accounts.begin(), m_accounts.end(), FindAccount(account_target));
-	
-	//if target account wasn't found
-	if (m_accounts.end() == found_target) {
-		m_accs_lock.ReadUnlock(true); //sleep for one second
-		//TODO: ADD log writing here
-
-		stringstream error;
-		error << "Error " << atm_id << ": Your transaction failed - account id " << account_target << " does not exist" << endl;
-		m_logger << error.str(); //thread safe logging
+	//if the account wasn't found (or has been closed meanwhile)
+	if (!found_account || (password_correct && status == TXN_NO_ACCOUNT && failed_account == account_no)) {
+		__report(METRIC_TRANSFER, MSG_NO_ACCOUNT, atm_id);
 		return false;
 	}
 
-	//check the password of the account
-	int balance, tar_balance;
-	bool password_correct = (*found_account)->Password() == password;
-
-	if(password_correct) //if password is correct, try to withdraw the money
-		balance = (*found_account)->Withdraw(amount, true); //sleep for one second
-	if(balance > -1){ //if withdrawl succeeded, deposit the amount
-		tar_balance = (*found_target)->Deposit(amount, false);
-		m_accs_lock.ReadUnlock(false);//do not sleep after transfer, already slept while transfer
+	//if target account wasn't found (or has been closed meanwhile)
+	if (!found_target || (password_correct && status == TXN_NO_ACCOUNT)) {
+		__report(METRIC_TRANSFER, MSG_NO_TARGET, atm_id, account_target);
+		return false;
 	}
-	//sleep before unlocking
-	else m_accs_lock.ReadUnlock(true); // sleep for one second
 
 
 	//POST opration:
-	//TODO: write to log file here
-	stringstream msg;
 	if (password_correct) {
-		if(balance > -1)
-			msg << atm_id << "Transfer " << amount << " from account " << account_no << " to account " << account_target
-					<< " new account balance is " << balance << " new target account balance is " << tar_balance << endl;
-		else
-			msg << "Error " << atm_id << ": Your transaction failed - account id " << account_no << " balance is lower than" << amount << endl;
+		if(status == TXN_COMMITTED)
+			__report(METRIC_TRANSFER, MSG_TRANSFERRED, atm_id, amount, account_no, account_target, balance, tar_balance);
+		else if (failed_account == account_no)
+			__report(METRIC_TRANSFER, MSG_TRANSFER_LOW_BALANCE, atm_id, account_no, amount);
+		else //a negative amount - the target's leg is the debit that has failed
+			__report(METRIC_TRANSFER, MSG_TRANSFER_LOW_BALANCE, atm_id, account_target, -amount);
 	}
 	else
-		msg << "Error " << atm_id << ": Your transaction failed - password for account id " << account_no << " is incorrect" << endl;
-
-	m_logger << msg.str(); //thread save logging
+		__report(METRIC_TRANSFER, MSG_WRONG_PASSWORD, atm_id, account_no);
 
-	return password_correct && (balance > -1);
+	return password_correct && status == TXN_COMMITTED;
 }
 
+/********************************************
+// function name: 	Bank::Serve
+// Description	: 	Runs an ATM operation on behalf of a client of the bank's socket server (see BankServer), and returns its outcome -
+//					the message the operation has reported, and the balances it tells. The operation is the one an ATM would run
+//					(logged and counted the same way), its outcome is caught on the way to the log
+// Parameters	: 	command - the operation (its password id is ignored)
+//					password - the password of the account
+//					client_id - the id of the client (logged in place of the ATM's id)
+// Returns		: 	bank_reply - the outcome (m_message is NUM_BANK_MESSAGES for an unknown operation)
+// Exception	: 	None
+*/
+bank_reply Bank::Serve(atm_command const& command, string const& password, int client_id) {
+	bank_reply reply;
+	t_reply = &reply;
+	switch (command.m_op) {
+	case ATM_OP_OPEN:
+		OpenAccount(command.m_account, password, command.m_amount, client_id);
+		break;
+	case ATM_OP_DEPOSIT:
+		Deposit(command.m_account, password, command.m_amount, client_id);
+		break;
+	case ATM_OP_WITHDRAW:
+		Withdraw(command.m_account, password, command.m_amount, client_id);
+		break;
+	case ATM_OP_BALANCE:
+		Balance(command.m_account, password, client_id);
+		break;
+	case ATM_OP_CLOSE:
+		RemoveAccount(command.m_account, password, client_id);
+		break;
+	case ATM_OP_TRANSFER:
+		Transfer(command.m_account, password, command.m_target, command.m_amount, client_id);
+		break;
+	default:
+		break;
+	}
+	t_reply = NULL;
+	return reply;
+}
@@ -7,32 +7,68 @@
 
  /*
 	Module Name : Bank
-	Description : an implementation of a Bank. The bank holds a list of BankAccount pointers (dynamicaly allocated).
-					The Bank will run 2 distinct threads - charging commissions from bank accounts & printing bank stats to stdout
-	Main methods: 	1. Main - creates and runs said methods
-					2. ChargeCommissions - runs as a different thread
-					3. PrintBankStats - runs as a different thread
+	Description : an implementation of a Bank. The bank holds a sharded directory of BankAccount pointers (dynamicaly allocated).
+					The Bank runs its background jobs - charging commissions from bank accounts, printing bank stats to stdout and taking
+					checkpoints - on a timer wheel of a single thread, until the last ATM is done
+	Main methods: 	1. Main - runs said jobs on schedule
+					2. ChargeCommissionPass - a job of Main
+					3. PrintBankStats - a job of Main
  */
 #ifndef BANK_H_
 #define BANK_H_
 
 #include <iostream>
 #include <vector>
+#include <atomic>
 
+#include "BankService.h"
 #include "BankAccount.h"
+#include "AccountDirectory.h"
+#include "AccountIndex.h"
 #include "rwlock.h"
+#include "epoch.h"
+#include "snapshot.h"
 #include "Logger.h"
+#include "WriteAheadLog.h"
+#include "Message.h"
+#include "Options.h"
+#include "TimerWheel.h"
+#include "metrics.h"
+#include "CommandFile.h"
 
 using namespace std;
 
-//NOTE: deleting an account from the bank requires locking the whole data structure so
-//there wouldn't be a fatal case where another thread is waiting to read values from the account that
-//is being deleted, (otherwise a seg-fault)
+class CheckpointFile;
+
+//NOTE: deleting an account from the bank doesn't lock the accounts' directory (only the account's shard, for unlinking it).
+//The deleted account is retired to an epoch manager, and it is freed only after every thread that might be reading values from it
+//has finished its operation, so there wouldn't be a fatal case of accessing a freed account (otherwise a seg-fault)
+
+
+#define TXN_MAX_LEGS 64 //the maximal number of legs of a single transaction
+#define RESTORE_CHUNK_SIZE 65536 //the number of checkpoint records a restoring thread takes at a time
+
+//a leg of a transaction - a debit (negative amount) or a credit (positive amount) of a single account
+struct transaction_leg {
+	int m_account_no;
+	int m_amount;
+	int m_balance; //filled by Bank::Execute with the new balance of the account, once the transaction is committed
+};
+
+//the result of a transaction
+typedef enum {TXN_COMMITTED, TXN_NO_ACCOUNT, TXN_INSUFFICIENT_FUNDS, TXN_TOO_MANY_LEGS} txn_status;
+
+//an account as it was at a snapshot of the bank
+struct account_snapshot {
+	int m_account_number;
+	int m_balance;
+	string m_password;
+};
 
 
 /********************************************
 // 	class name	: 	Bank
-// 	Description	: 	A class that manages the access and traffic to the accounts of the bank.
+// 	Description	: 	A class that manages the access and traffic to the accounts of the bank (a bank_service whose accounts live in the memory of the process).
 //					The class holds a list of accounts and enables access and manipulation of said account
 //					via class methods. These operations are protected by a read-write lock in order to assure thread safety
 //					Said operations are utilized by the ATM instances that are allowed to access the accounts of the bank, but
@@ -42,12 +78,28 @@ using namespace std;
 //						1st thread charges commission from the bank's accounts every 3 seconds
 //						2nd thread prints the status of the bank to stdout
 //
-//	Members		:	m_accounts	- a container that holds the all of the accounts belong to the bank
-//					m_accs_lock	- a read-write lock that is attached to m_accounts container
+//	Members		:	m_versions	- the version manager of the bank. The balances of the accounts and of the bank are versioned by it, so a consistent
+//								  snapshot of the bank can be read without blocking the ATMs
+//					m_accounts	- a sharded directory that holds the all of the accounts belong to the bank.
+//								  Every shard of the directory is protected by its own read-write lock
+//					m_index		- an ordered index (a concurrent skiplist) of the accounts, sorted by the account number. Updated when an account
+//								  is opened or unlinked (while its shard is locked), read by the snapshots (while all of the shards are read-locked)
+//					m_epochs	- an epoch-based reclamation manager. Closed accounts are retired to it, and deleted once no ATM operation references them
 //					m_logger	- an instance of Logger class, a thread-safe logger. The bank writes every message about the operations to this file
-//					m_bank_balance - the balance of the bank. Raised by charging commission from the accounts
-//					m_finished_atms - a thread-safe counter that notifies the bank about how many ATM's have finished their job (= done all of their operations).
-//										when the counter reaches it's threashold, the bank stops its work
+//					m_wal		- the write-ahead log of the bank's mutations (NULL unless the options give its path). The bank is recovered from it
+//								  by the constructor, and an operation that mutates the bank returns (and is reported to the log) only once its
+//								  record is durable
+//					m_checkpoint_path - the path of the bank's checkpoint (empty - no checkpoints). The constructor restores the bank from it
+//					m_checkpoint_period - the period (in micro-seconds) of the checkpoints
+//					m_lock_free - whether the accounts are created in lock-free mode (see BankAccount)
+//					m_bank_balance - the balance of the bank. Raised by charging commission from the accounts (versioned, written by the commission thread only)
+//					m_num_commission_workers - the number of threads that charge the commissions of the shards in parallel (one per core. A single
+//											   worker charges them on the commission thread itself)
+//					m_seed - the seed of the commissions' rates (0 - seeded by the clock's time)
+//					m_atms_done - a latch that is counted down by every ATM that has finished its job (= done all of its operations).
+//								  when it opens, the bank stops its work at once
+//					m_metrics - the counters of the outcomes of the ATM operations, per operation type and per ATM (sharded by thread)
+//					t_reply - the reply a thread's operation sets on its way to the log, while the thread runs it for Serve
 //					
 //
 //	Methods		:	Withdraw 		: withdraw an amount of money from a certain account
@@ -56,19 +108,27 @@ using namespace std;
 //					RemoveAccount	: delete a certain account from the bank
 //					OpenAccount		: open a new account in the bank
 //					Transfer		: transfer money from one account to other account
+//					Snapshot		: take a consistent point-in-time snapshot of the accounts and the bank's balance
+//					Execute			: apply a set of debits and credits to several accounts atomically
+//					Metrics			: the counters of the outcomes of the ATM operations
+//					Serve			: run an ATM operation for a client of the bank's socket server, and return its outcome
 */
-class Bank {
+class Bank : public bank_service {
 public:
 	/********************************************
 	// function name: 	Bank::Bank
 	// Description	: 	Constructor.
-	//					Initializes the bank's balance to 0, no accounts, logger to "log.txt", and the atm counter to 0.
-	//					Also initializes to lock of the accounts' data structure.
-	// Parameters	: 	None
+	//					Initializes the bank's balance to 0, no accounts, logger to the options' log path ("log.txt" by default),
+	//					and the latch of the ATMs closed (until the number of ATMs is set).
+	//					Also initializes the locks of the accounts' directory shards.
+	//					In case the options give a checkpoint and a write-ahead log, the accounts and the bank's balance are restored from the
+	//					checkpoint, and recovered from the records of the log after it
+	// Parameters	: 	options - the options of the run (default: the default options). On a virtual clock, the commissions are charged
+	//							  by a single worker (there are no other threads to charge them in parallel)
 	// Returns		: 	None
-	// Exception	: 	None
+	// Exception	: 	std::ofstream::failure in case the log or the write-ahead log can't be opened, or the checkpoint is invalid
 	*/
-	Bank();
+	Bank(system_options const& options = system_options());
 	
 	/********************************************
 	// function name: 	Bank::~Bank
@@ -79,37 +139,70 @@ public:
 	*/
 	~Bank();
 
-public: //Main threads of the bank
+public: //Background jobs of the bank
 	/********************************************
-	// function name: 	Bank::ChargeCommissions
-	// Description	: 	Charges commissions (with an interest rate of 2%-4%) from the bank's accounts every 3 seconds 
-	//					Runs as an independant thread
+	// function name: 	Bank::ChargeCommissionPass
+	// Description	: 	A commission pass, run by Main every 3 seconds - draws an interest rate (2%-4%), charges it from all of the accounts
+	//					(the shards are split between the commission workers, a thread per core), adds the total to the bank's balance, and
+	//					reclaims the accounts that were closed since the last pass.
+	//					No lock is held over the whole directory, so ATM operations keep running during a pass
 	// Parameters	: 	None
-	// Returns		: 	None
+	// Returns		: 	int - the total commission charged in the pass
 	// Exception	: 	None
 	*/
-	void ChargeCommissions();
+	int ChargeCommissionPass();
 	
 	/********************************************
 	// function name: 	Bank::PrintBankStats
 	// Description	: 	Prints a snapshot of the banks' status (including stats of the accounts)
-	//					Exclusive access is acquired via WriteLock (not really changing the status of the bank, but a write lock is an exclusive lock)
-	//					Runs as an independant thread
+	//					The snapshot comes sorted from the ordered index, it is rendered without holding any lock and printed with a single write
+	//					Run by Main every half a second, and once more when the ATMs are done
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void PrintBankStats() const; //use WriteLock to acquire an exclusive lock the structure
+	void PrintBankStats() const;
+
+	/********************************************
+	// function name: 	Bank::Snapshot
+	// Description	: 	Takes a consistent point-in-time snapshot of the bank - the accounts that were open at the snapshot (in a range of
+	//					account numbers), their balances and the bank's balance. The shards are read-locked only while the accounts are
+	//					collected and no account is locked at all, so ATM operations keep running (and are not reflected in the snapshot)
+	// Parameters	: 	accounts - filled with the accounts at the snapshot, sorted by their account numbers
+	//					first - the lowest account number of the range (default: INT_MIN)
+	//					last - the highest account number of the range (default: INT_MAX)
+	// Returns		: 	int - the bank's balance at the snapshot
+	// Exception	: 	None
+	*/
+	int Snapshot(vector<account_snapshot>& accounts, int first = INT_MIN, int last = INT_MAX) const;
+
+	/********************************************
+	// function name: 	Bank::Checkpoint
+	// Description	: 	Takes a checkpoint of the bank - a snapshot of the accounts and of the bank's balance is written to the checkpoint file
+	//					(see CheckpointFile), then the records of the write-ahead log the checkpoint reflects are cut off the log.
+	//					The checkpoint is fuzzy with respect to the log - the LSN is read before the snapshot is taken, so every record up to it
+	//					is reflected, and the records after it that are reflected too are replayed again on restore (harmlessly, a record holds
+	//					the balances after its mutation). The ATMs keep running during a checkpoint.
+	//					Must not run at the same time as a commission pass (the bank's balance at the snapshot must reflect exactly the
+	//					commission records up to the LSN)
+	// Parameters	: 	None
+	// Returns		: 	bool - false in case the bank has no checkpoint path, or the checkpoint couldn't be written
+	// Exception	: 	std::bad_alloc
+	*/
+	bool Checkpoint();
 	
 	/********************************************
 	// function name: 	Bank::Main
-	// Description	: 	Spawns the two main threads of the bank (charging commissions & status printing). 
-	//					Waits for the two threads to end (created as joinable)
+	// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second, the commission passes every
+	//					3 seconds and the checkpoints every checkpoint period (if the bank has a checkpoint) - one at a time, so a checkpoint
+	//					never overlaps a commission pass. Returns the moment the last ATM is done (the jobs' thread sleeps on the latch of
+	//					the ATMs between the runs), after the log is flushed, the final status is printed and the last checkpoint is taken.
+	//					Runs as a thread of the system (or as a fiber of a virtual clock)
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void Main();
+	virtual void Main();
 
 public: //ATM supported methods of the bank
 	/********************************************
@@ -122,7 +215,7 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None
 	*/
-	bool RemoveAccount(int account_no, string password, int atm_id);
+	virtual bool RemoveAccount(int account_no, string const& password, int atm_id);
 	
 	/********************************************
 	// function name: 	Bank::OpenAccount
@@ -135,7 +228,7 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None (exits if std::bad_alloc occurs)
 	*/
-	bool OpenAccount(int account_no, string password, int balance, int atm_id);
+	virtual bool OpenAccount(int account_no, string const& password, int balance, int atm_id);
 	
 	/********************************************
 	// function name: 	Bank::Deposit
@@ -148,7 +241,7 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None 
 	*/
-	bool Deposit(int account_no, string password, int amount, int atm_id);
+	virtual bool Deposit(int account_no, string const& password, int amount, int atm_id);
 	
 	/********************************************
 	// function name: 	Bank::Withdraw
@@ -161,7 +254,7 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None
 	*/
-	bool Withdraw(int account_no, string password, int amount, int atm_id);
+	virtual bool Withdraw(int account_no, string const& password, int amount, int atm_id);
 	
 	/********************************************
 	// function name: 	Bank::Balance
@@ -173,11 +266,12 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None
 	*/
-	bool Balance(int account_no, string password, int atm_id);
+	virtual bool Balance(int account_no, string const& password, int atm_id);
 	
 	/********************************************
 	// function name: 	Bank::Transfer
 	// Description	: 	Transfer money from a certain account to another
+	//					The withdrawal and the deposit are a single transaction (Bank::Execute), so the money is never seen in neither or in both accounts
 	// Parameters	: 	account_no - the account number
 	//					password - the password of the account
 	//					account_target - the target account number
@@ -187,43 +281,247 @@ public: //ATM supported methods of the bank
 	//					Else return true
 	// Exception	: 	None
 	*/
-	bool Transfer(int account_no, string password, int account_target, int amount, int atm_id);
+	virtual bool Transfer(int account_no, string const& password, int account_target, int amount, int atm_id);
+
+	/********************************************
+	// function name: 	Bank::Serve
+	// Description	: 	Runs an ATM operation on behalf of a client of the bank's socket server (see BankServer), and returns its outcome -
+	//					the message the operation has reported, and the balances it tells. The operation is the one an ATM would run
+	//					(logged and counted the same way), its outcome is caught on the way to the log
+	// Parameters	: 	command - the operation (its password id is ignored)
+	//					password - the password of the account
+	//					client_id - the id of the client (logged in place of the ATM's id)
+	// Returns		: 	bank_reply - the outcome (m_message is NUM_BANK_MESSAGES for an unknown operation)
+	// Exception	: 	None
+	*/
+	bank_reply Serve(atm_command const& command, string const& password, int client_id);
+
+public: //transactions
+	/********************************************
+	// function name: 	Bank::Execute
+	// Description	: 	Executes a transaction - applies a set of debits and credits to several accounts atomically.
+	//					The accounts are locked in ascending order of their numbers (so two transactions never deadlock, and no retry is needed),
+	//					validated, and written with a single version (so a snapshot sees either all of the legs or none of them)
+	// Parameters	: 	legs - the legs of the transaction. Reordered by account number, and on commit every leg is filled with the new balance of its account
+	//					num_legs - the number of legs (up to TXN_MAX_LEGS, several legs may refer to the same account)
+	//					failed_account - if not NULL, filled with the number of the account that failed the transaction
+	//					is_sleep - tells the accounts' locks to sleep (once, before unlocking) or not (default: true)
+	// Returns		: 	TXN_COMMITTED on success, TXN_NO_ACCOUNT if an account doesn't exist (or has been closed), TXN_INSUFFICIENT_FUNDS if
+	//					an account's debits are not lower than its balance, TXN_TOO_MANY_LEGS. Nothing is applied unless committed
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	txn_status Execute(transaction_leg* legs, unsigned num_legs, int* failed_account = NULL, bool is_sleep = true);
+
+	/********************************************
+	// function name: 	Bank::WAL
+	// Description	: 	Returns the write-ahead log of the bank
+	// Parameters	: 	None
+	// Returns		: 	WriteAheadLog const* - the log, NULL if the bank has none
+	// Exception	: 	None
+	*/
+	WriteAheadLog const* WAL() const {
+		return m_wal;
+	}
+
+	/********************************************
+	// function name: 	Bank::Metrics
+	// Description	: 	Returns the operation counters of the bank (the outcomes of the ATM operations)
+	// Parameters	: 	None
+	// Returns		: 	bank_metrics const& - the counters
+	// Exception	: 	None
+	*/
+	bank_metrics const& Metrics() const {
+		return m_metrics;
+	}
 
 private:
 	/********************************************
-	// function name: 	Bank::__set_counter_top
+	// function name: 	Bank::__set_num_atms
 	// Description	: 	Sets the number of ATM accessing the bank (used by ATM_manager at allocation)
-	// Parameters	: 	top - number of atm's. This will be the counter's new top border.
+	// Parameters	: 	num_atms - number of atm's. This will be the count of the latch the ATMs signal
 	// Returns		: 	None
-	// Exception	: 	None
+	// Exception	: 	std::bad_alloc
 	*/
-	void __set_counter_top(int top){
-		m_finished_atms.SetTop(top);
+	virtual void __set_num_atms(unsigned num_atms){
+		m_metrics.SetNumAtms(num_atms);
+		m_atms_done.Reset(num_atms);
 	}
 
 	/********************************************
 	// function name: 	Bank::__signal_finished
 	// Description	: 	A message that is sent from a certain ATM to the bank,
-	//					raises the number of finished ATM's by increasing the bank's internal thread safe counter
+	//					counts down the bank's latch of the finished ATMs (the last one wakes up the bank's jobs)
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void __signal_finished(){
-		++m_finished_atms;
+	virtual void __signal_finished(){
+		m_atms_done.CountDown();
 		return;
 	}
 
+	/********************************************
+	// function name: 	Bank::__add_front_end
+	// Description	: 	Adds a front-end that runs operations besides the ATMs (a BankServer) to the latch - the bank's jobs run until it
+	//					signals it's finished, too. Must be called after the number of ATMs is set, before the ATMs run
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __add_front_end(){
+		m_atms_done.Add(1);
+	}
+
+	/********************************************
+	// function name: 	Bank::__commit
+	// Description	: 	Waits until the mutations the calling thread has logged are durable (see WriteAheadLog::Commit), if the bank has a
+	//					write-ahead log. Called after the accounts are unlocked, and before the operation is reported
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __commit() {
+		if (m_wal)
+			m_wal->Commit();
+	}
+
+	//replays the records of the write-ahead log into the bank (defined in Bank.cpp)
+	class wal_recovery;
+
+	/********************************************
+	// function name: 	Bank::__restore
+	// Description	: 	Restores the accounts from a checkpoint, while the bank is being constructed. The accounts are created from the mapped
+	//					records by a thread per core (see __restore_chunks), the shards are sized in advance, and the ordered index is built
+	//					in one pass once they are done (the records are sorted)
+	// Parameters	: 	checkpoint - an open checkpoint
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void __restore(CheckpointFile const& checkpoint);
+
+	//the arguments of a restoring thread
+	struct restore_worker {
+		Bank* m_bank;
+		CheckpointFile const* m_checkpoint;
+		BankAccount** m_accounts; 		//the restored accounts, in the order of the records
+		atomic<size_t>* m_next_chunk; 	//shared by the workers, every worker takes the next chunk of records
+	};
+
+	/********************************************
+	// function name: 	Bank::__restore_worker_main
+	// Description	: 	The routine of a restoring thread. Runs Bank::__restore_chunks
+	// Parameters	: 	worker - a void* to a restore_worker
+	// Returns		: 	void*
+	// Exception	: 	None
+	*/
+	static void* __restore_worker_main(void* worker);
+
+	/********************************************
+	// function name: 	Bank::__restore_chunks
+	// Description	: 	Creates the accounts of the checkpoint's records and inserts them to their shards, taking the next chunk of
+	//					RESTORE_CHUNK_SIZE records until none is left. A shard is locked (unique) only for an insertion
+	// Parameters	: 	worker - the checkpoint, where to store the accounts, and the next chunk
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void __restore_chunks(restore_worker const& worker);
+
+	/********************************************
+	// function name: 	Bank::__find_account
+	// Description	: 	Looks up an account in its shard (the shard is locked only for the lookup)
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	BankAccount* - the account, NULL if there is no such account
+	// Exception	: 	None
+	// Thread-safety:	The caller must be inside an epoch critical section (epoch_guard) as long as it uses the account
+	*/
+	BankAccount* __find_account(int account_no) const;
+
+	//the arguments and the result of a commission charging thread
+	struct commission_worker {
+		Bank* m_bank;
+		float m_interest;
+		atomic<unsigned>* m_next_shard; //shared by the workers of a pass, every worker takes the next uncharged shard
+		int m_total;
+	};
+
+	/********************************************
+	// function name: 	Bank::__commission_worker_main
+	// Description	: 	The routine of a commission charging thread. Runs Bank::__charge_shards
+	// Parameters	: 	worker - a void* to a commission_worker, the result is stored in it
+	// Returns		: 	void*
+	// Exception	: 	None
+	*/
+	static void* __commission_worker_main(void* worker);
+
+	/********************************************
+	// function name: 	Bank::__charge_shards
+	// Description	: 	Charges the commissions from the accounts of the shards, taking the next uncharged shard until none is left.
+	//					A shard is locked (shared) only while its accounts are collected, the accounts are charged one by one afterwards
+	// Parameters	: 	interest - the interest rate of the commission
+	//					next_shard - the next shard to be charged (shared by all the workers of the pass)
+	// Returns		: 	int - the total commission charged by this worker
+	// Exception	: 	None
+	*/
+	int __charge_shards(float interest, atomic<unsigned>& next_shard);
+
+	/********************************************
+	// function name: 	Bank::__log
+	// Description	: 	Formats a typed message on the stack and writes it to the log (no heap allocation, unless the message outgrows the buffer)
+	// Parameters	: 	message - the type of the message
+	//					args - the arguments of the message (integers or strings), in the order of its format
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	template <class... Args> void __log(bank_message message, Args const&... args) {
+		message_arg argv[] = {message_arg(args)...};
+		message_buffer msg(&m_logger); //a long message overflows to the logger, which still logs it whole
+		msg.Format(message, argv, sizeof...(Args));
+		m_logger.Write(msg.Data(), msg.Size()); //thread-safe logging
+	}
+
+	/********************************************
+	// function name: 	Bank::__report
+	// Description	: 	Reports the outcome of an ATM operation - counts it in the bank's metrics (by the outcome the message tells), and logs
+	//					the message
+	// Parameters	: 	op - the type of the operation
+	//					message - the type of the message
+	//					atm_id - the id of the atm that requested the operation (the first argument of every message of an operation)
+	//					args - the rest of the arguments of the message, in the order of its format
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	template <class... Args> void __report(metric_op op, bank_message message, int atm_id, Args const&... args) {
+		m_metrics.Count(op, metric_outcome_of(message), atm_id);
+		__log(message, atm_id, args...);
+		if (t_reply) { //the operation runs for Serve
+			message_arg argv[] = {message_arg(atm_id), message_arg(args)...};
+			t_reply->Set(message, argv, 1 + sizeof...(Args));
+		}
+	}
+
 private:
-	vector<BankAccount*> m_accounts;
-	mutable rwlock m_accs_lock;
+	static thread_local bank_reply* t_reply; //the reply of the operation the thread runs for Serve (NULL - none)
+
+	mutable version_manager m_versions;
+	AccountDirectory m_accounts;
+	AccountIndex m_index;
+	mutable epoch_manager m_epochs;
 
 	Logger m_logger;
-	int m_bank_balance;
-	thread_safe_counter m_finished_atms;
+	WriteAheadLog* m_wal;
+	string m_checkpoint_path;
+	uint64_t m_checkpoint_period;
+	bool m_lock_free;
+	versioned_int m_bank_balance;
+	unsigned m_num_commission_workers;
+	unsigned m_seed;
+	countdown_latch m_atms_done;
+	bank_metrics m_metrics;
 
 	friend class ATM_manager;
 	friend class ATM;
+	friend class BankServer;
 };
 
 
@@ -7,6 +7,7 @@
  *	An implementation of the BankAccount class
  */
 
+#include <math.h>
 #include "BankAccount.h"
 #include "defs.h"
 
@@ -17,11 +18,24 @@
 // Parameters	: 	account_no - the account number (int)
 //					password   - the password of the account (std::string)
 //					balance    - the balance of the account (int)
+//					versions   - the version manager the balance is versioned by (default: NULL - not versioned)
+//					wal		   - the write-ahead log the mutations are logged to (default: NULL - not logged). The opening itself is
+//								 logged by the bank
+//					lock_free  - whether the balance is updated lock-free (default: false. Ignored in case of a write-ahead log)
 // Returns		: 	None
 // Exception	: 	None
 */
-BankAccount::BankAccount(int account_no, string password ,int balance) : m_account_number(account_no), m_password(password) ,m_balance(balance), m_rwlock(ONE_SEC) {
-
+BankAccount::BankAccount(int account_no, string password ,int balance, version_manager* versions, WriteAheadLog* wal, bool lock_free) :
+																										m_account_number(account_no),
+																										m_password(password),
+																										m_versions(versions),
+																										m_wal(wal),
+																										m_balance(ACCOUNT_CLOSED, 0, ACCOUNT_CLOSED), //snapshots older than the opening don't see the account
+																										m_rwlock(ONE_SEC),
+																										m_lock_free(lock_free && !wal) {
+	static lock_site* const site = lock_site_get("account"); //NULL while the instrumentation is off
+	m_rwlock.SetSite(site);
+	__store_balance(balance);
 }
 
 /********************************************
@@ -30,21 +44,33 @@ BankAccount::BankAccount(int account_no, string password ,int balance) : m_accou
 //					Fails incase: amount > balance.
 // Parameters	: 	amount 	 - the amount to be withrawn from the account (int)
 //					is_sleep - tells the internal lock to sleep (or not)
-// Returns		: 	The account's new balance (after the operation), if succeeded. -1 if fails. 
+// Returns		: 	The account's new balance (after the operation), if succeeded. -1 if fails, ACCOUNT_CLOSED if the account is closed
 // Exception	: 	None
 // Thread-safety:	Yes
 */
 int BankAccount::Withdraw(int amount, bool is_sleep) {
+	int new_balance;
+	if (m_lock_free && __try_add(-amount, new_balance)) {
+		if (is_sleep) fiber_sleep(ONE_SEC); //the same pace as the locked path, without holding anything
+		return new_balance;
+	}
 
-	m_rwlock.WriteLock();
+	__lock();
 	//critical section
-	bool cond = amount < m_balance;
-	if(cond)
-		m_balance -= amount;
-	
-	int new_balance = m_balance;
+	new_balance = m_balance.Load();
+	if (new_balance == ACCOUNT_CLOSED) {
+		__unlock(is_sleep);
+		return ACCOUNT_CLOSED;
+	}
+
+	bool cond = amount < new_balance;
+	if(cond) {
+		new_balance -= amount;
+		__store_balance(new_balance);
+		__log_mutation(WAL_WITHDRAW, amount, new_balance);
+	}
 	//end of critical section
-	m_rwlock.WriteUnlock(is_sleep); //sleep for one second if told so
+	__unlock(is_sleep); //sleep for one second if told so
 
 	return cond ? new_balance : -1;
 }
@@ -54,18 +80,27 @@ int BankAccount::Withdraw(int amount, bool is_sleep) {
 // Description	: 	Deposit an amount of money to the account
 // Parameters	: 	amount 	 - the amount to be deposited the the account (int)
 //					is_sleep - tells the internal lock to sleep (or not)
-// Returns		: 	The account's new balance (after the operation).
+// Returns		: 	The account's new balance (after the operation). ACCOUNT_CLOSED if the account is closed
 // Exception	: 	None
 // Thread-safery:	Yes
 */
 int BankAccount::Deposit(int amount, bool is_sleep) {
+	int new_balance;
+	if (m_lock_free && __try_add(amount, new_balance)) {
+		if (is_sleep) fiber_sleep(ONE_SEC); //the same pace as the locked path, without holding anything
+		return new_balance;
+	}
 
-	m_rwlock.WriteLock();
+	__lock();
 	//critical section
-	m_balance += amount;
-	int new_balance = m_balance;
+	new_balance = m_balance.Load();
+	if (new_balance != ACCOUNT_CLOSED) {
+		new_balance += amount;
+		__store_balance(new_balance);
+		__log_mutation(WAL_DEPOSIT, amount, new_balance);
+	}
 	//end of critical section
-	m_rwlock.WriteUnlock(is_sleep);
+	__unlock(is_sleep);
 
 	return new_balance;
 }
@@ -75,15 +110,24 @@ int BankAccount::Deposit(int amount, bool is_sleep) {
 // function name: 	BankAccount::Balance
 // Description	: 	Returns the balance of the account
 // Parameters	: 	is_sleep - tells the internal lock to sleep (or not)
-// Returns		: 	The balance of the account (int)
+// Returns		: 	The balance of the account (int). ACCOUNT_CLOSED if the account is closed
 // Exception	: 	None
 // Thread-safery:	Yes
 */
 int BankAccount::Balance(bool is_sleep) const {
+	if (m_lock_free) {
+		//a single word - the lock is needed only while a locked operation holds it
+		uint64_t word = m_balance.Word();
+		if (!versioned_int::IsHeld(word)) {
+			if (is_sleep) fiber_sleep(ONE_SEC);
+			return versioned_int::Value(word);
+		}
+	}
+
 	int c;
 	m_rwlock.ReadLock();
 	//critical section
-	c = m_balance;
+	c = m_balance.Load();
 	//end of critical section
 
 	m_rwlock.ReadUnlock(is_sleep);
@@ -109,12 +153,165 @@ int BankAccount::AccountNumber() const{
 // function name: 	BankAccount::Password
 // Description	: 	Returns the account's password
 // Parameters	: 	None
-// Returns		: 	The account's password (std::string)
+// Returns		: 	A reference to the account's password (std::string), set once at construction - no copy is made
 // Exception	: 	None
 // Thread-safery:	Yes
 */
-string BankAccount::Password() const{
+string const& BankAccount::Password() const{
 	//password and account number are only set once (at initialization) and only read (not being written to) by threads, 
 	//so no lock is needed
 	return m_password;
 }
+
+/********************************************
+// function name: 	BankAccount::Close
+// Description	: 	Closes the account. Every operation on a closed account fails with ACCOUNT_CLOSED
+// Parameters	: 	is_sleep - tells the internal lock to sleep (or not)
+// Returns		: 	The balance of the account when it was closed. ACCOUNT_CLOSED if the account was already closed
+// Exception	: 	None
+// Thread-safery:	Yes
+*/
+int BankAccount::Close(bool is_sleep) {
+	__lock();
+	//critical section
+	int balance = m_balance.Load();
+	if (balance != ACCOUNT_CLOSED) {
+		__store_balance(ACCOUNT_CLOSED);
+		__log_mutation(WAL_CLOSE, balance, ACCOUNT_CLOSED);
+	}
+	//end of critical section
+	__unlock(is_sleep);
+
+	return balance;
+}
+
+/********************************************
+// function name: 	BankAccount::ChargeCommission
+// Description	: 	Charges a commission from the account - the balance is reduced by (balance * interest), rounded
+// Parameters	: 	interest - the interest rate of the commission
+//					is_sleep - tells the internal lock to sleep (or not)
+// Returns		: 	The charged commission. ACCOUNT_CLOSED if the account is closed
+// Exception	: 	None
+// Thread-safery:	Yes
+*/
+int BankAccount::ChargeCommission(float interest, bool is_sleep) {
+	__lock();
+	//critical section
+	int commission = ACCOUNT_CLOSED;
+	int balance = m_balance.Load();
+	if (balance != ACCOUNT_CLOSED) {
+		commission = static_cast<int>(roundf(balance * interest));
+		//same rule as Withdraw - the commission must be lower than the balance
+		if (commission < balance) {
+			__store_balance(balance - commission);
+			__log_mutation(WAL_COMMISSION, commission, balance - commission);
+		}
+		else
+			commission = 0;
+	}
+	//end of critical section
+	__unlock(is_sleep);
+
+	return commission;
+}
+
+/********************************************
+// function name: 	BankAccount::SnapshotBalance
+// Description	: 	Returns the balance of the account at a snapshot of its version manager, without locking the account
+// Parameters	: 	snapshot - the version of a snapshot that hasn't been released yet
+// Returns		: 	The balance of the account at the snapshot. ACCOUNT_CLOSED if the account was closed (or not opened yet) at the snapshot
+// Exception	: 	None
+// Thread-safery:	Yes (lock-free)
+*/
+int BankAccount::SnapshotBalance(uint32_t snapshot) const {
+	return m_balance.Load(snapshot);
+}
+
+/********************************************
+// function name: 	BankAccount::WriteLock
+// Description	: 	Acquires the unique lock of the account. Accounts must be locked in ascending order of their numbers
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankAccount::WriteLock() {
+	__lock();
+}
+
+/********************************************
+// function name: 	BankAccount::WriteUnlock
+// Description	: 	Releases the unique lock of the account
+// Parameters	: 	is_sleep - tells the internal lock to sleep (or not) before unlocking
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankAccount::WriteUnlock(bool is_sleep) {
+	__unlock(is_sleep);
+}
+
+/********************************************
+// function name: 	BankAccount::LockedBalance
+// Description	: 	Returns the balance of the account. The caller must hold the account's lock
+// Parameters	: 	None
+// Returns		: 	The balance of the account (int). ACCOUNT_CLOSED if the account is closed
+// Exception	: 	None
+*/
+int BankAccount::LockedBalance() const {
+	return m_balance.Load();
+}
+
+/********************************************
+// function name: 	BankAccount::LockedStore
+// Description	: 	Writes a new balance. The caller must hold the account's lock and a write version (version_write_guard),
+//					so all of the accounts of a transaction are written with the same version
+// Parameters	: 	balance - the new balance
+//					version - the version of the write
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankAccount::LockedStore(int balance, uint32_t version) {
+	m_balance.Store(balance, version);
+}
+
+/********************************************
+// function name: 	BankAccount::__store_balance
+// Description	: 	Writes a new balance, tagged with the version of the write. Must be called with the account's write lock held
+//					(the write window doesn't include the sleeping of the lock, so snapshots never wait for it)
+// Parameters	: 	balance - the new balance
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankAccount::__store_balance(int balance) {
+	version_write_guard write(m_versions);
+	m_balance.Store(balance, write.Version());
+}
+
+/********************************************
+// function name: 	BankAccount::__try_add
+// Description	: 	The lock-free path of Deposit / Withdraw - adds an amount to the balance with a CAS loop. Gives up in case the
+//					balance word is held by a locked operation, or its version isn't the version of the write (the first write after
+//					a snapshot keeps the previous version, which only a locked write may do)
+// Parameters	: 	amount - the amount to add (negative for a withdrawal, which fails unless the amount is lower than the balance)
+//					result - set to the new balance, -1 if the withdrawal failed, ACCOUNT_CLOSED if the account is closed
+// Returns		: 	bool - false in case the locked path must be taken
+// Exception	: 	None
+*/
+bool BankAccount::__try_add(int amount, int& result) {
+	version_write_guard write(m_versions);
+	uint64_t word = m_balance.Word();
+
+	//a failed CAS reloads the word - the loop ends once the update is done, or the locked path is needed
+	while (!versioned_int::IsHeld(word) && versioned_int::Version(word) == write.Version()) {
+		int balance = versioned_int::Value(word);
+		if (balance == ACCOUNT_CLOSED || (amount < 0 && -amount >= balance)) {
+			result = (balance == ACCOUNT_CLOSED) ? ACCOUNT_CLOSED : -1;
+			return true;
+		}
+
+		if (m_balance.CompareStore(word, balance + amount)) {
+			result = balance + amount;
+			return true;
+		}
+	}
+	return false;
+}
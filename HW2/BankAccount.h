@@ -13,6 +13,7 @@
 	Main methods: 	1. Withdraw - withdraw amount of money from an account
 					2. Deposit - deposit amount of money to an account
 					3. Balance - report the amount of money inside the account
+					4. Close - mark the account as closed, before it is removed from the bank
  */
 
 #ifndef BankAccount_H_
@@ -22,21 +23,40 @@
 #include <limits.h>
 #include <string>
 #include "rwlock.h"
+#include "snapshot.h"
+#include "WriteAheadLog.h"
 
 using namespace std;
 
+#define ACCOUNT_CLOSED INT_MIN //returned by the account's operations after the account has been closed
+
 /********************************************
 // 	class name	: 	BankAccount
 //	Members		:	m_account_number 	- the number of the account (unique). Integer
 //					m_password			- the password of the account. std::string.
-//					m_balance			- the amount of money at the bank account, currently. Integer.
+//					m_versions			- the version manager of the bank the account belongs to (may be NULL - the balance isn't read by snapshots)
+//					m_wal				- the write-ahead log of the bank the account belongs to (may be NULL - the mutations aren't logged).
+//										  Every mutation is appended to it before the account is unlocked
+//					m_balance			- the amount of money at the bank account, currently, and before the last snapshot (versioned_int).
+//										  ACCOUNT_CLOSED once the account has been closed. A closed account is unlinked from the bank, but threads that have found it
+//										  before it was unlinked may still hold it, so every operation checks the balance (under the lock)
 //					m_rwlock			- the thread-lock protecting the balance of the account. Sleeps for one second in case told so before unlocking
+//					m_lock_free			- whether Deposit / Withdraw / Balance update and read the balance word with atomic instructions (a CAS
+//										  loop), instead of locking the account. The lock is kept for the other operations (closure, commission,
+//										  transactions) - they hold the balance word while they hold the lock, so the lock-free updates wait
+//										  for them (see versioned_int::Hold). Off for an account with a write-ahead log (its records must be
+//										  appended in the order of the mutations, under the lock)
 //
 //	Methods		:	Withdraw : withdraw an amount of money from the account
 //					Deposit  : deposit an amount of money to the account
 //					Balance  : return the balance of the account
 //					AccountNumber : return the account number
 //					Password : return the password of the account
+//					Close	 : close the account
+//					ChargeCommission : charge a commission from the account
+//					SnapshotBalance : return the balance of the account at a snapshot
+//					WriteLock / WriteUnlock : lock the account for a multi-account transaction
+//					LockedBalance / LockedStore : read / write the balance while the account is locked
 */
 class BankAccount {
 public:
@@ -47,10 +67,15 @@ public:
 	// Parameters	: 	account_no - the account number (int)
 	//					password   - the password of the account (std::string)
 	//					balance    - the balance of the account (int)
+	//					versions   - the version manager the balance is versioned by (default: NULL - not versioned)
+	//					wal		   - the write-ahead log the mutations are logged to (default: NULL - not logged). The opening itself is
+	//								 logged by the bank
+	//					lock_free  - whether the balance is updated lock-free (default: false. Ignored in case of a write-ahead log)
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	BankAccount(int account_no, string password ,int balance);
+	BankAccount(int account_no, string password ,int balance, version_manager* versions = NULL, WriteAheadLog* wal = NULL,
+				bool lock_free = false);
 
 
 public://API
@@ -60,7 +85,7 @@ public://API
 	//					Fails incase amount > balance.
 	// Parameters	: 	amount 	 - the amount to be withrawn from the account (int)
 	//					is_sleep - tells the internal lock to sleep (or not)
-	// Returns		: 	The account's new balance (after the operation). 
+	// Returns		: 	The account's new balance (after the operation). -1 if fails, ACCOUNT_CLOSED if the account is closed
 	// Exception	: 	None
 	// Thread-safety:	Yes
 	*/
@@ -71,7 +96,7 @@ public://API
 	// Description	: 	Deposit an amount of money to the account
 	// Parameters	: 	amount 	 - the amount to be deposited the the account (int)
 	//					is_sleep - tells the internal lock to sleep (or not)
-	// Returns		: 	The account's new balance (after the operation).
+	// Returns		: 	The account's new balance (after the operation). ACCOUNT_CLOSED if the account is closed
 	// Exception	: 	None
 	// Thread-safery:	Yes
 	*/
@@ -81,7 +106,7 @@ public://API
 	// function name: 	BankAccount::Balance
 	// Description	: 	Returns the balance of the account
 	// Parameters	: 	is_sleep - tells the internal lock to sleep (or not)
-	// Returns		: 	The balance of the account (int)
+	// Returns		: 	The balance of the account (int). ACCOUNT_CLOSED if the account is closed
 	// Exception	: 	None
 	// Thread-safery:	Yes
 	*/
@@ -101,18 +126,141 @@ public://API
 	// function name: 	BankAccount::Password
 	// Description	: 	Returns the account's password
 	// Parameters	: 	None
-	// Returns		: 	The account's password (std::string)
+	// Returns		: 	A reference to the account's password (std::string), set once at construction - no copy is made
+	// Exception	: 	None
+	// Thread-safery:	Yes
+	*/
+	string const& Password() const;
+
+	/********************************************
+	// function name: 	BankAccount::Close
+	// Description	: 	Closes the account. Every operation on a closed account fails with ACCOUNT_CLOSED
+	// Parameters	: 	is_sleep - tells the internal lock to sleep (or not)
+	// Returns		: 	The balance of the account when it was closed. ACCOUNT_CLOSED if the account was already closed
 	// Exception	: 	None
 	// Thread-safery:	Yes
 	*/
-	string Password() const;
+	int Close(bool is_sleep = true);
+
+	/********************************************
+	// function name: 	BankAccount::ChargeCommission
+	// Description	: 	Charges a commission from the account - the balance is reduced by (balance * interest), rounded
+	// Parameters	: 	interest - the interest rate of the commission
+	//					is_sleep - tells the internal lock to sleep (or not)
+	// Returns		: 	The charged commission. ACCOUNT_CLOSED if the account is closed
+	// Exception	: 	None
+	// Thread-safery:	Yes
+	*/
+	int ChargeCommission(float interest, bool is_sleep = false);
+
+	/********************************************
+	// function name: 	BankAccount::SnapshotBalance
+	// Description	: 	Returns the balance of the account at a snapshot of its version manager, without locking the account
+	// Parameters	: 	snapshot - the version of a snapshot that hasn't been released yet
+	// Returns		: 	The balance of the account at the snapshot. ACCOUNT_CLOSED if the account was closed (or not opened yet) at the snapshot
+	// Exception	: 	None
+	// Thread-safery:	Yes (lock-free)
+	*/
+	int SnapshotBalance(uint32_t snapshot) const;
+
+public: //raw access, for transactions that span several accounts (see Bank::Execute)
+	/********************************************
+	// function name: 	BankAccount::WriteLock
+	// Description	: 	Acquires the unique lock of the account. Accounts must be locked in ascending order of their numbers
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void WriteLock();
+
+	/********************************************
+	// function name: 	BankAccount::WriteUnlock
+	// Description	: 	Releases the unique lock of the account
+	// Parameters	: 	is_sleep - tells the internal lock to sleep (or not) before unlocking
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void WriteUnlock(bool is_sleep = true);
+
+	/********************************************
+	// function name: 	BankAccount::LockedBalance
+	// Description	: 	Returns the balance of the account. The caller must hold the account's lock
+	// Parameters	: 	None
+	// Returns		: 	The balance of the account (int). ACCOUNT_CLOSED if the account is closed
+	// Exception	: 	None
+	*/
+	int LockedBalance() const;
+
+	/********************************************
+	// function name: 	BankAccount::LockedStore
+	// Description	: 	Writes a new balance. The caller must hold the account's lock and a write version (version_write_guard),
+	//					so all of the accounts of a transaction are written with the same version
+	// Parameters	: 	balance - the new balance
+	//					version - the version of the write
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void LockedStore(int balance, uint32_t version);
 
+private:
+	/********************************************
+	// function name: 	BankAccount::__store_balance
+	// Description	: 	Writes a new balance, tagged with the version of the write. Must be called with the account's write lock held
+	// Parameters	: 	balance - the new balance
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __store_balance(int balance);
+
+	/********************************************
+	// function name: 	BankAccount::__try_add
+	// Description	: 	The lock-free path of Deposit / Withdraw - adds an amount to the balance with a CAS loop. Gives up in case the
+	//					balance word is held by a locked operation, or its version isn't the version of the write (the first write after
+	//					a snapshot keeps the previous version, which only a locked write may do)
+	// Parameters	: 	amount - the amount to add (negative for a withdrawal, which fails unless the amount is lower than the balance)
+	//					result - set to the new balance, -1 if the withdrawal failed, ACCOUNT_CLOSED if the account is closed
+	// Returns		: 	bool - false in case the locked path must be taken
+	// Exception	: 	None
+	*/
+	bool __try_add(int amount, int& result);
+
+	//acquire / release the unique lock, and hold the balance word while it's held (in lock-free mode)
+	void __lock() {
+		m_rwlock.WriteLock();
+		if (m_lock_free)
+			m_balance.Hold();
+	}
+
+	void __unlock(bool is_sleep) {
+		if (m_lock_free)
+			m_balance.Release();
+		m_rwlock.WriteUnlock(is_sleep);
+	}
+
+	/********************************************
+	// function name: 	BankAccount::__log_mutation
+	// Description	: 	Appends a mutation of the account to the write-ahead log (if any). Must be called with the account's write lock held
+	// Parameters	: 	type - the type of the mutation
+	//					amount - the amount of the mutation
+	//					balance - the balance after the mutation
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __log_mutation(wal_record_type type, int amount, int balance) {
+		if (m_wal) {
+			wal_entry entry = {m_account_number, amount, balance};
+			m_wal->Append(type, &entry, 1);
+		}
+	}
 
 private:
 	int m_account_number;
 	string m_password;
-	int m_balance;
+	version_manager* m_versions;
+	WriteAheadLog* m_wal;
+	versioned_int m_balance;
 	mutable rwlock m_rwlock; //for it to be changed (locked/unlocked) in const methods (state is defined by balance)
+	bool m_lock_free;
 };
 
 
@@ -0,0 +1,525 @@
+/*
+ * BankServer.cpp
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ *
+ *	An implementation of the BankServer class
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fstream>
+#include <sstream>
+#include "BankServer.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28) //Linux 4.5, missing from older headers
+#endif
+
+static_assert(sizeof(wire_request) == 32 && sizeof(wire_response) == 16, "the wire structs must match the protocol");
+static_assert(SERVER_INPUT_SIZE % sizeof(wire_request) == 0 &&
+			  SERVER_OUTPUT_SIZE / sizeof(wire_response) == SERVER_INPUT_SIZE / sizeof(wire_request),
+			  "the output of a connection must hold the responses of a full input buffer");
+
+
+//******************************Addresses************************************
+
+//a parsed address of a server
+struct server_address {
+	struct sockaddr_storage m_addr;
+	socklen_t m_len;
+	string m_unix_path; //empty - a TCP address
+};
+
+//parses unix:<path> or tcp:<port> (of the loopback interface). Returns false in case the address is malformed
+static bool __parse_address(string const& address, server_address& parsed) {
+	memset(&parsed.m_addr, 0, sizeof(parsed.m_addr));
+	if (address.compare(0, 5, "unix:") == 0) {
+		struct sockaddr_un* addr = reinterpret_cast<struct sockaddr_un*>(&parsed.m_addr);
+		parsed.m_unix_path = address.substr(5);
+		if (parsed.m_unix_path.empty() || parsed.m_unix_path.size() >= sizeof(addr->sun_path))
+			return false;
+
+		addr->sun_family = AF_UNIX;
+		memcpy(addr->sun_path, parsed.m_unix_path.c_str(), parsed.m_unix_path.size() + 1);
+		parsed.m_len = sizeof(struct sockaddr_un);
+		return true;
+	}
+
+	if (address.compare(0, 4, "tcp:") == 0) {
+		struct sockaddr_in* addr = reinterpret_cast<struct sockaddr_in*>(&parsed.m_addr);
+		char* end;
+		unsigned long port = strtoul(address.c_str() + 4, &end, 10);
+		if (end == address.c_str() + 4 || *end != '\0' || port == 0 || port > 65535)
+			return false;
+
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons((uint16_t)port);
+		addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		parsed.m_len = sizeof(struct sockaddr_in);
+		return true;
+	}
+	return false;
+}
+
+//makes a socket non-blocking
+static bool __set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/********************************************
+// function name: 	server_connect
+// Description	: 	Connects to a server (blocking), and makes the socket non-blocking
+// Parameters	: 	address - the address of the server - unix:<path> or tcp:<port> (of the loopback interface)
+// Returns		: 	int - the socket, -1 in case of an error (errno tells it, EINVAL - a malformed address)
+// Exception	: 	None
+*/
+int server_connect(string const& address) {
+	server_address parsed;
+	if (!__parse_address(address, parsed)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = socket(parsed.m_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	int result;
+	do {
+		result = connect(fd, reinterpret_cast<struct sockaddr*>(&parsed.m_addr), parsed.m_len);
+	} while (result < 0 && errno == EINTR);
+
+	if (result < 0 || !__set_nonblocking(fd)) {
+		int error_code = errno;
+		close(fd);
+		errno = error_code;
+		return -1;
+	}
+
+	if (parsed.m_unix_path.empty()) {
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+/********************************************
+// function name: 	server_raise_fd_limit
+// Description	: 	Raises the limit of the open files of the process to its hard limit, for thousands of connections
+// Parameters	: 	None
+// Returns		: 	unsigned - the limit
+// Exception	: 	None
+*/
+unsigned server_raise_fd_limit() {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return 0;
+
+	if (limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+	return (unsigned)limit.rlim_cur;
+}
+
+
+//******************************BankServer************************************
+
+/********************************************
+// function name: 	BankServer::BankServer
+// Description	: 	Constructor.
+//					Listens on the options' address (an existing Unix domain socket file is replaced), creates the event loops, and
+//					adds the server to the front-ends the bank waits for (so it must be created after the bank's ATMs are set).
+//					The stopping signals must be blocked by then (BlockStopSignals), in all of the threads of the process
+// Parameters	: 	bank - the bank
+//					options - the options of the run (m_serve_address)
+// Returns		: 	None
+// Exception	: 	std::ofstream::failure in case the address is malformed, or the server can't listen on it
+*/
+BankServer::BankServer(Bank* bank, system_options const& options) :	m_bank(bank),
+																	m_address(options.m_serve_address),
+																	m_listen_fd(-1),
+																	m_stop_fd(-1),
+																	m_signal_fd(-1),
+																	m_next_client_id(SERVER_FIRST_CLIENT_ID) {
+	server_address parsed;
+	if (!__parse_address(m_address, parsed))
+		throw ofstream::failure("server address " + m_address + " is malformed (unix:<path> or tcp:<port>)");
+
+	server_raise_fd_limit();
+	m_listen_fd = socket(parsed.m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_listen_fd >= 0 && parsed.m_unix_path.empty()) {
+		int one = 1;
+		setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	else if (m_listen_fd >= 0)
+		unlink(parsed.m_unix_path.c_str()); //the socket file of a previous run
+
+	if (m_listen_fd < 0 || bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&parsed.m_addr), parsed.m_len) != 0 ||
+		listen(m_listen_fd, SERVER_BACKLOG) != 0) {
+		int error_code = errno;
+		if (m_listen_fd >= 0)
+			close(m_listen_fd);
+
+		stringstream error;
+		error << "server could not listen on " << m_address << ": " << strerror(error_code);
+		throw ofstream::failure(error.str());
+	}
+	m_unix_path = parsed.m_unix_path;
+
+	//the stopping event, and the stopping signals (blocked by BlockStopSignals)
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	m_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	//an event loop per core - every loop watches the listening socket (exclusively, so a connection wakes a single loop), and the
+	//stopping event (non-exclusively, so it wakes all of them). The first loop watches the signals too
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	m_loops.resize(cores > 0 ? cores : 1);
+	bool failed = m_stop_fd < 0 || m_signal_fd < 0;
+	for (unsigned i = 0; i < m_loops.size(); ++i) {
+		event_loop& loop = m_loops[i];
+		loop.m_server = this;
+		loop.m_handles_signals = (i == 0);
+		loop.m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (loop.m_epoll_fd < 0) {
+			failed = true;
+			continue;
+		}
+
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = &m_listen_fd;
+		failed = failed || epoll_ctl(loop.m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &event) != 0;
+		event.events = EPOLLIN;
+		event.data.ptr = &m_stop_fd;
+		failed = failed || epoll_ctl(loop.m_epoll_fd, EPOLL_CTL_ADD, m_stop_fd, &event) != 0;
+		if (loop.m_handles_signals) {
+			event.data.ptr = &m_signal_fd;
+			failed = failed || epoll_ctl(loop.m_epoll_fd, EPOLL_CTL_ADD, m_signal_fd, &event) != 0;
+		}
+	}
+
+	if (failed) {
+		int error_code = errno;
+		__release();
+		stringstream error;
+		error << "server could not create its event loops: " << strerror(error_code);
+		throw ofstream::failure(error.str());
+	}
+
+	m_bank->__add_front_end();
+}
+
+/********************************************
+// function name: 	BankServer::~BankServer
+// Description	: 	Destructor.
+//					Closes the connections and the sockets, and unlinks the Unix domain socket file
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+BankServer::~BankServer() {
+	__release();
+}
+
+/********************************************
+// function name: 	BankServer::BlockStopSignals
+// Description	: 	Blocks SIGINT and SIGTERM in the calling thread, so they are read by the server's signalfd. Must be called
+//					before the process creates its threads (they inherit the mask)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankServer::BlockStopSignals() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+/********************************************
+// function name: 	BankServer::Main
+// Description	: 	Runs the event loops (the first one on the calling thread) until the server is stopped, then tells the bank the
+//					server is finished
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankServer::Main() {
+	for (unsigned i = 1; i < m_loops.size(); ++i)
+		pthread_create(&m_loops[i].m_thread, NULL, __loop_main, &m_loops[i]);
+
+	__run_loop(m_loops[0]);
+	for (unsigned i = 1; i < m_loops.size(); ++i)
+		pthread_join(m_loops[i].m_thread, NULL);
+
+	m_bank->__signal_finished();
+}
+
+/********************************************
+// function name: 	BankServer::Stop
+// Description	: 	Stops the event loops (they finish the events at hand). Called when the process gets SIGINT or SIGTERM
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void BankServer::Stop() {
+	uint64_t one = 1;
+	ssize_t written = write(m_stop_fd, &one, sizeof(one));
+	(void)written; //the counter can't overflow - the event is never read
+}
+
+void* BankServer::__loop_main(void* loop) {
+	event_loop& self = *reinterpret_cast<event_loop*>(loop);
+	self.m_server->__run_loop(self);
+	return NULL;
+}
+
+/********************************************
+// function name: 	BankServer::__run_loop
+// Description	: 	Runs an event loop until the server is stopped - accepts connections, reads their requests, serves them and sends
+//					their responses
+// Parameters	: 	loop - the loop
+// Returns		: 	None
+// Exception	: 	None
+*/
+void BankServer::__run_loop(event_loop& loop) {
+	fiber_set_thread_delays(false); //the clients' operations run without the simulated delays, the ATMs keep theirs
+
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	bool stopped = false;
+	while (!stopped) {
+		int num_events = epoll_wait(loop.m_epoll_fd, events, SERVER_MAX_EVENTS, -1);
+		if (num_events < 0 && errno != EINTR)
+			break;
+
+		for (int i = 0; i < num_events; ++i) {
+			void* source = events[i].data.ptr;
+			if (source == &m_stop_fd) {
+				stopped = true;
+				continue;
+			}
+			if (source == &m_signal_fd) {
+				struct signalfd_siginfo info;
+				if (read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+					Stop();
+				continue;
+			}
+			if (source == &m_listen_fd) {
+				__accept(loop);
+				continue;
+			}
+
+			connection* conn = reinterpret_cast<connection*>(source);
+			bool alive;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				alive = false;
+			else if (conn->m_writing)
+				alive = __process(loop, *conn); //sends the rest of the output, and serves the requests that were held back
+			else
+				alive = __on_readable(loop, *conn);
+
+			if (!alive)
+				__close(loop, conn);
+		}
+	}
+}
+
+//accepts the pending connections of the listening socket
+void BankServer::__accept(event_loop& loop) {
+	while (true) {
+		int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return; //EAGAIN - no more pending connections (or out of descriptors - they are accepted when some are closed)
+		}
+
+		if (m_unix_path.empty()) {
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+
+		connection* conn = new (nothrow) connection;
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		conn->m_fd = fd;
+		conn->m_id = m_next_client_id++;
+		conn->m_index = loop.m_connections.size();
+		conn->m_writing = false;
+		conn->m_in_len = conn->m_out_len = 0;
+		conn->m_password.reserve(WIRE_PASSWORD_SIZE);
+
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+		if (epoll_ctl(loop.m_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			close(fd);
+			delete conn;
+			continue;
+		}
+		loop.m_connections.push_back(conn);
+	}
+}
+
+//reads the input of a connection and serves it. Returns false in case the connection is to be closed
+bool BankServer::__on_readable(event_loop& loop, connection& conn) {
+	ssize_t received = read(conn.m_fd, conn.m_in + conn.m_in_len, SERVER_INPUT_SIZE - conn.m_in_len);
+	if (received == 0)
+		return false; //the client has closed the connection
+	if (received < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	conn.m_in_len += received;
+	return __process(loop, conn);
+}
+
+/********************************************
+// function name: 	BankServer::__process
+// Description	: 	Serves the whole requests in the input of a connection, as long as their responses fit in its output, and sends
+//					the output. A connection whose output can't be sent at once is watched for writing instead of reading
+// Parameters	: 	loop - the loop of the connection
+//					conn - the connection
+// Returns		: 	bool - false in case the connection is to be closed (its socket has failed)
+// Exception	: 	None
+*/
+bool BankServer::__process(event_loop& loop, connection& conn) {
+	//serve the requests (a response is only written once the rest of the previous output is sent, so they stay in order)
+	size_t consumed = 0;
+	if (!conn.m_writing) {
+		while (conn.m_in_len - consumed >= sizeof(wire_request) && conn.m_out_len + sizeof(wire_response) <= SERVER_OUTPUT_SIZE) {
+			wire_request request;
+			wire_response response;
+			memcpy(&request, conn.m_in + consumed, sizeof(request));
+			__serve(conn, request, response);
+			memcpy(conn.m_out + conn.m_out_len, &response, sizeof(response));
+			conn.m_out_len += sizeof(response);
+			consumed += sizeof(request);
+		}
+
+		if (consumed) {
+			memmove(conn.m_in, conn.m_in + consumed, conn.m_in_len - consumed);
+			conn.m_in_len -= consumed;
+		}
+	}
+
+	//send the responses with a single write (the socket may take a part of them)
+	size_t sent = 0;
+	while (sent < conn.m_out_len) {
+		ssize_t written = send(conn.m_fd, conn.m_out + sent, conn.m_out_len - sent, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return false;
+		}
+		sent += written;
+	}
+	if (sent) {
+		memmove(conn.m_out, conn.m_out + sent, conn.m_out_len - sent);
+		conn.m_out_len -= sent;
+	}
+
+	//wait for the socket to drain before reading more (backpressure), and go back to reading once it has
+	bool writing = conn.m_out_len > 0;
+	if (writing != conn.m_writing) {
+		struct epoll_event event;
+		event.events = writing ? EPOLLOUT : EPOLLIN;
+		event.data.ptr = &conn;
+		if (epoll_ctl(loop.m_epoll_fd, EPOLL_CTL_MOD, conn.m_fd, &event) != 0)
+			return false;
+		conn.m_writing = writing;
+
+		//the requests that were held back while the output was full
+		if (!writing && conn.m_in_len >= sizeof(wire_request))
+			return __process(loop, conn);
+	}
+	return true;
+}
+
+//runs a request against the bank, and fills its response
+void BankServer::__serve(connection& conn, wire_request const& request, wire_response& response) {
+	response.m_tag = request.m_tag;
+	response.m_reserved = 0;
+	response.m_balance = response.m_target_balance = 0;
+	if (request.m_op >= ATM_OP_UNKNOWN || request.m_password_len > WIRE_PASSWORD_SIZE) {
+		response.m_status = WIRE_BAD_REQUEST;
+		response.m_message = NUM_BANK_MESSAGES;
+		return;
+	}
+
+	atm_command command;
+	command.m_op = request.m_op;
+	command.m_account = request.m_account;
+	command.m_amount = request.m_amount;
+	command.m_target = request.m_target;
+	command.m_password = 0;
+	conn.m_password.assign(request.m_password, request.m_password_len);
+
+	bank_reply reply = m_bank->Serve(command, conn.m_password, conn.m_id);
+	response.m_status = metric_outcome_of(reply.m_message) == OUTCOME_OK ? WIRE_OK : WIRE_FAILED;
+	response.m_message = reply.m_message;
+	response.m_balance = reply.m_balance;
+	response.m_target_balance = reply.m_target_balance;
+}
+
+//closes a connection, and removes it from its loop (the last connection of the list takes its place)
+void BankServer::__close(event_loop& loop, connection* conn) {
+	close(conn->m_fd); //removes it from the epoll instance too
+	connection* last = loop.m_connections.back();
+	loop.m_connections[conn->m_index] = last;
+	last->m_index = conn->m_index;
+	loop.m_connections.pop_back();
+	delete conn;
+}
+
+//closes the connections, the loops and the sockets (by the destructor, or by a constructor that has failed)
+void BankServer::__release() {
+	for (unsigned i = 0; i < m_loops.size(); ++i) {
+		event_loop& loop = m_loops[i];
+		for (unsigned j = 0; j < loop.m_connections.size(); ++j) {
+			close(loop.m_connections[j]->m_fd);
+			delete loop.m_connections[j];
+		}
+		loop.m_connections.clear();
+
+		if (loop.m_epoll_fd >= 0)
+			close(loop.m_epoll_fd);
+		loop.m_epoll_fd = -1;
+	}
+
+	if (m_listen_fd >= 0) 	close(m_listen_fd);
+	if (m_stop_fd >= 0) 	close(m_stop_fd);
+	if (m_signal_fd >= 0) 	close(m_signal_fd);
+	m_listen_fd = m_stop_fd = m_signal_fd = -1;
+
+	if (!m_unix_path.empty())
+		unlink(m_unix_path.c_str());
+	m_unix_path.clear();
+}
@@ -0,0 +1,252 @@
+/*
+ * BankServer.h
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : BankServer
+	Description : A socket front-end of the bank - clients send it the operations of an ATM over a local socket (a Unix domain socket,
+					or TCP on the loopback interface), and get the outcome of every operation back.
+					The protocol is binary and fixed-size: a request is a wire_request (32 bytes), and the server answers every request
+					with a wire_response (16 bytes) that echoes the request's tag. The fields are in the byte order of the host (the
+					server is local only). A client may pipeline its requests - send many of them without waiting for their responses -
+					and the responses come back in the order of the requests.
+					The server runs an event loop per core, every loop waits on its own epoll instance for the listening socket (which
+					wakes a single loop per connection - EPOLLEXCLUSIVE) and for the sockets of the connections it has accepted. The
+					sockets are non-blocking. A loop reads whatever a connection has sent, runs all of the whole requests in it, and
+					sends their responses with a single write - so a pipelined batch costs a read and a write, not a pair per request.
+					A connection whose responses the client doesn't read stops being read (backpressure), until its responses are sent.
+					The operations run on the loops themselves - they are the operations of an ATM (Bank::Serve), logged to the bank's
+					log with the id of the connection in place of the ATM's id. The simulated delays are off for the loops' threads only,
+					so the ATMs of the same run keep their pace.
+					The server runs until the process gets SIGINT or SIGTERM, and the bank waits for it as it waits for its ATMs.
+	Main methods: 	1. BankServer::BankServer - listens on the address
+					2. Main - runs the event loops, until the server is stopped
+					3. Stop - stops the event loops
+					4. server_connect - connects a client to an address of a server
+ */
+
+#ifndef BANKSERVER_H_
+#define BANKSERVER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "Bank.h"
+#include "Options.h"
+#include "defs.h"
+
+using namespace std;
+
+#define WIRE_PASSWORD_SIZE 12 					//the longest password of a request
+#define SERVER_INPUT_SIZE 4096 					//the input buffer of a connection - the requests of a read (a multiple of a request)
+#define SERVER_OUTPUT_SIZE (SERVER_INPUT_SIZE / 2) 	//the output buffer of a connection - the responses of a full input buffer
+#define SERVER_MAX_EVENTS 256 					//the events a loop handles per wait
+#define SERVER_BACKLOG 4096 					//the backlog of the listening socket (capped by the kernel's somaxconn)
+#define SERVER_FIRST_CLIENT_ID 100000 			//the id of the first connection (the ids of the ATMs are below it)
+
+//a request - an ATM operation (see atm_command)
+struct wire_request {
+	uint32_t m_tag;			//any value of the client's, echoed by the response
+	uint8_t m_op;			//atm_opcode
+	uint8_t m_password_len;	//up to WIRE_PASSWORD_SIZE
+	uint16_t m_reserved;
+	int32_t m_account;
+	int32_t m_amount;		//the amount (or the initial balance of an opened account)
+	int32_t m_target;		//the target account of a transfer
+	char m_password[WIRE_PASSWORD_SIZE]; //not null terminated
+};
+
+//the status of a response
+typedef enum {
+	WIRE_OK,			//the operation has succeeded
+	WIRE_FAILED,		//the operation has failed - the message tells why
+	WIRE_BAD_REQUEST	//the request is malformed (an unknown operation, or a password that is too long)
+} wire_status;
+
+//a response - the outcome of a request
+struct wire_response {
+	uint32_t m_tag;				//the tag of the request
+	uint8_t m_status;			//wire_status
+	uint8_t m_message;			//the bank_message the operation has reported (NUM_BANK_MESSAGES for a bad request)
+	uint16_t m_reserved;
+	int32_t m_balance;			//the balance of the account after the operation (0 - the message tells none)
+	int32_t m_target_balance;	//the balance of the target account, after a transfer
+};
+
+
+/********************************************
+// function name: 	server_connect
+// Description	: 	Connects to a server (blocking), and makes the socket non-blocking
+// Parameters	: 	address - the address of the server - unix:<path> or tcp:<port> (of the loopback interface)
+// Returns		: 	int - the socket, -1 in case of an error (errno tells it, EINVAL - a malformed address)
+// Exception	: 	None
+*/
+int server_connect(string const& address);
+
+/********************************************
+// function name: 	server_raise_fd_limit
+// Description	: 	Raises the limit of the open files of the process to its hard limit, for thousands of connections
+// Parameters	: 	None
+// Returns		: 	unsigned - the limit
+// Exception	: 	None
+*/
+unsigned server_raise_fd_limit();
+
+
+/********************************************
+// 	class name	: 	BankServer
+// 	Description	: 	The socket front-end of a Bank. The bank counts the server as one more front-end it waits for - the bank's jobs run
+//					until the server is stopped, and the ATMs of the command line (if any) are done
+//
+//	Members		:	m_bank - the bank the requests run against
+//					m_address - the address the server listens on
+//					m_unix_path - the path of the Unix domain socket (empty - TCP), unlinked by the destructor
+//					m_listen_fd - the listening socket
+//					m_stop_fd - an eventfd that is signaled to stop the loops (never read, so it wakes all of them)
+//					m_signal_fd - a signalfd of SIGINT and SIGTERM, watched by the first loop
+//					m_loops - the event loops
+//					m_next_client_id - the id of the next connection
+//
+//	Methods		:	BlockStopSignals - blocks the signals that stop the server, in the calling thread (and the threads it creates)
+//					Main - runs the event loops, until the server is stopped
+//					Stop - stops the event loops
+*/
+class BankServer {
+public:
+	/********************************************
+	// function name: 	BankServer::BankServer
+	// Description	: 	Constructor.
+	//					Listens on the options' address (an existing Unix domain socket file is replaced), creates the event loops, and
+	//					adds the server to the front-ends the bank waits for (so it must be created after the bank's ATMs are set).
+	//					The stopping signals must be blocked by then (BlockStopSignals), in all of the threads of the process
+	// Parameters	: 	bank - the bank
+	//					options - the options of the run (m_serve_address)
+	// Returns		: 	None
+	// Exception	: 	std::ofstream::failure in case the address is malformed, or the server can't listen on it
+	*/
+	BankServer(Bank* bank, system_options const& options);
+
+	/********************************************
+	// function name: 	BankServer::~BankServer
+	// Description	: 	Destructor.
+	//					Closes the connections and the sockets, and unlinks the Unix domain socket file
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~BankServer();
+
+public: //API
+	/********************************************
+	// function name: 	BankServer::BlockStopSignals
+	// Description	: 	Blocks SIGINT and SIGTERM in the calling thread, so they are read by the server's signalfd. Must be called
+	//					before the process creates its threads (they inherit the mask)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	static void BlockStopSignals();
+
+	/********************************************
+	// function name: 	BankServer::Main
+	// Description	: 	Runs the event loops (the first one on the calling thread) until the server is stopped, then tells the bank the
+	//					server is finished
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Main();
+
+	/********************************************
+	// function name: 	BankServer::Stop
+	// Description	: 	Stops the event loops (they finish the events at hand). Called when the process gets SIGINT or SIGTERM
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void Stop();
+
+private:
+	//a connection of a client
+	struct connection {
+		int m_fd;
+		int m_id;				//logged in place of the ATM's id
+		size_t m_index;			//the position of the connection in the list of its loop
+		bool m_writing;			//whether the loop waits for the socket to be writable (the connection isn't read meanwhile)
+		size_t m_in_len;		//the bytes in m_in (a partial request may be left at its end)
+		size_t m_out_len;		//the bytes in m_out that weren't sent yet
+		string m_password;		//the password of the request at hand (reused, so it isn't allocated per request)
+		char m_in[SERVER_INPUT_SIZE];
+		char m_out[SERVER_OUTPUT_SIZE];
+	};
+
+	//an event loop (a cache line of its own)
+	struct alignas(CACHE_LINE_SIZE) event_loop {
+		BankServer* m_server;
+		int m_epoll_fd;
+		bool m_handles_signals;
+		pthread_t m_thread;
+		vector<connection*> m_connections;
+	};
+
+	static void* __loop_main(void* loop);
+
+	/********************************************
+	// function name: 	BankServer::__run_loop
+	// Description	: 	Runs an event loop until the server is stopped - accepts connections, reads their requests, serves them and sends
+	//					their responses
+	// Parameters	: 	loop - the loop
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __run_loop(event_loop& loop);
+
+	//accepts the pending connections of the listening socket
+	void __accept(event_loop& loop);
+
+	//reads the input of a connection and serves it. Returns false in case the connection is to be closed
+	bool __on_readable(event_loop& loop, connection& conn);
+
+	/********************************************
+	// function name: 	BankServer::__process
+	// Description	: 	Serves the whole requests in the input of a connection, as long as their responses fit in its output, and sends
+	//					the output. A connection whose output can't be sent at once is watched for writing instead of reading
+	// Parameters	: 	loop - the loop of the connection
+	//					conn - the connection
+	// Returns		: 	bool - false in case the connection is to be closed (its socket has failed)
+	// Exception	: 	None
+	*/
+	bool __process(event_loop& loop, connection& conn);
+
+	//runs a request against the bank, and fills its response
+	void __serve(connection& conn, wire_request const& request, wire_response& response);
+
+	//closes a connection, and removes it from its loop
+	void __close(event_loop& loop, connection* conn);
+
+	//closes the connections, the loops and the sockets
+	void __release();
+
+private: //do not allow the user to copy the object
+	BankServer(BankServer const&);
+	BankServer& operator=(BankServer const&);
+
+private:
+	Bank* m_bank;
+	string m_address;
+	string m_unix_path;
+	int m_listen_fd;
+	int m_stop_fd;
+	int m_signal_fd;
+	vector<event_loop> m_loops;
+	atomic<int> m_next_client_id;
+};
+
+
+#endif /* BANKSERVER_H_ */
@@ -0,0 +1,81 @@
+/*
+ * BankService.h
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : BankService
+	Description : The interface of a bank, as the ATMs and the system see it - the operations an ATM sends to the bank, the bank's
+					background jobs, and the bookkeeping of the ATMs that the bank waits for.
+					Implemented by Bank (the accounts live in the memory of the process) and by SharedBank (the accounts live in a
+					shared memory segment, and the ATMs may run in other processes), so the same ATMs run against either of them.
+	Main methods: 	1. Main - runs the bank's background jobs, until the ATMs are done
+					2. OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+ */
+
+#ifndef BANKSERVICE_H_
+#define BANKSERVICE_H_
+
+#include <string>
+
+using namespace std;
+
+
+/********************************************
+// 	class name	: 	bank_service
+// 	Description	: 	The interface of a bank. Every operation of an ATM reports its outcome to the bank's log, and returns whether it
+//					has succeeded
+//
+//	Methods		:	Main - runs the background jobs of the bank, until all of the ATMs are done
+//					OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+//					__set_num_atms / __signal_finished - the number of ATMs the bank waits for, and an ATM that is done
+*/
+class bank_service {
+public:
+	virtual ~bank_service() {}
+
+	/********************************************
+	// function name: 	bank_service::Main
+	// Description	: 	Runs the background jobs of the bank, until all of the ATMs are done
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual void Main() = 0;
+
+public: //ATM supported methods of the bank
+	virtual bool OpenAccount(int account_no, string const& password, int balance, int atm_id) = 0;
+	virtual bool RemoveAccount(int account_no, string const& password, int atm_id) = 0;
+	virtual bool Deposit(int account_no, string const& password, int amount, int atm_id) = 0;
+	virtual bool Withdraw(int account_no, string const& password, int amount, int atm_id) = 0;
+	virtual bool Balance(int account_no, string const& password, int atm_id) = 0;
+	virtual bool Transfer(int account_no, string const& password, int account_target, int amount, int atm_id) = 0;
+
+protected:
+	/********************************************
+	// function name: 	bank_service::__set_num_atms
+	// Description	: 	Sets the number of ATMs the bank waits for (used by ATM_manager at allocation)
+	// Parameters	: 	num_atms - number of atm's
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	virtual void __set_num_atms(unsigned num_atms) = 0;
+
+	/********************************************
+	// function name: 	bank_service::__signal_finished
+	// Description	: 	A message that is sent to the bank by an ATM that has finished its job (or on its behalf, by the ATM_manager
+	//					that has reaped the process of the ATM)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual void __signal_finished() = 0;
+
+	friend class ATM_manager;
+	friend class ATM;
+};
+
+
+#endif /* BANKSERVICE_H_ */
@@ -0,0 +1,194 @@
+/*
+ * Checkpoint.cpp
+ *
+ *  Created on: Jun 19, 2017
+ *      Author: dror
+ *
+ *	An implementation of the CheckpointFile class, and of the checkpoint file format:
+ *		the header (checkpoint_header), the account records (checkpoint_account) and the password pool, padded to 8 bytes
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include "Checkpoint.h"
+
+#define CHECKPOINT_MAGIC "BANKCKP" 		//the first bytes of a checkpoint file (with the terminating NUL)
+#define CHECKPOINT_VERSION 1 			//the version of the file format
+#define CHECKPOINT_ALIGNMENT 8
+#define CHECKPOINT_TEMP_SUFFIX ".tmp" 	//the suffix of the file being written, until it replaces the checkpoint
+
+struct checkpoint_header {
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_header_size;
+	uint64_t m_lsn;
+	uint64_t m_num_accounts;
+	int64_t m_bank_balance;
+	uint64_t m_passwords_size; 	//padded
+	uint64_t m_checksum; 		//of the accounts and the passwords
+};
+
+//the checksum of the body of a checkpoint (a multiply-xor hash over 8-byte words - the body is padded to a multiple of 8)
+static uint64_t checkpoint_checksum(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	uint64_t const* words = (uint64_t const*)data;
+	for (size_t i = 0; i < size / sizeof(uint64_t); ++i) {
+		hash = (hash ^ words[i]) * 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+
+CheckpointFile::CheckpointFile() : m_data(NULL), m_size(0), m_accounts(NULL), m_passwords(NULL) {
+}
+
+CheckpointFile::~CheckpointFile() {
+	__close();
+}
+
+/********************************************
+// function name: 	CheckpointFile::Write
+// Description	: 	Writes a checkpoint - the file is built in a mapping of a temporary file, synced, and renamed over the path
+// Parameters	: 	path - the path of the checkpoint
+//					accounts - the accounts, sorted by their account numbers (as returned by Bank::Snapshot)
+//					bank_balance - the bank's balance
+//					lsn - the LSN of the last record of the write-ahead log the checkpoint reflects (0 - no log)
+// Returns		: 	bool - false in case the checkpoint couldn't be written (the previous checkpoint is left as is)
+// Exception	: 	None
+*/
+bool CheckpointFile::Write(string const& path, vector<account_snapshot> const& accounts, int bank_balance, uint64_t lsn) {
+	size_t passwords_size = 0;
+	for (size_t i = 0; i < accounts.size(); ++i)
+		passwords_size += accounts[i].m_password.size();
+	passwords_size = (passwords_size + CHECKPOINT_ALIGNMENT - 1) & ~(size_t)(CHECKPOINT_ALIGNMENT - 1);
+
+	size_t accounts_size = accounts.size() * sizeof(checkpoint_account);
+	size_t size = sizeof(checkpoint_header) + accounts_size + passwords_size;
+
+	string temp_path = path + CHECKPOINT_TEMP_SUFFIX;
+	int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	char* data = NULL;
+	if (ftruncate(fd, size) == 0) {
+		data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+	}
+	if (!data) {
+		close(fd);
+		unlink(temp_path.c_str());
+		return false;
+	}
+
+	//the body - the records and the pool (the file is zero-filled, so the padding is zeroed)
+	checkpoint_account* records = (checkpoint_account*)(data + sizeof(checkpoint_header));
+	char* passwords = data + sizeof(checkpoint_header) + accounts_size;
+	uint32_t offset = 0;
+	for (size_t i = 0; i < accounts.size(); ++i) {
+		string const& password = accounts[i].m_password;
+		checkpoint_account record = {accounts[i].m_account_number, accounts[i].m_balance, offset, (uint32_t)password.size()};
+		records[i] = record;
+		memcpy(passwords + offset, password.data(), password.size());
+		offset += password.size();
+	}
+
+	checkpoint_header& header = *(checkpoint_header*)data;
+	memcpy(header.m_magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.m_version = CHECKPOINT_VERSION;
+	header.m_header_size = sizeof(checkpoint_header);
+	header.m_lsn = lsn;
+	header.m_num_accounts = accounts.size();
+	header.m_bank_balance = bank_balance;
+	header.m_passwords_size = passwords_size;
+	header.m_checksum = checkpoint_checksum(data + sizeof(checkpoint_header), accounts_size + passwords_size);
+
+	bool written = msync(data, size, MS_SYNC) == 0;
+	munmap(data, size);
+	written = written && fsync(fd) == 0;
+	close(fd);
+
+	if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+		unlink(temp_path.c_str());
+		return false;
+	}
+
+	//the rename is durable once the directory is synced
+	string directory = path.find('/') == string::npos ? "." : path.substr(0, path.rfind('/') + 1);
+	int dir_fd = open(directory.c_str(), O_RDONLY);
+	if (dir_fd >= 0) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+	return true;
+}
+
+/********************************************
+// function name: 	CheckpointFile::Open
+// Description	: 	Maps a checkpoint file, and validates its header and its checksum
+// Parameters	: 	path - the path of the checkpoint
+// Returns		: 	bool - false in case there is no such file
+// Exception	: 	std::ofstream::failure in case the file is not a valid checkpoint of this version
+*/
+bool CheckpointFile::Open(string const& path) {
+	__close();
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(checkpoint_header)) {
+		m_size = st.st_size;
+		m_data = (const char*)mmap(NULL, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if (m_data == MAP_FAILED)
+			m_data = NULL;
+	}
+	close(fd); //the mapping stays valid
+
+	checkpoint_header const* header = (checkpoint_header const*)m_data;
+	bool valid = header && memcmp(header->m_magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+				 header->m_version == CHECKPOINT_VERSION && header->m_header_size == sizeof(checkpoint_header) &&
+				 header->m_num_accounts <= (m_size - sizeof(checkpoint_header)) / sizeof(checkpoint_account) &&
+				 m_size == sizeof(checkpoint_header) + header->m_num_accounts * sizeof(checkpoint_account) + header->m_passwords_size &&
+				 header->m_checksum == checkpoint_checksum(m_data + sizeof(checkpoint_header), m_size - sizeof(checkpoint_header));
+	if (!valid) {
+		__close();
+		stringstream error;
+		error << path << " is not a valid checkpoint of version " << CHECKPOINT_VERSION << "!" << endl;
+		throw ofstream::failure(error.str());
+	}
+
+	m_accounts = (checkpoint_account const*)(m_data + sizeof(checkpoint_header));
+	m_passwords = (const char*)(m_accounts + header->m_num_accounts);
+	return true;
+}
+
+uint64_t CheckpointFile::NumAccounts() const {
+	return m_data ? ((checkpoint_header const*)m_data)->m_num_accounts : 0;
+}
+
+int CheckpointFile::BankBalance() const {
+	return m_data ? (int)((checkpoint_header const*)m_data)->m_bank_balance : 0;
+}
+
+uint64_t CheckpointFile::Lsn() const {
+	return m_data ? ((checkpoint_header const*)m_data)->m_lsn : 0;
+}
+
+//unmaps the file
+void CheckpointFile::__close() {
+	if (m_data)
+		munmap((void*)m_data, m_size);
+	m_data = NULL;
+	m_size = 0;
+	m_accounts = NULL;
+	m_passwords = NULL;
+}
@@ -0,0 +1,108 @@
+/*
+ * Checkpoint.h
+ *
+ *  Created on: Jun 19, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : Checkpoint
+	Description : A checkpoint of the bank - the open accounts (number, balance and password) and the bank's balance, as of a
+					consistent snapshot, in a versioned binary file that is read by mapping it to memory.
+					The file is a fixed header, an array of fixed-size account records sorted by account number, and a pool of the
+					accounts' passwords. A restore reads the records in place from the mapping (nothing is parsed or copied on the way),
+					and the sorted order lets the bank's ordered index be built in a single pass.
+					A checkpoint is written to a temporary file which replaces the previous checkpoint atomically (rename), so a crash
+					during a checkpoint leaves the previous one intact. The header holds the LSN of the write-ahead log the checkpoint
+					reflects - a restore replays only the records after it.
+	Main methods: 	1. CheckpointFile::Write - writes a checkpoint
+					2. CheckpointFile::Open - maps a checkpoint, and validates it
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Bank.h"
+
+using namespace std;
+
+//an account in the checkpoint file
+struct checkpoint_account {
+	int32_t m_account_no;
+	int32_t m_balance;
+	uint32_t m_password_offset; //the offset of the password in the pool
+	uint32_t m_password_len;
+};
+
+
+/********************************************
+// 	class name	: 	CheckpointFile
+// 	Description	: 	A read-only mapping of a checkpoint file (and the writer of the files)
+//
+//	Members		:	m_data / m_size - the mapping of the file (NULL while no file is open)
+//					m_accounts - the account records, in the mapping
+//					m_passwords - the password pool, in the mapping
+//
+//	Methods		:	Write - writes a checkpoint file
+//					Open - maps a checkpoint file
+//					NumAccounts / Account / Password - the accounts of the checkpoint
+//					BankBalance / Lsn - the bank's balance, and the LSN of the write-ahead log the checkpoint reflects
+*/
+class CheckpointFile {
+public:
+	CheckpointFile();
+	~CheckpointFile();
+
+public: //API
+	/********************************************
+	// function name: 	CheckpointFile::Write
+	// Description	: 	Writes a checkpoint - the file is built in a mapping of a temporary file, synced, and renamed over the path
+	// Parameters	: 	path - the path of the checkpoint
+	//					accounts - the accounts, sorted by their account numbers (as returned by Bank::Snapshot)
+	//					bank_balance - the bank's balance
+	//					lsn - the LSN of the last record of the write-ahead log the checkpoint reflects (0 - no log)
+	// Returns		: 	bool - false in case the checkpoint couldn't be written (the previous checkpoint is left as is)
+	// Exception	: 	None
+	*/
+	static bool Write(string const& path, vector<account_snapshot> const& accounts, int bank_balance, uint64_t lsn);
+
+	/********************************************
+	// function name: 	CheckpointFile::Open
+	// Description	: 	Maps a checkpoint file, and validates its header and its checksum
+	// Parameters	: 	path - the path of the checkpoint
+	// Returns		: 	bool - false in case there is no such file
+	// Exception	: 	std::ofstream::failure in case the file is not a valid checkpoint of this version
+	*/
+	bool Open(string const& path);
+
+	uint64_t NumAccounts() const;
+	int BankBalance() const;
+	uint64_t Lsn() const;
+
+	checkpoint_account const& Account(uint64_t i) const {
+		return m_accounts[i];
+	}
+
+	const char* Password(uint64_t i) const {
+		return m_passwords + m_accounts[i].m_password_offset;
+	}
+
+private:
+	void __close();
+
+private: //do not allow the user to copy the object
+	CheckpointFile(CheckpointFile const&);
+	CheckpointFile& operator=(CheckpointFile const&);
+
+private:
+	const char* m_data;
+	size_t m_size;
+	checkpoint_account const* m_accounts;
+	const char* m_passwords;
+};
+
+
+#endif /* CHECKPOINT_H_ */
@@ -0,0 +1,287 @@
+/*
+ * CommandFile.cpp
+ *
+ *  Created on: Jun 11, 2017
+ *      Author: dror
+ *
+ *	An implementation of the CommandFile and password_table classes
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <algorithm>
+#include "CommandFile.h"
+
+#define PASSWORD_TABLE_INITIAL_SLOTS 64 	//must be a power of 2
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define MAX_COMMAND_TOKENS 5 				//the opcode, the account, the password and (up to) two numbers
+
+
+//********************************************Helper functions************************************************
+
+//a token of a command line (points into the mapped file)
+struct token {
+	const char* m_data;
+	size_t m_len;
+};
+
+static inline bool is_blank(char c){
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/********************************************
+// function name: 	parse_int
+// Description	: 	Parses an integer with the rules of atoi - an optional sign and the digits up to the first non-digit
+// Parameters	: 	tok - the token (an empty token is parsed as 0)
+// Returns		: 	int - the integer
+// Exception	: 	None
+*/
+static int parse_int(token const& tok){
+	size_t i = 0;
+	bool negative = false;
+	if (i < tok.m_len && (tok.m_data[i] == '-' || tok.m_data[i] == '+'))
+		negative = tok.m_data[i++] == '-';
+
+	long value = 0;
+	for (; i < tok.m_len && tok.m_data[i] >= '0' && tok.m_data[i] <= '9'; ++i)
+		value = value * 10 + (tok.m_data[i] - '0');
+
+	return static_cast<int>(negative ? -value : value);
+}
+
+/********************************************
+// function name: 	parse_opcode
+// Description	: 	Maps the first letter of a command line to its opcode
+// Parameters	: 	c - the letter
+// Returns		: 	atm_opcode - the opcode, ATM_OP_UNKNOWN in case the letter is not a command
+// Exception	: 	None
+*/
+static atm_opcode parse_opcode(char c){
+	switch (c) {
+		case 'O': return ATM_OP_OPEN;
+		case 'D': return ATM_OP_DEPOSIT;
+		case 'W': return ATM_OP_WITHDRAW;
+		case 'B': return ATM_OP_BALANCE;
+		case 'Q': return ATM_OP_CLOSE;
+		case 'T': return ATM_OP_TRANSFER;
+		default:  return ATM_OP_UNKNOWN;
+	}
+}
+
+//*****************************************************************password_table*****************************************************
+
+password_table::password_table() : m_slots(PASSWORD_TABLE_INITIAL_SLOTS, 0) {
+
+}
+
+/********************************************
+// function name: 	password_table::Intern
+// Description	: 	Returns the id of a password, adding it to the table in case it's new
+// Parameters	: 	data - the characters of the password
+//					len - the length of the password
+// Returns		: 	uint32_t - the id of the password
+// Exception	: 	std::bad_alloc
+*/
+uint32_t password_table::Intern(const char* data, size_t len) {
+	size_t mask = m_slots.size() - 1;
+
+	for (size_t i = __hash(data, len) & mask; ; i = (i + 1) & mask) {
+		uint32_t slot = m_slots[i];
+		if (slot == 0) {
+			//a new password
+			uint32_t id = m_passwords.size();
+			m_passwords.push_back(string(data, len));
+			m_slots[i] = id + 1;
+
+			//keep the table at most half full
+			if (2 * m_passwords.size() > m_slots.size())
+				__grow();
+			return id;
+		}
+
+		string const& password = m_passwords[slot - 1];
+		if (password.size() == len && memcmp(password.data(), data, len) == 0)
+			return slot - 1;
+	}
+}
+
+/********************************************
+// function name: 	password_table::Clear
+// Description	: 	Removes all of the passwords (the ids that were handed out become invalid).
+//					The memory of the table is kept, so a table that is cleared and refilled doesn't grow
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void password_table::Clear() {
+	m_passwords.clear();
+	fill(m_slots.begin(), m_slots.end(), 0);
+}
+
+//FNV-1a hash of the characters
+uint32_t password_table::__hash(const char* data, size_t len) {
+	uint32_t hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+//doubles the hash table, and re-inserts the ids
+void password_table::__grow() {
+	vector<uint32_t> slots(2 * m_slots.size(), 0);
+	size_t mask = slots.size() - 1;
+
+	for (uint32_t id = 0; id < m_passwords.size(); ++id) {
+		size_t i = __hash(m_passwords[id].data(), m_passwords[id].size()) & mask;
+		while (slots[i] != 0)
+			i = (i + 1) & mask;
+		slots[i] = id + 1;
+	}
+
+	m_slots.swap(slots);
+}
+
+//*****************************************************************CommandFile********************************************************
+
+/********************************************
+// function name: 	CommandFile::CommandFile
+// Description	: 	Constructor.
+//					Opens the file and maps it to memory
+// Parameters	: 	file_path - the path to the commands file
+//					release_window - the parsed pages are released every time this amount of bytes is parsed (default: COMMAND_RELEASE_WINDOW)
+// Returns		: 	None
+// Exception	: 	std::ifstream::failure in case the file can't be opened or mapped
+*/
+CommandFile::CommandFile(string const& file_path, size_t release_window) :	m_fd(-1),
+																			m_data(NULL),
+																			m_size(0),
+																			m_pos(0),
+																			m_released(0),
+																			m_release_window(release_window) {
+	struct stat file_stat;
+	m_fd = open(file_path.c_str(), O_RDONLY);
+	if (m_fd < 0 || fstat(m_fd, &file_stat) < 0) {
+		if (m_fd >= 0) close(m_fd);
+
+		stringstream error;
+		error << __func__ << " LINE " <<  __LINE__ << ": file at path " << file_path << " does not exist" << endl;
+		throw std::ifstream::failure(error.str());
+	}
+
+	m_size = file_stat.st_size;
+	if (m_size == 0)
+		return; //nothing to map
+
+	void* mapping = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (mapping == MAP_FAILED) {
+		close(m_fd);
+
+		stringstream error;
+		error << __func__ << " LINE " <<  __LINE__ << ": file at path " << file_path << " could not be mapped" << endl;
+		throw std::ifstream::failure(error.str());
+	}
+
+	m_data = static_cast<const char*>(mapping);
+	madvise(mapping, m_size, MADV_SEQUENTIAL); //read ahead aggressively
+}
+
+/********************************************
+// function name: 	CommandFile::~CommandFile
+// Description	: 	Destructor.
+//					Unmaps and closes the file
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+CommandFile::~CommandFile() {
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+	close(m_fd);
+}
+
+/********************************************
+// function name: 	CommandFile::Read
+// Description	: 	Parses the next command lines of the file
+// Parameters	: 	commands - an array where the parsed commands are stored
+//					max_commands - the size of the array
+//					passwords - the table where the passwords are interned
+// Returns		: 	size_t - the number of parsed commands (0 once the whole file has been parsed)
+// Exception	: 	std::bad_alloc
+*/
+size_t CommandFile::Read(atm_command* commands, size_t max_commands, password_table& passwords) {
+	size_t num_commands = 0;
+
+	while (num_commands < max_commands && m_pos < m_size) {
+		//find the end of the line
+		const char* line = m_data + m_pos;
+		const char* end = static_cast<const char*>(memchr(line, '\n', m_size - m_pos));
+		if (!end) end = m_data + m_size;
+		m_pos = (end - m_data) + 1;
+
+		//break the line into tokens
+		token tokens[MAX_COMMAND_TOKENS];
+		unsigned num_tokens = 0;
+		for (const char* p = line; p < end && num_tokens < MAX_COMMAND_TOKENS; ) {
+			while (p < end && is_blank(*p)) ++p;
+			if (p == end) break;
+
+			const char* start = p;
+			while (p < end && !is_blank(*p)) ++p;
+			tokens[num_tokens].m_data = start;
+			tokens[num_tokens++].m_len = p - start;
+		}
+
+		if (num_tokens == 0)
+			continue; //an empty line
+
+		for (unsigned i = num_tokens; i < MAX_COMMAND_TOKENS; ++i) {
+			tokens[i].m_data = end;
+			tokens[i].m_len = 0;
+		}
+
+		atm_command& command = commands[num_commands++];
+		command.m_op = parse_opcode(tokens[0].m_data[0]);
+		command.m_account = parse_int(tokens[1]);
+		command.m_password = passwords.Intern(tokens[2].m_data, tokens[2].m_len);
+		command.m_target = 0;
+		command.m_amount = 0;
+
+		if (command.m_op == ATM_OP_TRANSFER) {
+			command.m_target = parse_int(tokens[3]);
+			command.m_amount = parse_int(tokens[4]);
+		}
+		else
+			command.m_amount = parse_int(tokens[3]);
+	}
+
+	__release_parsed();
+	return num_commands;
+}
+
+/********************************************
+// function name: 	CommandFile::__release_parsed
+// Description	: 	Releases the resident pages of the part of the file that has been parsed, once it exceeds the release window
+//					(the mapping is private and read only, so the pages are simply dropped, and would be read again from the file if touched)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void CommandFile::__release_parsed() {
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t parsed = (m_pos < m_size ? m_pos : m_size) & ~(page_size - 1);
+
+	if (parsed - m_released < m_release_window && m_pos < m_size)
+		return;
+
+	if (parsed > m_released) {
+		madvise(const_cast<char*>(m_data) + m_released, parsed - m_released, MADV_DONTNEED);
+		m_released = parsed;
+	}
+}
@@ -0,0 +1,190 @@
+/*
+ * CommandFile.h
+ *
+ *  Created on: Jun 11, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : CommandFile
+	Description : A one-pass, zero-copy loader of the ATMs' command files.
+					The file is mapped to memory (mmap) and parsed in place, line by line, into compact fixed-size records (atm_command) -
+					an opcode, integers, and the id of the password, interned in a password_table. No line is copied into a string.
+					The pages of the file that were already parsed are released, so even a multi-gigabyte file costs only a bounded window
+					of resident memory.
+	Main methods: 	1. CommandFile::Read - parse the next commands of the file
+					2. password_table::Intern / Get - map a password to a small id and back
+ */
+
+#ifndef COMMANDFILE_H_
+#define COMMANDFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+#define COMMAND_RELEASE_WINDOW (64 * 1024 * 1024) //the parsed pages of the file are released every time this amount of bytes is parsed
+
+//the operations of an ATM (the first letter of a command line)
+typedef enum {
+	ATM_OP_OPEN,		//O <account> <password> <initial_amount>
+	ATM_OP_DEPOSIT,		//D <account> <password> <amount>
+	ATM_OP_WITHDRAW,	//W <account> <password> <amount>
+	ATM_OP_BALANCE,		//B <account> <password>
+	ATM_OP_CLOSE,		//Q <account> <password>
+	ATM_OP_TRANSFER,	//T <account> <password> <target_account> <amount>
+	ATM_OP_UNKNOWN		//any other letter - the ATM does nothing (but still waits between the commands)
+} atm_opcode;
+
+//a parsed command line
+struct atm_command {
+	int32_t m_account;
+	int32_t m_amount;		//the amount (or the initial balance of an opened account)
+	int32_t m_target;		//the target account of a transfer
+	uint32_t m_password;	//the id of the password in the ATM's password_table
+	uint8_t m_op;			//atm_opcode
+};
+
+
+/********************************************
+// 	class name	: 	password_table
+// 	Description	: 	Interns passwords - every distinct password is stored once, and is identified by a small integer.
+//					An open-addressing hash table maps the characters of a password to its id, so a password that was seen before
+//					is looked up without being copied. Not thread-safe (every ATM has its own table)
+//
+//	Members		:	m_passwords - the passwords, indexed by their ids
+//					m_slots - the hash table. Holds id + 1 of the password in every used slot (0 - an empty slot). Its size is a power of 2
+//
+//	Methods		:	Intern - returns the id of a password (adds it, if needed)
+//					Get - returns the password of an id
+//					Size - returns the number of distinct passwords
+*/
+class password_table {
+public:
+	password_table();
+
+	/********************************************
+	// function name: 	password_table::Intern
+	// Description	: 	Returns the id of a password, adding it to the table in case it's new
+	// Parameters	: 	data - the characters of the password
+	//					len - the length of the password
+	// Returns		: 	uint32_t - the id of the password
+	// Exception	: 	std::bad_alloc
+	*/
+	uint32_t Intern(const char* data, size_t len);
+
+	/********************************************
+	// function name: 	password_table::Get
+	// Description	: 	Returns the password of an id
+	// Parameters	: 	id - the id (returned by Intern)
+	// Returns		: 	string const& - the password
+	// Exception	: 	None
+	*/
+	string const& Get(uint32_t id) const {
+		return m_passwords[id];
+	}
+
+	size_t Size() const {
+		return m_passwords.size();
+	}
+
+	/********************************************
+	// function name: 	password_table::Clear
+	// Description	: 	Removes all of the passwords (the ids that were handed out become invalid).
+	//					The memory of the table is kept, so a table that is cleared and refilled doesn't grow
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Clear();
+
+private:
+	static uint32_t __hash(const char* data, size_t len);
+	void __grow();
+
+private:
+	vector<string> m_passwords;
+	vector<uint32_t> m_slots;
+};
+
+
+/********************************************
+// 	class name	: 	CommandFile
+// 	Description	: 	A command file of an ATM, mapped to memory and parsed in place.
+//					Empty lines are skipped, missing numbers are read as 0 and numbers are read with the rules of atoi.
+//
+//	Members		:	m_fd - the file descriptor of the file
+//					m_data / m_size - the mapping of the file and its size
+//					m_pos - the offset of the next line to be parsed
+//					m_released - the offset up to which the parsed pages have been released
+//					m_release_window - the amount of parsed bytes that may stay resident before they are released
+//
+//	Methods		:	Read - parse the next commands
+//					Eof - tells whether the whole file has been parsed
+//					Size - returns the size of the file
+*/
+class CommandFile {
+public:
+	/********************************************
+	// function name: 	CommandFile::CommandFile
+	// Description	: 	Constructor.
+	//					Opens the file and maps it to memory
+	// Parameters	: 	file_path - the path to the commands file
+	//					release_window - the parsed pages are released every time this amount of bytes is parsed (default: COMMAND_RELEASE_WINDOW)
+	// Returns		: 	None
+	// Exception	: 	std::ifstream::failure in case the file can't be opened or mapped
+	*/
+	CommandFile(string const& file_path, size_t release_window = COMMAND_RELEASE_WINDOW);
+
+	/********************************************
+	// function name: 	CommandFile::~CommandFile
+	// Description	: 	Destructor.
+	//					Unmaps and closes the file
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~CommandFile();
+
+public: //API
+	/********************************************
+	// function name: 	CommandFile::Read
+	// Description	: 	Parses the next command lines of the file
+	// Parameters	: 	commands - an array where the parsed commands are stored
+	//					max_commands - the size of the array
+	//					passwords - the table where the passwords are interned
+	// Returns		: 	size_t - the number of parsed commands (0 once the whole file has been parsed)
+	// Exception	: 	std::bad_alloc
+	*/
+	size_t Read(atm_command* commands, size_t max_commands, password_table& passwords);
+
+	bool Eof() const {
+		return m_pos >= m_size;
+	}
+
+	size_t Size() const {
+		return m_size;
+	}
+
+private:
+	void __release_parsed();
+
+private: //do not allow the user to copy the object
+	CommandFile(CommandFile const&);
+	CommandFile& operator=(CommandFile const&);
+
+private:
+	int m_fd;
+	const char* m_data;
+	size_t m_size;
+	size_t m_pos;
+	size_t m_released;
+	size_t m_release_window;
+};
+
+
+#endif /* COMMANDFILE_H_ */
@@ -0,0 +1,154 @@
+/*
+ * CommandStream.cpp
+ *
+ *  Created on: Jun 12, 2017
+ *      Author: dror
+ *
+ *	An implementation of the CommandStream class
+ */
+
+#include <new>
+#include "CommandStream.h"
+
+
+/********************************************
+// function name: 	CommandStream::CommandStream
+// Description	: 	Constructor.
+//					Opens the file and starts the I/O thread (which starts loading the first chunks right away)
+// Parameters	: 	file_path - the path to the commands file
+// Returns		: 	None
+// Exception	: 	std::ifstream::failure in case the file can't be opened, std::bad_alloc
+*/
+CommandStream::CommandStream(string const& file_path) :	m_file(file_path, STREAM_RELEASE_WINDOW),
+														m_fill(0),
+														m_drain(0),
+														m_loaded(0),
+														m_eof(false),
+														m_stop(false) {
+	for (unsigned i = 0; i < STREAM_NUM_CHUNKS; ++i) {
+		m_chunks[i].m_commands.resize(STREAM_CHUNK_COMMANDS);
+		m_chunks[i].m_size = 0;
+	}
+
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	pthread_create(&m_loader, NULL, __loader_main, static_cast<void*>(this));
+}
+
+/********************************************
+// function name: 	CommandStream::~CommandStream
+// Description	: 	Destructor.
+//					Stops the I/O thread (even if the file wasn't read to its end) and closes the file
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+CommandStream::~CommandStream() {
+	pthread_mutex_lock(&m_lock);
+	m_stop = true;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_lock);
+
+	pthread_join(m_loader, NULL);
+
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_lock);
+}
+
+/********************************************
+// function name: 	CommandStream::Acquire
+// Description	: 	Waits for the next chunk of the file to be loaded, and returns its commands.
+//					The chunk is owned by the caller until it calls Release
+// Parameters	: 	commands - set to the commands of the chunk
+//					passwords - set to the password table of the chunk (the commands' password ids refer to it)
+// Returns		: 	size_t - the number of commands in the chunk, 0 once the whole file has been executed
+// Exception	: 	None
+// Thread-safety:	A single consumer
+*/
+size_t CommandStream::Acquire(atm_command const*& commands, password_table const*& passwords) {
+	pthread_mutex_lock(&m_lock);
+	while (m_loaded == 0 && !m_eof)
+		pthread_cond_wait(&m_cond, &m_lock);
+
+	bool drained = (m_loaded == 0);
+	pthread_mutex_unlock(&m_lock);
+
+	if (drained)
+		return 0;
+
+	//the chunk is not touched by the I/O thread until it's released, no need to hold the lock while it's executed
+	chunk& c = m_chunks[m_drain];
+	commands = &c.m_commands[0];
+	passwords = &c.m_passwords;
+	return c.m_size;
+}
+
+/********************************************
+// function name: 	CommandStream::Release
+// Description	: 	Hands the chunk returned by the last Acquire back to the I/O thread, to be refilled
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	A single consumer
+*/
+void CommandStream::Release() {
+	m_drain = (m_drain + 1) % STREAM_NUM_CHUNKS;
+
+	pthread_mutex_lock(&m_lock);
+	--m_loaded;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_lock);
+}
+
+/********************************************
+// function name: 	CommandStream::__loader_main
+// Description	: 	The I/O thread's routine. Runs CommandStream::__load_loop
+// Parameters	: 	stream - a void* to the CommandStream object
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* CommandStream::__loader_main(void* stream) {
+	static_cast<CommandStream*>(stream)->__load_loop();
+	pthread_exit((void*)0);
+}
+
+/********************************************
+// function name: 	CommandStream::__load_loop
+// Description	: 	Loads the chunks of the file, one after the other, as long as there is a free chunk in the ring.
+//					A chunk is parsed without holding the lock (it's not visible to the consumer until it's published)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void CommandStream::__load_loop() {
+	while (true) {
+		pthread_mutex_lock(&m_lock);
+		while (m_loaded == STREAM_NUM_CHUNKS && !m_stop)
+			pthread_cond_wait(&m_cond, &m_lock);
+		bool stop = m_stop;
+		pthread_mutex_unlock(&m_lock);
+
+		if (stop)
+			return;
+
+		chunk& c = m_chunks[m_fill];
+		c.m_passwords.Clear();
+		try {
+			c.m_size = m_file.Read(&c.m_commands[0], STREAM_CHUNK_COMMANDS, c.m_passwords);
+		} catch (std::bad_alloc& e) {
+			c.m_size = 0; //can't intern the passwords of the chunk, end the stream here
+		}
+
+		pthread_mutex_lock(&m_lock);
+		if (c.m_size > 0) {
+			m_fill = (m_fill + 1) % STREAM_NUM_CHUNKS;
+			++m_loaded;
+		}
+		else m_eof = true;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_lock);
+
+		if (c.m_size == 0)
+			return;
+	}
+}
@@ -0,0 +1,125 @@
+/*
+ * CommandStream.h
+ *
+ *  Created on: Jun 12, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : CommandStream
+	Description : A streaming reader of an ATM's command file.
+					Instead of parsing the whole file before the ATM starts, a background I/O thread parses the file into two
+					fixed-size chunks (double buffering) - while the ATM executes the commands of one chunk, the next chunk is loaded.
+					Every chunk has its own password table, which is cleared when the chunk is refilled, so the memory of a stream
+					is constant no matter how long the file is.
+	Main methods: 	1. CommandStream::Acquire - waits for the next loaded chunk of commands
+					2. CommandStream::Release - hands a consumed chunk back to the I/O thread
+ */
+
+#ifndef COMMANDSTREAM_H_
+#define COMMANDSTREAM_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "CommandFile.h"
+
+using namespace std;
+
+#define STREAM_CHUNK_COMMANDS 4096 				//the number of commands in a chunk
+#define STREAM_NUM_CHUNKS 2 					//double buffering - one chunk is executed while the other is loaded
+#define STREAM_RELEASE_WINDOW (1024 * 1024) 	//the parsed pages of the file are released every MB
+
+
+/********************************************
+// 	class name	: 	CommandStream
+// 	Description	: 	A bounded producer-consumer ring of STREAM_NUM_CHUNKS chunks, filled by an I/O thread and consumed by a single ATM.
+//					A chunk is handed back and forth as a whole, so the ATM synchronizes with the I/O thread once per chunk
+//					and not once per command.
+//
+//	Members		:	m_file - the mapped command file (used by the I/O thread only)
+//					m_chunks - the chunks of the ring
+//					m_fill / m_drain - the index of the next chunk to be loaded / executed
+//					m_loaded - the number of chunks that are loaded and not yet released
+//					m_eof - true once the I/O thread parsed the whole file
+//					m_stop - true once the stream is being destroyed
+//					m_lock / m_cond - protect the state of the ring, and signal a loaded or released chunk
+//					m_loader - the I/O thread
+//
+//	Methods		:	Acquire - returns the next chunk of commands (waits until it's loaded)
+//					Release - hands the acquired chunk back to the I/O thread
+*/
+class CommandStream {
+public:
+	/********************************************
+	// function name: 	CommandStream::CommandStream
+	// Description	: 	Constructor.
+	//					Opens the file and starts the I/O thread (which starts loading the first chunks right away)
+	// Parameters	: 	file_path - the path to the commands file
+	// Returns		: 	None
+	// Exception	: 	std::ifstream::failure in case the file can't be opened, std::bad_alloc
+	*/
+	CommandStream(string const& file_path);
+
+	/********************************************
+	// function name: 	CommandStream::~CommandStream
+	// Description	: 	Destructor.
+	//					Stops the I/O thread (even if the file wasn't read to its end) and closes the file
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~CommandStream();
+
+public: //API
+	/********************************************
+	// function name: 	CommandStream::Acquire
+	// Description	: 	Waits for the next chunk of the file to be loaded, and returns its commands.
+	//					The chunk is owned by the caller until it calls Release
+	// Parameters	: 	commands - set to the commands of the chunk
+	//					passwords - set to the password table of the chunk (the commands' password ids refer to it)
+	// Returns		: 	size_t - the number of commands in the chunk, 0 once the whole file has been executed
+	// Exception	: 	None
+	// Thread-safety:	A single consumer
+	*/
+	size_t Acquire(atm_command const*& commands, password_table const*& passwords);
+
+	/********************************************
+	// function name: 	CommandStream::Release
+	// Description	: 	Hands the chunk returned by the last Acquire back to the I/O thread, to be refilled
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	A single consumer
+	*/
+	void Release();
+
+private:
+	struct chunk {
+		vector<atm_command> m_commands;
+		size_t m_size;
+		password_table m_passwords;
+	};
+
+	static void* __loader_main(void* stream);
+	void __load_loop();
+
+private: //do not allow the user to copy the object
+	CommandStream(CommandStream const&);
+	CommandStream& operator=(CommandStream const&);
+
+private:
+	CommandFile m_file;
+	chunk m_chunks[STREAM_NUM_CHUNKS];
+	unsigned m_fill;
+	unsigned m_drain;
+	unsigned m_loaded;
+	bool m_eof;
+	bool m_stop;
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_cond;
+	pthread_t m_loader;
+};
+
+
+#endif /* COMMANDSTREAM_H_ */
@@ -0,0 +1,409 @@
+/*
+ * Executor.cpp
+ *
+ *  Created on: Jun 13, 2017
+ *      Author: dror
+ *
+ *	An implementation of the Executor class.
+ *	The deques follow Chase & Lev ("Dynamic Circular Work-Stealing Deque"), with the memory orders of
+ *	Le, Pop, Cohen & Zappa Nardelli ("Correct and Efficient Work-Stealing for Weak Memory Models")
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "Executor.h"
+#include "futex.h"
+
+static thread_local void* t_worker = NULL; //the worker the calling thread runs (NULL outside of the executors' workers)
+
+
+/********************************************
+// function name: 	Executor::Executor
+// Description	: 	Constructor.
+// Parameters	: 	num_workers - the number of workers (default: 0 - a worker per core)
+// Returns		: 	None
+// Exception	: 	None
+*/
+Executor::Executor(unsigned num_workers) :	m_workers(NULL),
+											m_num_workers(num_workers),
+											m_has_injected(false),
+											m_pending(0),
+											m_sleepers(0),
+											m_wakeup(0) {
+	if (m_num_workers == 0) {
+		long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+		m_num_workers = num_cores > 1 ? (unsigned)num_cores : 1;
+	}
+
+	pthread_mutex_init(&m_inject_lock, NULL);
+}
+
+/********************************************
+// function name: 	Executor::~Executor
+// Description	: 	Destructor.
+//					Releases the workers' deques (the tasks are owned by the caller, and are not deleted)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+Executor::~Executor() {
+	pthread_mutex_destroy(&m_inject_lock);
+}
+
+/********************************************
+// function name: 	Executor::Submit
+// Description	: 	Adds a task to the executor. The task runs its first step as soon as a worker is free
+// Parameters	: 	task - the task (must stay alive until it's done)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes (may be called by the tasks themselves)
+*/
+void Executor::Submit(executor_task* task) {
+	m_pending.fetch_add(1);
+
+	//a task of this executor submits a task - push it to the bottom of the worker's own deque
+	worker* w = static_cast<worker*>(t_worker);
+	if (w && w->m_executor == this) {
+		__push(*w, task);
+		__wake();
+		return;
+	}
+
+	pthread_mutex_lock(&m_inject_lock);
+	m_injected.push_back(task);
+	m_has_injected.store(true);
+	pthread_mutex_unlock(&m_inject_lock);
+	__wake();
+}
+
+/********************************************
+// function name: 	Executor::Run
+// Description	: 	Starts the workers, and waits until all of the submitted tasks are done
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void Executor::Run() {
+	m_workers = new worker[m_num_workers];
+	for (unsigned i = 0; i < m_num_workers; ++i) {
+		worker& w = m_workers[i];
+		w.m_top.store(0);
+		w.m_bottom.store(0);
+		w.m_ring.store(__new_ring(EXECUTOR_DEQUE_CAPACITY));
+		w.m_executor = this;
+		w.m_index = i;
+		w.m_random = 2463534242u + i; //any non-zero seed will do, the victims only have to be spread
+	}
+
+	//deal the tasks that were submitted so far between the workers (no worker runs yet, so the deques may be pushed to from here)
+	pthread_mutex_lock(&m_inject_lock);
+	for (size_t i = 0; i < m_injected.size(); ++i)
+		__push(m_workers[i % m_num_workers], m_injected[i]);
+	m_injected.clear();
+	m_has_injected.store(false);
+	pthread_mutex_unlock(&m_inject_lock);
+
+	for (unsigned i = 0; i < m_num_workers; ++i)
+		pthread_create(&m_workers[i].m_thread, NULL, __worker_main, static_cast<void*>(&m_workers[i]));
+
+	for (unsigned i = 0; i < m_num_workers; ++i)
+		pthread_join(m_workers[i].m_thread, NULL);
+
+	for (unsigned i = 0; i < m_num_workers; ++i) {
+		worker& w = m_workers[i];
+		__delete_ring(w.m_ring.load());
+		for (size_t j = 0; j < w.m_retired.size(); ++j)
+			__delete_ring(w.m_retired[j]);
+	}
+	delete[] m_workers;
+	m_workers = NULL;
+}
+
+/********************************************
+// function name: 	Executor::__worker_main
+// Description	: 	A worker thread's routine. Runs Executor::__work_loop
+// Parameters	: 	w - a void* to the worker
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* Executor::__worker_main(void* w) {
+	worker& self = *static_cast<worker*>(w);
+	t_worker = w;
+	self.m_executor->__work_loop(self);
+	t_worker = NULL;
+	pthread_exit((void*)0);
+}
+
+/********************************************
+// function name: 	Executor::__work_loop
+// Description	: 	The main loop of a worker: moves its due timers to its deque, finds a task (its own, an injected one or a stolen one),
+//					runs a step of the task and re-schedules it. Sleeps when there is nothing to run, and returns once all of the tasks are done
+// Parameters	: 	w - the worker
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Executor::__work_loop(worker& w) {
+	while (m_pending.load() > 0) {
+		//the tasks whose delay has passed are runnable again
+		if (!w.m_timers.empty()) {
+			uint64_t now = __now();
+			bool woke_tasks = false;
+			while (!w.m_timers.empty() && w.m_timers.top().first <= now) {
+				__ready(w.m_timers.top().second, w);
+				w.m_timers.pop();
+				woke_tasks = true;
+			}
+			if (woke_tasks) __wake(); //let the idle workers steal some of them
+		}
+
+		executor_task* task = __find_task(w);
+		if (!task) {
+			__idle(w);
+			continue;
+		}
+
+		__finish(task, task->Step(), w);
+	}
+
+	//wake the workers that are still sleeping, so they see that all of the tasks are done
+	++m_wakeup;
+	futex_wake(m_wakeup, FUTEX_WAKE_ALL);
+}
+
+/********************************************
+// function name: 	Executor::__finish
+// Description	: 	Re-schedules a task after one of its steps - right away on the worker's deque, later on the worker's timer heap,
+//					or not at all in case the task is done
+// Parameters	: 	task - the task
+//					delay - the value returned by the task's step
+//					w - the worker that ran the step
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Executor::__finish(executor_task* task, int delay, worker& w) {
+	if (delay == EXECUTOR_TASK_DONE) {
+		if (m_pending.fetch_sub(1) == 1) {
+			++m_wakeup;
+			futex_wake(m_wakeup, FUTEX_WAKE_ALL);
+		}
+	}
+	else if (delay == 0)
+		__ready(task, w);
+	else
+		w.m_timers.push(timer(__now() + delay, task));
+}
+
+/********************************************
+// function name: 	Executor::__ready
+// Description	: 	Makes a task runnable on a worker - on the worker's deque, or on its private queue in case the task is pinned
+// Parameters	: 	task - the task
+//					w - the worker (the calling thread must be its owner)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void Executor::__ready(executor_task* task, worker& w) {
+	if (task->Pinned())
+		w.m_pinned.push_back(task);
+	else
+		__push(w, task);
+}
+
+/********************************************
+// function name: 	Executor::__find_task
+// Description	: 	Finds a runnable task for a worker: its pinned tasks, the bottom of its own deque, then the injected tasks,
+//					then the top of the other workers' deques (starting from a random victim)
+// Parameters	: 	w - the worker
+// Returns		: 	executor_task* - the task, NULL if there is no runnable task
+// Exception	: 	None
+*/
+executor_task* Executor::__find_task(worker& w) {
+	if (!w.m_pinned.empty()) {
+		executor_task* pinned = w.m_pinned.front();
+		w.m_pinned.pop_front();
+		return pinned;
+	}
+
+	executor_task* task = __take(w);
+	if (task) return task;
+
+	if (m_has_injected.load()) {
+		pthread_mutex_lock(&m_inject_lock);
+		if (!m_injected.empty()) {
+			task = m_injected.back();
+			m_injected.pop_back();
+		}
+		m_has_injected.store(!m_injected.empty());
+		pthread_mutex_unlock(&m_inject_lock);
+		if (task) return task;
+	}
+
+	w.m_random ^= w.m_random << 13;
+	w.m_random ^= w.m_random >> 17;
+	w.m_random ^= w.m_random << 5;
+
+	unsigned start = w.m_random % m_num_workers;
+	for (unsigned i = 0; i < m_num_workers; ++i) {
+		worker& victim = m_workers[(start + i) % m_num_workers];
+		if (&victim == &w) continue;
+
+		task = __steal(victim);
+		if (task) return task;
+	}
+
+	return NULL;
+}
+
+/********************************************
+// function name: 	Executor::__idle
+// Description	: 	Puts an idle worker to sleep until it's woken up (a task became runnable, or all of the tasks are done),
+//					until its next timer is due, or for EXECUTOR_MAX_IDLE at most
+// Parameters	: 	w - the worker
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Executor::__idle(worker& w) {
+	uint64_t timeout = EXECUTOR_MAX_IDLE;
+	if (!w.m_timers.empty()) {
+		uint64_t now = __now();
+		uint64_t due = w.m_timers.top().first;
+		if (due <= now) return;
+		if (due - now < timeout) timeout = due - now;
+	}
+
+	//register as a sleeper before the last check, so a task that is pushed after the check bumps the wakeup word
+	uint32_t wakeup = m_wakeup.load();
+	m_sleepers.fetch_add(1);
+
+	bool has_tasks = !w.m_pinned.empty() || m_has_injected.load() || m_pending.load() == 0;
+	for (unsigned i = 0; i < m_num_workers && !has_tasks; ++i)
+		has_tasks = __has_tasks(m_workers[i]);
+
+	if (!has_tasks) {
+		struct timespec period = {(time_t)(timeout / 1000000), (long)(timeout % 1000000) * 1000};
+		futex_wait(m_wakeup, wakeup, &period);
+	}
+
+	m_sleepers.fetch_sub(1);
+}
+
+/********************************************
+// function name: 	Executor::__wake
+// Description	: 	Wakes an idle worker (if there is one) to look for tasks
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Executor::__wake() {
+	atomic_thread_fence(memory_order_seq_cst); //order the push of the task before the check of the sleepers
+	if (m_sleepers.load() == 0)
+		return;
+
+	++m_wakeup;
+	futex_wake(m_wakeup, 1);
+}
+
+/********************************************
+// function name: 	Executor::__push
+// Description	: 	Pushes a task to the bottom of a worker's deque. Grows the ring in case it's full
+// Parameters	: 	w - the worker (the calling thread must be its owner)
+//					task - the task
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void Executor::__push(worker& w, executor_task* task) {
+	int64_t bottom = w.m_bottom.load(memory_order_relaxed);
+	int64_t top = w.m_top.load(memory_order_acquire);
+	ring* r = w.m_ring.load(memory_order_relaxed);
+
+	if (bottom - top > r->m_mask) {
+		//the ring is full - copy the tasks to a ring of twice the size
+		ring* bigger = __new_ring(2 * (r->m_mask + 1));
+		for (int64_t i = top; i < bottom; ++i)
+			bigger->m_slots[i & bigger->m_mask].store(r->m_slots[i & r->m_mask].load(memory_order_relaxed), memory_order_relaxed);
+
+		w.m_retired.push_back(r);
+		w.m_ring.store(bigger, memory_order_release);
+		r = bigger;
+	}
+
+	r->m_slots[bottom & r->m_mask].store(task, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	w.m_bottom.store(bottom + 1, memory_order_relaxed);
+}
+
+/********************************************
+// function name: 	Executor::__take
+// Description	: 	Takes the task at the bottom of a worker's deque (the last one pushed)
+// Parameters	: 	w - the worker (the calling thread must be its owner)
+// Returns		: 	executor_task* - the task, NULL if the deque is empty
+// Exception	: 	None
+*/
+executor_task* Executor::__take(worker& w) {
+	int64_t bottom = w.m_bottom.load(memory_order_relaxed) - 1;
+	ring* r = w.m_ring.load(memory_order_relaxed);
+	w.m_bottom.store(bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t top = w.m_top.load(memory_order_relaxed);
+
+	if (top > bottom) {
+		//the deque is empty
+		w.m_bottom.store(bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	executor_task* task = r->m_slots[bottom & r->m_mask].load(memory_order_relaxed);
+	if (top == bottom) {
+		//the last task - race the thieves for it
+		if (!w.m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+			task = NULL;
+		w.m_bottom.store(bottom + 1, memory_order_relaxed);
+	}
+
+	return task;
+}
+
+/********************************************
+// function name: 	Executor::__steal
+// Description	: 	Steals the task at the top of a worker's deque (the first one pushed)
+// Parameters	: 	w - the victim
+// Returns		: 	executor_task* - the task, NULL if the deque is empty or the task was claimed by someone else
+// Exception	: 	None
+*/
+executor_task* Executor::__steal(worker& w) {
+	int64_t top = w.m_top.load(memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t bottom = w.m_bottom.load(memory_order_acquire);
+
+	if (top >= bottom)
+		return NULL;
+
+	ring* r = w.m_ring.load(memory_order_acquire);
+	executor_task* task = r->m_slots[top & r->m_mask].load(memory_order_relaxed);
+	if (!w.m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+		return NULL;
+
+	return task;
+}
+
+bool Executor::__has_tasks(worker& w) {
+	return w.m_top.load() < w.m_bottom.load();
+}
+
+Executor::ring* Executor::__new_ring(int64_t capacity) {
+	ring* r = new ring;
+	r->m_mask = capacity - 1;
+	r->m_slots = new atomic<executor_task*>[capacity];
+	return r;
+}
+
+void Executor::__delete_ring(ring* r) {
+	delete[] r->m_slots;
+	delete r;
+}
+
+//the time, in micro-seconds, of a monotonic clock
+uint64_t Executor::__now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,195 @@
+/*
+ * Executor.h
+ *
+ *  Created on: Jun 13, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : Executor
+	Description : A fixed-size work-stealing thread pool, that runs many small tasks (e.g. ATMs) on a few threads.
+					Every worker owns a deque of runnable tasks (a Chase-Lev deque): the worker pushes and takes tasks at the bottom
+					of its own deque, without contending with anyone, and an idle worker steals tasks from the top of the others' deques.
+					A task runs in steps - after every step it tells the executor whether it's done, or after how long it wants to run
+					again. A waiting task is kept in a timer heap of the worker that ran it, so no thread ever sleeps on behalf of a task.
+					A task is held by a single deque (or timer heap) at a time, so the steps of a task never run concurrently, and run in order.
+	Main methods: 	1. Executor::Submit - adds a task to the executor
+					2. Executor::Run - runs the tasks on the workers, until all of them are done
+ */
+
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <utility>
+#include "defs.h"
+
+using namespace std;
+
+#define EXECUTOR_TASK_DONE -1 				//returned by a task's step once the task is done
+#define EXECUTOR_DEQUE_CAPACITY 256 		//the initial capacity of a worker's deque (must be a power of 2, the deque grows as needed)
+#define EXECUTOR_MAX_IDLE 10000 			//the longest period (in micro-seconds) an idle worker sleeps before it looks for tasks again
+
+
+/********************************************
+// 	class name	: 	executor_task
+// 	Description	: 	A task of the executor. The task implements Step, which runs a single step of the task
+//
+//	Methods		:	Step - runs the next step of the task
+//					Pinned - tells whether the task must keep running on the same worker
+*/
+class executor_task {
+public:
+	virtual ~executor_task() {}
+
+	/********************************************
+	// function name: 	executor_task::Step
+	// Description	: 	Runs the next step of the task
+	// Parameters	: 	None
+	// Returns		: 	int - the delay (in micro-seconds) before the next step of the task (0 - right away), or EXECUTOR_TASK_DONE
+	// Exception	: 	None
+	*/
+	virtual int Step() = 0;
+
+	/********************************************
+	// function name: 	executor_task::Pinned
+	// Description	: 	Tells whether the next step of the task must run on the worker that ran the last one
+	//					(a pinned task is never stolen. Default: false)
+	// Parameters	: 	None
+	// Returns		: 	bool - true if the task is pinned to its worker
+	// Exception	: 	None
+	*/
+	virtual bool Pinned() const {
+		return false;
+	}
+};
+
+
+/********************************************
+// 	class name	: 	Executor
+// 	Description	: 	A work-stealing thread pool of a fixed number of workers.
+//
+//	Members		:	m_workers - the workers of the pool (allocated once the executor runs)
+//					m_num_workers - the number of workers
+//					m_injected - the tasks submitted from outside of the workers (protected by m_inject_lock)
+//					m_pending - the number of tasks that are not done yet
+//					m_sleepers - the number of idle workers that sleep on m_wakeup
+//					m_wakeup - a futex word, bumped every time an idle worker should look for tasks again
+//
+//	Methods		:	Submit - adds a task to the executor
+//					Run - runs all of the tasks (and the tasks they submit) until they are done
+//					NumWorkers - returns the number of workers
+*/
+class Executor {
+public:
+	/********************************************
+	// function name: 	Executor::Executor
+	// Description	: 	Constructor.
+	// Parameters	: 	num_workers - the number of workers (default: 0 - a worker per core)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	Executor(unsigned num_workers = 0);
+
+	/********************************************
+	// function name: 	Executor::~Executor
+	// Description	: 	Destructor.
+	//					Releases the workers' deques (the tasks are owned by the caller, and are not deleted)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~Executor();
+
+public: //API
+	/********************************************
+	// function name: 	Executor::Submit
+	// Description	: 	Adds a task to the executor. The task runs its first step as soon as a worker is free
+	// Parameters	: 	task - the task (must stay alive until it's done)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes (may be called by the tasks themselves)
+	*/
+	void Submit(executor_task* task);
+
+	/********************************************
+	// function name: 	Executor::Run
+	// Description	: 	Starts the workers, and waits until all of the submitted tasks are done
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void Run();
+
+	unsigned NumWorkers() const {
+		return m_num_workers;
+	}
+
+private:
+	//the ring of a deque. A full ring is replaced with a ring of twice the size, the old ring is kept until the deque is destroyed
+	//(a thief may still be reading it)
+	struct ring {
+		int64_t m_mask;
+		atomic<executor_task*>* m_slots;
+	};
+
+	typedef pair<uint64_t, executor_task*> timer; //the time (in micro-seconds) a waiting task should run again, and the task
+	typedef priority_queue<timer, vector<timer>, greater<timer> > timer_heap;
+
+	//a worker of the pool. The bottom of the deque is modified by the owner only, the top is claimed (by the owner and the thieves)
+	//with a compare-and-swap, so it's kept on a cache line of its own
+	struct worker {
+		atomic<int64_t> m_top;
+		char m_top_pad[CACHE_LINE_SIZE - sizeof(atomic<int64_t>)];
+		atomic<int64_t> m_bottom;
+		atomic<ring*> m_ring;
+		Executor* m_executor;
+		unsigned m_index;
+		uint32_t m_random; 		//the state of the generator of the steal victims
+		pthread_t m_thread;
+		vector<ring*> m_retired;
+		timer_heap m_timers;
+		deque<executor_task*> m_pinned; //the runnable tasks that are pinned to this worker (can't be stolen)
+		char m_pad[CACHE_LINE_SIZE]; //keep the next worker away from this worker's deque
+	};
+
+	static void* __worker_main(void* w);
+	void __work_loop(worker& w);
+	void __finish(executor_task* task, int delay, worker& w);
+	void __ready(executor_task* task, worker& w);
+	executor_task* __find_task(worker& w);
+	void __idle(worker& w);
+	void __wake();
+
+	//the deque operations
+	static void __push(worker& w, executor_task* task);
+	static executor_task* __take(worker& w);
+	static executor_task* __steal(worker& w);
+	static bool __has_tasks(worker& w);
+
+	static ring* __new_ring(int64_t capacity);
+	static void __delete_ring(ring* r);
+	static uint64_t __now();
+
+private: //do not allow the user to copy the object
+	Executor(Executor const&);
+	Executor& operator=(Executor const&);
+
+private:
+	worker* m_workers;
+	unsigned m_num_workers;
+	vector<executor_task*> m_injected;
+	pthread_mutex_t m_inject_lock;
+	atomic<bool> m_has_injected;
+	atomic<uint64_t> m_pending;
+	atomic<uint32_t> m_sleepers;
+	atomic<uint32_t> m_wakeup;
+};
+
+
+#endif /* EXECUTOR_H_ */
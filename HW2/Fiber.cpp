@@ -0,0 +1,239 @@
+/*
+ * Fiber.cpp
+ *
+ *  Created on: Jun 14, 2017
+ *      Author: dror
+ *
+ *	An implementation of the Fiber class, and of the cooperative waits
+ */
+
+#include <unistd.h>
+#include <atomic>
+#include "Fiber.h"
+
+static thread_local Fiber* t_fiber = NULL; //the fiber the calling thread runs (NULL outside of a fiber)
+static atomic<bool> s_delays(true); //false - fiber_sleep returns at once (see fiber_set_delays)
+static thread_local bool t_delays = true; //same, for the calling thread only (see fiber_set_thread_delays)
+static atomic<bool> s_key_used[FIBER_MAX_KEYS];
+static fiber_key_destructor s_key_destructors[FIBER_MAX_KEYS]; //set before the key is handed out, so before any fiber holds a value
+
+
+Fiber::Fiber() : m_stack(NULL), m_delay(0), m_park(FIBER_MIN_PARK), m_started(false), m_done(false) {
+	for (unsigned i = 0; i < FIBER_MAX_KEYS; ++i)
+		m_specific[i] = NULL;
+}
+
+Fiber::~Fiber() {
+	__release_specific(); //a fiber that has not ended
+	delete[] m_stack;
+}
+
+/********************************************
+// function name: 	Fiber::Step
+// Description	: 	Resumes the fiber (starts it in the first step), and returns once the fiber suspends or ends
+// Parameters	: 	None
+// Returns		: 	int - the delay the fiber asked for, or EXECUTOR_TASK_DONE once Run has returned
+// Exception	: 	std::bad_alloc (the stack of the fiber, in the first step)
+*/
+int Fiber::Step() {
+	if (!m_started) {
+		m_stack = new char[FIBER_STACK_SIZE];
+		getcontext(&m_context);
+		m_context.uc_stack.ss_sp = m_stack;
+		m_context.uc_stack.ss_size = FIBER_STACK_SIZE;
+		m_context.uc_link = NULL; //the fiber never returns through its context, __trampoline switches back explicitly
+		makecontext(&m_context, __trampoline, 0);
+		m_started = true;
+	}
+
+	Fiber* resumer = t_fiber;
+	t_fiber = this;
+	m_delay = 0;
+	swapcontext(&m_caller, &m_context);
+	t_fiber = resumer;
+
+	if (!m_done)
+		return m_delay;
+
+	//the stack is not needed anymore
+	delete[] m_stack;
+	m_stack = NULL;
+	return EXECUTOR_TASK_DONE;
+}
+
+/********************************************
+// function name: 	Fiber::Suspend
+// Description	: 	Suspends the fiber, and returns to the worker that resumed it. Must be called by the fiber itself
+// Parameters	: 	delay - the delay (in micro-seconds) before the fiber is resumed again
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Fiber::Suspend(unsigned delay) {
+	m_delay = delay;
+	swapcontext(&m_context, &m_caller);
+}
+
+/********************************************
+// function name: 	Fiber::__trampoline
+// Description	: 	The entry point of a fiber's stack. Runs the fiber, marks it as done, and switches back to the worker for good
+// Parameters	: 	None
+// Returns		: 	None (never returns)
+// Exception	: 	None
+*/
+void Fiber::__trampoline() {
+	Fiber* self = t_fiber;
+	self->Run();
+
+	self->__release_specific();
+	self->m_done = true;
+	setcontext(&self->m_caller);
+}
+
+/********************************************
+// function name: 	Fiber::__release_specific
+// Description	: 	Releases the fiber specific values of the fiber, by the destructors of their keys
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Fiber::__release_specific() {
+	for (unsigned i = 0; i < FIBER_MAX_KEYS; ++i) {
+		void* value = m_specific[i];
+		m_specific[i] = NULL;
+		if (value && s_key_used[i].load() && s_key_destructors[i])
+			s_key_destructors[i](value);
+	}
+}
+
+/********************************************
+// function name: 	fiber_current
+// Description	: 	Returns the fiber the calling thread runs
+// Parameters	: 	None
+// Returns		: 	Fiber* - the fiber, NULL in case the thread doesn't run a fiber
+// Exception	: 	None
+*/
+Fiber* fiber_current() {
+	return t_fiber;
+}
+
+/********************************************
+// function name: 	fiber_sleep
+// Description	: 	Waits for a period. Inside a fiber the fiber is suspended (and the worker runs other fibers),
+//					outside of a fiber the calling thread sleeps
+// Parameters	: 	usec - the period (in micro-seconds)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_sleep(unsigned usec) {
+	if (!t_delays || !s_delays.load(memory_order_relaxed))
+		return;
+
+	Fiber* fiber = t_fiber;
+	if (!fiber) {
+		usleep(usec);
+		return;
+	}
+
+	fiber->m_park = FIBER_MIN_PARK; //the fiber has made progress since its last wait for a lock
+	fiber->Suspend(usec);
+}
+
+/********************************************
+// function name: 	fiber_park
+// Description	: 	Waits for a lock to change its state, in case the caller is a fiber - the fiber is suspended for a period that grows
+//					with every consecutive wait (from FIBER_MIN_PARK to FIBER_MAX_PARK), and the caller checks the lock again.
+//					A thread that is not a fiber should park on the lock's futex instead
+// Parameters	: 	None
+// Returns		: 	bool - true if the caller is a fiber (and has waited), false otherwise
+// Exception	: 	None
+*/
+bool fiber_park() {
+	Fiber* fiber = t_fiber;
+	if (!fiber)
+		return false;
+
+	unsigned period = fiber->m_park;
+	if (fiber->m_park < FIBER_MAX_PARK)
+		fiber->m_park = (2 * fiber->m_park < FIBER_MAX_PARK) ? 2 * fiber->m_park : FIBER_MAX_PARK;
+
+	fiber->Suspend(period);
+	return true;
+}
+
+/********************************************
+// function name: 	fiber_set_delays
+// Description	: 	Turns the simulated delays of the program on or off, for the whole process. While they are off, fiber_sleep returns
+//					at once (the locks' holding period, the failures' penalty and the think time all cost nothing) - so a benchmark
+//					measures the bank itself. The waits for locks are not affected
+// Parameters	: 	enabled - true to sleep as usual (the default), false to skip the delays
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_set_delays(bool enabled) {
+	s_delays.store(enabled);
+}
+
+/********************************************
+// function name: 	fiber_key_create
+// Description	: 	Creates a fiber specific key - every fiber holds a value of its own for it (NULL at first)
+// Parameters	: 	destructor - called with the non-NULL value of a fiber when the fiber ends (NULL - none)
+// Returns		: 	int - the key, -1 in case FIBER_MAX_KEYS keys already exist
+// Exception	: 	None
+*/
+int fiber_key_create(fiber_key_destructor destructor) {
+	for (int key = 0; key < FIBER_MAX_KEYS; ++key) {
+		bool used = false;
+		if (s_key_used[key].load() || !s_key_used[key].compare_exchange_strong(used, true))
+			continue;
+
+		s_key_destructors[key] = destructor;
+		return key;
+	}
+
+	return -1;
+}
+
+/********************************************
+// function name: 	fiber_key_delete
+// Description	: 	Deletes a fiber specific key. The values the fibers hold for it are not released
+// Parameters	: 	key - the key
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_key_delete(int key) {
+	s_key_destructors[key] = NULL;
+	s_key_used[key].store(false);
+}
+
+/********************************************
+// function name: 	fiber_getspecific / fiber_setspecific
+// Description	: 	Return / set the value of a key for the calling fiber
+// Parameters	: 	key - the key
+//					value - the new value
+// Returns		: 	void* - the value (fiber_getspecific), NULL outside of a fiber
+// Exception	: 	None
+// Thread-safety:	Must be called by a fiber (fiber_setspecific does nothing outside of a fiber)
+*/
+void* fiber_getspecific(int key) {
+	Fiber* fiber = t_fiber;
+	return fiber ? fiber->m_specific[key] : NULL;
+}
+
+void fiber_setspecific(int key, void* value) {
+	Fiber* fiber = t_fiber;
+	if (fiber)
+		fiber->m_specific[key] = value;
+}
+
+/********************************************
+// function name: 	fiber_set_thread_delays
+// Description	: 	Turns the simulated delays on or off for the calling thread only (and the fibers it runs) - e.g. for the threads
+//					that serve the bank's socket clients, while the ATMs of the same process keep their pace. The delays are skipped
+//					in case either this or fiber_set_delays turned them off
+// Parameters	: 	enabled - true to sleep as usual (the default), false to skip the delays
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_set_thread_delays(bool enabled) {
+	t_delays = enabled;
+}
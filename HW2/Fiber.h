@@ -0,0 +1,231 @@
+/*
+ * Fiber.h
+ *
+ *  Created on: Jun 14, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : Fiber
+	Description : Cooperative user-level threads (fibers), run as the tasks of an Executor.
+					A fiber has a stack of its own (a ucontext), so it can suspend in the middle of its code - anywhere down the call chain -
+					and give its worker to another fiber. The waits of the program are made cooperative through two functions:
+					fiber_sleep (a simulated delay - the ATMs' think time and the locks' holding period) and fiber_park (a wait for a lock).
+					Inside a fiber they suspend the fiber, outside of a fiber they sleep (or park) the calling thread as before,
+					so the same code runs in both worlds, and a few workers can host hundreds of thousands of waiting fibers.
+	Main methods: 	1. Fiber::Step - resumes the fiber until it suspends again (or ends)
+					2. fiber_sleep - suspends the calling fiber for a period (usleep outside of a fiber)
+					3. fiber_park - suspends the calling fiber while it waits for a lock
+					4. fiber_key_create / fiber_getspecific / fiber_setspecific - per-fiber data, the way POSIX keys are per-thread data
+ */
+
+#ifndef FIBER_H_
+#define FIBER_H_
+
+#include <stddef.h>
+#include <ucontext.h>
+#include "Executor.h"
+
+#define FIBER_STACK_SIZE (64 * 1024) 	//the stack of a fiber. Its pages are committed only when they are touched
+#define FIBER_MIN_PARK 1000 			//the first period (in micro-seconds) a fiber waits for a lock before it checks it again
+#define FIBER_MAX_PARK 100000 			//the period is doubled on every check, up to this period
+#define FIBER_MAX_KEYS 8 				//the number of fiber specific keys that may exist at the same time
+
+typedef void (*fiber_key_destructor)(void*); //releases the value of a key when its fiber ends
+
+
+/********************************************
+// 	class name	: 	Fiber
+// 	Description	: 	A fiber - a task of an Executor that runs Run on a stack of its own.
+//					Every step of the task resumes the fiber, which runs until it suspends (fiber_sleep / fiber_park) or until Run returns.
+//					Once started, a fiber is pinned to the worker that runs it (it may hold thread-affine state, such as the locks
+//					it holds in the lock statistics, while it's suspended), so the fibers are balanced between the workers when they start.
+//					State that must follow the fiber itself - e.g. an epoch critical section, which stays open while the fiber sleeps
+//					and other fibers of the worker run - is kept in its fiber specific values (see fiber_key_create)
+//
+//	Members		:	m_context - the context of the fiber (saved when it suspends)
+//					m_caller - the context of the worker that resumed the fiber
+//					m_stack - the stack of the fiber (allocated when it starts, released when it ends)
+//					m_delay - the delay the fiber asked for when it last suspended
+//					m_park - the next period to wait for a lock (doubled on every consecutive wait)
+//					m_started / m_done - the state of the fiber
+//					m_specific - the values of the fiber specific keys (released by their destructors when the fiber ends)
+//
+//	Methods		:	Step - resumes the fiber
+//					Pinned - tells whether the fiber may move between the workers
+//					Run - the code of the fiber (implemented by a derived class)
+*/
+class Fiber : public executor_task {
+public:
+	Fiber();
+	virtual ~Fiber();
+
+	/********************************************
+	// function name: 	Fiber::Step
+	// Description	: 	Resumes the fiber (starts it in the first step), and returns once the fiber suspends or ends
+	// Parameters	: 	None
+	// Returns		: 	int - the delay the fiber asked for, or EXECUTOR_TASK_DONE once Run has returned
+	// Exception	: 	std::bad_alloc (the stack of the fiber, in the first step)
+	*/
+	virtual int Step();
+
+	virtual bool Pinned() const {
+		return m_started && !m_done;
+	}
+
+	/********************************************
+	// function name: 	Fiber::Suspend
+	// Description	: 	Suspends the fiber, and returns to the worker that resumed it. Must be called by the fiber itself
+	// Parameters	: 	delay - the delay (in micro-seconds) before the fiber is resumed again
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Suspend(unsigned delay);
+
+protected:
+	/********************************************
+	// function name: 	Fiber::Run
+	// Description	: 	The code of the fiber. Runs on the fiber's stack, and may suspend anywhere
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None (an exception must not leave the fiber)
+	*/
+	virtual void Run() = 0;
+
+private:
+	static void __trampoline();
+
+	void __release_specific();
+
+	friend void fiber_sleep(unsigned usec);
+	friend bool fiber_park();
+	friend void* fiber_getspecific(int key);
+	friend void fiber_setspecific(int key, void* value);
+
+private: //do not allow the user to copy the object
+	Fiber(Fiber const&);
+	Fiber& operator=(Fiber const&);
+
+private:
+	ucontext_t m_context;
+	ucontext_t m_caller;
+	char* m_stack;
+	unsigned m_delay;
+	unsigned m_park;
+	bool m_started;
+	bool m_done;
+	void* m_specific[FIBER_MAX_KEYS];
+};
+
+
+/********************************************
+// 	class name	: 	method_fiber
+// 	Description	: 	A fiber that runs a method (with no parameters) of an object - e.g. ATM::Main or Bank::Main
+//
+//	Members		:	m_object - the object
+//					m_method - a pointer to the method
+*/
+template <class T, class Method> class method_fiber : public Fiber {
+public:
+	method_fiber(T* object, Method method) : m_object(object), m_method(method) {}
+
+protected:
+	virtual void Run() {
+		(m_object->*m_method)();
+	}
+
+private:
+	T* m_object;
+	Method m_method;
+};
+
+//allocates a method_fiber (the types are deduced from the arguments)
+template <class T, class Method> Fiber* new_method_fiber(T* object, Method method) {
+	return new method_fiber<T, Method>(object, method);
+}
+
+
+/********************************************
+// function name: 	fiber_current
+// Description	: 	Returns the fiber the calling thread runs
+// Parameters	: 	None
+// Returns		: 	Fiber* - the fiber, NULL in case the thread doesn't run a fiber
+// Exception	: 	None
+*/
+Fiber* fiber_current();
+
+/********************************************
+// function name: 	fiber_sleep
+// Description	: 	Waits for a period. Inside a fiber the fiber is suspended (and the worker runs other fibers),
+//					outside of a fiber the calling thread sleeps
+// Parameters	: 	usec - the period (in micro-seconds)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_sleep(unsigned usec);
+
+/********************************************
+// function name: 	fiber_park
+// Description	: 	Waits for a lock to change its state, in case the caller is a fiber - the fiber is suspended for a period that grows
+//					with every consecutive wait (from FIBER_MIN_PARK to FIBER_MAX_PARK), and the caller checks the lock again.
+//					A thread that is not a fiber should park on the lock's futex instead
+// Parameters	: 	None
+// Returns		: 	bool - true if the caller is a fiber (and has waited), false otherwise
+// Exception	: 	None
+*/
+bool fiber_park();
+
+/********************************************
+// function name: 	fiber_set_delays
+// Description	: 	Turns the simulated delays of the program on or off, for the whole process. While they are off, fiber_sleep returns
+//					at once (the locks' holding period, the failures' penalty and the think time all cost nothing) - so a benchmark
+//					measures the bank itself. The waits for locks are not affected
+// Parameters	: 	enabled - true to sleep as usual (the default), false to skip the delays
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_set_delays(bool enabled);
+
+/********************************************
+// function name: 	fiber_set_thread_delays
+// Description	: 	Turns the simulated delays on or off for the calling thread only (and the fibers it runs) - e.g. for the threads
+//					that serve the bank's socket clients, while the ATMs of the same process keep their pace. The delays are skipped
+//					in case either this or fiber_set_delays turned them off
+// Parameters	: 	enabled - true to sleep as usual (the default), false to skip the delays
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_set_thread_delays(bool enabled);
+
+/********************************************
+// function name: 	fiber_key_create
+// Description	: 	Creates a fiber specific key - every fiber holds a value of its own for it (NULL at first)
+// Parameters	: 	destructor - called with the non-NULL value of a fiber when the fiber ends (NULL - none)
+// Returns		: 	int - the key, -1 in case FIBER_MAX_KEYS keys already exist
+// Exception	: 	None
+*/
+int fiber_key_create(fiber_key_destructor destructor);
+
+/********************************************
+// function name: 	fiber_key_delete
+// Description	: 	Deletes a fiber specific key. The values the fibers hold for it are not released
+// Parameters	: 	key - the key
+// Returns		: 	None
+// Exception	: 	None
+*/
+void fiber_key_delete(int key);
+
+/********************************************
+// function name: 	fiber_getspecific / fiber_setspecific
+// Description	: 	Return / set the value of a key for the calling fiber
+// Parameters	: 	key - the key
+//					value - the new value
+// Returns		: 	void* - the value (fiber_getspecific), NULL outside of a fiber
+// Exception	: 	None
+// Thread-safety:	Must be called by a fiber (fiber_setspecific does nothing outside of a fiber)
+*/
+void* fiber_getspecific(int key);
+void fiber_setspecific(int key, void* value);
+
+
+#endif /* FIBER_H_ */
@@ -1,4 +1,3 @@
-
 /*
  * Logger.cpp
  *
@@ -8,34 +7,351 @@
 #include "Logger.h"
 #include <exception>
 #include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define LOG_STAGING_SIZE 4096 //the size of a thread's private buffer. Longer messages are gathered on the heap
+
+
+/********************************************
+// 	struct name	: 	log_staging
+// 	Description	: 	The private buffer of a thread, where the fragments of a message are gathered until the message is complete.
+//					A thread stages messages for a single logger at a time (a partial message of another logger is dropped)
+*/
+struct log_staging {
+	Logger const* m_owner;
+	size_t m_len;
+	string* m_spill; 		//the message, once it doesn't fit into m_data (NULL otherwise)
+	char m_data[LOG_STAGING_SIZE];
+};
+
+static thread_local log_staging t_staging;
+
 
 //********************************************
 // function name: Logger::Logger
 // Description	: 	Construction of the logger class.
-//					Checks if file exists (else throws), and initializes the internal lock 
-//					for thread safety
+//					Checks if file can be opened (else throws), allocates the queue and starts the flusher thread
 // Parameters	: log_file : a string representing the path to the file
+//				  flush_interval : the interval (in micro-seconds) between flushes of an idle queue (default: LOG_FLUSH_INTERVAL)
+//				  durability : LOG_WRITE_BACK - write the batches only, LOG_DATA_SYNC - also sync every batch to the disk (default: LOG_WRITE_BACK)
+//				  capacity : the number of records in the queue, rounded up to a power of 2 (default: LOG_QUEUE_CAPACITY)
+//				  open_mode : LOG_TRUNCATE - the file is emptied, LOG_APPEND - the records are appended to it (default: LOG_TRUNCATE)
 // Returns		: None
-// Exception	: In case the file doesn't exist, throw an std::ifstream::failure error
-Logger::Logger(string log_file) : m_log(log_file, ofstream::out){
-	if (!m_log.is_open()) {
+// Exception	: In case the file can't be opened, throw an std::ofstream::failure error
+Logger::Logger(string log_file, unsigned flush_interval, log_durability durability, unsigned capacity, log_open_mode open_mode) :	m_fd(-1),
+																																		m_durability(durability),
+																																		m_flush_interval(flush_interval),
+																																		m_slots(NULL),
+																																		m_mask(0),
+																																		m_tail(0),
+																																		m_head(0),
+																																		m_written(0),
+																																		m_wakeup(0),
+																																		m_flushed(0),
+																																		m_running(true) {
+	m_fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (open_mode == LOG_TRUNCATE ? O_TRUNC : 0), 0644);
+	if (m_fd < 0) {
 		stringstream error;
 		error << "log file " << log_file << " could not be opened!" << endl;
 		throw ofstream::failure(error.str());
 	}
+
+	//round the capacity up to a power of 2, and initialize the records as free
+	uint64_t n = 1;
+	while (n < capacity) n <<= 1;
+	m_mask = n - 1;
+
+	m_slots = new record[n];
+	for (uint64_t i = 0; i < n; ++i) {
+		m_slots[i].m_seq.store(i);
+		m_slots[i].m_len = 0;
+		m_slots[i].m_overflow = NULL;
+	}
+
+	m_batch.reserve(LOG_BATCH_SIZE);
+
+	pthread_create(&m_flusher, NULL, __flusher_main, static_cast<void*>(this));
 }
 
 
 //********************************************
 // function name: Logger::~Logger
 // Description	: Destructor of the logger class
-//					Closes the file safely and releases the resource after that
+//					Stops the flusher (after it has written all of the published records), closes the file and releases the queue
 // Parameters	: None
 // Returns		: None
 Logger::~Logger(){
-	m_lock.WriteLock();
+	m_running.store(false);
+	++m_wakeup;
+	futex_wake(m_wakeup, 1);
+	pthread_join(m_flusher, NULL);
+
+	close(m_fd);
+	delete[] m_slots;
+}
+
+/********************************************
+// function name: 	Logger::Write
+// Description	: 	Appends characters to the message of the calling thread. The message is published as a single record
+//					once it ends with a new line (a message longer than the private buffer is gathered on the heap)
+// Parameters	: 	data - the characters to append
+//					len - the number of characters
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes (lock-free)
+*/
+void Logger::Write(const char* data, size_t len) {
+	log_staging& staging = t_staging;
+	if (staging.m_owner != this) {
+		staging.m_owner = this;
+		staging.m_len = 0;
+		delete staging.m_spill;
+		staging.m_spill = NULL;
+	}
+
+	//a complete message with nothing staged before it - publish it without copying it to the private buffer
+	if (staging.m_len == 0 && !staging.m_spill && len > 0 && data[len - 1] == '\n') {
+		__publish(data, len);
+		return;
+	}
+
+	//the message outgrows the private buffer - move it to the heap, so it is still published as a single record
+	if (!staging.m_spill && staging.m_len + len > LOG_STAGING_SIZE) {
+		staging.m_spill = new string(staging.m_data, staging.m_len);
+		staging.m_len = 0;
+	}
+
+	if (staging.m_spill) {
+		staging.m_spill->append(data, len);
+		if (len > 0 && data[len - 1] == '\n') {
+			__publish(staging.m_spill); //the record takes the string
+			staging.m_spill = NULL;
+		}
+		return;
+	}
+
+	memcpy(staging.m_data + staging.m_len, data, len);
+	staging.m_len += len;
+
+	if (staging.m_len > 0 && staging.m_data[staging.m_len - 1] == '\n') {
+		__publish(staging.m_data, staging.m_len);
+		staging.m_len = 0;
+	}
+}
+
+/********************************************
+// function name: 	Logger::Flush
+// Description	: 	Wakes the flusher, and waits until every record published so far is written to the file
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void Logger::Flush() {
+	uint64_t target = m_tail.load();
+	struct timespec timeout = {m_flush_interval / 1000000, (long)(m_flush_interval % 1000000) * 1000};
+
+	while (m_written.load() < target) {
+		uint32_t flushed = m_flushed.load();
+
+		++m_wakeup;
+		futex_wake(m_wakeup, 1);
+
+		if (m_written.load() < target)
+			futex_wait(m_flushed, flushed, &timeout);
+	}
+}
+
+/********************************************
+// function name: 	Logger::__flusher_main
+// Description	: 	The flusher thread's routine. Runs Logger::__flush_loop
+// Parameters	: 	logger - a void* to the Logger object
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* Logger::__flusher_main(void* logger) {
+	static_cast<Logger*>(logger)->__flush_loop();
+	pthread_exit((void*)0);
+}
+
+/********************************************
+// function name: 	Logger::__publish
+// Description	: 	Publishes a complete message as a single record of the queue. A message longer than the record's inline data
+//					is copied to the heap
+// Parameters	: 	data - the message
+//					len - the length of the message
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Logger::__publish(const char* data, size_t len) {
+	if (len <= LOG_RECORD_SIZE) {
+		uint64_t pos;
+		record* r = __claim(pos);
+		memcpy(r->m_data, data, len);
+		r->m_overflow = NULL;
+		__commit(r, pos, len);
+	}
+	else __publish(new string(data, len));
+}
+
+/********************************************
+// function name: 	Logger::__publish
+// Description	: 	Publishes a complete message that is already on the heap as a single record of the queue
+// Parameters	: 	message - the message. The record takes it (the flusher deletes it once it is written)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Logger::__publish(string* message) {
+	uint64_t pos;
+	record* r = __claim(pos);
+	r->m_overflow = message;
+	__commit(r, pos, message->size());
+}
+
+/********************************************
+// function name: 	Logger::__claim
+// Description	: 	Claims a free record by advancing the tail with a compare-and-swap.
+//					In case the queue is full, the flusher is woken up and the producer waits for a free record
+// Parameters	: 	pos - set to the position of the claimed record
+// Returns		: 	record* - the claimed record, to be filled and then committed (see __commit)
+// Exception	: 	None
+*/
+Logger::record* Logger::__claim(uint64_t& pos) {
+	pos = m_tail.load(memory_order_relaxed);
+	record* r;
+
+	while (true) {
+		r = &m_slots[pos & m_mask];
+		uint64_t seq = r->m_seq.load(memory_order_acquire);
+		int64_t diff = (int64_t)(seq - pos);
+
+		if (diff == 0) {
+			//the record is free, try to claim it
+			if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			//the queue is full, let the flusher make some room
+			++m_wakeup;
+			futex_wake(m_wakeup, 1);
+			sched_yield();
+			pos = m_tail.load(memory_order_relaxed);
+		}
+		else pos = m_tail.load(memory_order_relaxed);
+	}
+
+	return r;
+}
+
+/********************************************
+// function name: 	Logger::__commit
+// Description	: 	Marks a filled record as published
+// Parameters	: 	r - the record (see __claim)
+//					pos - the position of the record
+//					len - the length of the message
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Logger::__commit(record* r, uint64_t pos, size_t len) {
+	r->m_len = len;
+	r->m_seq.store(pos + 1, memory_order_release);
+
+	//wake the flusher earlier than its interval in case the queue is half full
+	if (pos - m_head.load(memory_order_relaxed) == (m_mask + 1) / 2) {
+		++m_wakeup;
+		futex_wake(m_wakeup, 1);
+	}
+}
+
+/********************************************
+// function name: 	Logger::__flush_loop
+// Description	: 	The main loop of the flusher. Drains the queue, then sleeps for the flush interval (or until woken up)
+//					Returns once the logger is being destroyed and the queue is empty
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Logger::__flush_loop() {
+	struct timespec timeout = {m_flush_interval / 1000000, (long)(m_flush_interval % 1000000) * 1000};
+
+	while (true) {
+		uint32_t wakeup = m_wakeup.load();
+		bool drained = __drain();
+
+		if (!drained && !m_running.load())
+			return;
+
+		futex_wait(m_wakeup, wakeup, &timeout);
+	}
+}
+
+/********************************************
+// function name: 	Logger::__drain
+// Description	: 	Moves all of the published records into batches, writes them to the file, and frees the records
+// Parameters	: 	None
+// Returns		: 	bool - true if any record was written
+// Exception	: 	None
+*/
+bool Logger::__drain() {
+	uint64_t head = m_head.load(memory_order_relaxed);
+	uint64_t first = head;
+
+	while (true) {
+		record& r = m_slots[head & m_mask];
+		if (r.m_seq.load(memory_order_acquire) != head + 1)
+			break; //not published yet
+
+		const char* data = r.m_overflow ? r.m_overflow->data() : r.m_data;
+		if (m_batch.size() + r.m_len > LOG_BATCH_SIZE)
+			__write_batch();
+		m_batch.append(data, r.m_len);
+
+		delete r.m_overflow;
+		r.m_overflow = NULL;
+
+		//free the record for the producers of the next round
+		r.m_seq.store(head + m_mask + 1, memory_order_release);
+		m_head.store(++head, memory_order_relaxed);
+	}
+
+	if (head == first)
+		return false;
+
+	__write_batch();
+	m_written.store(head);
+
+	//release the threads that wait for a flush
+	++m_flushed;
+	futex_wake(m_flushed, FUTEX_WAKE_ALL);
+	return true;
+}
+
+/********************************************
+// function name: 	Logger::__write_batch
+// Description	: 	Writes the gathered batch to the file with as few system calls as possible (and syncs it, if told so)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void Logger::__write_batch() {
+	const char* data = m_batch.data();
+	size_t left = m_batch.size();
+
+	while (left > 0) {
+		ssize_t n = write(m_fd, data, left);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break; //nothing to do about a failing log, drop the batch
+		}
+		data += n;
+		left -= n;
+	}
 
-	m_log.close();
+	if (m_durability == LOG_DATA_SYNC)
+		fdatasync(m_fd);
 
-	m_lock.WriteUnlock(false); //do not sleep before unlocking
+	m_batch.clear();
 }
@@ -7,47 +7,84 @@
 
   /*
 	Module Name : Logger
-	Description : An implementation of a thread-safe logger
+	Description : An implementation of a thread-safe, asynchronous logger.
+					Every thread builds its message in a private (thread-local) buffer. A complete message (one that ends with
+					a new line) is pushed as a single record to a bounded lock-free queue, so messages of different threads never
+					interleave. A background flusher thread drains the queue and writes the records in batches (group commit).
 	Main methods: 	1. operator << - a template output operator, enables ease of use (cout-like)
+					2. Write - appends raw characters to the message of the calling thread
+					3. Flush - waits until every message that was completed so far is written to the file
  */
- 
+
 #ifndef LOGGER_H_
 #define LOGGER_H_
 
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
+#include <sstream>
 #include <fstream>
-#include "rwlock.h"
+#include <atomic>
+#include "futex.h"
 
 using namespace std;
 
+#define LOG_RECORD_SIZE 240 			//the size of a record's inline data, longer messages are stored on the heap
+#define LOG_QUEUE_CAPACITY 16384 		//default number of records in the queue (must be a power of 2)
+#define LOG_FLUSH_INTERVAL 10000 		//default interval (in micro-seconds) between two flushes of the queue
+#define LOG_BATCH_SIZE (64 * 1024) 		//the maximal number of bytes written by a single write system call
+
+//the durability of the log file - write the batches to the page cache only, or also sync them to the disk
+typedef enum {LOG_WRITE_BACK, LOG_DATA_SYNC} log_durability;
 
+//the way the log file is opened - truncated, or appended to (a process that writes to the log of another process). The batches are
+//always written at the end of the file, so the loggers of several processes may share a file (their batches never overwrite each other)
+typedef enum {LOG_TRUNCATE, LOG_APPEND} log_open_mode;
 
 
 /********************************************
-// 	class name	: 	ATM_manager
-// 	Description	: 	An Implementation of a POSIX thread safe logger
+// 	class name	: 	Logger
+// 	Description	: 	An Implementation of a POSIX thread safe logger, with a background flusher thread
+//					The producers (the threads that log) never lock anything - a record is published to the queue with a single
+//					compare-and-swap. In case the queue is full, the producer wakes the flusher and waits for a free slot.
+//
+//	Members		:	m_fd : the file descriptor of the log file
+//					m_durability : the durability mode of the log
+//					m_flush_interval : the interval (in micro-seconds) the flusher sleeps when the queue is empty
+//					m_slots / m_mask : the queue (a ring of records) and capacity - 1
+//					m_tail : the position of the next record to be published (advanced by the producers)
+//					m_head : the position of the next record to be drained (advanced by the flusher only)
+//					m_written : all of the records before this position are written to the file
+//					m_wakeup / m_flushed : futex words. The flusher sleeps on m_wakeup, the threads that wait for a flush sleep on m_flushed
+//					m_running : false once the logger is being destroyed
+//					m_flusher : the flusher thread
+//					m_batch : the buffer the flusher gathers a batch of records into
 //
-//	Members		:	m_log  : an ofstream object, the log file stream
-//					m_lock : a rwlock object, the thread safe mechanism for protecting the m_log file
-//					
 //	Methods		:	operator << - overloading this operator in order to support simple syntax (cout-like)
+//					Write - append raw characters to the message of the calling thread
+//					Flush - wait until the completed messages are written
 */
 class Logger {
 public:
 	//********************************************
 	// function name: Logger::Logger
 	// Description	: 	Construction of the logger class.
-	//					Checks if file exists (else throws), and initializes the internal lock 
-	//					for thread safety
+	//					Checks if file can be opened (else throws), allocates the queue and starts the flusher thread
 	// Parameters	: log_file : a string representing the path to the file
+	//				  flush_interval : the interval (in micro-seconds) between flushes of an idle queue (default: LOG_FLUSH_INTERVAL)
+	//				  durability : LOG_WRITE_BACK - write the batches only, LOG_DATA_SYNC - also sync every batch to the disk (default: LOG_WRITE_BACK)
+	//				  capacity : the number of records in the queue, rounded up to a power of 2 (default: LOG_QUEUE_CAPACITY)
+	//				  open_mode : LOG_TRUNCATE - the file is emptied, LOG_APPEND - the records are appended to it (default: LOG_TRUNCATE)
 	// Returns		: None
-	// Exception	: In case the file doesn't exist, throw an std::ifstream::failure error
-	Logger(string m_log_file);
-	
+	// Exception	: In case the file can't be opened, throw an std::ofstream::failure error
+	Logger(string m_log_file, unsigned flush_interval = LOG_FLUSH_INTERVAL, log_durability durability = LOG_WRITE_BACK, unsigned capacity = LOG_QUEUE_CAPACITY,
+		   log_open_mode open_mode = LOG_TRUNCATE);
+
 	//********************************************
 	// function name: Logger::~Logger
 	// Description	: Destructor of the logger class
-	//					Closes the file safely and releases the resource after that
+	//					Stops the flusher (after it has written all of the published records), closes the file and releases the queue
 	// Parameters	: None
 	// Returns		: None
 	~Logger();
@@ -55,33 +92,97 @@ public:
 public:
 
 	/********************************************
-	// function name: 	ATM_manager::operator << 
+	// function name: 	Logger::operator <<
 	// Description	: 	Template out stream operator
 	// Parameters	: 	data - the data to be written to the stream
 	// Returns		: 	Logger& - a referece to this object
 	// Exception	: 	None
 	*/
 	template <class T> Logger& operator << (const T& data){
-		m_lock.WriteLock();
-		//critical section, modifying logger state
-		m_log << data;
-		//end of critical section
-		m_lock.WriteUnlock(false); //do not sleep before unlocking
+		ostringstream formatted;
+		formatted << data;
+		string const& str = formatted.str();
+		Write(str.data(), str.size());
+		return *this;
+	}
+
+	//same as above, without the formatting overhead for strings
+	Logger& operator << (string const& data){
+		Write(data.data(), data.size());
+		return *this;
+	}
+
+	Logger& operator << (const char* data){
+		Write(data, strlen(data));
 		return *this;
 	}
 
-	//same as above, but for endl support/overload
+	//same as above, but for endl support/overload. Every manipulator ends the message
 	Logger& operator << (ostream& (*pf)(ostream&)){
-		m_lock.WriteLock();
-		m_log << pf;
-		m_lock.WriteUnlock(); //do not sleep before unlocking
+		Write("\n", 1);
 		return *this;
 	}
 
+	/********************************************
+	// function name: 	Logger::Write
+	// Description	: 	Appends characters to the message of the calling thread. The message is published as a single record
+	//					once it ends with a new line (a message longer than the private buffer is gathered on the heap)
+	// Parameters	: 	data - the characters to append
+	//					len - the number of characters
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes (lock-free)
+	*/
+	void Write(const char* data, size_t len);
+
+	/********************************************
+	// function name: 	Logger::Flush
+	// Description	: 	Wakes the flusher, and waits until every record published so far is written to the file
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void Flush();
+
 private:
-	ofstream m_log;
-	mutable rwlock m_lock;
+	struct record {
+		atomic<uint64_t> m_seq; //the position of the record in the queue, tells whether the record is free or published
+		uint32_t m_len;
+		string* m_overflow; 	//the message, in case it doesn't fit into m_data
+		char m_data[LOG_RECORD_SIZE];
+	};
+
+	static void* __flusher_main(void* logger);
+
+	void __publish(const char* data, size_t len);
+	void __publish(string* message);
+	record* __claim(uint64_t& pos);
+	void __commit(record* r, uint64_t pos, size_t len);
+	void __flush_loop();
+	bool __drain();
+	void __write_batch();
+
+private: //do not allow the user to copy the object
+	Logger(Logger const&);
+	Logger& operator=(Logger const&);
+
+private:
+	int m_fd;
+	log_durability m_durability;
+	unsigned m_flush_interval;
+	record* m_slots;
+	uint64_t m_mask;
+	atomic<uint64_t> m_tail;
+	atomic<uint64_t> m_head;
+	atomic<uint64_t> m_written;
+	atomic<uint32_t> m_wakeup;
+	atomic<uint32_t> m_flushed;
+	atomic<bool> m_running;
+	pthread_t m_flusher;
+	string m_batch;
 };
 
 
 #endif /* LOGGER_H_ */
+
@@ -0,0 +1,172 @@
+/*
+ * Message.cpp
+ *
+ *  Created on: Jun 8, 2017
+ *      Author: dror
+ *
+ *	An implementation of the bank's fixed-format messages
+ */
+
+#include <string.h>
+#include "Message.h"
+#include "Logger.h"
+
+#define MSG_PLACEHOLDER "{}" //marks the place of an argument in a format
+
+//the formats of the bank's messages, indexed by bank_message (the texts are the ones the assignment requires, including their quirks)
+static const char* const message_formats[NUM_BANK_MESSAGES] = {
+	"{}: New account id is {} with password {} and initial balance {}\n",										//MSG_OPENED
+	"{}: Account {} is now closed. Balance was {}\n",															//MSG_CLOSED
+	"{}: Account {} new balance is {} after {}$ was deposited\n",												//MSG_DEPOSITED
+	"{}: Account {} new balance is {} after {}$ was withdrawn\n",												//MSG_WITHDRAWN
+	"{}: Account {} balance is {}\n",																			//MSG_BALANCE
+	"{}Transfer {} from account {} to account {} new account balance is {} new target account balance is {}\n",	//MSG_TRANSFERRED
+	"Bank: commissions of {} % were charged, the bank gained {} $ from account {}\n",							//MSG_COMMISSION
+	"Error {}: Your transaction failed - account with the same id exists\n",									//MSG_ACCOUNT_EXISTS
+	"Error {}: Your transaction failed - account with the same id exists\n",									//MSG_NO_ACCOUNT
+	"Error {}: Your transaction failed - account id {} does not exist\n",										//MSG_NO_TARGET
+	"Error {}: Your transaction failed - password for account id {} is incorrect\n",							//MSG_WRONG_PASSWORD
+	"Error: {}: Your transaction failed - password for account id {} is incorrect\n",							//MSG_WITHDRAW_WRONG_PASSWORD
+	"Error: {}: Your transaction failed - account id {} balance is lower than {}\n",							//MSG_WITHDRAW_LOW_BALANCE
+	"Error {}: Your transaction failed - account id {} balance is lower than{}\n"								//MSG_TRANSFER_LOW_BALANCE
+};
+
+
+//the arguments that tell balances - the index of the account's balance and of the target account's (-1 - none), indexed by bank_message
+static const int reply_balances[NUM_BANK_MESSAGES][2] = {
+	{3, -1},	//MSG_OPENED
+	{2, -1},	//MSG_CLOSED
+	{2, -1},	//MSG_DEPOSITED
+	{2, -1},	//MSG_WITHDRAWN
+	{2, -1},	//MSG_BALANCE
+	{4, 5},		//MSG_TRANSFERRED
+	{-1, -1},	//MSG_COMMISSION
+	{-1, -1},	//MSG_ACCOUNT_EXISTS
+	{-1, -1},	//MSG_NO_ACCOUNT
+	{-1, -1},	//MSG_NO_TARGET
+	{-1, -1},	//MSG_WRONG_PASSWORD
+	{-1, -1},	//MSG_WITHDRAW_WRONG_PASSWORD
+	{-1, -1},	//MSG_WITHDRAW_LOW_BALANCE
+	{-1, -1}	//MSG_TRANSFER_LOW_BALANCE
+};
+
+
+message_arg::message_arg(const char* value) : m_is_int(false), m_int(0), m_str(value), m_len(strlen(value)) {
+
+}
+
+/********************************************
+// function name: 	message_buffer::Format
+// Description	: 	Formats a typed message (replacing the content of the buffer). The message ends with a new line
+// Parameters	: 	message - the type of the message
+//					args - the arguments of the message, in the order of its format
+//					num_args - the number of arguments (missing arguments are left empty)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void message_buffer::Format(bank_message message, message_arg const* args, unsigned num_args) {
+	m_len = 0;
+
+	const char* format = message_formats[message];
+	unsigned next_arg = 0;
+	while (true) {
+		const char* placeholder = strstr(format, MSG_PLACEHOLDER);
+		if (!placeholder) break;
+
+		Append(format, placeholder - format);
+		if (next_arg < num_args)
+			__append(args[next_arg++]);
+		format = placeholder + sizeof(MSG_PLACEHOLDER) - 1;
+	}
+	Append(format, strlen(format));
+
+	//a truncated message still ends the line
+	if (m_len == MSG_BUFFER_SIZE && !m_overflow)
+		m_data[m_len - 1] = '\n';
+}
+
+/********************************************
+// function name: 	message_buffer::operator <<
+// Description	: 	Appends the decimal representation of an integer to the buffer
+// Parameters	: 	value - the integer
+// Returns		: 	message_buffer& - a reference to this object
+// Exception	: 	None
+*/
+message_buffer& message_buffer::operator << (int value) {
+	char digits[16];
+	unsigned n = sizeof(digits);
+
+	//work on the negative value, so INT_MIN doesn't overflow. The digits are written from the end of the array
+	int rest = value < 0 ? value : -value;
+	do {
+		digits[--n] = '0' - (rest % 10);
+		rest /= 10;
+	} while (rest != 0);
+	if (value < 0)
+		digits[--n] = '-';
+
+	Append(digits + n, sizeof(digits) - n);
+	return *this;
+}
+
+message_buffer& message_buffer::operator << (const char* value) {
+	Append(value, strlen(value));
+	return *this;
+}
+
+message_buffer& message_buffer::operator << (string const& value) {
+	Append(value.data(), value.size());
+	return *this;
+}
+
+/********************************************
+// function name: 	message_buffer::Append
+// Description	: 	Appends raw characters to the buffer. In case they don't fit, the buffer is written to the logger first (and
+//					characters that don't fit even into an empty buffer are written right after it), or they are truncated without a logger
+// Parameters	: 	data - the characters
+//					len - the number of characters
+// Returns		: 	None
+// Exception	: 	None
+*/
+void message_buffer::Append(const char* data, size_t len) {
+	if (len > MSG_BUFFER_SIZE - m_len && m_overflow) {
+		m_overflow->Write(m_data, m_len);
+		m_len = 0;
+		if (len > MSG_BUFFER_SIZE) {
+			m_overflow->Write(data, len);
+			return;
+		}
+	}
+
+	if (len > MSG_BUFFER_SIZE - m_len)
+		len = MSG_BUFFER_SIZE - m_len;
+	memcpy(m_data + m_len, data, len);
+	m_len += len;
+}
+
+void message_buffer::__append(message_arg const& arg) {
+	if (arg.m_is_int)
+		*this << arg.m_int;
+	else
+		Append(arg.m_str, arg.m_len);
+}
+
+/********************************************
+// function name: 	bank_reply::Set
+// Description	: 	Sets the reply to a message an operation reports, and picks the balances out of its arguments
+// Parameters	: 	message - the type of the message
+//					args - the arguments of the message, in the order of its format
+//					num_args - the number of arguments
+// Returns		: 	None
+// Exception	: 	None
+*/
+void bank_reply::Set(bank_message message, message_arg const* args, unsigned num_args) {
+	m_message = message;
+	m_balance = m_target_balance = 0;
+
+	int balance = reply_balances[message][0], target_balance = reply_balances[message][1];
+	if (balance >= 0 && (unsigned)balance < num_args && args[balance].m_is_int)
+		m_balance = args[balance].m_int;
+	if (target_balance >= 0 && (unsigned)target_balance < num_args && args[target_balance].m_is_int)
+		m_target_balance = args[target_balance].m_int;
+}
@@ -0,0 +1,146 @@
+/*
+ * Message.h
+ *
+ *  Created on: Jun 8, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : Message
+	Description : Fixed-format messages of the bank, formatted without any heap allocation.
+					Every message the bank reports is a typed record (bank_message) with a constant format, whose arguments
+					(integers and strings) are formatted into a fixed-size buffer (message_buffer) living on the formatting thread's stack.
+					A message that outgrows the buffer is handed to the logger in parts, and the logger gathers them into a single record.
+	Main methods: 	1. message_buffer::Format - format a typed message with its arguments
+					2. message_buffer::operator << - append an integer or a string to the buffer (cout-like)
+ */
+
+#ifndef MESSAGE_H_
+#define MESSAGE_H_
+
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+#define MSG_BUFFER_SIZE 256 //the size of a message's buffer, longer messages overflow to the logger (or are truncated without one)
+
+class Logger;
+
+//the messages the bank reports to the log. The format of every message is constant (see Message.cpp)
+typedef enum {
+	MSG_OPENED,					//atm, account, password, balance
+	MSG_CLOSED,					//atm, account, balance
+	MSG_DEPOSITED,				//atm, account, new balance, amount
+	MSG_WITHDRAWN,				//atm, account, new balance, amount
+	MSG_BALANCE,				//atm, account, balance
+	MSG_TRANSFERRED,			//atm, amount, account, target account, new balance, new target balance
+	MSG_COMMISSION,				//percents, commission, account
+	MSG_ACCOUNT_EXISTS,			//atm
+	MSG_NO_ACCOUNT,				//atm
+	MSG_NO_TARGET,				//atm, target account
+	MSG_WRONG_PASSWORD,			//atm, account
+	MSG_WITHDRAW_WRONG_PASSWORD,//atm, account
+	MSG_WITHDRAW_LOW_BALANCE,	//atm, account, amount
+	MSG_TRANSFER_LOW_BALANCE,	//atm, account, amount
+	NUM_BANK_MESSAGES
+} bank_message;
+
+
+/********************************************
+// 	class name	: 	message_arg
+// 	Description	: 	An argument of a typed message - an integer or a string. A string argument is referenced, not copied,
+//					so it must outlive the formatting
+*/
+class message_arg {
+public:
+	message_arg(int value) : m_is_int(true), m_int(value), m_str(NULL), m_len(0) {}
+	message_arg(string const& value) : m_is_int(false), m_int(0), m_str(value.data()), m_len(value.size()) {}
+	message_arg(const char* value);
+
+private:
+	friend class message_buffer;
+	friend struct bank_reply;
+
+	bool m_is_int;
+	int m_int;
+	const char* m_str;
+	size_t m_len;
+};
+
+
+/********************************************
+// 	struct name	: 	bank_reply
+// 	Description	: 	The outcome of an ATM operation, as a client of the bank sees it - the message the operation has reported, and the
+//					balances the message tells (see Bank::Serve)
+*/
+struct bank_reply {
+	bank_message m_message;	//NUM_BANK_MESSAGES - nothing was reported
+	int m_balance;			//the balance of the account after the operation (0 - the message tells none)
+	int m_target_balance;	//the balance of the target account, after a transfer
+
+	bank_reply() : m_message(NUM_BANK_MESSAGES), m_balance(0), m_target_balance(0) {}
+
+	/********************************************
+	// function name: 	bank_reply::Set
+	// Description	: 	Sets the reply to a message an operation reports, and picks the balances out of its arguments
+	// Parameters	: 	message - the type of the message
+	//					args - the arguments of the message, in the order of its format
+	//					num_args - the number of arguments
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Set(bank_message message, message_arg const* args, unsigned num_args);
+};
+
+
+/********************************************
+// 	class name	: 	message_buffer
+// 	Description	: 	A fixed-size buffer a message is formatted into. Never allocates by itself - once the buffer is full, its content is
+//					written to the buffer's logger as the beginning of the message (the logger stages the parts of a message until it
+//					ends with a new line, so the message is still logged whole, as a single record). Without a logger the text is truncated
+//
+//	Members		:	m_data - the characters of the message (the part that hasn't been written to the logger)
+//					m_len - the length of that part
+//					m_overflow - the logger the beginning of a long message is written to (NULL - truncate)
+//
+//	Methods		:	Format - format a typed message
+//					operator << - append an integer or a string
+//					Data / Size - the formatted message
+*/
+class message_buffer {
+public:
+	message_buffer(Logger* overflow = NULL) : m_len(0), m_overflow(overflow) {}
+
+	/********************************************
+	// function name: 	message_buffer::Format
+	// Description	: 	Formats a typed message (replacing the content of the buffer). The message ends with a new line
+	// Parameters	: 	message - the type of the message
+	//					args - the arguments of the message, in the order of its format
+	//					num_args - the number of arguments (missing arguments are left empty)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Format(bank_message message, message_arg const* args, unsigned num_args);
+
+	message_buffer& operator << (int value);
+	message_buffer& operator << (const char* value);
+	message_buffer& operator << (string const& value);
+
+	void Append(const char* data, size_t len);
+	void Clear() { m_len = 0; }
+
+	const char* Data() const { return m_data; }
+	size_t Size() const { return m_len; }
+
+private:
+	void __append(message_arg const& arg);
+
+private:
+	char m_data[MSG_BUFFER_SIZE];
+	size_t m_len;
+	Logger* m_overflow;
+};
+
+
+#endif /* MESSAGE_H_ */
@@ -0,0 +1,120 @@
+/*
+ * Options.h
+ *
+ *  Created on: Jun 12, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : Options
+	Description : The run-time options of the system, given as flags on the command line before the number of ATMs:
+					./Bank [options] <num_atms> <atm_file_1> ... <atm_file_n>
+					The options are parsed once, by the main thread, and passed down to the blocks of the system (read only).
+ */
+
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+#include <string>
+
+#define WAL_SYNC_INTERVAL 2000 //the default interval (in micro-seconds) between two syncs of the write-ahead log, in batch / async mode
+#define CHECKPOINT_PERIOD 30 	//the default period (in seconds) between two checkpoints of the bank
+
+//the way an ATM reads its command file
+typedef enum {
+	ATM_LOAD_PRELOAD,	//the whole file is parsed before the ATM starts (the default)
+	ATM_LOAD_STREAM		//-s / --stream : the file is parsed by a background I/O thread while the ATM runs, in constant memory
+} atm_load_mode;
+
+//the way the ATMs are run
+typedef enum {
+	ATM_RUN_THREADS,		//a thread per ATM (the default)
+	ATM_RUN_EXECUTOR,		//-w / --workers=<n> : the ATMs are tasks of a work-stealing pool of n workers (a worker per core by default)
+	ATM_RUN_FIBERS,			//-f / --fibers : the ATMs are fibers on the pool - the think time and the waits for locks suspend the fibers
+	ATM_RUN_VIRTUAL_CLOCK,	//-v / --virtual-clock : the ATMs and the bank's threads are fibers on a single thread, in simulated time
+							//(deterministic - the same seed replays the same interleaving, and the same log)
+	ATM_RUN_PROCESSES		//-p / --processes : the accounts live in a shared memory segment (see SharedBank), and every ATM is a process
+							//of its own that attaches to it - a crashed ATM doesn't take the bank (or the other ATMs) down with it.
+							//The write-ahead log, the checkpoints, --lock-free and --metrics are features of the in-process Bank only
+} atm_run_mode;
+
+//when a committed mutation of the bank is durable (see WriteAheadLog)
+typedef enum {
+	WAL_SYNC_TXN,		//--wal-mode=txn : an operation returns once its record is synced to the disk (the concurrent operations share a sync)
+	WAL_SYNC_BATCH,		//--wal-mode=batch : same, but the log is synced every interval only - fewer syncs, longer waits
+	WAL_SYNC_ASYNC		//--wal-mode=async : an operation doesn't wait, the log is synced every interval (a crash loses the last interval)
+} wal_sync_mode;
+
+
+/********************************************
+// 	struct name	: 	system_options
+// 	Description	: 	The options of a run of the system. A default constructed object holds the default options
+//
+//	Members		:	m_load_mode - the way the ATMs read their command files
+//					m_run_mode - the way the ATMs are run
+//					m_num_workers - the number of workers of the pool, in ATM_RUN_EXECUTOR / ATM_RUN_FIBERS mode (0 - a worker per core)
+//					m_seed - --seed=<n> : the seed of the run's randomness - the commissions' rates, and the interleaving of the virtual clock
+//							 (0 - not given: the clock's time in the real modes, 1 in ATM_RUN_VIRTUAL_CLOCK mode)
+//					m_log_path - the path of the bank's log (./log.txt)
+//					m_log_interval - --log-interval=<usec> : the interval between two flushes of the log's queue when it's idle
+//									 (0 - LOG_FLUSH_INTERVAL, the default; see Logger)
+//					m_log_sync - --log-sync : every batch of the log is synced to the disk (LOG_DATA_SYNC), not only written to the page cache
+//					m_lock_stats - --lock-stats[=<sec>] : instrument the locks, and report their contention statistics to stderr every
+//								   m_lock_stats_period seconds (0 - only on SIGUSR1), and at the end of the run
+//					m_wal_path - --wal=<path> : the write-ahead log of the bank. The bank is recovered from it at startup, and logs its
+//								 mutations to it (empty - no log, the default)
+//					m_wal_mode / m_wal_interval - --wal-mode=txn|batch|async, --wal-interval=<usec> : the sync mode of the log, and the
+//								 interval of its syncs in batch / async mode
+//					m_checkpoint_path - --checkpoint=<path> : the checkpoint of the bank. The bank is restored from it at startup (and from the
+//										write-ahead log's records after it), and checkpoints itself every m_checkpoint_period seconds -
+//										--checkpoint-period=<sec> - and at the end of the run (empty - no checkpoints, the default)
+//					m_lock_free - --lock-free : deposits, withdrawals and balance queries update the accounts' balances with atomic
+//								  instructions instead of locking the accounts (see BankAccount). Ignored with a write-ahead log
+//					m_metrics - --metrics : report the bank's operation counters (see bank_metrics) to stderr at the end of the run
+//					m_shm_name - --shm=<name> : the name of the shared memory segment of the bank in ATM_RUN_PROCESSES mode
+//								 (empty - /bank.<pid>, the default)
+//					m_attach - --attach=<name> : the bank is not created - the ATMs of the command line attach to the shared memory segment
+//							   of a running bank (of ATM_RUN_PROCESSES mode) instead, and run against it. The ATM processes of the bank are
+//							   started this way, and more ATM front-ends can join the bank the same way while it runs
+//					m_first_atm_id - --atm-id=<n> : the id of the first ATM of the command line (the rest are numbered after it, 1 by default)
+//					m_serve_address - --serve=unix:<path>|tcp:<port> : the bank serves the operations of clients on a local socket besides its
+//									  ATMs (see BankServer), until the process gets SIGINT or SIGTERM. The clients' operations run
+//									  without the simulated delays (the ATMs keep theirs). A feature of the in-process Bank in the real modes (not of a virtual clock, nor of
+//									  processes mode). The number of ATMs may be 0 (empty - no server, the default)
+//					m_sharded / m_num_shards - --shards[=<n>] : the bank is a ShardedBank of n single-writer shards (0 - a shard per core) -
+//									  the accounts are partitioned among owner threads that run the operations, and nothing is locked.
+//									  A mode of the real ATM modes (not of a virtual clock, nor of processes mode). The write-ahead log,
+//									  the checkpoints, --lock-free, --metrics and --serve are features of the in-process Bank only
+*/
+struct system_options {
+	atm_load_mode m_load_mode;
+	atm_run_mode m_run_mode;
+	unsigned m_num_workers;
+	unsigned m_seed;
+	std::string m_log_path;
+	unsigned m_log_interval;
+	bool m_log_sync;
+	bool m_lock_stats;
+	unsigned m_lock_stats_period;
+	std::string m_wal_path;
+	wal_sync_mode m_wal_mode;
+	unsigned m_wal_interval;
+	std::string m_checkpoint_path;
+	unsigned m_checkpoint_period;
+	bool m_lock_free;
+	bool m_metrics;
+	std::string m_shm_name;
+	bool m_attach;
+	int m_first_atm_id;
+	std::string m_serve_address;
+	bool m_sharded;
+	unsigned m_num_shards;
+
+	system_options() :	m_load_mode(ATM_LOAD_PRELOAD), m_run_mode(ATM_RUN_THREADS), m_num_workers(0), m_seed(0), m_log_path("./log.txt"),
+						m_log_interval(0), m_log_sync(false), m_lock_stats(false), m_lock_stats_period(0), m_wal_mode(WAL_SYNC_TXN), m_wal_interval(WAL_SYNC_INTERVAL),
+						m_checkpoint_period(CHECKPOINT_PERIOD), m_lock_free(false), m_metrics(false),
+						m_attach(false), m_first_atm_id(1), m_sharded(false), m_num_shards(0) {}
+};
+
+
+#endif /* OPTIONS_H_ */
@@ -0,0 +1,735 @@
+/*
+ * ShardedBank.cpp
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ *
+ *	An implementation of the ShardedBank class
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include "ShardedBank.h"
+#include "Fiber.h"
+#include "futex.h"
+
+#define SHARD_PENDING_WAIT 1000 	//the longest sleep (in micro-seconds) of an owner that has pending messages for a full link
+
+
+ShardedBank::shard::shard(ShardedBank* bank, unsigned index, unsigned num_shards) :	m_bank(bank),
+																						m_index(index),
+																						m_inbox(SHARD_INBOX_CAPACITY),
+																						m_links(num_shards, NULL),
+																						m_pending(num_shards),
+																						m_num_pending(0),
+																						m_commission(NULL),
+																						m_commission_next(0),
+																						m_sleeping(0) {
+	for (unsigned from = 0; from < num_shards; ++from) {
+		if (from != index)
+			m_links[from] = new spsc_queue<shard_message>(SHARD_LINK_CAPACITY);
+	}
+}
+
+ShardedBank::shard::~shard() {
+	for (unsigned from = 0; from < m_links.size(); ++from)
+		delete m_links[from];
+}
+
+/********************************************
+// function name: 	ShardedBank::ShardedBank
+// Description	: 	Constructor.
+//					Creates the shards (their inboxes, and a link from every shard to every other shard) and starts their owners.
+//					The log is opened at the options' log path
+// Parameters	: 	options - the options of the run - the number of shards (m_num_shards, 0 - a shard per core), the log path and the seed
+// Returns		: 	None
+// Exception	: 	std::ofstream::failure in case the log can't be opened, std::bad_alloc
+*/
+ShardedBank::ShardedBank(system_options const& options) :	m_logger(options.m_log_path, options.m_log_interval ? options.m_log_interval : LOG_FLUSH_INTERVAL,
+																	 options.m_log_sync ? LOG_DATA_SYNC : LOG_WRITE_BACK, LOG_QUEUE_CAPACITY, LOG_TRUNCATE),
+															m_bank_balance(0),
+															m_seed(options.m_seed),
+															m_atms_done(UINT32_MAX) {
+	unsigned num_shards = options.m_num_shards;
+	if (num_shards == 0) {
+		long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+		num_shards = num_cores > 0 ? num_cores : 1;
+	}
+
+	for (unsigned i = 0; i < num_shards; ++i)
+		m_shards.push_back(new shard(this, i, num_shards));
+
+	for (unsigned i = 0; i < num_shards; ++i) {
+		if (pthread_create(&m_shards[i]->m_owner, NULL, __owner_main, m_shards[i]) != 0) {
+			cerr << "error: pthread_create failed" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/********************************************
+// function name: 	ShardedBank::~ShardedBank
+// Description	: 	Destructor.
+//					Stops the owners of the shards (after the messages that were sent before), and releases the shards
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+ShardedBank::~ShardedBank() {
+	shard_message stop = shard_message();
+	stop.m_type = SHARD_STOP;
+	for (unsigned i = 0; i < m_shards.size(); ++i)
+		__post(*m_shards[i], stop);
+
+	for (unsigned i = 0; i < m_shards.size(); ++i) {
+		pthread_join(m_shards[i]->m_owner, NULL);
+		delete m_shards[i];
+	}
+}
+
+
+//*******************************************Background jobs of the bank*******************************************
+
+/********************************************
+// function name: 	ShardedBank::Main
+// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second and the commission passes every
+//					3 seconds - until the last ATM is done, then flushes the log and prints the final status
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::Main() {
+	std::srand(m_seed ? m_seed : std::time(NULL));
+
+	TimerWheel jobs;
+	jobs.Schedule(new_method_timer_job(this, &ShardedBank::PrintBankStats), HALF_SEC);
+	jobs.Schedule(new_method_timer_job(this, &ShardedBank::ChargeCommissionPass), THREE_SEC);
+	jobs.Run(m_atms_done);
+
+	m_logger.Flush(); //the log of the ATMs' operations is written before their final status is printed
+	PrintBankStats();
+}
+
+/********************************************
+// function name: 	ShardedBank::ChargeCommissionPass
+// Description	: 	A commission pass - draws an interest rate (2%-4%), has every shard charge it from its accounts (in parallel, on the
+//					owners), and adds the total to the bank's balance
+// Parameters	: 	None
+// Returns		: 	int - the total commission charged in the pass
+// Exception	: 	None
+*/
+int ShardedBank::ChargeCommissionPass() {
+	float interest = (HIGHEST_INTEREST - LOWEST_INTEREST) * fabsf(static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) + LOWEST_INTEREST;
+
+	shard_job job(m_shards.size(), interest);
+	__run_job(SHARD_COMMISSION, job);
+
+	int total = job.m_commission.load();
+	m_bank_balance.fetch_add(total);
+	return total;
+}
+
+/********************************************
+// function name: 	ShardedBank::PrintBankStats
+// Description	: 	Prints the status of the bank (the open accounts, sorted by their numbers, and the bank's balance) - every shard
+//					copies its accounts on its owner
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::PrintBankStats() {
+	shard_job job(m_shards.size(), 0);
+	__run_job(SHARD_STATUS, job);
+
+	vector<shard_account_status> accounts;
+	for (unsigned i = 0; i < job.m_accounts.size(); ++i)
+		accounts.insert(accounts.end(), job.m_accounts[i].begin(), job.m_accounts[i].end());
+	sort(accounts.begin(), accounts.end());
+
+	ostringstream screen;
+	screen << "\033[H\033[J";   //clear the screen
+	screen << "\033[1;1H"; //move the cursor to the top left corner of the screen
+	screen << "Current Bank Status" << endl;
+	for (unsigned i = 0; i < accounts.size(); ++i) {
+		screen << "Account " << accounts[i].m_account_no << ": Balance - "
+				<< accounts[i].m_balance << " $ ," << "Account Password - "
+				<< accounts[i].m_password << endl;
+	}
+	screen << "The Bank has " << m_bank_balance.load() << " $" << endl;
+
+	cout << screen.str() << flush;
+}
+
+
+//*******************************API for usage by ATMs************************************************************************
+
+/********************************************
+// function name: 	ShardedBank::OpenAccount
+// Description	: 	Open a new account in the bank (on the owner of the account's shard)
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					balance - the beginning balance of the new account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that already exists, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::OpenAccount(int account_no, string const& password, int balance, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_OPEN;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_amount = balance;
+	message.m_password = &password;
+	return __call(message);
+}
+
+/********************************************
+// function name: 	ShardedBank::RemoveAccount
+// Description	: 	Remove an account from the bank
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::RemoveAccount(int account_no, string const& password, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_CLOSE;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_password = &password;
+	return __call(message);
+}
+
+/********************************************
+// function name: 	ShardedBank::Deposit
+// Description	: 	Deposit money to a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount of money to be deposited
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::Deposit(int account_no, string const& password, int amount, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_DEPOSIT;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_amount = amount;
+	message.m_password = &password;
+	return __call(message);
+}
+
+/********************************************
+// function name: 	ShardedBank::Withdraw
+// Description	: 	Withdraw money from a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount of money to be withdrawn
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect or withdrawl failed, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::Withdraw(int account_no, string const& password, int amount, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_WITHDRAW;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_amount = amount;
+	message.m_password = &password;
+	return __call(message);
+}
+
+/********************************************
+// function name: 	ShardedBank::Balance
+// Description	: 	Get the balance of a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::Balance(int account_no, string const& password, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_BALANCE;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_password = &password;
+	return __call(message);
+}
+
+/********************************************
+// function name: 	ShardedBank::Transfer
+// Description	: 	Transfer money from a certain account to another
+//					The operation is sent to the source's shard, which passes it on to the target's shard (see __transfer / __credit)
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					account_target - the target account number
+//					amount - the amount of money to be transfered
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect or target account wasn't found, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool ShardedBank::Transfer(int account_no, string const& password, int account_target, int amount, int atm_id) {
+	shard_message message = shard_message();
+	message.m_type = SHARD_TRANSFER;
+	message.m_atm_id = atm_id;
+	message.m_account = account_no;
+	message.m_target = account_target;
+	message.m_amount = amount;
+	message.m_password = &password;
+	return __call(message);
+}
+
+
+//*********************************************************messaging*********************************************************
+
+/********************************************
+// function name: 	ShardedBank::__call
+// Description	: 	Sends an operation to the shard of its account, waits for the reply, and sleeps for a second (the pace of an operation)
+// Parameters	: 	message - the operation (its reply is set by the call)
+// Returns		: 	bool - the result of the operation
+// Exception	: 	None
+*/
+bool ShardedBank::__call(shard_message& message) {
+	shard_reply reply;
+	reply.m_state.store(REPLY_PENDING, memory_order_relaxed);
+	reply.m_result = false;
+	message.m_reply = &reply;
+	__post(*m_shards[__shard_of(message.m_account)], message);
+
+	//spin for a short reply, then sleep until the owner (the last one of a transfer) completes it
+	for (unsigned spins = 0; spins < SHARD_SPIN && reply.m_state.load(memory_order_acquire) != REPLY_DONE; ++spins)
+		cpu_relax();
+	Fiber* fiber = fiber_current();
+	while (reply.m_state.load(memory_order_acquire) != REPLY_DONE) {
+		if (fiber) {
+			fiber->Suspend(0); //the worker runs the other fibers meanwhile
+			continue;
+		}
+		uint32_t pending = REPLY_PENDING;
+		if (reply.m_state.compare_exchange_strong(pending, REPLY_SLEEPING) || pending == REPLY_SLEEPING)
+			futex_wait(reply.m_state, REPLY_SLEEPING);
+	}
+
+	fiber_sleep(ONE_SEC); //sleep for a second (the account isn't held meanwhile)
+	return reply.m_result;
+}
+
+/********************************************
+// function name: 	ShardedBank::__post
+// Description	: 	Pushes a message into the inbox of a shard (waits while the inbox is full), and wakes the owner if it sleeps
+// Parameters	: 	target - the shard
+//					message - the message
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void ShardedBank::__post(shard& target, shard_message const& message) {
+	Fiber* fiber = fiber_current();
+	while (!target.m_inbox.TryPush(message)) {
+		__wake(target);
+		if (fiber)
+			fiber->Suspend(0);
+		else
+			sched_yield();
+	}
+	__wake(target);
+}
+
+/********************************************
+// function name: 	ShardedBank::__forward
+// Description	: 	Sends a message from the owner of a shard to another shard, over their link. A message the link can't take (it's
+//					full) waits in the sender's pending messages, so an owner never blocks on another owner
+// Parameters	: 	from - the sending shard (called by its owner)
+//					to - the index of the receiving shard
+//					message - the message
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void ShardedBank::__forward(shard& from, unsigned to, shard_message const& message) {
+	shard& target = *m_shards[to];
+	if (!from.m_pending[to].empty() || !target.m_links[from.m_index]->TryPush(message)) {
+		from.m_pending[to].push_back(message); //behind the earlier pending messages, to keep the order of the link
+		++from.m_num_pending;
+	}
+	__wake(target);
+}
+
+//wakes the owner of a shard, if it sleeps
+void ShardedBank::__wake(shard& target) {
+	//the fence orders the push before the read of the flag (the owner sets the flag before it checks its queues again)
+	atomic_thread_fence(memory_order_seq_cst);
+	if (target.m_sleeping.load(memory_order_relaxed) && target.m_sleeping.exchange(0))
+		futex_wake(target.m_sleeping, 1);
+}
+
+//completes the reply of an operation, and wakes its ATM if it sleeps
+void ShardedBank::__complete(shard_reply* reply, bool result) {
+	reply->m_result = result;
+	if (reply->m_state.exchange(REPLY_DONE) == REPLY_SLEEPING)
+		futex_wake(reply->m_state, 1); //the word may be reused by now - a stray wake is harmless (futex waiters check again)
+}
+
+void* ShardedBank::__owner_main(void* arg) {
+	shard* self = static_cast<shard*>(arg);
+	self->m_bank->__run_owner(*self);
+	return NULL;
+}
+
+/********************************************
+// function name: 	ShardedBank::__run_owner
+// Description	: 	The loop of a shard's owner - handles the messages of its links and of its inbox, sends its pending messages, and
+//					sleeps while there is nothing to do, until it gets SHARD_STOP
+// Parameters	: 	self - the shard
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::__run_owner(shard& self) {
+	unsigned idle = 0;
+	bool running = true;
+	while (running) {
+		bool busy = self.m_num_pending > 0 && __send_pending(self);
+
+		//the links first - they carry the second halves of transfers, whose ATMs are waiting already
+		shard_message message;
+		for (unsigned from = 0; from < self.m_links.size(); ++from) {
+			if (!self.m_links[from])
+				continue;
+			while (self.m_links[from]->TryPop(message)) {
+				__handle(self, message);
+				busy = true;
+			}
+		}
+
+		for (unsigned i = 0; i < SHARD_BATCH && running && self.m_inbox.TryPop(message); ++i) {
+			running = __handle(self, message);
+			busy = true;
+		}
+
+		if (self.m_commission) {
+			__charge_commission(self);
+			busy = true;
+		}
+
+		if (busy) {
+			idle = 0;
+			continue;
+		}
+		if (++idle < SHARD_SPIN) {
+			cpu_relax();
+			continue;
+		}
+
+		//nothing to do - sleep, unless a message has come in after the flag is set (see __wake)
+		self.m_sleeping.store(1);
+		atomic_thread_fence(memory_order_seq_cst);
+		bool empty = self.m_inbox.Empty();
+		for (unsigned from = 0; from < self.m_links.size() && empty; ++from)
+			empty = !self.m_links[from] || self.m_links[from]->Empty();
+		if (empty) {
+			//a full link is drained by its receiver without waking this owner, so the pending messages are retried periodically
+			struct timespec pending_wait = {0, SHARD_PENDING_WAIT * 1000};
+			futex_wait(self.m_sleeping, 1, self.m_num_pending > 0 ? &pending_wait : NULL);
+		}
+		self.m_sleeping.store(0);
+		idle = 0;
+	}
+}
+
+//sends the pending messages of a shard that its links can take now. Returns whether any was sent
+bool ShardedBank::__send_pending(shard& self) {
+	bool sent = false;
+	for (unsigned to = 0; to < self.m_pending.size(); ++to) {
+		deque<shard_message>& pending = self.m_pending[to];
+		shard& target = *m_shards[to];
+		bool pushed = false;
+		while (!pending.empty() && target.m_links[self.m_index]->TryPush(pending.front())) {
+			pending.pop_front();
+			--self.m_num_pending;
+			pushed = true;
+		}
+		if (pushed) {
+			__wake(target);
+			sent = true;
+		}
+	}
+	return sent;
+}
+
+/********************************************
+// function name: 	ShardedBank::__handle
+// Description	: 	Handles a message on the owner of its shard - runs the operation on the shard's accounts, logs it and replies (or
+//					sends the next message of a transfer)
+// Parameters	: 	self - the shard
+//					message - the message
+// Returns		: 	bool - false for SHARD_STOP
+// Exception	: 	None
+*/
+bool ShardedBank::__handle(shard& self, shard_message const& message) {
+	int atm_id = message.m_atm_id, account_no = message.m_account;
+	unordered_map<int, shard_account>::iterator account = self.m_accounts.end();
+	if (message.m_type <= SHARD_BALANCE)
+		account = self.m_accounts.find(account_no);
+	bool found = account != self.m_accounts.end();
+	bool password_correct = found && *message.m_password == account->second.m_password;
+
+	switch (message.m_type) {
+	case SHARD_OPEN:
+		if (found) {
+			__log(MSG_ACCOUNT_EXISTS, atm_id);
+			__complete(message.m_reply, false);
+		}
+		else {
+			shard_account& opened = self.m_accounts[account_no];
+			opened.m_balance = message.m_amount;
+			opened.m_password = *message.m_password;
+			__log(MSG_OPENED, atm_id, account_no, opened.m_password, opened.m_balance);
+			__complete(message.m_reply, true);
+		}
+		break;
+
+	case SHARD_CLOSE:
+	case SHARD_DEPOSIT:
+	case SHARD_BALANCE:
+		if (!password_correct) {
+			if (found)
+				__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+			else
+				__log(MSG_NO_ACCOUNT, atm_id);
+			__complete(message.m_reply, false);
+			break;
+		}
+
+		if (message.m_type == SHARD_CLOSE) {
+			int balance = account->second.m_balance;
+			self.m_accounts.erase(account);
+			__log(MSG_CLOSED, atm_id, account_no, balance);
+		}
+		else if (message.m_type == SHARD_DEPOSIT) {
+			account->second.m_balance += message.m_amount;
+			__log(MSG_DEPOSITED, atm_id, account_no, account->second.m_balance, message.m_amount);
+		}
+		else
+			__log(MSG_BALANCE, atm_id, account_no, account->second.m_balance);
+		__complete(message.m_reply, true);
+		break;
+
+	case SHARD_WITHDRAW:
+		if (!password_correct) {
+			if (found)
+				__log(MSG_WITHDRAW_WRONG_PASSWORD, atm_id, account_no);
+			else
+				__log(MSG_NO_ACCOUNT, atm_id);
+			__complete(message.m_reply, false);
+		}
+		else if (message.m_amount < account->second.m_balance) {
+			account->second.m_balance -= message.m_amount;
+			__log(MSG_WITHDRAWN, atm_id, account_no, account->second.m_balance, message.m_amount);
+			__complete(message.m_reply, true);
+		}
+		else {
+			__log(MSG_WITHDRAW_LOW_BALANCE, atm_id, account_no, message.m_amount);
+			__complete(message.m_reply, false);
+		}
+		break;
+
+	case SHARD_TRANSFER:
+		__transfer(self, message);
+		break;
+
+	case SHARD_CREDIT:
+		__credit(self, message);
+		break;
+
+	case SHARD_REFUND:
+		account = self.m_accounts.find(account_no);
+		if (account != self.m_accounts.end())
+			account->second.m_balance += message.m_amount;
+		else
+			m_bank_balance.fetch_add(message.m_amount); //the account was closed meanwhile - the bank keeps the money
+		__complete(message.m_reply, false);
+		break;
+
+	case SHARD_COMMISSION:
+		if (self.m_commission)
+			__charge_commission(self, true); //the passes of the shard don't overlap
+
+		self.m_commission = message.m_job;
+		self.m_commission_accounts.clear();
+		self.m_commission_accounts.reserve(self.m_accounts.size());
+		for (account = self.m_accounts.begin(); account != self.m_accounts.end(); ++account)
+			self.m_commission_accounts.push_back(account->first);
+		self.m_commission_next = 0;
+		break;
+
+	case SHARD_STATUS: {
+		vector<shard_account_status>& accounts = message.m_job->m_accounts[self.m_index];
+		accounts.reserve(self.m_accounts.size());
+		for (account = self.m_accounts.begin(); account != self.m_accounts.end(); ++account) {
+			shard_account_status status = {account->first, account->second.m_balance, account->second.m_password};
+			accounts.push_back(status);
+		}
+		message.m_job->m_done.CountDown();
+		break;
+	}
+
+	case SHARD_STOP:
+		return false;
+	}
+	return true;
+}
+
+/********************************************
+// function name: 	ShardedBank::__transfer
+// Description	: 	The first step of a transfer, on the source's shard - checks the source account, debits it in case the password is
+//					correct and the balance is high enough, and sends the rest of the transfer to the target's shard (a transfer within
+//					the shard is completed at once). The outcome is logged by the target's shard, in the order of Bank's checks - no
+//					source account, no target account, a wrong password, a low balance
+// Parameters	: 	self - the source's shard
+//					message - the SHARD_TRANSFER message
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::__transfer(shard& self, shard_message const& message) {
+	int atm_id = message.m_atm_id, account_no = message.m_account, account_target = message.m_target, amount = message.m_amount;
+	unordered_map<int, shard_account>::iterator source = self.m_accounts.find(account_no);
+	if (source == self.m_accounts.end()) {
+		__log(MSG_NO_ACCOUNT, atm_id);
+		__complete(message.m_reply, false);
+		return;
+	}
+
+	bool password_correct = *message.m_password == source->second.m_password;
+	unsigned target_shard = __shard_of(account_target);
+	if (target_shard == self.m_index) {
+		unordered_map<int, shard_account>::iterator target = self.m_accounts.find(account_target);
+		bool cond = target != self.m_accounts.end() && password_correct && amount < source->second.m_balance;
+		if (cond && target != source) {
+			source->second.m_balance -= amount;
+			target->second.m_balance += amount;
+		}
+
+		if (target == self.m_accounts.end())
+			__log(MSG_NO_TARGET, atm_id, account_target);
+		else if (!password_correct)
+			__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+		else if (cond)
+			__log(MSG_TRANSFERRED, atm_id, amount, account_no, account_target, source->second.m_balance, target->second.m_balance);
+		else
+			__log(MSG_TRANSFER_LOW_BALANCE, atm_id, account_no, amount);
+		__complete(message.m_reply, cond);
+		return;
+	}
+
+	//the source's part of the transfer is done - the money is on its way to the target
+	shard_message credit = message;
+	credit.m_type = SHARD_CREDIT;
+	credit.m_flags = password_correct ? SHARD_PASSWORD_CORRECT : 0;
+	if (password_correct && amount < source->second.m_balance) {
+		source->second.m_balance -= amount;
+		credit.m_flags |= SHARD_DEBITED;
+	}
+	credit.m_balance = source->second.m_balance;
+	__forward(self, target_shard, credit);
+}
+
+/********************************************
+// function name: 	ShardedBank::__credit
+// Description	: 	The second step of a transfer, on the target's shard - credits the target account with what the source's shard has
+//					debited, logs the outcome and replies. In case the target account doesn't exist, a debit is sent back to the source's
+//					shard, which replies once it has returned it
+// Parameters	: 	self - the target's shard
+//					message - the SHARD_CREDIT message
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::__credit(shard& self, shard_message const& message) {
+	int atm_id = message.m_atm_id, account_no = message.m_account, account_target = message.m_target, amount = message.m_amount;
+	bool debited = message.m_flags & SHARD_DEBITED;
+	unordered_map<int, shard_account>::iterator target = self.m_accounts.find(account_target);
+	if (target == self.m_accounts.end()) {
+		__log(MSG_NO_TARGET, atm_id, account_target);
+		if (!debited) {
+			__complete(message.m_reply, false);
+			return;
+		}
+
+		shard_message refund = message;
+		refund.m_type = SHARD_REFUND;
+		__forward(self, __shard_of(account_no), refund);
+		return;
+	}
+
+	if (!(message.m_flags & SHARD_PASSWORD_CORRECT))
+		__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+	else if (debited) {
+		target->second.m_balance += amount;
+		__log(MSG_TRANSFERRED, atm_id, amount, account_no, account_target, message.m_balance, target->second.m_balance);
+	}
+	else
+		__log(MSG_TRANSFER_LOW_BALANCE, atm_id, account_no, amount);
+	__complete(message.m_reply, debited);
+}
+
+/********************************************
+// function name: 	ShardedBank::__charge_commission
+// Description	: 	Charges the next batch of accounts of the shard's commission pass (the accounts that were closed since the start of
+//					the pass are skipped), and counts the pass's job down once the last account is charged
+// Parameters	: 	self - the shard (called by its owner)
+//					all - whether to charge all of the remaining accounts (default: a batch only)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void ShardedBank::__charge_commission(shard& self, bool all) {
+	shard_job& job = *self.m_commission;
+	size_t end = all ? self.m_commission_accounts.size() : min(self.m_commission_next + SHARD_BATCH, self.m_commission_accounts.size());
+	int total = 0;
+	for (; self.m_commission_next < end; ++self.m_commission_next) {
+		int account_no = self.m_commission_accounts[self.m_commission_next];
+		unordered_map<int, shard_account>::iterator account = self.m_accounts.find(account_no);
+		if (account == self.m_accounts.end())
+			continue;
+
+		//same rule as Withdraw - the commission must be lower than the balance
+		int balance = account->second.m_balance;
+		int commission = static_cast<int>(roundf(balance * job.m_interest));
+		if (commission < balance)
+			account->second.m_balance = balance - commission;
+		else
+			commission = 0;
+
+		__log(MSG_COMMISSION, (int)roundf(100 * job.m_interest), commission, account_no);
+		total += commission;
+	}
+	job.m_commission.fetch_add(total);
+
+	if (self.m_commission_next == self.m_commission_accounts.size()) {
+		self.m_commission = NULL;
+		job.m_done.CountDown();
+	}
+}
+
+//runs a job of the bank on every shard, and waits until all of them are done
+void ShardedBank::__run_job(shard_message_type type, shard_job& job) {
+	shard_message message = shard_message();
+	message.m_type = type;
+	message.m_job = &job;
+	for (unsigned i = 0; i < m_shards.size(); ++i)
+		__post(*m_shards[i], message);
+	job.m_done.Wait();
+}
@@ -0,0 +1,357 @@
+/*
+ * ShardedBank.h
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : ShardedBank
+	Description : A bank of single-writer shards - the accounts are partitioned by their numbers among N shards, and every shard is
+					owned by a thread of its own that is the only thread to ever touch the shard's accounts. So an account is never
+					locked: an operation of an ATM is a message to the owner of the account's shard, which runs the operation, logs it,
+					and replies to the ATM.
+					Every shard has an inbox - a bounded lock-free queue of many producers (the ATMs and the bank's jobs) - and a link
+					from every other shard - a bounded lock-free queue of a single producer and a single consumer. An owner drains its
+					links and its inbox in batches, and sleeps on a futex word once they are all empty (a producer wakes it only if it
+					sleeps, so a busy owner costs its producers no system call).
+					A transfer between the accounts of two shards is two messages: the ATM's message to the source's shard, which checks
+					the source account (and debits it, if the password is correct and the balance is high enough), and the source shard's
+					message to the target's shard, which credits the target account, logs the transfer, and replies to the ATM. In case
+					the target account doesn't exist, the target shard sends the debit back to the source shard (a third message), which
+					returns it to the account. A transfer within a shard is a single step.
+					The bank's jobs are messages to every shard too - a commission pass charges every shard's accounts on its owner (a
+					batch at a time, between the batches of the ATMs' operations, so the pass doesn't hold the shard's ATMs), and the
+					status printing collects a copy of every shard's accounts.
+	Main methods: 	1. ShardedBank::ShardedBank - starts the owners of the shards
+					2. Main - runs the bank's jobs, until the ATMs are done
+					3. OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+ */
+
+#ifndef SHARDEDBANK_H_
+#define SHARDEDBANK_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include "BankService.h"
+#include "Logger.h"
+#include "Message.h"
+#include "Options.h"
+#include "TimerWheel.h"
+#include "ringqueue.h"
+#include "defs.h"
+
+using namespace std;
+
+#define SHARD_INBOX_CAPACITY 4096 	//the messages of a shard's inbox
+#define SHARD_LINK_CAPACITY 256 	//the messages of a link between two shards (there are N * (N - 1) links)
+#define SHARD_BATCH 256 			//the messages an owner pops from its inbox before it checks its links again (and the accounts it
+									//charges before it checks its queues again, in a commission pass)
+#define SHARD_SPIN 64 				//the empty polls of an owner (or of a waiting ATM) before it sleeps
+
+//the types of the messages of the shards
+typedef enum {
+	SHARD_OPEN,
+	SHARD_CLOSE,
+	SHARD_DEPOSIT,
+	SHARD_WITHDRAW,
+	SHARD_BALANCE,
+	SHARD_TRANSFER,			//to the source's shard - checks the source account, and debits it
+	SHARD_CREDIT,			//from the source's shard to the target's shard - credits the target account (or tells why the transfer failed)
+	SHARD_REFUND,			//from the target's shard back to the source's shard - the target doesn't exist, the debit is returned
+	SHARD_COMMISSION,		//a commission pass over the shard's accounts
+	SHARD_STATUS,			//a copy of the shard's accounts, for the status printing
+	SHARD_STOP				//the owner exits
+} shard_message_type;
+
+//the flags of a SHARD_CREDIT message
+#define SHARD_PASSWORD_CORRECT 1u 	//the password of the source account is correct
+#define SHARD_DEBITED 2u 			//the amount was debited from the source account
+
+//the reply of an operation - the ATM waits on its state word
+struct shard_reply {
+	atomic<uint32_t> m_state; 	//shard_reply_state
+	bool m_result;
+};
+
+//the states of a reply
+typedef enum {REPLY_PENDING, REPLY_DONE, REPLY_SLEEPING} shard_reply_state;
+
+//an open account, as copied by the status printing
+struct shard_account_status {
+	int m_account_no;
+	int m_balance;
+	string m_password;
+
+	bool operator<(shard_account_status const& other) const {
+		return m_account_no < other.m_account_no;
+	}
+};
+
+//a job of the bank over all of the shards - a commission pass, or a copy of the accounts for the status printing
+struct shard_job {
+	float m_interest;
+	atomic<int> m_commission; 					//the total commission charged by the shards
+	vector<vector<shard_account_status> > m_accounts; 	//the copies, by shard
+	countdown_latch m_done; 					//counted down by every shard
+
+	shard_job(unsigned num_shards, float interest) : m_interest(interest), m_commission(0), m_accounts(num_shards), m_done(num_shards) {}
+};
+
+//a message to a shard
+struct shard_message {
+	uint8_t m_type; 		//shard_message_type
+	uint8_t m_flags; 		//of a SHARD_CREDIT message
+	int32_t m_atm_id;
+	int32_t m_account;
+	int32_t m_target; 		//the target account of a transfer
+	int32_t m_amount; 		//the amount (or the initial balance of an opened account)
+	int32_t m_balance; 		//of a SHARD_CREDIT message - the balance of the source account after the debit
+	string const* m_password; //the password of the operation (the ATM waits for the reply, so it outlives the message)
+	shard_reply* m_reply; 	//NULL for the jobs of the bank
+	shard_job* m_job; 		//the job of a SHARD_COMMISSION / SHARD_STATUS message
+};
+
+
+/********************************************
+// 	class name	: 	ShardedBank
+// 	Description	: 	A bank_service of single-writer shards. An operation of an ATM returns once its shard's owner has replied, and then the
+//					ATM sleeps for a second (the pace of Bank's operations) - but the account isn't held meanwhile, so the ATMs of the
+//					same account don't wait for each other. The status is a copy of every shard at a moment of its own (not a point-in-time
+//					snapshot of the whole bank, and a transfer between two shards may be seen debited but not credited yet)
+//
+//	Members		:	m_shards - the shards
+//					m_logger - the log of the bank
+//					m_bank_balance - the balance of the bank (written by the bank's jobs, and by a refund to an account that was closed
+//									 meanwhile - the bank keeps it)
+//					m_seed - the seed of the commissions' rates (0 - seeded by the clock's time)
+//					m_atms_done - a latch that is counted down by every ATM that has finished
+//
+//	Methods		:	Main - runs the bank's jobs until the ATMs are done
+//					ChargeCommissionPass / PrintBankStats - the jobs of Main
+//					NumShards - the number of shards
+//					OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+*/
+class ShardedBank : public bank_service {
+public:
+	/********************************************
+	// function name: 	ShardedBank::ShardedBank
+	// Description	: 	Constructor.
+	//					Creates the shards (their inboxes, and a link from every shard to every other shard) and starts their owners.
+	//					The log is opened at the options' log path
+	// Parameters	: 	options - the options of the run - the number of shards (m_num_shards, 0 - a shard per core), the log path and the seed
+	// Returns		: 	None
+	// Exception	: 	std::ofstream::failure in case the log can't be opened, std::bad_alloc
+	*/
+	ShardedBank(system_options const& options);
+
+	/********************************************
+	// function name: 	ShardedBank::~ShardedBank
+	// Description	: 	Destructor.
+	//					Stops the owners of the shards (after the messages that were sent before), and releases the shards
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual ~ShardedBank();
+
+public: //Background jobs of the bank
+	/********************************************
+	// function name: 	ShardedBank::Main
+	// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second and the commission passes every
+	//					3 seconds - until the last ATM is done, then prints the final status
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual void Main();
+
+	/********************************************
+	// function name: 	ShardedBank::ChargeCommissionPass
+	// Description	: 	A commission pass - draws an interest rate (2%-4%), has every shard charge it from its accounts (in parallel, on the
+	//					owners), and adds the total to the bank's balance
+	// Parameters	: 	None
+	// Returns		: 	int - the total commission charged in the pass
+	// Exception	: 	None
+	*/
+	int ChargeCommissionPass();
+
+	/********************************************
+	// function name: 	ShardedBank::PrintBankStats
+	// Description	: 	Prints the status of the bank (the open accounts, sorted by their numbers, and the bank's balance) - every shard
+	//					copies its accounts on its owner
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void PrintBankStats();
+
+	unsigned NumShards() const {
+		return m_shards.size();
+	}
+
+public: //ATM supported methods of the bank (see Bank)
+	virtual bool OpenAccount(int account_no, string const& password, int balance, int atm_id);
+	virtual bool RemoveAccount(int account_no, string const& password, int atm_id);
+	virtual bool Deposit(int account_no, string const& password, int amount, int atm_id);
+	virtual bool Withdraw(int account_no, string const& password, int amount, int atm_id);
+	virtual bool Balance(int account_no, string const& password, int atm_id);
+	virtual bool Transfer(int account_no, string const& password, int account_target, int amount, int atm_id);
+
+private:
+	//an account of a shard
+	struct shard_account {
+		int m_balance;
+		string m_password;
+	};
+
+	//a shard, and the state of its owner
+	struct shard {
+		ShardedBank* m_bank;
+		unsigned m_index;
+		pthread_t m_owner;
+		mpsc_queue<shard_message> m_inbox;
+		vector<spsc_queue<shard_message>*> m_links; 	//by the sending shard (NULL for the shard itself)
+		vector<deque<shard_message> > m_pending; 		//by the receiving shard - the messages its full link couldn't take yet
+		unsigned m_num_pending;
+		unordered_map<int, shard_account> m_accounts;
+		shard_job* m_commission; 						//the commission pass in progress (NULL - none)
+		vector<int> m_commission_accounts; 				//the accounts of the pass, as of its start
+		size_t m_commission_next; 						//the next account of the pass to charge
+		char m_pad0[CACHE_LINE_SIZE];
+		atomic<uint32_t> m_sleeping; 					//1 while the owner sleeps (or is about to)
+		char m_pad1[CACHE_LINE_SIZE];
+
+		shard(ShardedBank* bank, unsigned index, unsigned num_shards);
+		~shard();
+	};
+
+	virtual void __set_num_atms(unsigned num_atms) {
+		m_atms_done.Reset(num_atms);
+	}
+
+	virtual void __signal_finished() {
+		m_atms_done.CountDown();
+	}
+
+	//the shard of an account
+	unsigned __shard_of(int account_no) const {
+		return (uint32_t)account_no % m_shards.size();
+	}
+
+	/********************************************
+	// function name: 	ShardedBank::__call
+	// Description	: 	Sends an operation to the shard of its account, waits for the reply, and sleeps for a second (the pace of an operation)
+	// Parameters	: 	message - the operation (its reply is set by the call)
+	// Returns		: 	bool - the result of the operation
+	// Exception	: 	None
+	*/
+	bool __call(shard_message& message);
+
+	/********************************************
+	// function name: 	ShardedBank::__post
+	// Description	: 	Pushes a message into the inbox of a shard (waits while the inbox is full), and wakes the owner if it sleeps
+	// Parameters	: 	target - the shard
+	//					message - the message
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void __post(shard& target, shard_message const& message);
+
+	/********************************************
+	// function name: 	ShardedBank::__forward
+	// Description	: 	Sends a message from the owner of a shard to another shard, over their link. A message the link can't take (it's
+	//					full) waits in the sender's pending messages, so an owner never blocks on another owner
+	// Parameters	: 	from - the sending shard (called by its owner)
+	//					to - the index of the receiving shard
+	//					message - the message
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void __forward(shard& from, unsigned to, shard_message const& message);
+
+	//wakes the owner of a shard, if it sleeps
+	static void __wake(shard& target);
+
+	//completes the reply of an operation, and wakes its ATM if it sleeps
+	static void __complete(shard_reply* reply, bool result);
+
+	static void* __owner_main(void* arg);
+
+	/********************************************
+	// function name: 	ShardedBank::__run_owner
+	// Description	: 	The loop of a shard's owner - handles the messages of its links and of its inbox, sends its pending messages, and
+	//					sleeps while there is nothing to do, until it gets SHARD_STOP
+	// Parameters	: 	self - the shard
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __run_owner(shard& self);
+
+	//sends the pending messages of a shard that its links can take now. Returns whether any was sent
+	bool __send_pending(shard& self);
+
+	/********************************************
+	// function name: 	ShardedBank::__handle
+	// Description	: 	Handles a message on the owner of its shard - runs the operation on the shard's accounts, logs it and replies (or
+	//					sends the next message of a transfer)
+	// Parameters	: 	self - the shard
+	//					message - the message
+	// Returns		: 	bool - false for SHARD_STOP
+	// Exception	: 	None
+	*/
+	bool __handle(shard& self, shard_message const& message);
+
+	/********************************************
+	// function name: 	ShardedBank::__charge_commission
+	// Description	: 	Charges the next batch of accounts of the shard's commission pass (the accounts that were closed since the start of
+	//					the pass are skipped), and counts the pass's job down once the last account is charged
+	// Parameters	: 	self - the shard (called by its owner)
+	//					all - whether to charge all of the remaining accounts (default: a batch only)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __charge_commission(shard& self, bool all = false);
+
+	//the steps of a transfer - on the source's shard, and on the target's shard
+	void __transfer(shard& self, shard_message const& message);
+	void __credit(shard& self, shard_message const& message);
+
+	//runs a job of the bank on every shard, and waits until all of them are done
+	void __run_job(shard_message_type type, shard_job& job);
+
+	/********************************************
+	// function name: 	ShardedBank::__log
+	// Description	: 	Formats a typed message on the stack and writes it to the log (no heap allocation, unless the message outgrows the buffer)
+	// Parameters	: 	message - the type of the message
+	//					args - the arguments of the message (integers or strings), in the order of its format
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	template <class... Args> void __log(bank_message message, Args const&... args) {
+		message_arg argv[] = {message_arg(args)...};
+		message_buffer msg(&m_logger); //a long message overflows to the logger, which still logs it whole
+		msg.Format(message, argv, sizeof...(Args));
+		m_logger.Write(msg.Data(), msg.Size()); //thread-safe logging
+	}
+
+private: //do not allow the user to copy the object
+	ShardedBank(ShardedBank const&);
+	ShardedBank& operator=(ShardedBank const&);
+
+private:
+	vector<shard*> m_shards;
+	Logger m_logger;
+	atomic<int> m_bank_balance;
+	unsigned m_seed;
+	countdown_latch m_atms_done;
+};
+
+
+#endif /* SHARDEDBANK_H_ */
@@ -0,0 +1,588 @@
+/*
+ * SharedBank.cpp
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ *
+ *	An implementation of the SharedBank class
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include "SharedBank.h"
+#include "Fiber.h"
+
+
+//an open account, as read by the status printing
+struct shared_account_status {
+	int m_account_no;
+	int m_balance;
+	string m_password;
+
+	bool operator<(shared_account_status const& other) const {
+		return m_account_no < other.m_account_no;
+	}
+};
+
+
+/********************************************
+// function name: 	SharedBank::SharedBank
+// Description	: 	Constructor.
+//					Creates the segment of the options' name (it must not exist), or attaches to it in attach mode. The log is
+//					opened at the options' log path - truncated by the creator, appended to by the attaching processes
+// Parameters	: 	options - the options of the run - the name of the segment (m_shm_name), attach mode, the log path and the seed
+// Returns		: 	None
+// Exception	: 	std::ofstream::failure in case the segment can't be created or attached (or isn't a segment of a SharedBank),
+//					or the log can't be opened
+*/
+SharedBank::SharedBank(system_options const& options) :	m_name(options.m_shm_name),
+															m_owner(!options.m_attach),
+															m_segment(NULL),
+															m_pid(getpid()),
+															m_logger(options.m_log_path, options.m_log_interval ? options.m_log_interval : LOG_FLUSH_INTERVAL,
+																	 options.m_log_sync ? LOG_DATA_SYNC : LOG_WRITE_BACK, LOG_QUEUE_CAPACITY,
+																	 options.m_attach ? LOG_APPEND : LOG_TRUNCATE),
+															m_seed(options.m_seed),
+															m_atms_done(UINT32_MAX) {
+	int fd = m_owner ? shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600) : shm_open(m_name.c_str(), O_RDWR, 0);
+	if (fd < 0 || (m_owner && ftruncate(fd, sizeof(shared_bank_segment)) < 0)) {
+		int error_code = errno;
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(m_name.c_str());
+		}
+
+		stringstream error;
+		error << "shared memory segment " << m_name << " could not be " << (m_owner ? "created" : "opened") << ": " << strerror(error_code);
+		throw ofstream::failure(error.str());
+	}
+
+	void* mapping = mmap(NULL, sizeof(shared_bank_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping keeps the segment
+	if (mapping == MAP_FAILED) {
+		if (m_owner)
+			shm_unlink(m_name.c_str());
+		throw ofstream::failure("shared memory segment " + m_name + " could not be mapped");
+	}
+	m_segment = static_cast<shared_bank_segment*>(mapping);
+
+	if (m_owner) {
+		//the fresh segment is zeroed - only the header is written
+		m_segment->m_num_slots = SHARED_BANK_SLOTS;
+		m_segment->m_magic = SHARED_BANK_MAGIC;
+	}
+	else if (m_segment->m_magic != SHARED_BANK_MAGIC || m_segment->m_num_slots != SHARED_BANK_SLOTS) {
+		munmap(m_segment, sizeof(shared_bank_segment));
+		m_segment = NULL;
+		throw ofstream::failure("shared memory segment " + m_name + " is not a segment of a bank");
+	}
+}
+
+/********************************************
+// function name: 	SharedBank::~SharedBank
+// Description	: 	Destructor.
+//					Unmaps the segment, and unlinks it if this object has created it (the attached processes keep their mappings)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+SharedBank::~SharedBank() {
+	munmap(m_segment, sizeof(shared_bank_segment));
+	if (m_owner)
+		shm_unlink(m_name.c_str());
+}
+
+
+//*******************************************Background jobs of the bank*******************************************
+
+/********************************************
+// function name: 	SharedBank::Main
+// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second and the commission passes every
+//					3 seconds - until the last ATM is done, then flushes the log and prints the final status
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void SharedBank::Main() {
+	std::srand(m_seed ? m_seed : std::time(NULL));
+
+	TimerWheel jobs;
+	jobs.Schedule(new_method_timer_job(this, &SharedBank::PrintBankStats), HALF_SEC);
+	jobs.Schedule(new_method_timer_job(this, &SharedBank::ChargeCommissionPass), THREE_SEC);
+	jobs.Run(m_atms_done);
+
+	m_logger.Flush(); //the owner's records are written before the final status is printed (the ATM processes flush theirs on exit)
+	PrintBankStats();
+}
+
+/********************************************
+// function name: 	SharedBank::ChargeCommissionPass
+// Description	: 	A commission pass - draws an interest rate (2%-4%), charges it from all of the open accounts (every slot is locked
+//					only while it's charged) and adds the total to the bank's balance
+// Parameters	: 	None
+// Returns		: 	int - the total commission charged in the pass
+// Exception	: 	None
+*/
+int SharedBank::ChargeCommissionPass() {
+	float interest = (HIGHEST_INTEREST - LOWEST_INTEREST) * fabsf(static_cast<float>(rand()) / static_cast<float>(RAND_MAX)) + LOWEST_INTEREST;
+
+	int total = 0;
+	for (unsigned slot = 0; slot < SHARED_BANK_SLOTS; ++slot) {
+		shared_account& account = m_segment->m_accounts[slot];
+		if ((account.m_state.load() & SLOT_STATE_MASK) != SLOT_OPEN)
+			continue;
+
+		__lock(account.m_lock);
+		if ((account.m_state.load() & SLOT_STATE_MASK) != SLOT_OPEN) {
+			__unlock(account.m_lock); //closed meanwhile
+			continue;
+		}
+
+		//same rule as Withdraw - the commission must be lower than the balance
+		int balance = account.m_balance.load();
+		int commission = static_cast<int>(roundf(balance * interest));
+		if (commission < balance)
+			account.m_balance.store(balance - commission);
+		else
+			commission = 0;
+		int account_no = account.m_account_no.load();
+		__unlock(account.m_lock);
+
+		__log(MSG_COMMISSION, (int)roundf(100 * interest), commission, account_no);
+		total += commission;
+	}
+
+	m_segment->m_bank_balance.store(m_segment->m_bank_balance.load() + total);
+	return total;
+}
+
+/********************************************
+// function name: 	SharedBank::PrintBankStats
+// Description	: 	Prints the status of the bank (the open accounts, sorted by their numbers, and the bank's balance), without
+//					locking anything
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void SharedBank::PrintBankStats() const {
+	vector<shared_account_status> accounts;
+	for (unsigned slot = 0; slot < SHARED_BANK_SLOTS; ++slot) {
+		shared_account const& account = m_segment->m_accounts[slot];
+		uint32_t state = account.m_state.load(memory_order_acquire);
+		while ((state & SLOT_STATE_MASK) == SLOT_OPEN) {
+			char password[SHARED_PASSWORD_SIZE];
+			memcpy(password, account.m_password, SHARED_PASSWORD_SIZE);
+			password[SHARED_PASSWORD_SIZE - 1] = '\0';
+			shared_account_status status = {account.m_account_no.load(memory_order_relaxed), account.m_balance.load(memory_order_relaxed), password};
+
+			//the slot is the same account as long as it hasn't been reopened (a reopening bumps the generation of the state)
+			atomic_thread_fence(memory_order_acquire);
+			uint32_t again = account.m_state.load(memory_order_relaxed);
+			if (again == state) {
+				accounts.push_back(status);
+				break;
+			}
+			state = again;
+		}
+	}
+	sort(accounts.begin(), accounts.end());
+
+	ostringstream screen;
+	screen << "\033[H\033[J";   //clear the screen
+	screen << "\033[1;1H"; //move the cursor to the top left corner of the screen
+	screen << "Current Bank Status" << endl;
+	for (unsigned i = 0; i < accounts.size(); ++i) {
+		screen << "Account " << accounts[i].m_account_no << ": Balance - "
+				<< accounts[i].m_balance << " $ ," << "Account Password - "
+				<< accounts[i].m_password << endl;
+	}
+	screen << "The Bank has " << m_segment->m_bank_balance.load() << " $" << endl;
+
+	cout << screen.str() << flush;
+}
+
+
+//*******************************API for usage by ATMs************************************************************************
+
+/********************************************
+// function name: 	SharedBank::OpenAccount
+// Description	: 	Open a new account in the bank - in the first free slot of the account's probing sequence (a closed slot is reused).
+//					The openings are serialized by the lock of the table, so two processes never open the same number in two slots
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					balance - the beginning balance of the new account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that already exists, return false
+//					Else return true
+// Exception	: 	None (exits if the password is too long, or the segment has no free slot)
+*/
+bool SharedBank::OpenAccount(int account_no, string const& password, int balance, int atm_id) {
+	if (password.size() >= SHARED_PASSWORD_SIZE) {
+		cerr << "the password of account " << account_no << " is too long!" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	__lock(m_segment->m_table_lock);
+
+	//look for the account along its probing sequence (up to an empty slot), and for the first slot that may take it
+	shared_account* free_slot = NULL;
+	bool exists = false;
+	size_t position = __hash(account_no) & (SHARED_BANK_SLOTS - 1);
+	for (unsigned i = 0; i < SHARED_BANK_SLOTS; ++i, position = (position + 1) & (SHARED_BANK_SLOTS - 1)) {
+		shared_account& account = m_segment->m_accounts[position];
+		uint32_t state = account.m_state.load() & SLOT_STATE_MASK;
+		if (state == SLOT_EMPTY) {
+			if (!free_slot && m_segment->m_used_slots.load() < SHARED_BANK_MAX_USED)
+				free_slot = &account;
+			break;
+		}
+
+		if (state == SLOT_OPEN && account.m_account_no.load() == account_no) {
+			exists = true;
+			break;
+		}
+
+		if (state == SLOT_CLOSED && !free_slot)
+			free_slot = &account;
+	}
+
+	if (exists) {
+		__unlock(m_segment->m_table_lock);
+		fiber_sleep(ONE_SEC); //sleep for a second
+
+		__log(MSG_ACCOUNT_EXISTS, atm_id);
+		return false;
+	}
+
+	if (!free_slot) {
+		__unlock(m_segment->m_table_lock);
+		cerr << "the shared memory segment of the bank is full!" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	//fill the slot, and publish it with the next generation of its state
+	__lock(free_slot->m_lock);
+	uint32_t state = free_slot->m_state.load();
+	if ((state & SLOT_STATE_MASK) == SLOT_EMPTY)
+		++m_segment->m_used_slots;
+	free_slot->m_account_no.store(account_no);
+	free_slot->m_balance.store(balance);
+	memcpy(free_slot->m_password, password.c_str(), password.size() + 1);
+	free_slot->m_state.store(((state & ~SLOT_STATE_MASK) + SLOT_GENERATION) | SLOT_OPEN, memory_order_release);
+	__unlock(free_slot->m_lock);
+
+	__unlock(m_segment->m_table_lock);
+	fiber_sleep(ONE_SEC); //sleep for a second
+
+	__log(MSG_OPENED, atm_id, account_no, password, balance);
+	return true;
+}
+
+/********************************************
+// function name: 	SharedBank::RemoveAccount
+// Description	: 	Remove an account from the bank - its slot is left closed (a tombstone), for a later opening to reuse
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool SharedBank::RemoveAccount(int account_no, string const& password, int atm_id) {
+	bool password_correct = false;
+	shared_account* account = __acquire(account_no, password, password_correct);
+	if (!account || !password_correct) {
+		fiber_sleep(ONE_SEC); //sleep for a second
+		if (account)
+			__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+		else
+			__log(MSG_NO_ACCOUNT, atm_id);
+		return false;
+	}
+
+	int balance = account->m_balance.load();
+	account->m_state.store((account->m_state.load() & ~SLOT_STATE_MASK) | SLOT_CLOSED);
+	__unlock(account->m_lock, true); //sleep for a second before unlocking the slot
+
+	__log(MSG_CLOSED, atm_id, account_no, balance);
+	return true;
+}
+
+/********************************************
+// function name: 	SharedBank::Deposit
+// Description	: 	Deposit money to a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount of money to be deposited
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool SharedBank::Deposit(int account_no, string const& password, int amount, int atm_id) {
+	bool password_correct = false;
+	shared_account* account = __acquire(account_no, password, password_correct);
+	if (!account || !password_correct) {
+		fiber_sleep(ONE_SEC); //sleep for a second
+		if (account)
+			__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+		else
+			__log(MSG_NO_ACCOUNT, atm_id);
+		return false;
+	}
+
+	int new_balance = account->m_balance.load() + amount;
+	account->m_balance.store(new_balance);
+	__unlock(account->m_lock, true); //sleep for a second before unlocking the slot
+
+	__log(MSG_DEPOSITED, atm_id, account_no, new_balance, amount);
+	return true;
+}
+
+/********************************************
+// function name: 	SharedBank::Withdraw
+// Description	: 	Withdraw money from a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					amount - the amount of money to be withdrawn
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect or withdrawl failed, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool SharedBank::Withdraw(int account_no, string const& password, int amount, int atm_id) {
+	bool password_correct = false;
+	shared_account* account = __acquire(account_no, password, password_correct);
+	if (!account || !password_correct) {
+		fiber_sleep(ONE_SEC); //sleep for a second
+		if (account)
+			__log(MSG_WITHDRAW_WRONG_PASSWORD, atm_id, account_no);
+		else
+			__log(MSG_NO_ACCOUNT, atm_id);
+		return false;
+	}
+
+	int balance = account->m_balance.load();
+	bool cond = amount < balance;
+	if (cond)
+		account->m_balance.store(balance - amount);
+	__unlock(account->m_lock, true); //sleep for a second before unlocking the slot
+
+	if (cond)
+		__log(MSG_WITHDRAWN, atm_id, account_no, balance - amount, amount);
+	else
+		__log(MSG_WITHDRAW_LOW_BALANCE, atm_id, account_no, amount);
+	return cond;
+}
+
+/********************************************
+// function name: 	SharedBank::Balance
+// Description	: 	Get the balance of a certain account
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool SharedBank::Balance(int account_no, string const& password, int atm_id) {
+	bool password_correct = false;
+	shared_account* account = __acquire(account_no, password, password_correct);
+	if (!account || !password_correct) {
+		fiber_sleep(ONE_SEC); //sleep for a second
+		if (account)
+			__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+		else
+			__log(MSG_NO_ACCOUNT, atm_id);
+		return false;
+	}
+
+	int balance = account->m_balance.load();
+	__unlock(account->m_lock, true); //sleep for a second before unlocking the slot
+
+	__log(MSG_BALANCE, atm_id, account_no, balance);
+	return true;
+}
+
+/********************************************
+// function name: 	SharedBank::Transfer
+// Description	: 	Transfer money from a certain account to another
+//					The slots of both accounts are locked (in the order of their positions, so two transfers never deadlock) while the
+//					money is moved
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					account_target - the target account number
+//					amount - the amount of money to be transfered
+//					atm_id - the id of the atm that requested this operations
+// Returns		: 	In case the account number addresses an account that doesn't exist or password is incorrect or target account wasn't found, return false
+//					Else return true
+// Exception	: 	None
+*/
+bool SharedBank::Transfer(int account_no, string const& password, int account_target, int amount, int atm_id) {
+	shared_account* source = __find(account_no);
+	shared_account* target = source ? __find(account_target) : NULL;
+	if (!source || !target) {
+		fiber_sleep(ONE_SEC); //sleep for a second
+		if (!source)
+			__log(MSG_NO_ACCOUNT, atm_id);
+		else
+			__log(MSG_NO_TARGET, atm_id, account_target);
+		return false;
+	}
+
+	shared_account* first = min(source, target);
+	shared_account* second = max(source, target);
+	__lock(first->m_lock);
+	if (second != first)
+		__lock(second->m_lock);
+
+	//the accounts may have been closed before they were locked
+	bool source_open = (source->m_state.load() & SLOT_STATE_MASK) == SLOT_OPEN && source->m_account_no.load() == account_no;
+	bool target_open = (target->m_state.load() & SLOT_STATE_MASK) == SLOT_OPEN && target->m_account_no.load() == account_target;
+	bool password_correct = source_open && target_open && password == source->m_password;
+
+	int balance = source->m_balance.load(), tar_balance = target->m_balance.load();
+	bool cond = password_correct && amount < balance; //same rule as Withdraw, a transfer to the account itself included
+	if (cond && source != target) {
+		balance -= amount;
+		tar_balance += amount;
+		source->m_balance.store(balance);
+		target->m_balance.store(tar_balance);
+	}
+
+	//the first unlocking sleeps while both of the accounts are still locked
+	if (second != first)
+		__unlock(second->m_lock, true);
+	__unlock(first->m_lock, second == first);
+
+	if (!source_open)
+		__log(MSG_NO_ACCOUNT, atm_id);
+	else if (!target_open)
+		__log(MSG_NO_TARGET, atm_id, account_target);
+	else if (!password_correct)
+		__log(MSG_WRONG_PASSWORD, atm_id, account_no);
+	else if (cond)
+		__log(MSG_TRANSFERRED, atm_id, amount, account_no, account_target, balance, tar_balance);
+	else
+		__log(MSG_TRANSFER_LOW_BALANCE, atm_id, account_no, amount);
+	return cond;
+}
+
+
+//*********************************************************helpers*********************************************************
+
+/********************************************
+// function name: 	SharedBank::__find
+// Description	: 	Looks up the slot of an open account, without any lock (the account may be closed right after it's found)
+// Parameters	: 	account_no - the account number
+// Returns		: 	shared_account* - the slot of the account, NULL if there is no such account
+// Exception	: 	None
+*/
+shared_account* SharedBank::__find(int account_no) const {
+	size_t position = __hash(account_no) & (SHARED_BANK_SLOTS - 1);
+	for (unsigned i = 0; i < SHARED_BANK_SLOTS; ++i, position = (position + 1) & (SHARED_BANK_SLOTS - 1)) {
+		shared_account& account = m_segment->m_accounts[position];
+		uint32_t state = account.m_state.load() & SLOT_STATE_MASK;
+		if (state == SLOT_EMPTY)
+			return NULL; //the end of the probing sequence
+		if (state == SLOT_OPEN && account.m_account_no.load() == account_no)
+			return &account;
+	}
+	return NULL;
+}
+
+/********************************************
+// function name: 	SharedBank::__acquire
+// Description	: 	Looks up an open account and locks its slot. A slot that was closed (or reopened for another account) before it
+//					was locked is not the account anymore
+// Parameters	: 	account_no - the account number
+//					password - the password of the account
+//					password_correct - set to whether the password is the account's password. The slot is left unlocked if it isn't
+// Returns		: 	shared_account* - the slot of the account, NULL if there is no such account (nothing is locked then)
+// Exception	: 	None
+*/
+shared_account* SharedBank::__acquire(int account_no, string const& password, bool& password_correct) {
+	shared_account* account = __find(account_no);
+	if (!account)
+		return NULL;
+
+	__lock(account->m_lock);
+	if ((account->m_state.load() & SLOT_STATE_MASK) != SLOT_OPEN || account->m_account_no.load() != account_no) {
+		__unlock(account->m_lock);
+		return NULL;
+	}
+
+	password_correct = password == account->m_password;
+	if (!password_correct)
+		__unlock(account->m_lock);
+	return account;
+}
+
+/********************************************
+// function name: 	SharedBank::__lock
+// Description	: 	Locks a lock word of the segment (see shared_account::m_lock). A waiter sleeps on the word, and checks every
+//					SHARED_LOCK_CHECK whether the owner is still alive - the lock of a dead owner is taken over
+// Parameters	: 	word - the lock word
+// Returns		: 	None
+// Exception	: 	None
+*/
+void SharedBank::__lock(atomic<uint32_t>& word) const {
+	uint32_t value = 0;
+	if (word.compare_exchange_strong(value, m_pid))
+		return;
+
+	//a lock that was taken after a wait is marked as waited for - there may be other waiters behind this one
+	struct timespec check = {0, SHARED_LOCK_CHECK * 1000};
+	while (true) {
+		value = word.load();
+		if (value == 0) {
+			if (word.compare_exchange_strong(value, m_pid | SHARED_LOCK_WAITERS))
+				return;
+			continue;
+		}
+
+		uint32_t waited = value | SHARED_LOCK_WAITERS;
+		if (value != waited && !word.compare_exchange_strong(value, waited))
+			continue;
+
+		if (futex_wait_shared(word, waited, &check) < 0 && errno == ETIMEDOUT) {
+			//the owner has held the lock for a whole period - take it over if the owner's process is gone
+			pid_t owner = waited & ~SHARED_LOCK_WAITERS;
+			if (kill(owner, 0) < 0 && errno == ESRCH && word.compare_exchange_strong(waited, m_pid | SHARED_LOCK_WAITERS))
+				return;
+		}
+	}
+}
+
+/********************************************
+// function name: 	SharedBank::__unlock
+// Description	: 	Unlocks a lock word of the segment, and wakes one of its waiters (of any process), if it has any
+// Parameters	: 	word - the lock word
+//					is_sleep - tells the lock to sleep for a second before unlocking (default: false)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void SharedBank::__unlock(atomic<uint32_t>& word, bool is_sleep) const {
+	if (is_sleep)
+		fiber_sleep(ONE_SEC);
+
+	if (word.exchange(0) & SHARED_LOCK_WAITERS)
+		futex_wake_shared(word, 1);
+}
+
+//the home position of an account number in the table (a multiplicative hash - consecutive numbers are spread)
+size_t SharedBank::__hash(int account_no) {
+	return (size_t)(((uint64_t)(uint32_t)account_no * 0x9E3779B97F4A7C15ull) >> 32);
+}
@@ -0,0 +1,249 @@
+/*
+ * SharedBank.h
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : SharedBank
+	Description : A bank whose accounts live in a POSIX shared memory segment, so its ATMs can run as separate processes.
+					The bank's process creates the segment (and runs the commission passes and the status printing over it), every ATM
+					process attaches to it by its name, and runs its operations right on the segment - an operation is not a message to
+					the bank's process, it locks the account's slot in the segment as a thread of the bank would.
+					The segment holds a fixed table of account slots (no pointers, so it may be mapped at any address), a slot is found by
+					open addressing (linear probing from the hash of the account number), and a closed account leaves its slot as a
+					tombstone - slots never move, so a slot is found without any lock, and only the openings of accounts are serialized.
+					The locks are futex words in the segment (process-shared futexes) that hold the pid of their owner, so a lock whose
+					owner has died (a crashed ATM process) is taken over by its next waiter, instead of blocking the bank forever.
+					Every process logs to the same log file (its batches are appended).
+	Main methods: 	1. SharedBank::SharedBank - creates the segment, or attaches to it
+					2. Main - runs the bank's jobs over the segment (in the bank's process)
+					3. OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+ */
+
+#ifndef SHAREDBANK_H_
+#define SHAREDBANK_H_
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include "BankService.h"
+#include "Logger.h"
+#include "Message.h"
+#include "Options.h"
+#include "TimerWheel.h"
+#include "defs.h"
+
+using namespace std;
+
+#define SHARED_BANK_MAGIC 0x4b4e414248534442ull	//identifies a segment of a SharedBank
+#define SHARED_BANK_SLOTS 65536 				//the number of account slots of a segment (a power of 2)
+#define SHARED_BANK_MAX_USED (SHARED_BANK_SLOTS / 4 * 3) //the number of slots that may be used (open or closed), so the probing stays short
+#define SHARED_PASSWORD_SIZE 48 				//the size of a slot's password (the longest password is SHARED_PASSWORD_SIZE - 1 characters)
+#define SHARED_LOCK_WAITERS 0x80000000u 		//the bit of a lock word that tells the lock has waiters
+#define SHARED_LOCK_CHECK 100000 				//the period (in micro-seconds) a waiter for a lock checks whether the lock's owner is alive
+
+//the state of a slot - the low bits of the slot's state word (the rest count the openings of the slot)
+typedef enum {SLOT_EMPTY, SLOT_OPEN, SLOT_CLOSED} shared_slot_state;
+#define SLOT_STATE_MASK 3u
+#define SLOT_GENERATION 4u
+
+
+//an account slot of the segment (a cache line)
+struct shared_account {
+	atomic<uint32_t> m_lock;		//0 - free, otherwise the pid of the owner (and SHARED_LOCK_WAITERS)
+	atomic<uint32_t> m_state;		//shared_slot_state, and the generation of the slot - an opening bumps it
+	atomic<int32_t> m_account_no;
+	atomic<int32_t> m_balance;
+	char m_password[SHARED_PASSWORD_SIZE]; //null terminated. Written only while the slot is not open
+};
+
+//the layout of the segment. A fresh segment is zeroed - the locks are free, and the slots are empty
+struct shared_bank_segment {
+	uint64_t m_magic;
+	uint32_t m_num_slots;
+	atomic<uint32_t> m_table_lock; 		//taken by the openings of accounts (the only operations that claim slots)
+	atomic<uint32_t> m_used_slots; 		//the slots that are not empty
+	atomic<int32_t> m_bank_balance;		//written by the bank's process only
+	char m_pad[CACHE_LINE_SIZE - sizeof(uint64_t) - 4 * sizeof(uint32_t)];
+	shared_account m_accounts[SHARED_BANK_SLOTS];
+};
+
+
+/********************************************
+// 	class name	: 	SharedBank
+// 	Description	: 	A bank_service over a shared memory segment. The object that creates the segment owns it (and unlinks it when it's
+//					destroyed), the objects that attach to it only map it. The operations keep the pace of Bank's operations (an account
+//					is held for a second), and report the same messages to the log.
+//					A slot's fields are written under its lock, and read by the status printing without any lock (the state word is read
+//					before and after the fields, a slot that was reopened meanwhile is read again), so the status is not a point-in-time
+//					snapshot of the whole bank as it is in Bank. A lock that is taken over from a dead owner keeps the slot as the owner
+//					has left it - every operation writes a slot with a single store, but a transfer that is cut between its two stores
+//					is not rolled back
+//
+//	Members		:	m_name - the name of the segment
+//					m_owner - whether this object has created the segment
+//					m_segment - the mapped segment
+//					m_pid - the pid of the process (the value of the locks it holds)
+//					m_logger - the log of the bank (truncated by the owner, appended to by the ATM processes)
+//					m_seed - the seed of the commissions' rates (0 - seeded by the clock's time)
+//					m_atms_done - a latch that is counted down for every ATM that has finished (in the bank's process - for every ATM
+//								  process that has exited)
+//
+//	Methods		:	Main - runs the bank's jobs until the ATMs are done
+//					ChargeCommissionPass / PrintBankStats - the jobs of Main
+//					Name - the name of the segment
+//					OpenAccount / RemoveAccount / Deposit / Withdraw / Balance / Transfer - the operations of the ATMs
+*/
+class SharedBank : public bank_service {
+public:
+	/********************************************
+	// function name: 	SharedBank::SharedBank
+	// Description	: 	Constructor.
+	//					Creates the segment of the options' name (it must not exist), or attaches to it in attach mode. The log is
+	//					opened at the options' log path - truncated by the creator, appended to by the attaching processes
+	// Parameters	: 	options - the options of the run - the name of the segment (m_shm_name), attach mode, the log path and the seed
+	// Returns		: 	None
+	// Exception	: 	std::ofstream::failure in case the segment can't be created or attached (or isn't a segment of a SharedBank),
+	//					or the log can't be opened
+	*/
+	SharedBank(system_options const& options);
+
+	/********************************************
+	// function name: 	SharedBank::~SharedBank
+	// Description	: 	Destructor.
+	//					Unmaps the segment, and unlinks it if this object has created it (the attached processes keep their mappings)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual ~SharedBank();
+
+public: //Background jobs of the bank
+	/********************************************
+	// function name: 	SharedBank::Main
+	// Description	: 	Runs the jobs of the bank on a timer wheel - the status printing every half a second and the commission passes every
+	//					3 seconds - until the last ATM is done, then prints the final status
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual void Main();
+
+	/********************************************
+	// function name: 	SharedBank::ChargeCommissionPass
+	// Description	: 	A commission pass - draws an interest rate (2%-4%), charges it from all of the open accounts (every slot is locked
+	//					only while it's charged) and adds the total to the bank's balance
+	// Parameters	: 	None
+	// Returns		: 	int - the total commission charged in the pass
+	// Exception	: 	None
+	*/
+	int ChargeCommissionPass();
+
+	/********************************************
+	// function name: 	SharedBank::PrintBankStats
+	// Description	: 	Prints the status of the bank (the open accounts, sorted by their numbers, and the bank's balance), without
+	//					locking anything
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void PrintBankStats() const;
+
+	string const& Name() const {
+		return m_name;
+	}
+
+public: //ATM supported methods of the bank (see Bank)
+	virtual bool OpenAccount(int account_no, string const& password, int balance, int atm_id);
+	virtual bool RemoveAccount(int account_no, string const& password, int atm_id);
+	virtual bool Deposit(int account_no, string const& password, int amount, int atm_id);
+	virtual bool Withdraw(int account_no, string const& password, int amount, int atm_id);
+	virtual bool Balance(int account_no, string const& password, int atm_id);
+	virtual bool Transfer(int account_no, string const& password, int account_target, int amount, int atm_id);
+
+private:
+	virtual void __set_num_atms(unsigned num_atms) {
+		m_atms_done.Reset(num_atms);
+	}
+
+	virtual void __signal_finished() {
+		m_atms_done.CountDown();
+	}
+
+	/********************************************
+	// function name: 	SharedBank::__find
+	// Description	: 	Looks up the slot of an open account, without any lock (the account may be closed right after it's found)
+	// Parameters	: 	account_no - the account number
+	// Returns		: 	shared_account* - the slot of the account, NULL if there is no such account
+	// Exception	: 	None
+	*/
+	shared_account* __find(int account_no) const;
+
+	/********************************************
+	// function name: 	SharedBank::__acquire
+	// Description	: 	Looks up an open account and locks its slot. A slot that was closed (or reopened for another account) before it
+	//					was locked is not the account anymore
+	// Parameters	: 	account_no - the account number
+	//					password - the password of the account
+	//					password_correct - set to whether the password is the account's password. The slot is left unlocked if it isn't
+	// Returns		: 	shared_account* - the slot of the account, NULL if there is no such account (nothing is locked then)
+	// Exception	: 	None
+	*/
+	shared_account* __acquire(int account_no, string const& password, bool& password_correct);
+
+	/********************************************
+	// function name: 	SharedBank::__lock
+	// Description	: 	Locks a lock word of the segment (see shared_account::m_lock). A waiter sleeps on the word, and checks every
+	//					SHARED_LOCK_CHECK whether the owner is still alive - the lock of a dead owner is taken over
+	// Parameters	: 	word - the lock word
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __lock(atomic<uint32_t>& word) const;
+
+	/********************************************
+	// function name: 	SharedBank::__unlock
+	// Description	: 	Unlocks a lock word of the segment, and wakes one of its waiters (of any process), if it has any
+	// Parameters	: 	word - the lock word
+	//					is_sleep - tells the lock to sleep for a second before unlocking (default: false)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void __unlock(atomic<uint32_t>& word, bool is_sleep = false) const;
+
+	//the home position of an account number in the table
+	static size_t __hash(int account_no);
+
+	/********************************************
+	// function name: 	SharedBank::__log
+	// Description	: 	Formats a typed message on the stack and writes it to the log (no heap allocation, unless the message outgrows the buffer)
+	// Parameters	: 	message - the type of the message
+	//					args - the arguments of the message (integers or strings), in the order of its format
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	template <class... Args> void __log(bank_message message, Args const&... args) {
+		message_arg argv[] = {message_arg(args)...};
+		message_buffer msg(&m_logger); //a long message overflows to the logger, which still logs it whole
+		msg.Format(message, argv, sizeof...(Args));
+		m_logger.Write(msg.Data(), msg.Size()); //thread-safe logging
+	}
+
+private: //do not allow the user to copy the object
+	SharedBank(SharedBank const&);
+	SharedBank& operator=(SharedBank const&);
+
+private:
+	string m_name;
+	bool m_owner;
+	shared_bank_segment* m_segment;
+	uint32_t m_pid;
+	Logger m_logger;
+	unsigned m_seed;
+	countdown_latch m_atms_done;
+};
+
+
+#endif /* SHAREDBANK_H_ */
@@ -5,24 +5,28 @@
  *      Author: dror
  */
 
+#include <unistd.h>
 #include <exception>
+#include <sstream>
 #include <pthread.h>
 #include "System.h"
+#include "VirtualClock.h"
+#include "Fiber.h"
 
-#define NUM_MAIN_THREADS 2
+#define NUM_MAIN_THREADS 3
 typedef void* (*thread_fn)(void*);
 
 //******************************System main POSIX threads************************************
 /********************************************
 // function name: 	run_bank
 // Description	: 	Bank thread's routine. 
-//					Runs Bank::Main
-// Parameters	: 	arg - a void* to the Bank object
+//					Runs Bank::Main (or SharedBank::Main / ShardedBank::Main)
+// Parameters	: 	arg - a void* to the bank_service object
 // Returns		: 	void*
 // Exception	: 	None
 */
 void* run_bank(void* arg){
-	Bank* bank = reinterpret_cast<Bank*>(arg);
+	bank_service* bank = reinterpret_cast<bank_service*>(arg);
 	bank->Main();
 	pthread_exit((void*)0);
 }
@@ -41,6 +45,20 @@ void* run_atm_manager(void* arg){
 	pthread_exit((void*)0);
 }
 
+/********************************************
+// function name: 	run_server
+// Description	: 	BankServer thread's routine.
+//					Runs BankServer::Main
+// Parameters	: 	arg - a void* to the BankServer object
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* run_server(void* arg){
+	BankServer* server = reinterpret_cast<BankServer*>(arg);
+	server->Main();
+	pthread_exit((void*)0);
+}
+
 
 //***********************************************System API********************************************
 
@@ -48,22 +66,72 @@ void* run_atm_manager(void* arg){
 /********************************************
 // function name: 	System::System
 // Description	: 	Constructor.
-//					Initializes the Bank and the ATM_manager 
+//					Initializes the Bank and the ATM_manager (and the locks' instrumentation before them, if asked to).
+//					In processes mode a SharedBank is created instead of the Bank (its segment is named /bank.<pid> unless the options name
+//					it), and when attached to the segment of a running bank, a SharedBank attaches to it. With --shards (in the real modes) a
+//					ShardedBank is created instead of the Bank.
+//					When the bank serves clients on a socket, the BankServer is created after the ATMs
 // Parameters	: 	atm_files - a list of file paths for the ATMs files
+//					options - the options of the run (default: the default options)
 // Returns		: 	None
-// Exception	: 	Propagates std::ifstream::failure from ATM::ATM ctor, if needed
+// Exception	: 	Propagates std::ifstream::failure from ATM::ATM ctor, if needed (and from SharedBank::SharedBank, ShardedBank::ShardedBank and
+//					BankServer::BankServer)
 */
-System::System(vector<string> const& atm_files) : m_bank(NULL), m_manager(NULL){
+System::System(vector<string> const& atm_files, system_options const& options) :	m_bank(NULL),
+																					m_shared_bank(NULL),
+																					m_sharded_bank(NULL),
+																					m_manager(NULL),
+																					m_server(NULL),
+																					m_run_mode(options.m_run_mode),
+																					m_attach(options.m_attach),
+																					m_seed(options.m_seed ? options.m_seed : 1),
+																					m_report_metrics(options.m_metrics) {
+	//the locks get their sites when they are created, and the threads of the system must inherit the reporting signal's mask
+	if (options.m_lock_stats)
+		lock_stats_enable(options.m_lock_stats_period);
+
+	//the server is stopped by SIGINT / SIGTERM through a signalfd, so the threads of the system must inherit the signals' mask too
+	bool sharded = options.m_sharded && !m_attach && m_run_mode != ATM_RUN_PROCESSES && m_run_mode != ATM_RUN_VIRTUAL_CLOCK;
+	bool serve = !options.m_serve_address.empty() && !m_attach && m_run_mode != ATM_RUN_PROCESSES &&
+				 m_run_mode != ATM_RUN_VIRTUAL_CLOCK && !sharded;
+	if (serve)
+		BankServer::BlockStopSignals();
+
 	try {
-		m_bank = new Bank;
-		m_manager = new ATM_manager(atm_files, m_bank);
+		if (m_attach || m_run_mode == ATM_RUN_PROCESSES) {
+			system_options shared_options(options);
+			if (shared_options.m_shm_name.empty()) {
+				stringstream name;
+				name << "/bank." << getpid();
+				shared_options.m_shm_name = name.str();
+			}
+
+			m_shared_bank = new SharedBank(shared_options);
+			m_manager = new ATM_manager(atm_files, m_shared_bank, shared_options);
+		}
+		else if (sharded) {
+			m_sharded_bank = new ShardedBank(options);
+			m_manager = new ATM_manager(atm_files, m_sharded_bank, options);
+		}
+		else {
+			m_bank = new Bank(options);
+			m_manager = new ATM_manager(atm_files, m_bank, options);
+			if (serve)
+				m_server = new BankServer(m_bank, options);
+		}
 	} catch (std::bad_alloc& e) {
+		if (m_manager) delete m_manager;
 		if (m_bank) delete m_bank;
+		if (m_shared_bank) delete m_shared_bank;
+		if (m_sharded_bank) delete m_sharded_bank;
 		throw;
 	}
 	catch (std::ifstream::failure& e) {
+		delete m_server;
 		delete m_manager;
 		delete m_bank;
+		delete m_shared_bank;
+		delete m_sharded_bank;
 		throw;
 	}
 }
@@ -78,37 +146,79 @@ System::System(vector<string> const& atm_files) : m_bank(NULL), m_manager(NULL){
 // Exception	: 	None
 */
 System::~System(){
-	if (m_manager) 	delete m_manager;
-	if (m_bank) 	delete m_bank;
+	if (m_server) 		delete m_server;
+	if (m_manager) 		delete m_manager;
+	if (m_bank) 		delete m_bank;
+	if (m_shared_bank) 	delete m_shared_bank;
+	if (m_sharded_bank) delete m_sharded_bank;
 }
 
 /********************************************
 // function name: 	System::Main
 // Description	: 	Main method of the class. 
-//					Creates 2 distinc threads, 1st thread runs Bank::Main, 2nd thread runs ATM_manager::Main
+//					Creates 2 distinc threads, 1st thread runs Bank::Main, 2nd thread runs ATM_manager::Main (and a 3rd thread runs
+//					BankServer::Main, if the bank serves clients on a socket). On a virtual clock, the bank's jobs and all of the ATMs run as fibers of a VirtualClock
+//					on the calling thread instead (in simulated time, interleaved by the seed). Attached to the segment of a running bank,
+//					only ATM_manager::Main runs (on the calling thread).
+//					The final statistics of the locks are reported at the end, if they are instrumented, and the bank's operation
+//					counters, if asked to (a Bank's only - the operations of a SharedBank are not counted)
 // Parameters	: 	None
 // Returns		: 	None	
 // Exception	: 	None
 */
 void System::Main(){
+	if (m_attach)
+		m_manager->Main(); //the bank's jobs are run by the process of the bank
+	else if (m_run_mode == ATM_RUN_VIRTUAL_CLOCK)
+		__run_virtual_clock();
+	else
+		__run_threads();
+
+	//the final statistics of the locks, and the bank's counters
+	if (lock_stats_enabled())
+		lock_stats_report(stderr);
+	if (m_report_metrics && m_bank)
+		m_bank->Metrics().Report(stderr);
+}
+
+//runs Bank::Main and ATM_manager::Main on two threads (and BankServer::Main on a third one), until all of them are done
+void System::__run_threads(){
 	//create threads metadata
 	pthread_t main_threads[NUM_MAIN_THREADS];
-	thread_fn mains[NUM_MAIN_THREADS] = {run_bank, run_atm_manager};
-	void* args[NUM_MAIN_THREADS] = {static_cast<void*>(m_bank), static_cast<void*>(m_manager)};
+	thread_fn mains[NUM_MAIN_THREADS] = {run_bank, run_atm_manager, run_server};
+	bank_service* bank = m_bank ? static_cast<bank_service*>(m_bank) : m_sharded_bank ? static_cast<bank_service*>(m_sharded_bank) :
+																static_cast<bank_service*>(m_shared_bank);
+	void* args[NUM_MAIN_THREADS] = {static_cast<void*>(bank), static_cast<void*>(m_manager), static_cast<void*>(m_server)};
+	unsigned num_threads = m_server ? NUM_MAIN_THREADS : NUM_MAIN_THREADS - 1;
 	pthread_attr_t attr;
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
 	//create and run the threads
-	for (unsigned i = 0; i < NUM_MAIN_THREADS; ++i)
+	for (unsigned i = 0; i < num_threads; ++i)
 		pthread_create(&main_threads[i], &attr, mains[i], args[i]);
 
 	pthread_attr_destroy(&attr);
 
 	//wait for the threads to finish
-	for(unsigned i = 0; i < NUM_MAIN_THREADS; ++i)
+	for(unsigned i = 0; i < num_threads; ++i)
 		pthread_join(main_threads[i], NULL);
 
 	return;
 }
+
+//runs the bank's jobs and the ATMs as fibers of a virtual clock, until all of them are done
+void System::__run_virtual_clock() {
+	vector<Fiber*> fibers;
+	fibers.push_back(new_method_fiber(m_bank, &Bank::Main));
+	m_manager->CreateFibers(fibers);
+
+	VirtualClock clock(m_seed);
+	for (unsigned i = 0; i < fibers.size(); ++i)
+		clock.Spawn(fibers[i]);
+	clock.Run();
+
+	for (unsigned i = 0; i < fibers.size(); ++i)
+		delete fibers[i];
+}
@@ -9,7 +9,10 @@
 /*
 	Module Name : System
 	Description : An implementation of the system manager. Allocates and runs the main blocks of the program (Bank & ATM_manager)
-	Main methods: 	1. Main - creates 2 different threads that run ATM_manager::Main & Bank::Main
+	Main methods: 	1. Main - creates 2 different threads that run ATM_manager::Main & Bank::Main (or runs the whole system on a virtual clock).
+						In processes mode the bank is a SharedBank, and ATM_manager::Main runs the ATMs as processes. Attached to the segment
+						of another bank, only the ATMs run. A socket server runs BankServer::Main on a third thread. With --shards the bank is
+						a ShardedBank, and ShardedBank::Main runs the bank's jobs
  */
  
  
@@ -17,7 +20,11 @@
 #define SYSTEM_H_
 
 #include "Bank.h"
+#include "SharedBank.h"
+#include "ShardedBank.h"
 #include "ATM_manager.h"
+#include "BankServer.h"
+#include "Options.h"
 
 
 /********************************************
@@ -26,20 +33,29 @@
 //
 //	Members		:	manager - An ATM_manager, allocated on the heap
 //					bank - A Bank object, allocated on the heap
+//					shared_bank - A SharedBank object, allocated on the heap - in processes mode, and when attached to the segment of a
+//								  running bank (then there is no Bank object)
+//					sharded_bank - A ShardedBank object, allocated on the heap - with --shards, in the real modes (then there is no Bank object)
+//					server - A BankServer object, allocated on the heap - when the bank serves clients on a socket (NULL otherwise)
+//					m_attach - whether the system is attached to the segment of a running bank (the bank's jobs are run by that bank's process)
+//					m_run_mode - how the system runs (ATM_RUN_VIRTUAL_CLOCK - as fibers of a VirtualClock)
+//					m_seed - the seed of the virtual clock
+//					m_report_metrics - whether the bank's operation counters are reported at the end
 //					
-//	Methods		:	Main - ATM_manager::Main & Bank::Main on two distinct threads
+//	Methods		:	Main - ATM_manager::Main & Bank::Main on two distinct threads (and BankServer::Main on a third one)
 */
 class System {
 public:
 	/********************************************
 	// function name: 	System::System
 	// Description	: 	Constructor.
-	//					Initializes the Bank and the ATM_manager 
+	//					Initializes the Bank and the ATM_manager (and the locks' instrumentation before them, if asked to)
 	// Parameters	: 	atm_files - a list of file paths for the ATMs files
+	//					options - the options of the run (default: the default options)
 	// Returns		: 	None
 	// Exception	: 	Propagates std::ifstream::failure from ATM::ATM ctor, if needed
 	*/
-	System(vector<string> const& atm_files);
+	System(vector<string> const& atm_files, system_options const& options = system_options());
 	
 	/********************************************
 	// function name: 	System::~System
@@ -55,7 +71,12 @@ public: //API
 	/********************************************
 	// function name: 	System::Main
 	// Description	: 	Main method of the class. 
-	//					Creates 2 distinc threads, 1st thread runs Bank::Main, 2nd thread runs ATM_manager::Main
+	//					Creates 2 distinc threads, 1st thread runs Bank::Main, 2nd thread runs ATM_manager::Main (and a 3rd thread runs
+	//					BankServer::Main, if the bank serves clients on a socket). On a virtual clock, the bank's jobs and all of the ATMs run as fibers of a VirtualClock
+	//					on the calling thread instead (in simulated time, interleaved by the seed). Attached to the segment of a running bank,
+	//					only ATM_manager::Main runs (on the calling thread).
+	//					The final statistics of the locks are reported at the end, if they are instrumented, and the bank's operation
+	//					counters, if asked to (a Bank's only - the operations of a SharedBank are not counted)
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
@@ -63,11 +84,22 @@ public: //API
 	void Main();
 
 private: //do not allow the user to copy the object 
-	System(System const&) : m_bank(NULL), m_manager(NULL){}
+	System(System const&) : m_bank(NULL), m_shared_bank(NULL), m_sharded_bank(NULL), m_manager(NULL), m_server(NULL), m_run_mode(ATM_RUN_THREADS), m_attach(false), m_seed(0),
+							m_report_metrics(false){}
+
+	void __run_threads();
+	void __run_virtual_clock();
 
 private:
 	Bank* m_bank;
+	SharedBank* m_shared_bank;
+	ShardedBank* m_sharded_bank;
 	ATM_manager* m_manager;
+	BankServer* m_server;
+	atm_run_mode m_run_mode;
+	bool m_attach;
+	unsigned m_seed;
+	bool m_report_metrics;
 };
 
 
@@ -0,0 +1,227 @@
+/*
+ * TimerWheel.cpp
+ *
+ *  Created on: Jun 21, 2017
+ *      Author: dror
+ *
+ *	An implementation of the countdown_latch and the TimerWheel classes
+ */
+
+#include <limits.h>
+#include <time.h>
+#include <algorithm>
+#include "TimerWheel.h"
+#include "Fiber.h"
+
+//the time of the monotonic clock, in micro-seconds
+static uint64_t timer_now_usec() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+//**************************************countdown_latch***************************
+
+/********************************************
+// function name: 	countdown_latch::CountDown
+// Description	: 	Decrements the count. The call that opens the latch wakes all of its waiters
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void countdown_latch::CountDown() {
+	if (m_count.fetch_sub(1) == 1)
+		futex_wake(m_count, FUTEX_WAKE_ALL);
+}
+
+/********************************************
+// function name: 	countdown_latch::WaitFor
+// Description	: 	Waits until the latch opens, for a period at most. Inside a fiber the fiber sleeps (fiber_sleep) in steps of
+//					LATCH_FIBER_POLL, outside of a fiber the thread sleeps on the futex word
+// Parameters	: 	usec - the longest period to wait (in micro-seconds)
+// Returns		: 	bool - true if the latch is open, false if the period has passed
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+bool countdown_latch::WaitFor(unsigned usec) {
+	if (fiber_current()) {
+		while (usec > 0 && !IsOpen()) {
+			unsigned step = min(usec, (unsigned)LATCH_FIBER_POLL);
+			fiber_sleep(step);
+			usec -= step;
+		}
+		return IsOpen();
+	}
+
+	uint64_t deadline = timer_now_usec() + usec;
+	uint32_t count;
+	while ((count = m_count.load()) != 0) {
+		uint64_t now = timer_now_usec();
+		if (now >= deadline)
+			return false;
+
+		struct timespec timeout = {(time_t)((deadline - now) / 1000000), (long)((deadline - now) % 1000000) * 1000};
+		futex_wait(m_count, count, &timeout);
+	}
+	return true;
+}
+
+/********************************************
+// function name: 	countdown_latch::Wait
+// Description	: 	Waits until the latch opens
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void countdown_latch::Wait() {
+	if (fiber_current()) {
+		while (!IsOpen())
+			fiber_sleep(LATCH_FIBER_POLL);
+		return;
+	}
+
+	uint32_t count;
+	while ((count = m_count.load()) != 0)
+		futex_wait(m_count, count);
+}
+
+
+//**************************************TimerWheel***************************
+
+TimerWheel::TimerWheel() : m_tick(0), m_size(0) {
+	for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+		m_slots[i] = NULL;
+}
+
+TimerWheel::~TimerWheel() {
+	for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; ++i) {
+		while (m_slots[i]) {
+			timer_entry* entry = m_slots[i];
+			m_slots[i] = entry->m_next;
+			delete entry->m_job;
+			delete entry;
+		}
+	}
+}
+
+/********************************************
+// function name: 	TimerWheel::Schedule
+// Description	: 	Adds a periodic job to the wheel (the wheel owns it from now on). The periods are rounded up to whole ticks
+// Parameters	: 	job - the job
+//					period - the period of the job (in micro-seconds)
+//					delay - the time of the first run, since Run started (default: 0 - right away)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void TimerWheel::Schedule(timer_job* job, uint64_t period, uint64_t delay) {
+	timer_entry* entry = new timer_entry;
+	entry->m_job = job;
+	entry->m_period = max((uint64_t)1, (period + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK);
+	entry->m_due = m_tick + (delay + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+	__link(entry);
+}
+
+/********************************************
+// function name: 	TimerWheel::Run
+// Description	: 	Runs the jobs on schedule, until a latch opens. Between the runs the calling thread waits on the latch until the
+//					next due tick (countdown_latch::WaitFor), so it returns the moment the latch opens. A job that falls behind its
+//					schedule (the jobs before it took longer than its period) skips the runs it has missed, instead of running
+//					them back to back. Runs as a thread, or as a fiber (the time is then counted by the fiber's sleeps)
+// Parameters	: 	done - the latch
+// Returns		: 	None
+// Exception	: 	None
+*/
+void TimerWheel::Run(countdown_latch& done) {
+	bool is_fiber = fiber_current() != NULL;
+	uint64_t start = timer_now_usec();
+	uint64_t now = 0; //since the start, in micro-seconds
+	vector<timer_entry*> due;
+
+	while (true) {
+		__advance(now / TIMER_WHEEL_TICK, due);
+		for (unsigned i = 0; i < due.size(); ++i)
+			due[i]->m_job->Run();
+
+		//the jobs are rescheduled by the time they are done (a long job may have made the others miss a run)
+		if (!is_fiber)
+			now = timer_now_usec() - start;
+		uint64_t now_tick = now / TIMER_WHEEL_TICK;
+		for (unsigned i = 0; i < due.size(); ++i) {
+			timer_entry* entry = due[i];
+			entry->m_due += entry->m_period;
+			if (entry->m_due <= now_tick)
+				entry->m_due += ((now_tick - entry->m_due) / entry->m_period + 1) * entry->m_period;
+			__link(entry);
+		}
+
+		if (m_size == 0) {
+			done.Wait();
+			return;
+		}
+
+		uint64_t next = __next_due() * TIMER_WHEEL_TICK;
+		unsigned delay = next > now ? (unsigned)min(next - now, (uint64_t)UINT_MAX) : 0; //a longer wait is split
+		if (done.WaitFor(delay))
+			return;
+		now = is_fiber ? now + delay : timer_now_usec() - start;
+	}
+}
+
+//links a job to the slot of its tick (at the end of the slot's list, so the jobs due at the same tick run in the order they were scheduled)
+void TimerWheel::__link(timer_entry* entry) {
+	timer_entry** link = &m_slots[entry->m_due & (TIMER_WHEEL_SLOTS - 1)];
+	while (*link)
+		link = &(*link)->m_next;
+
+	entry->m_next = NULL;
+	*link = entry;
+	++m_size;
+}
+
+//unlinks the jobs that are due up to a tick (inclusive) and passes the wheel beyond it. The slots of the ticks the wheel passes are
+//visited once each - a revolution visits all of them, however far the wheel jumps
+void TimerWheel::__advance(uint64_t tick, vector<timer_entry*>& due) {
+	due.clear();
+	if (tick < m_tick)
+		return;
+
+	vector<pair<uint64_t, size_t> > order; //(tick, position in the slots' order) - the jobs run in the order of their ticks
+	vector<timer_entry*> found;
+	uint64_t last = min(tick, m_tick + TIMER_WHEEL_SLOTS - 1);
+	for (uint64_t t = m_tick; t <= last; ++t) {
+		timer_entry** link = &m_slots[t & (TIMER_WHEEL_SLOTS - 1)];
+		while (*link) {
+			timer_entry* entry = *link;
+			if (entry->m_due <= tick) {
+				*link = entry->m_next;
+				order.push_back(make_pair(entry->m_due, found.size()));
+				found.push_back(entry);
+				--m_size;
+			}
+			else
+				link = &entry->m_next;
+		}
+	}
+	m_tick = tick + 1;
+
+	sort(order.begin(), order.end());
+	for (unsigned i = 0; i < order.size(); ++i)
+		due.push_back(found[order[i].second]);
+}
+
+//the tick of the earliest job. The slots are visited from the current tick on - the first job found at its own tick is the earliest,
+//unless every job is more than a revolution ahead (the earliest of them all is taken then)
+uint64_t TimerWheel::__next_due() const {
+	uint64_t earliest = UINT64_MAX;
+	for (uint64_t t = m_tick; t < m_tick + TIMER_WHEEL_SLOTS; ++t) {
+		for (timer_entry* entry = m_slots[t & (TIMER_WHEEL_SLOTS - 1)]; entry; entry = entry->m_next) {
+			if (entry->m_due == t)
+				return t;
+			earliest = min(earliest, entry->m_due);
+		}
+	}
+	return earliest;
+}
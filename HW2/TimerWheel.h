@@ -0,0 +1,228 @@
+/*
+ * TimerWheel.h
+ *
+ *  Created on: Jun 21, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : TimerWheel
+	Description : The scheduling of the bank's background work - a hashed timer wheel that runs periodic jobs (the status printing,
+					the commission passes, the checkpoints) on a single thread, and a countdown latch the ATMs open as they finish.
+					The wheel's thread sleeps on the latch until the earliest job is due, so it wakes either exactly on schedule or the moment
+					the last ATM finishes - there is no polling loop, and no lock is taken to tell whether the ATMs are done.
+					A job is kept in the slot of the tick it's due at (its tick modulo the number of slots), so collecting the due jobs
+					only visits the slots of the ticks that have passed, instead of a queue ordered by all of the jobs' times.
+	Main methods: 	1. countdown_latch::CountDown / WaitFor - signal the latch / wait until it opens (or for a period)
+					2. TimerWheel::Schedule - adds a periodic job
+					3. TimerWheel::Run - runs the jobs on schedule, until a latch opens
+ */
+
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include "futex.h"
+
+using namespace std;
+
+#define TIMER_WHEEL_SLOTS 256 			//the number of slots of the wheel (a power of 2) - a revolution is TIMER_WHEEL_SLOTS ticks
+#define TIMER_WHEEL_TICK 10000 			//the resolution of the wheel (in micro-seconds)
+#define LATCH_FIBER_POLL 10000 			//the period (in micro-seconds) a fiber sleeps between two checks of a latch
+
+
+/********************************************
+// 	class name	: 	countdown_latch
+// 	Description	: 	A latch that opens once it has been counted down a number of times. The count is a single futex word - counting
+//					down is an atomic decrement (the last one wakes the waiters), and checking the latch is a plain load.
+//					A fiber can't sleep on the futex (it would block its worker, or the virtual clock), so it checks the latch
+//					every LATCH_FIBER_POLL instead
+//
+//	Members		:	m_count - the remaining count (0 - the latch is open)
+//
+//	Methods		:	Reset - sets the count
+//					Add - raises the count
+//					CountDown - decrements the count
+//					IsOpen - tells whether the count has reached 0
+//					Wait / WaitFor - waits until the latch opens (or for a period)
+*/
+class countdown_latch {
+public:
+	countdown_latch(uint32_t count) : m_count(count) {}
+
+public: //API
+	/********************************************
+	// function name: 	countdown_latch::Reset
+	// Description	: 	Sets the count of the latch. Must be called before anyone counts it down or waits for it
+	// Parameters	: 	count - the number of times the latch must be counted down to open (0 - it's open)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Reset(uint32_t count) {
+		m_count.store(count);
+	}
+
+	/********************************************
+	// function name: 	countdown_latch::Add
+	// Description	: 	Raises the count of the latch - more parties it waits for. Must be called before the latch opens
+	// Parameters	: 	count - the number of parties
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void Add(uint32_t count) {
+		m_count.fetch_add(count);
+	}
+
+	/********************************************
+	// function name: 	countdown_latch::CountDown
+	// Description	: 	Decrements the count. The call that opens the latch wakes all of its waiters
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void CountDown();
+
+	bool IsOpen() const {
+		return m_count.load() == 0;
+	}
+
+	/********************************************
+	// function name: 	countdown_latch::WaitFor
+	// Description	: 	Waits until the latch opens, for a period at most. Inside a fiber the fiber sleeps (fiber_sleep) in steps of
+	//					LATCH_FIBER_POLL, outside of a fiber the thread sleeps on the futex word
+	// Parameters	: 	usec - the longest period to wait (in micro-seconds)
+	// Returns		: 	bool - true if the latch is open, false if the period has passed
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	bool WaitFor(unsigned usec);
+
+	/********************************************
+	// function name: 	countdown_latch::Wait
+	// Description	: 	Waits until the latch opens
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void Wait();
+
+private: //do not allow the user to copy the object
+	countdown_latch(countdown_latch const&);
+	countdown_latch& operator=(countdown_latch const&);
+
+private:
+	atomic<uint32_t> m_count;
+};
+
+
+/********************************************
+// 	class name	: 	timer_job
+// 	Description	: 	A job of a TimerWheel. The job implements Run, which runs it once
+*/
+class timer_job {
+public:
+	virtual ~timer_job() {}
+	virtual void Run() = 0;
+};
+
+/********************************************
+// 	class name	: 	method_timer_job
+// 	Description	: 	A job that runs a method (with no parameters) of an object - e.g. Bank::ChargeCommissionPass. The method's
+//					result is ignored
+//
+//	Members		:	m_object - the object
+//					m_method - a pointer to the method
+*/
+template <class T, class Method> class method_timer_job : public timer_job {
+public:
+	method_timer_job(T* object, Method method) : m_object(object), m_method(method) {}
+
+	virtual void Run() {
+		(m_object->*m_method)();
+	}
+
+private:
+	T* m_object;
+	Method m_method;
+};
+
+//allocates a method_timer_job (the types are deduced from the arguments)
+template <class T, class Method> timer_job* new_method_timer_job(T* object, Method method) {
+	return new method_timer_job<T, Method>(object, method);
+}
+
+
+/********************************************
+// 	class name	: 	TimerWheel
+// 	Description	: 	A hashed timer wheel of periodic jobs. The time of the wheel is counted in ticks of TIMER_WHEEL_TICK since Run started,
+//					a job due at a tick is linked to slot (tick % TIMER_WHEEL_SLOTS) - a job that is due more than a revolution ahead
+//					shares its slot with nearer jobs, and is skipped until its own tick comes. Not thread-safe - the jobs are scheduled
+//					before Run, and run one at a time on its thread (so they never overlap each other)
+//
+//	Members		:	m_slots - the heads of the slots' lists of jobs
+//					m_tick - the next tick the wheel hasn't passed yet
+//					m_size - the number of jobs
+//
+//	Methods		:	Schedule - adds a periodic job
+//					Run - runs the jobs until a latch opens
+*/
+class TimerWheel {
+public:
+	TimerWheel();
+	~TimerWheel();
+
+public: //API
+	/********************************************
+	// function name: 	TimerWheel::Schedule
+	// Description	: 	Adds a periodic job to the wheel (the wheel owns it from now on). The periods are rounded up to whole ticks
+	// Parameters	: 	job - the job
+	//					period - the period of the job (in micro-seconds)
+	//					delay - the time of the first run, since Run started (default: 0 - right away)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void Schedule(timer_job* job, uint64_t period, uint64_t delay = 0);
+
+	/********************************************
+	// function name: 	TimerWheel::Run
+	// Description	: 	Runs the jobs on schedule, until a latch opens. Between the runs the calling thread waits on the latch until the
+	//					next due tick (countdown_latch::WaitFor), so it returns the moment the latch opens. A job that falls behind its
+	//					schedule (the jobs before it took longer than its period) skips the runs it has missed, instead of running
+	//					them back to back. Runs as a thread, or as a fiber (the time is then counted by the fiber's sleeps)
+	// Parameters	: 	done - the latch
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Run(countdown_latch& done);
+
+private:
+	struct timer_entry {
+		timer_job* m_job;
+		uint64_t m_period; 	//in ticks
+		uint64_t m_due; 	//the tick of the next run
+		timer_entry* m_next;
+	};
+
+	void __link(timer_entry* entry);
+	//unlinks the jobs that are due up to a tick (inclusive) and passes the wheel beyond it
+	void __advance(uint64_t tick, vector<timer_entry*>& due);
+	//the tick of the earliest job
+	uint64_t __next_due() const;
+
+private: //do not allow the user to copy the object
+	TimerWheel(TimerWheel const&);
+	TimerWheel& operator=(TimerWheel const&);
+
+private:
+	timer_entry* m_slots[TIMER_WHEEL_SLOTS];
+	uint64_t m_tick;
+	size_t m_size;
+};
+
+
+#endif /* TIMERWHEEL_H_ */
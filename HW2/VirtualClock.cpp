@@ -0,0 +1,64 @@
+/*
+ * VirtualClock.cpp
+ *
+ *  Created on: Jun 15, 2017
+ *      Author: dror
+ *
+ *	An implementation of the VirtualClock class
+ */
+
+#include "VirtualClock.h"
+
+#define VCLOCK_SEED_MIX 0x9e3779b97f4a7c15ull //spreads the bits of small seeds (xorshift needs a non-zero state)
+
+
+/********************************************
+// function name: 	VirtualClock::VirtualClock
+// Description	: 	Constructor.
+// Parameters	: 	seed - the seed of the interleaving of simultaneous events
+// Returns		: 	None
+// Exception	: 	None
+*/
+VirtualClock::VirtualClock(uint64_t seed) : m_now(0), m_random((seed + 1) * VCLOCK_SEED_MIX), m_sequence(0) {
+
+}
+
+/********************************************
+// function name: 	VirtualClock::Spawn
+// Description	: 	Adds a fiber to the clock. The fiber starts at the current simulated time
+// Parameters	: 	fiber - the fiber (owned by the caller, must stay alive until it's done)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void VirtualClock::Spawn(Fiber* fiber) {
+	__schedule(fiber, m_now);
+}
+
+/********************************************
+// function name: 	VirtualClock::Run
+// Description	: 	Runs the events in the order of their simulated time (and keys), until all of the fibers are done
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void VirtualClock::Run() {
+	while (!m_events.empty()) {
+		event next = m_events.top();
+		m_events.pop();
+
+		m_now = next.m_time;
+		int delay = next.m_fiber->Step();
+		if (delay != EXECUTOR_TASK_DONE)
+			__schedule(next.m_fiber, m_now + delay);
+	}
+}
+
+//schedules a fiber to be resumed at a simulated time, with the next key of the generator
+void VirtualClock::__schedule(Fiber* fiber, uint64_t time) {
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 7;
+	m_random ^= m_random << 17;
+
+	event e = {time, m_random, m_sequence++, fiber};
+	m_events.push(e);
+}
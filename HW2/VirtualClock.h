@@ -0,0 +1,108 @@
+/*
+ * VirtualClock.h
+ *
+ *  Created on: Jun 15, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : VirtualClock
+	Description : A deterministic discrete-event runner of fibers, in simulated time.
+					All of the fibers run on the calling thread, one at a time. A fiber that sleeps (fiber_sleep) or waits for a lock
+					(fiber_park) is suspended, and an event is scheduled at the simulated time it should wake up at - the clock then
+					jumps straight to the next event, so the delays of the program cost no real time at all.
+					Events that fall on the same simulated time are ordered by keys drawn from a seeded generator, so a seed fully
+					determines the interleaving of the fibers: a run with the same seed replays the same way, and different seeds explore
+					different interleavings.
+	Main methods: 	1. VirtualClock::Spawn - adds a fiber, to be started at the current simulated time
+					2. VirtualClock::Run - runs the fibers until all of them are done
+ */
+
+#ifndef VIRTUALCLOCK_H_
+#define VIRTUALCLOCK_H_
+
+#include <stdint.h>
+#include <vector>
+#include <queue>
+#include "Fiber.h"
+
+using namespace std;
+
+
+/********************************************
+// 	class name	: 	VirtualClock
+// 	Description	: 	A simulated clock and its queue of events (a fiber to be resumed at a simulated time).
+//
+//	Members		:	m_now - the current simulated time (in micro-seconds since the clock started)
+//					m_events - the scheduled events, the earliest first
+//					m_random - the state of the generator of the events' keys (xorshift64, seeded)
+//					m_sequence - the number of events scheduled so far (breaks the ties of the keys, so the order is total)
+//
+//	Methods		:	Spawn - adds a fiber
+//					Run - runs the fibers until all of them are done
+//					Now - returns the current simulated time
+*/
+class VirtualClock {
+public:
+	/********************************************
+	// function name: 	VirtualClock::VirtualClock
+	// Description	: 	Constructor.
+	// Parameters	: 	seed - the seed of the interleaving of simultaneous events
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	VirtualClock(uint64_t seed);
+
+public: //API
+	/********************************************
+	// function name: 	VirtualClock::Spawn
+	// Description	: 	Adds a fiber to the clock. The fiber starts at the current simulated time
+	// Parameters	: 	fiber - the fiber (owned by the caller, must stay alive until it's done)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void Spawn(Fiber* fiber);
+
+	/********************************************
+	// function name: 	VirtualClock::Run
+	// Description	: 	Runs the events in the order of their simulated time (and keys), until all of the fibers are done
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void Run();
+
+	uint64_t Now() const {
+		return m_now;
+	}
+
+private:
+	struct event {
+		uint64_t m_time;
+		uint64_t m_key;
+		uint64_t m_sequence;
+		Fiber* m_fiber;
+
+		//the priority queue holds the latest event at its top by default, so the order is reversed
+		bool operator<(event const& other) const {
+			if (m_time != other.m_time) return m_time > other.m_time;
+			if (m_key != other.m_key) return m_key > other.m_key;
+			return m_sequence > other.m_sequence;
+		}
+	};
+
+	void __schedule(Fiber* fiber, uint64_t time);
+
+private: //do not allow the user to copy the object
+	VirtualClock(VirtualClock const&);
+	VirtualClock& operator=(VirtualClock const&);
+
+private:
+	uint64_t m_now;
+	priority_queue<event> m_events;
+	uint64_t m_random;
+	uint64_t m_sequence;
+};
+
+
+#endif /* VIRTUALCLOCK_H_ */
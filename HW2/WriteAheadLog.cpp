@@ -0,0 +1,481 @@
+/*
+ * WriteAheadLog.cpp
+ *
+ *  Created on: Jun 18, 2017
+ *      Author: dror
+ *
+ *	An implementation of the WriteAheadLog class, and of its file format:
+ *		the file header (wal_file_header), followed by the records. A record is a wal_record_header, its entries, and the password
+ *		of an opened account, padded to a multiple of 8 bytes (so the headers in a mapped file are aligned).
+ *		The header holds the base LSN of the file - the records up to it were cut off by Truncate (a few of them may still be at the
+ *		beginning of the file, they are skipped by the replay)
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "WriteAheadLog.h"
+#include "Fiber.h"
+
+#define WAL_MAGIC "BANKWAL" 			//the first bytes of a log file (with the terminating NUL)
+#define WAL_VERSION 2 					//the version of the file format (2 - the base LSN was added to the header)
+#define WAL_ALIGNMENT 8 				//the records are padded to a multiple of this size
+#define WAL_BATCH_SIZE (256 * 1024) 	//in batch / async mode, the syncer is woken up before its interval once this much is pending
+#define WAL_COPY_SIZE (1024 * 1024) 	//the buffer of Truncate, when it copies the tail of the log
+#define WAL_TEMP_SUFFIX ".tmp" 			//the suffix of the new file of Truncate, until it replaces the log
+
+struct wal_file_header {
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_reserved;
+	uint64_t m_base_lsn;
+};
+
+struct wal_record_header {
+	uint32_t m_size; 			//the size of the whole record (padded)
+	uint32_t m_checksum; 		//FNV-1a of the record, from m_lsn to the end of the padding
+	uint64_t m_lsn;
+	uint8_t m_type;
+	uint8_t m_num_entries;
+	uint16_t m_password_len;
+	uint32_t m_reserved;
+};
+
+//the size of a record, padded
+static size_t record_size(unsigned num_entries, size_t password_len) {
+	size_t size = sizeof(wal_record_header) + num_entries * sizeof(wal_entry) + password_len;
+	return (size + WAL_ALIGNMENT - 1) & ~(size_t)(WAL_ALIGNMENT - 1);
+}
+
+//the checksum of a record (FNV-1a over everything after the checksum field)
+static uint32_t record_checksum(const char* record, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = offsetof(wal_record_header, m_lsn); i < size; ++i) {
+		hash ^= (unsigned char)record[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//writes a buffer to a file. Returns false in case of an error
+static bool write_all(int fd, const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+//writes the header of a log file, with the given base LSN
+static bool write_file_header(int fd, uint64_t base_lsn) {
+	wal_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+	header.m_version = WAL_VERSION;
+	header.m_base_lsn = base_lsn;
+	return write_all(fd, (const char*)&header, sizeof(header));
+}
+
+
+//********************************************
+// function name: WriteAheadLog::WriteAheadLog
+// Description	: 	Opens the log (it's created, with a file header, in case it doesn't exist) and starts the syncer thread
+// Parameters	: path - the path of the log file
+//				  mode - the sync mode (default: WAL_SYNC_TXN)
+//				  interval - the interval (micro-seconds) between two syncs in batch / async mode (default: WAL_SYNC_INTERVAL)
+//				  park_fibers - whether a fiber that waits for a sync is suspended, or blocks its thread (default: true)
+// Returns		: None
+// Exception	: In case the file can't be opened, or isn't a log of this version, throw an std::ofstream::failure error
+WriteAheadLog::WriteAheadLog(string path, wal_sync_mode mode, unsigned interval, bool park_fibers) :	m_path(path),
+																										m_fd(-1),
+																										m_mode(mode),
+																										m_interval(interval ? interval : WAL_SYNC_INTERVAL),
+																										m_park_fibers(park_fibers),
+																										m_base_lsn(0),
+																										m_file_size(sizeof(wal_file_header)),
+																										m_next_lsn(1),
+																										m_records(0),
+																										m_appended(0),
+																										m_durable(0),
+																										m_wakeup(0),
+																										m_synced(0),
+																										m_syncs(0),
+																										m_failed(false),
+																										m_running(true) {
+	stringstream error;
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (m_fd < 0) {
+		error << "write-ahead log " << path << " could not be opened!" << endl;
+		throw ofstream::failure(error.str());
+	}
+
+	wal_file_header header;
+	ssize_t n = pread(m_fd, &header, sizeof(header), 0);
+	if (n == 0) {
+		//a new log - write its header
+		write_file_header(m_fd, 0);
+		fdatasync(m_fd);
+	}
+	else if (n != sizeof(header) || memcmp(header.m_magic, WAL_MAGIC, sizeof(WAL_MAGIC)) != 0 || header.m_version != WAL_VERSION) {
+		close(m_fd);
+		error << path << " is not a write-ahead log of version " << WAL_VERSION << "!" << endl;
+		throw ofstream::failure(error.str());
+	}
+	else {
+		struct stat st;
+		fstat(m_fd, &st);
+		m_base_lsn = header.m_base_lsn;
+		m_file_size = st.st_size;
+		m_next_lsn = m_base_lsn + 1;
+		m_appended.store(m_base_lsn);
+		m_durable.store(m_base_lsn);
+	}
+
+	//the records at the beginning of the file are the first batch (their LSNs are unknown until they are replayed - 0 is a lower bound)
+	wal_batch first = {0, sizeof(wal_file_header)};
+	m_batches.push_back(first);
+
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_mutex_init(&m_io_lock, NULL);
+	m_pending.reserve(WAL_BATCH_SIZE);
+	m_writing.reserve(WAL_BATCH_SIZE);
+
+	pthread_create(&m_syncer, NULL, __syncer_main, static_cast<void*>(this));
+}
+
+//********************************************
+// function name: WriteAheadLog::~WriteAheadLog
+// Description	: Stops the syncer (after it has synced all of the appended records) and closes the file
+// Parameters	: None
+// Returns		: None
+WriteAheadLog::~WriteAheadLog() {
+	m_running.store(false);
+	++m_wakeup;
+	futex_wake(m_wakeup, 1);
+	pthread_join(m_syncer, NULL);
+
+	pthread_mutex_destroy(&m_lock);
+	pthread_mutex_destroy(&m_io_lock);
+	close(m_fd);
+}
+
+/********************************************
+// function name: 	WriteAheadLog::Replay
+// Description	: 	Reads the log from its beginning, and passes every valid record to a visitor. The replay stops at the first record
+//					that is torn or corrupted, and the file is cut there (so the following records are appended after the valid ones).
+//					Must be called before the first Append
+// Parameters	: 	visitor - applies the records
+//					after_lsn - only the records after this LSN are passed to the visitor (default: 0 - all of them). The records up
+//								to the base LSN of the file are never passed
+// Returns		: 	uint64_t - the number of records replayed
+// Exception	: 	None
+*/
+uint64_t WriteAheadLog::Replay(wal_visitor& visitor, uint64_t after_lsn) {
+	struct stat st;
+	if (fstat(m_fd, &st) < 0 || (size_t)st.st_size <= sizeof(wal_file_header))
+		return 0;
+
+	//the log is mapped and read in place - no copying, and the kernel reads ahead
+	size_t size = st.st_size;
+	const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (data == MAP_FAILED)
+		return 0;
+	madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	uint64_t replayed = 0, last_lsn = 0;
+	after_lsn = max(after_lsn, m_base_lsn);
+	size_t offset = sizeof(wal_file_header);
+	string password;
+	while (offset + sizeof(wal_record_header) <= size) {
+		const char* record = data + offset;
+		wal_record_header const& header = *(wal_record_header const*)record;
+
+		if (header.m_size != record_size(header.m_num_entries, header.m_password_len) || header.m_size > size - offset ||
+			header.m_lsn <= last_lsn || header.m_type < WAL_OPEN || header.m_type > WAL_COMMISSION ||
+			header.m_checksum != record_checksum(record, header.m_size))
+			break; //a torn (or corrupted) record - the end of the valid log
+
+		if (header.m_lsn > after_lsn) {
+			wal_entry const* entries = (wal_entry const*)(record + sizeof(wal_record_header));
+			password.assign((const char*)(entries + header.m_num_entries), header.m_password_len);
+			visitor.Apply((wal_record_type)header.m_type, entries, header.m_num_entries, password);
+			++replayed;
+		}
+
+		last_lsn = header.m_lsn;
+		offset += header.m_size;
+	}
+	munmap((void*)data, size);
+
+	if (offset < size) {
+		cerr << "write-ahead log: dropped a torn tail of " << size - offset << " bytes" << endl;
+		if (ftruncate(m_fd, offset) == 0)
+			fdatasync(m_fd);
+	}
+
+	last_lsn = max(last_lsn, m_base_lsn);
+	pthread_mutex_lock(&m_lock);
+	m_file_size = offset;
+	m_next_lsn = last_lsn + 1;
+	m_appended.store(last_lsn);
+	m_durable.store(last_lsn);
+	pthread_mutex_unlock(&m_lock);
+
+	return replayed;
+}
+
+/********************************************
+// function name: 	WriteAheadLog::Append
+// Description	: 	Appends a record to the pending buffer. The caller must still hold the locks of the record's accounts,
+//					so the records of an account are appended in the order of its mutations
+// Parameters	: 	type - the type of the record
+//					entries / num_entries - the after-images of the accounts (up to WAL_MAX_ENTRIES)
+//					password - the password of an opened account (default: NULL - none)
+// Returns		: 	uint64_t - the LSN of the record
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+uint64_t WriteAheadLog::Append(wal_record_type type, wal_entry const* entries, unsigned num_entries, string const* password) {
+	size_t password_len = password ? min(password->size(), (size_t)UINT16_MAX) : 0;
+	size_t size = record_size(num_entries, password_len);
+
+	pthread_mutex_lock(&m_lock);
+	//the record is built in place, at the end of the pending buffer
+	size_t start = m_pending.size();
+	m_pending.resize(start + size, '\0');
+	char* record = &m_pending[start];
+
+	wal_record_header& header = *(wal_record_header*)record;
+	header.m_size = size;
+	header.m_lsn = m_next_lsn++;
+	header.m_type = type;
+	header.m_num_entries = num_entries;
+	header.m_password_len = password_len;
+	header.m_reserved = 0;
+	memcpy(record + sizeof(wal_record_header), entries, num_entries * sizeof(wal_entry));
+	if (password_len)
+		memcpy(record + sizeof(wal_record_header) + num_entries * sizeof(wal_entry), password->data(), password_len);
+	header.m_checksum = record_checksum(record, size);
+
+	uint64_t lsn = header.m_lsn;
+	++m_records;
+	m_appended.store(lsn);
+	bool full = m_pending.size() >= WAL_BATCH_SIZE && start < WAL_BATCH_SIZE;
+	pthread_mutex_unlock(&m_lock);
+
+	//a large batch is written without waiting for the interval (once, by the record that filled it)
+	if (full && m_mode != WAL_SYNC_TXN) {
+		++m_wakeup;
+		futex_wake(m_wakeup, 1);
+	}
+	return lsn;
+}
+
+/********************************************
+// function name: 	WriteAheadLog::Commit
+// Description	: 	Waits until every record appended before the call is synced to the disk - in WAL_SYNC_TXN mode the syncer is
+//					woken up at once, in WAL_SYNC_BATCH mode the record waits for the next periodic sync, in WAL_SYNC_ASYNC mode
+//					it returns at once. Should be called after the accounts are unlocked (a sync is long)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+// Thread-safety:	Yes
+*/
+void WriteAheadLog::Commit() {
+	if (m_mode == WAL_SYNC_ASYNC)
+		return;
+
+	uint64_t target = m_appended.load();
+	while (m_durable.load() < target) {
+		uint32_t synced = m_synced.load();
+
+		if (m_mode == WAL_SYNC_TXN) {
+			++m_wakeup;
+			futex_wake(m_wakeup, 1);
+		}
+
+		if (m_durable.load() >= target)
+			break;
+		if (!m_park_fibers || !fiber_park())
+			futex_wait(m_synced, synced);
+	}
+}
+
+uint64_t WriteAheadLog::Records() const {
+	pthread_mutex_lock(&m_lock);
+	uint64_t records = m_records;
+	pthread_mutex_unlock(&m_lock);
+	return records;
+}
+
+/********************************************
+// function name: 	WriteAheadLog::Truncate
+// Description	: 	Cuts the records up to an LSN off the log (they are reflected by a durable checkpoint). The rest of the log is copied to
+//					a new file, which replaces the log atomically (rename) - a crash leaves either the old log or the new one. The copy
+//					starts at the first written batch that may hold a record after the LSN, so the syncer is stopped only while that tail
+//					(the records written since the checkpoint began) is copied. The appending threads are never stopped
+// Parameters	: 	lsn - the LSN the log is cut at
+// Returns		: 	bool - false in case the new file couldn't be written (the log is left as is)
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+bool WriteAheadLog::Truncate(uint64_t lsn) {
+	pthread_mutex_lock(&m_io_lock);
+	if (lsn <= m_base_lsn) {
+		pthread_mutex_unlock(&m_io_lock);
+		return true;
+	}
+
+	//the last batch that begins at (or before) the first record after the LSN
+	unsigned first = 0;
+	while (first + 1 < m_batches.size() && m_batches[first + 1].m_first_lsn <= lsn + 1)
+		++first;
+	size_t from = m_batches[first].m_offset;
+
+	string temp_path = m_path + WAL_TEMP_SUFFIX;
+	int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	bool copied = fd >= 0 && write_file_header(fd, lsn);
+
+	vector<char> buffer(WAL_COPY_SIZE);
+	for (size_t offset = from; copied && offset < m_file_size;) {
+		ssize_t n = pread(m_fd, &buffer[0], min((size_t)WAL_COPY_SIZE, m_file_size - offset), offset);
+		copied = n > 0 && write_all(fd, &buffer[0], n);
+		offset += copied ? n : 0;
+	}
+
+	copied = copied && fdatasync(fd) == 0 && rename(temp_path.c_str(), m_path.c_str()) == 0;
+	if (!copied) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(temp_path.c_str());
+		}
+		pthread_mutex_unlock(&m_io_lock);
+		return false;
+	}
+
+	//the rename is durable once the directory is synced
+	string directory = m_path.find('/') == string::npos ? "." : m_path.substr(0, m_path.rfind('/') + 1);
+	int dir_fd = open(directory.c_str(), O_RDONLY);
+	if (dir_fd >= 0) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+
+	close(m_fd);
+	m_fd = fd;
+	m_base_lsn = lsn;
+
+	//the batches of the tail move to the beginning of the new file
+	size_t shift = from - sizeof(wal_file_header);
+	m_batches.erase(m_batches.begin(), m_batches.begin() + first);
+	for (unsigned i = 0; i < m_batches.size(); ++i)
+		m_batches[i].m_offset -= shift;
+	m_file_size -= shift;
+
+	pthread_mutex_unlock(&m_io_lock);
+	return true;
+}
+
+/********************************************
+// function name: 	WriteAheadLog::__syncer_main
+// Description	: 	The syncer thread's routine. Runs WriteAheadLog::__sync_loop
+// Parameters	: 	wal - a void* to the WriteAheadLog object
+// Returns		: 	void*
+// Exception	: 	None
+*/
+void* WriteAheadLog::__syncer_main(void* wal) {
+	static_cast<WriteAheadLog*>(wal)->__sync_loop();
+	pthread_exit((void*)0);
+}
+
+/********************************************
+// function name: 	WriteAheadLog::__sync_loop
+// Description	: 	The main loop of the syncer. In WAL_SYNC_TXN mode the syncer syncs back to back as long as there are pending records
+//					(the records appended during a sync form the next group), and sleeps until a committer wakes it up otherwise.
+//					In batch / async mode it syncs once every interval (or once a large batch is pending).
+//					Returns once the log is being destroyed and nothing is pending
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void WriteAheadLog::__sync_loop() {
+	struct timespec timeout = {m_interval / 1000000, (long)(m_interval % 1000000) * 1000};
+
+	while (true) {
+		uint32_t wakeup = m_wakeup.load();
+		bool synced = __sync();
+
+		if (!synced && !m_running.load())
+			return;
+
+		if (!synced || m_mode != WAL_SYNC_TXN)
+			futex_wait(m_wakeup, wakeup, &timeout);
+	}
+}
+
+/********************************************
+// function name: 	WriteAheadLog::__sync
+// Description	: 	Takes the pending records, writes them with a single system call and syncs the file, then releases their committers
+// Parameters	: 	None
+// Returns		: 	bool - true if any record was synced
+// Exception	: 	None
+*/
+bool WriteAheadLog::__sync() {
+	pthread_mutex_lock(&m_lock);
+	if (m_pending.empty()) {
+		pthread_mutex_unlock(&m_lock);
+		return false;
+	}
+	m_pending.swap(m_writing);
+	uint64_t lsn = m_appended.load();
+	pthread_mutex_unlock(&m_lock);
+
+	pthread_mutex_lock(&m_io_lock);
+	//the batches are remembered sparsely (Truncate copies a little more than it must, but the list stays short)
+	if (m_file_size - m_batches.back().m_offset >= WAL_BATCH_SIZE) {
+		wal_batch batch = {((wal_record_header const*)m_writing.data())->m_lsn, m_file_size};
+		m_batches.push_back(batch);
+	}
+
+	__write(m_writing.data(), m_writing.size());
+	m_file_size += m_writing.size();
+	if (fdatasync(m_fd) < 0 && !m_failed.exchange(true))
+		perror("write-ahead log: sync failed");
+	pthread_mutex_unlock(&m_io_lock);
+	m_writing.clear();
+
+	m_durable.store(lsn);
+	++m_syncs;
+
+	//release the committers of the group
+	++m_synced;
+	futex_wake(m_synced, FUTEX_WAKE_ALL);
+	return true;
+}
+
+/********************************************
+// function name: 	WriteAheadLog::__write
+// Description	: 	Writes a buffer to the end of the file. A failure is reported once - the bank keeps running, without durability
+// Parameters	: 	data - the buffer
+//					len - the length of the buffer
+// Returns		: 	None
+// Exception	: 	None
+*/
+void WriteAheadLog::__write(const char* data, size_t len) {
+	if (!write_all(m_fd, data, len) && !m_failed.exchange(true))
+		perror("write-ahead log: write failed");
+}
@@ -0,0 +1,238 @@
+/*
+ * WriteAheadLog.h
+ *
+ *  Created on: Jun 18, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : WriteAheadLog
+	Description : A binary write-ahead log of the committed mutations of the bank - openings, closures, deposits, withdrawals,
+					transactions (transfers) and commissions. A record holds the after-images of the accounts it changed (the new
+					balances), so replaying the records in the log's order rebuilds the accounts, whatever state the replay starts from.
+					A record is appended while its accounts are still locked (so the records of an account are in the order of its
+					mutations) into an in-memory buffer, and a background syncer thread writes the buffer and syncs it to the disk.
+					An operation that must be durable waits (after it has unlocked its accounts) until the syncer has synced its record -
+					all of the operations that commit while a sync is in progress are synced together by the next one (group commit),
+					so the number of syncs doesn't grow with the number of ATMs.
+					Every record carries a log sequence number (LSN) and a checksum, the replay stops at the first torn or corrupted
+					record (the tail of a crash), and cuts it off. Once a checkpoint reflects the records up to an LSN, they are cut off
+					the beginning of the log (Truncate), so the log holds only the tail after the last checkpoint.
+	Main methods: 	1. Replay - rebuilds the state of the log's owner, before anything is appended
+					2. Append - appends a record, and returns its LSN
+					3. Commit - waits until the records appended so far are durable (according to the sync mode)
+					4. Truncate - cuts the records up to an LSN off the log
+ */
+
+#ifndef WRITEAHEADLOG_H_
+#define WRITEAHEADLOG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "futex.h"
+#include "Options.h"
+
+using namespace std;
+
+#define WAL_MAX_ENTRIES 255 //the maximal number of accounts of a single record
+
+//the type of a record - the mutation it logs
+typedef enum {
+	WAL_OPEN = 1,	//a single entry - the opening balance (the record also holds the password)
+	WAL_CLOSE,		//a single entry - the amount is the balance at the closure
+	WAL_DEPOSIT,	//a single entry each - the amount, and the new balance
+	WAL_WITHDRAW,
+	WAL_TRANSFER,	//an entry per account of a transaction (Bank::Execute) - the amount is the change of the balance
+	WAL_COMMISSION	//a single entry - the amount is the commission, it's added to the bank's balance
+} wal_record_type;
+
+//the after-image of an account in a record
+struct wal_entry {
+	int32_t m_account_no;
+	int32_t m_amount;
+	int32_t m_balance;
+};
+
+
+/********************************************
+// 	class name	: 	wal_visitor
+// 	Description	: 	The interface of a replay of the log - gets the valid records, in the log's order
+*/
+class wal_visitor {
+public:
+	virtual ~wal_visitor() {}
+
+	/********************************************
+	// function name: 	wal_visitor::Apply
+	// Description	: 	Applies a record
+	// Parameters	: 	type - the type of the record
+	//					entries / num_entries - the after-images of the record's accounts
+	//					password - the password of an opened account (empty in the other records)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	virtual void Apply(wal_record_type type, wal_entry const* entries, unsigned num_entries, string const& password) = 0;
+};
+
+
+/********************************************
+// 	class name	: 	WriteAheadLog
+// 	Description	: 	An append-only log file with group commit. The appending threads only copy their records into the pending buffer
+//					(under a short mutex), the syncer thread does all of the I/O
+//
+//	Members		:	m_path - the path of the log file
+//					m_fd - the file descriptor of the log
+//					m_mode - the sync mode (WAL_SYNC_TXN / WAL_SYNC_BATCH / WAL_SYNC_ASYNC)
+//					m_interval - the interval (micro-seconds) between two syncs in batch / async mode
+//					m_park_fibers - whether a fiber that waits for a sync is suspended (false on a virtual clock, where the real time
+//									of the sync must not change the simulated interleaving - the thread waits instead)
+//					m_base_lsn - the records up to this LSN were cut off the log
+//					m_io_lock - protects the file (m_fd, m_file_size, m_batches) - held by the syncer while it writes, and by Truncate
+//					m_file_size - the size of the file
+//					m_batches - the LSN of the first record of some of the written batches, and their offsets in the file (so Truncate
+//								knows where to cut the file without reading it)
+//					m_lock - protects m_pending, m_next_lsn and m_records
+//					m_pending - the records appended since the last sync
+//					m_writing - the records being written by the syncer (swapped with m_pending, so the appenders never wait for I/O)
+//					m_next_lsn - the LSN of the next record
+//					m_appended / m_durable - the LSN of the last appended record / of the last synced record
+//					m_wakeup / m_synced - futex words. The syncer sleeps on m_wakeup, the committers sleep on m_synced
+//					m_records / m_syncs - the number of records appended / the number of syncs (the ratio is the size of a group)
+//					m_failed - set once a write or a sync has failed (reported once)
+//					m_running - false once the log is being destroyed
+//					m_syncer - the syncer thread
+//
+//	Methods		:	Replay - replays the records of the log
+//					Append - appends a record
+//					Commit - waits until the appended records are durable
+//					Truncate - cuts the records up to an LSN off the log
+//					LastLsn - the LSN of the last appended record
+//					Records / Syncs - the statistics of the log
+*/
+class WriteAheadLog {
+public:
+	//********************************************
+	// function name: WriteAheadLog::WriteAheadLog
+	// Description	: 	Opens the log (it's created, with a file header, in case it doesn't exist) and starts the syncer thread
+	// Parameters	: path - the path of the log file
+	//				  mode - the sync mode (default: WAL_SYNC_TXN)
+	//				  interval - the interval (micro-seconds) between two syncs in batch / async mode (default: WAL_SYNC_INTERVAL)
+	//				  park_fibers - whether a fiber that waits for a sync is suspended, or blocks its thread (default: true)
+	// Returns		: None
+	// Exception	: In case the file can't be opened, or isn't a log of this version, throw an std::ofstream::failure error
+	WriteAheadLog(string path, wal_sync_mode mode = WAL_SYNC_TXN, unsigned interval = WAL_SYNC_INTERVAL, bool park_fibers = true);
+
+	//********************************************
+	// function name: WriteAheadLog::~WriteAheadLog
+	// Description	: Stops the syncer (after it has synced all of the appended records) and closes the file
+	// Parameters	: None
+	// Returns		: None
+	~WriteAheadLog();
+
+public: //API
+	/********************************************
+	// function name: 	WriteAheadLog::Replay
+	// Description	: 	Reads the log from its beginning, and passes every valid record to a visitor. The replay stops at the first record
+	//					that is torn or corrupted, and the file is cut there (so the following records are appended after the valid ones).
+	//					Must be called before the first Append
+	// Parameters	: 	visitor - applies the records
+	//					after_lsn - only the records after this LSN are passed to the visitor (default: 0 - all of them). The records up
+	//								to the base LSN of the file are never passed
+	// Returns		: 	uint64_t - the number of records replayed
+	// Exception	: 	None
+	*/
+	uint64_t Replay(wal_visitor& visitor, uint64_t after_lsn = 0);
+
+	/********************************************
+	// function name: 	WriteAheadLog::Append
+	// Description	: 	Appends a record to the pending buffer. The caller must still hold the locks of the record's accounts,
+	//					so the records of an account are appended in the order of its mutations
+	// Parameters	: 	type - the type of the record
+	//					entries / num_entries - the after-images of the accounts (up to WAL_MAX_ENTRIES)
+	//					password - the password of an opened account (default: NULL - none)
+	// Returns		: 	uint64_t - the LSN of the record
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	uint64_t Append(wal_record_type type, wal_entry const* entries, unsigned num_entries, string const* password = NULL);
+
+	/********************************************
+	// function name: 	WriteAheadLog::Commit
+	// Description	: 	Waits until every record appended before the call is synced to the disk - in WAL_SYNC_TXN mode the syncer is
+	//					woken up at once, in WAL_SYNC_BATCH mode the record waits for the next periodic sync, in WAL_SYNC_ASYNC mode
+	//					it returns at once. Should be called after the accounts are unlocked (a sync is long)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	// Thread-safety:	Yes
+	*/
+	void Commit();
+
+	/********************************************
+	// function name: 	WriteAheadLog::Truncate
+	// Description	: 	Cuts the records up to an LSN off the log (they are reflected by a durable checkpoint). The rest of the log is copied to
+	//					a new file, which replaces the log atomically (rename) - a crash leaves either the old log or the new one. The copy
+	//					starts at the first written batch that may hold a record after the LSN, so the syncer is stopped only while that tail
+	//					(the records written since the checkpoint began) is copied. The appending threads are never stopped
+	// Parameters	: 	lsn - the LSN the log is cut at
+	// Returns		: 	bool - false in case the new file couldn't be written (the log is left as is)
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	bool Truncate(uint64_t lsn);
+
+	uint64_t LastLsn() const {
+		return m_appended.load();
+	}
+
+	uint64_t Records() const;
+	uint64_t Syncs() const {
+		return m_syncs.load();
+	}
+
+private:
+	struct wal_batch {
+		uint64_t m_first_lsn;
+		size_t m_offset;
+	};
+
+	static void* __syncer_main(void* wal);
+
+	void __sync_loop();
+	bool __sync();
+	void __write(const char* data, size_t len);
+
+private: //do not allow the user to copy the object
+	WriteAheadLog(WriteAheadLog const&);
+	WriteAheadLog& operator=(WriteAheadLog const&);
+
+private:
+	string m_path;
+	int m_fd;
+	wal_sync_mode m_mode;
+	unsigned m_interval;
+	bool m_park_fibers;
+	uint64_t m_base_lsn;
+	pthread_mutex_t m_io_lock;
+	size_t m_file_size;
+	vector<wal_batch> m_batches;
+	mutable pthread_mutex_t m_lock;
+	string m_pending;
+	string m_writing;
+	uint64_t m_next_lsn;
+	uint64_t m_records;
+	atomic<uint64_t> m_appended;
+	atomic<uint64_t> m_durable;
+	atomic<uint32_t> m_wakeup;
+	atomic<uint32_t> m_synced;
+	atomic<uint64_t> m_syncs;
+	atomic<bool> m_failed;
+	atomic<bool> m_running;
+	pthread_t m_syncer;
+};
+
+
+#endif /* WRITEAHEADLOG_H_ */
@@ -0,0 +1,1545 @@
+/*
+ * bench.cpp
+ *
+ *  Created on: Jun 16, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : bench
+	Description : A synthetic workload generator and benchmark of the bank (make bench).
+					A run opens a set of accounts, and then a number of simulated ATMs call the Bank directly, as fast as they can - the
+					simulated delays of the program (the locks' holding period, the failures' penalty, the think time) are turned off.
+					Every ATM draws its operations from a weighted mix of O/D/W/B/Q/T, and its accounts from a uniform or a Zipfian
+					distribution. The latency of every operation is recorded in per-thread histograms, and the results are printed
+					as a single JSON object: the throughput, and p50/p99/p99.9 of the latency of every operation type.
+
+						./bench [--atms=<n>] [--accounts=<n>] [--mix=O:2,D:30,W:30,B:25,Q:2,T:11] [--skew=uniform|zipf[:<theta>]]
+								[--duration=<sec> | --ops=<n per ATM>] [--run=threads|executor|fibers] [--workers=<n>]
+								[--commissions] [--seed=<n>] [--log=<path>] [--lock-stats] [--wal=<path> [--wal-mode=txn|batch|async]]
+								[--checkpoint=<path>] [--shards[=<n>]]
+						./bench --generate=<path> --commands=<n> [--accounts=<n>] [--mix=...] [--skew=...] [--seed=<n>]
+						./bench --load=<path> [--stream]
+						./bench --scan [--accounts=<n>] [--passes=<n>]
+						./bench --lookup[=<max accounts>] [--ops=<n per size>] [--seed=<n>]
+						./bench --hot [--threads=<max>] [--duration=<sec per run>]
+						./bench --metrics [--threads=<max>]
+						./bench --allocs [--ops=<n>] (make check)
+						./bench --connect=unix:<path>|tcp:<port> [--connections=<n>] [--pipeline=<n>] [--workers=<n>] [--accounts=<n>]
+								[--mix=...] [--skew=...] [--duration=<sec>] [--seed=<n>]
+
+					--commissions charges commission passes back to back while the ATMs run (the passes are reported as the type "C").
+					--lock-stats instruments the bank's locks, and prints their contention statistics (to stderr) after the run.
+					--wal logs the bank's mutations to a write-ahead log (the bank is recovered from it first, if it exists) - the
+					number of records per sync shows the effect of the group commit.
+					--checkpoint restores the bank from a checkpoint first (if it exists, the accounts it holds are not opened again),
+					and writes a checkpoint after the run - the times of the restore and of the checkpoint are reported.
+					--shards runs the workload against a ShardedBank of n single-writer shards (a shard per core by default) instead of
+					the Bank - the accounts are owned by the shards' threads, and the ATMs send them their operations (--wal and
+					--checkpoint are features of the Bank, and are ignored).
+					--generate writes an ATM command file of the workload (to run the real system with it), --load measures the speed
+					of the command file loader (CommandFile / CommandStream) on a file.
+					--scan compares the account layout of the bank (a BankAccount object per account, in the directory and the index) with
+					the columns of AccountStore - the memory per account, and the time per account of a pass that sums the balances and of
+					a commission pass.
+					--lookup measures the latency of an account's lookup as the bank grows - a Bank of 100, 1000, ... accounts (up to
+					1,000,000 by default) is opened, and a single thread runs balance queries of uniformly drawn accounts against every
+					size - once over all of the accounts, and once over a hot set of 100 of them that fits in the cache. The latency
+					percentiles of every size are reported, and the ratio of the median of the largest bank to the smallest one's. The hot
+					set's ratio is close to 1 (the lookup is O(1), whatever the number of accounts), the ratio over all of the accounts adds
+					the cache misses of a bank that outgrows the cache.
+					--hot measures the contention on a single account - the throughput of deposits and withdrawals by 1, 2, 4, ... threads,
+					with the locked balance and with the lock-free one (--lock-free of the program).
+					--metrics measures the cost of counting an operation in the bank's per-thread counters (bank_metrics), by 1, 2, 4, ...
+					threads, against a single shared atomic counter.
+					--allocs enforces that a steady-state transaction of the bank makes no heap allocation - the program's operator new
+					counts the allocations of every thread, and a thread runs deposits, withdrawals, transfers and balance queries (and
+					their failures) against the Bank, after a warm-up. The run fails (exits with an error) if a single allocation was made.
+					--connect is a load generator of the bank's socket server (./Bank --serve=...) - it opens the accounts over a
+					connection, and then keeps --pipeline requests in flight on every one of --connections connections, spread over
+					--workers threads (a thread per core by default) that wait on an epoll instance each. The end-to-end throughput and
+					the latency of every operation type (from the send of a request to the arrival of its response) are reported.
+	Main methods: 	1. __run_workload - runs the ATMs against the bank and reports the results
+					2. __generate - writes a command file
+					3. __load - measures the loading of a command file
+					4. __scan - compares the memory and the scans of the two account layouts
+					5. __hot - compares the locked and the lock-free balance of a contended account
+					6. __metrics - measures the cost of the operation counters
+					7. __connect - loads the bank's socket server, and reports the requests per second and their latencies
+					8. __allocs - counts the heap allocations of steady-state transactions
+					9. __lookup - measures the latency of a lookup by the number of accounts
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+#include "Bank.h"
+#include "ShardedBank.h"
+#include "BankServer.h"
+#include "AccountStore.h"
+#include "CommandFile.h"
+#include "CommandStream.h"
+#include "Executor.h"
+#include "Fiber.h"
+#include "histogram.h"
+#include "lockstat.h"
+
+using namespace std;
+
+#define BENCH_NUM_OPS 6					//O D W B Q T
+#define BENCH_COMMISSION BENCH_NUM_OPS	//the histogram of the commission passes
+#define BENCH_PASSWORD "1234"
+#define BENCH_INITIAL_BALANCE 1000000	//the balance of the opened accounts (large enough for the withdrawals not to fail)
+#define BENCH_AMOUNT 10					//the largest amount of a deposit / withdrawal / transfer
+#define BENCH_LOAD_BATCH 4096			//the commands read from a file at a time, by --load
+#define BENCH_SCAN_PASSES 5				//the default number of passes of every kind, by --scan
+#define BENCH_SCAN_INTEREST 0.01f		//the interest rate of the commission passes of --scan
+#define BENCH_LOOKUP_MAX_ACCOUNTS 1000000	//the default largest number of accounts, by --lookup
+#define BENCH_LOOKUP_OPS 200000			//the default number of measured lookups at every size, by --lookup
+#define BENCH_LOOKUP_HOT_SET 100		//the accounts of the hot set of --lookup (and the smallest bank it measures)
+#define BENCH_HOT_THREADS 64			//the default largest number of threads, by --hot
+#define BENCH_METRICS_COUNTS 4000000	//the outcomes counted by every thread, by --metrics
+#define BENCH_CONNECTIONS 1000			//the default number of connections, by --connect
+#define BENCH_PIPELINE 16				//the default number of requests in flight on a connection, by --connect
+#define BENCH_MAX_PIPELINE 128			//the largest number of requests in flight on a connection
+#define BENCH_CONNECT_POLL 100			//the longest wait (in milli-seconds) of a thread of --connect for its connections
+#define BENCH_ALLOCS_OPS 100000			//the default number of measured rounds, by --allocs
+#define BENCH_ALLOCS_WARMUP 10000		//the rounds of --allocs before the allocations are counted
+#define BENCH_ALLOCS_ACCOUNTS 64		//the accounts of --allocs
+#define BENCH_ERROR 1
+
+static const char OP_LETTERS[BENCH_NUM_OPS + 1] = {'O', 'D', 'W', 'B', 'Q', 'T', 'C'};
+
+typedef enum {RUN_THREADS, RUN_EXECUTOR, RUN_FIBERS} bench_run_mode;
+
+
+/********************************************
+// 	struct name	: 	bench_options
+// 	Description	: 	The parameters of a benchmark run (see the module's description for the flags)
+*/
+struct bench_options {
+	unsigned m_num_atms;
+	unsigned m_num_accounts;
+	unsigned m_weights[BENCH_NUM_OPS];	//indexed by atm_opcode
+	double m_zipf_theta;				//0 - uniform
+	double m_duration;					//in seconds (used when m_ops is 0)
+	uint64_t m_ops;						//the operations of every ATM (0 - run for m_duration)
+	bench_run_mode m_run_mode;
+	unsigned m_num_workers;
+	bool m_commissions;
+	bool m_lock_stats;
+	unsigned m_seed;
+	string m_log_path;
+	string m_wal_path;
+	wal_sync_mode m_wal_mode;
+	string m_checkpoint_path;
+	string m_generate_path;
+	uint64_t m_num_commands;
+	string m_load_path;
+	bool m_stream;
+	bool m_scan;
+	unsigned m_passes;
+	bool m_hot;
+	unsigned m_max_threads;
+	bool m_metrics;
+	string m_connect_address;
+	unsigned m_num_connections;
+	unsigned m_pipeline;
+	bool m_sharded;
+	unsigned m_num_shards;
+	bool m_allocs;
+	bool m_lookup;
+	unsigned m_lookup_max_accounts;
+
+	bench_options() :	m_num_atms(4), m_num_accounts(10000), m_zipf_theta(0), m_duration(5), m_ops(0), m_run_mode(RUN_THREADS),
+						m_num_workers(0), m_commissions(false), m_lock_stats(false), m_seed(1), m_log_path("/dev/null"),
+						m_wal_mode(WAL_SYNC_TXN), m_num_commands(0), m_stream(false), m_scan(false), m_passes(BENCH_SCAN_PASSES),
+						m_hot(false), m_max_threads(BENCH_HOT_THREADS), m_metrics(false), m_num_connections(BENCH_CONNECTIONS),
+						m_pipeline(BENCH_PIPELINE), m_sharded(false), m_num_shards(0), m_allocs(false),
+						m_lookup(false), m_lookup_max_accounts(BENCH_LOOKUP_MAX_ACCOUNTS) {
+		unsigned weights[BENCH_NUM_OPS] = {2, 30, 30, 25, 2, 11};
+		memcpy(m_weights, weights, sizeof(m_weights));
+	}
+};
+
+
+//**************************************Random numbers***************************
+
+//a xorshift64 generator (every ATM has its own)
+class bench_random {
+public:
+	bench_random(uint64_t seed) : m_state((seed + 1) * 0x9e3779b97f4a7c15ull) {}
+
+	uint64_t Next() {
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 7;
+		m_state ^= m_state << 17;
+		return m_state;
+	}
+
+	//a uniform double in [0, 1)
+	double NextDouble() {
+		return (double)(Next() >> 11) / (double)(1ull << 53);
+	}
+
+private:
+	uint64_t m_state;
+};
+
+/********************************************
+// 	class name	: 	account_picker
+// 	Description	: 	Draws account numbers (1..n), uniformly or from a Zipfian distribution of skew theta (0 < theta < 1), where
+//					the account 1 is the most popular one. The Zipfian draw is the one of Gray et al. ("Quickly generating
+//					billion-record synthetic databases") - O(n) to set up, O(1) a draw. Shared (read only) by all of the ATMs
+*/
+class account_picker {
+public:
+	account_picker(unsigned num_accounts, double theta) : m_num_accounts(num_accounts), m_theta(theta), m_zetan(0), m_alpha(0), m_eta(0) {
+		if (m_theta <= 0)
+			return;
+
+		for (unsigned i = 1; i <= m_num_accounts; ++i)
+			m_zetan += 1.0 / pow((double)i, m_theta);
+		double zeta2 = 1.0 + 1.0 / pow(2.0, m_theta);
+		m_alpha = 1.0 / (1.0 - m_theta);
+		m_eta = (1.0 - pow(2.0 / m_num_accounts, 1.0 - m_theta)) / (1.0 - zeta2 / m_zetan);
+	}
+
+	int Pick(bench_random& random) const {
+		if (m_theta <= 0)
+			return 1 + (int)(random.Next() % m_num_accounts);
+
+		double u = random.NextDouble();
+		double uz = u * m_zetan;
+		if (uz < 1.0)
+			return 1;
+		if (uz < 1.0 + pow(0.5, m_theta))
+			return 2;
+
+		unsigned rank = (unsigned)(m_num_accounts * pow(m_eta * u - m_eta + 1.0, m_alpha));
+		return 1 + (int)(rank < m_num_accounts ? rank : m_num_accounts - 1);
+	}
+
+private:
+	unsigned m_num_accounts;
+	double m_theta;
+	double m_zetan;
+	double m_alpha;
+	double m_eta;
+};
+
+//draws an operation from the weighted mix
+static atm_opcode __pick_op(bench_options const& options, unsigned total_weight, bench_random& random) {
+	unsigned drawn = (unsigned)(random.Next() % total_weight);
+	for (unsigned op = 0; op < BENCH_NUM_OPS; ++op) {
+		if (drawn < options.m_weights[op])
+			return (atm_opcode)op;
+		drawn -= options.m_weights[op];
+	}
+	return ATM_OP_BALANCE; //not reached
+}
+
+
+//**************************************Statistics***************************
+
+//the latencies recorded by a thread. Registered once per thread, merged at the end of the run
+struct bench_stats {
+	latency_histogram m_latency[BENCH_NUM_OPS + 1];
+	uint64_t m_failures[BENCH_NUM_OPS + 1];
+
+	bench_stats() {
+		memset(m_failures, 0, sizeof(m_failures));
+	}
+};
+
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<bench_stats*> s_stats;
+static thread_local bench_stats* t_stats = NULL;
+
+//the statistics of the calling thread (allocated and registered on the first call)
+static bench_stats& __thread_stats() {
+	if (!t_stats) {
+		t_stats = new bench_stats;
+		pthread_mutex_lock(&s_stats_lock);
+		s_stats.push_back(t_stats);
+		pthread_mutex_unlock(&s_stats_lock);
+	}
+	return *t_stats;
+}
+
+static uint64_t __now_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+//**************************************The workload***************************
+
+static atomic<bool> s_stop(false);			//set when the run's duration is over
+static atomic<int> s_next_new_account(0);	//the next account number to be opened by an O operation
+
+/********************************************
+// 	class name	: 	bench_atm
+// 	Description	: 	A simulated ATM - draws operations and calls the bank. Runs as a thread (Main), as a task of an Executor (Step,
+//					an operation at a time) or as a fiber (FiberMain, yields after every operation)
+//
+//	Members		:	m_opened - the accounts the ATM has opened (and not closed yet) - Q closes them (Q of a missing account otherwise)
+*/
+class bench_atm : public executor_task {
+public:
+	bench_atm(bank_service* bank, bench_options const& options, account_picker const& picker, unsigned total_weight, int id) :
+		m_bank(bank), m_options(options), m_picker(picker), m_total_weight(total_weight), m_id(id), m_random(options.m_seed * 100003ull + id),
+		m_done_ops(0), m_password(BENCH_PASSWORD) {}
+
+	void Main() {
+		while (__operate()) {}
+	}
+
+	void FiberMain() {
+		while (__operate())
+			fiber_current()->Suspend(0);
+	}
+
+	virtual int Step() {
+		return __operate() ? 0 : EXECUTOR_TASK_DONE;
+	}
+
+private:
+	//runs the next operation. Returns false once the ATM is done
+	bool __operate() {
+		if (m_options.m_ops ? m_done_ops >= m_options.m_ops : s_stop.load(memory_order_relaxed))
+			return false;
+		++m_done_ops;
+
+		atm_opcode op = __pick_op(m_options, m_total_weight, m_random);
+		int account = m_picker.Pick(m_random);
+		int amount = 1 + (int)(m_random.Next() % BENCH_AMOUNT);
+		bool succeeded = false;
+
+		uint64_t start = __now_ns();
+		switch (op) {
+		case ATM_OP_OPEN:
+			account = ++s_next_new_account;
+			succeeded = m_bank->OpenAccount(account, m_password, amount, m_id);
+			if (succeeded)
+				m_opened.push_back(account);
+			break;
+		case ATM_OP_DEPOSIT:
+			succeeded = m_bank->Deposit(account, m_password, amount, m_id);
+			break;
+		case ATM_OP_WITHDRAW:
+			succeeded = m_bank->Withdraw(account, m_password, amount, m_id);
+			break;
+		case ATM_OP_BALANCE:
+			succeeded = m_bank->Balance(account, m_password, m_id);
+			break;
+		case ATM_OP_CLOSE:
+			account = -1; //no such account
+			if (!m_opened.empty()) {
+				account = m_opened.back();
+				m_opened.pop_back();
+			}
+			succeeded = m_bank->RemoveAccount(account, m_password, m_id);
+			break;
+		default: { //ATM_OP_TRANSFER
+			int target = m_picker.Pick(m_random);
+			if (target == account)
+				target = account % m_options.m_num_accounts + 1;
+			succeeded = m_bank->Transfer(account, m_password, target, amount, m_id);
+			break;
+		}
+		}
+		uint64_t latency = __now_ns() - start;
+
+		bench_stats& stats = __thread_stats();
+		stats.m_latency[op].Record(latency);
+		if (!succeeded)
+			++stats.m_failures[op];
+		return true;
+	}
+
+private:
+	bank_service* m_bank;
+	bench_options const& m_options;
+	account_picker const& m_picker;
+	unsigned m_total_weight;
+	int m_id;
+	bench_random m_random;
+	uint64_t m_done_ops;
+	string m_password;
+	vector<int> m_opened;
+};
+
+static void* __atm_thread_main(void* atm) {
+	reinterpret_cast<bench_atm*>(atm)->Main();
+	return NULL;
+}
+
+//charges commission passes back to back until the run is over (of the Bank, or of the ShardedBank)
+struct commission_charger {
+	Bank* m_bank;
+	ShardedBank* m_sharded_bank;
+	atomic<bool>* m_done;
+};
+
+static void* __commission_thread_main(void* arg) {
+	commission_charger& charger = *reinterpret_cast<commission_charger*>(arg);
+	while (!charger.m_done->load()) {
+		uint64_t start = __now_ns();
+		if (charger.m_bank)
+			charger.m_bank->ChargeCommissionPass();
+		else
+			charger.m_sharded_bank->ChargeCommissionPass();
+		__thread_stats().m_latency[BENCH_COMMISSION].Record(__now_ns() - start);
+	}
+	return NULL;
+}
+
+//ends the run after its duration
+static void* __timer_thread_main(void* duration) {
+	usleep((useconds_t)(*reinterpret_cast<double*>(duration) * 1000000));
+	s_stop.store(true);
+	return NULL;
+}
+
+//merges the statistics of all of the threads. Returns the number of ATM operations (the commission passes aside)
+static uint64_t __merge_stats(latency_histogram latency[BENCH_NUM_OPS + 1], uint64_t failures[BENCH_NUM_OPS + 1]) {
+	for (unsigned i = 0; i < s_stats.size(); ++i) {
+		for (unsigned op = 0; op <= BENCH_NUM_OPS; ++op) {
+			latency[op].Merge(s_stats[i]->m_latency[op]);
+			failures[op] += s_stats[i]->m_failures[op];
+		}
+	}
+
+	uint64_t total = 0;
+	for (unsigned op = 0; op < BENCH_NUM_OPS; ++op)
+		total += latency[op].Count();
+	return total;
+}
+
+//prints the "by_op" member of the results - the count, the failures and the latency of every operation type
+static void __print_by_op(latency_histogram const latency[BENCH_NUM_OPS + 1], uint64_t const failures[BENCH_NUM_OPS + 1],
+						  double elapsed_sec) {
+	printf("\"by_op\":{");
+
+	bool first = true;
+	for (unsigned op = 0; op <= BENCH_NUM_OPS; ++op) {
+		latency_histogram const& h = latency[op];
+		if (h.Count() == 0)
+			continue;
+		printf("%s\"%c\":{\"count\":%llu,\"failures\":%llu,\"ops_per_sec\":%.1f,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+			   "\"p999_us\":%.3f,\"max_us\":%.3f}",
+			   first ? "" : ",", OP_LETTERS[op], (unsigned long long)h.Count(), (unsigned long long)failures[op], h.Count() / elapsed_sec,
+			   h.Mean() / 1000.0, h.Percentile(50) / 1000.0, h.Percentile(99) / 1000.0, h.Percentile(99.9) / 1000.0, h.Max() / 1000.0);
+		first = false;
+	}
+	printf("}");
+}
+
+//prints the results of a run as a JSON object (bank is NULL for a ShardedBank of num_shards shards)
+static void __report(bench_options const& options, Bank const* bank, unsigned num_shards, double recovery_sec, double setup_sec, double elapsed_sec,
+					 double checkpoint_sec) {
+	latency_histogram latency[BENCH_NUM_OPS + 1];
+	uint64_t failures[BENCH_NUM_OPS + 1] = {0};
+	uint64_t total = __merge_stats(latency, failures);
+
+	static const char* RUN_MODES[] = {"threads", "executor", "fibers"};
+	printf("{\"benchmark\":\"workload\",\"run\":\"%s\",\"atms\":%u,\"accounts\":%u,\"skew\":%.3f,\"commissions\":%s,\"seed\":%u,",
+		   RUN_MODES[options.m_run_mode], options.m_num_atms, options.m_num_accounts, options.m_zipf_theta,
+		   options.m_commissions ? "true" : "false", options.m_seed);
+	if (num_shards)
+		printf("\"shards\":%u,", num_shards);
+	printf("\"setup_sec\":%.3f,\"elapsed_sec\":%.3f,\"ops\":%llu,\"ops_per_sec\":%.1f,",
+		   setup_sec, elapsed_sec, (unsigned long long)total, total / elapsed_sec);
+	if (bank && bank->WAL()) {
+		static const char* WAL_MODES[] = {"txn", "batch", "async"};
+		uint64_t records = bank->WAL()->Records(), syncs = bank->WAL()->Syncs();
+		printf("\"wal\":{\"mode\":\"%s\",\"recovery_sec\":%.3f,\"records\":%llu,\"syncs\":%llu,\"records_per_sync\":%.2f},",
+			   WAL_MODES[options.m_wal_mode], recovery_sec, (unsigned long long)records, (unsigned long long)syncs,
+			   syncs ? (double)records / syncs : 0.0);
+	}
+	if (bank && !options.m_checkpoint_path.empty())
+		printf("\"checkpoint\":{\"restore_sec\":%.3f,\"checkpoint_sec\":%.3f},", recovery_sec, checkpoint_sec);
+	__print_by_op(latency, failures, elapsed_sec);
+	printf("}\n");
+}
+
+/********************************************
+// function name: 	__run_workload
+// Description	: 	Opens the accounts, runs the ATMs against the bank - a Bank, or a ShardedBank with --shards - (as threads, tasks or
+//					fibers) and reports the results
+// Parameters	: 	options - the parameters of the run
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+static void __run_workload(bench_options const& options) {
+	fiber_set_delays(false);
+	if (options.m_lock_stats)
+		lock_stats_enable(0); //before the bank's locks are created
+
+	system_options bank_options;
+	bank_options.m_seed = options.m_seed;
+	bank_options.m_log_path = options.m_log_path;
+	bank_options.m_wal_path = options.m_wal_path;
+	bank_options.m_wal_mode = options.m_wal_mode;
+	bank_options.m_checkpoint_path = options.m_checkpoint_path;
+	bank_options.m_num_shards = options.m_num_shards;
+	uint64_t recovery_start = __now_ns();
+	Bank* locked_bank = NULL;
+	ShardedBank* sharded_bank = NULL;
+	if (options.m_sharded)
+		sharded_bank = new ShardedBank(bank_options);
+	else
+		locked_bank = new Bank(bank_options);
+	bank_service& bank = locked_bank ? static_cast<bank_service&>(*locked_bank) : static_cast<bank_service&>(*sharded_bank);
+	double recovery_sec = (__now_ns() - recovery_start) / 1e9;
+	srand(options.m_seed);
+
+	uint64_t setup_start = __now_ns();
+	string password(BENCH_PASSWORD);
+	for (unsigned account = 1; account <= options.m_num_accounts; ++account)
+		bank.OpenAccount(account, password, BENCH_INITIAL_BALANCE, 0);
+	s_next_new_account.store(options.m_num_accounts);
+
+	account_picker picker(options.m_num_accounts, options.m_zipf_theta);
+	unsigned total_weight = 0;
+	for (unsigned op = 0; op < BENCH_NUM_OPS; ++op)
+		total_weight += options.m_weights[op];
+
+	vector<bench_atm*> atms;
+	atms.reserve(options.m_num_atms);
+	for (unsigned i = 0; i < options.m_num_atms; ++i)
+		atms.push_back(new bench_atm(&bank, options, picker, total_weight, i + 1));
+	double setup_sec = (__now_ns() - setup_start) / 1e9;
+
+	//the optional commission passes, and the timer of the run
+	atomic<bool> commissions_done(false);
+	commission_charger charger = {locked_bank, sharded_bank, &commissions_done};
+	pthread_t commission_thread, timer_thread;
+	if (options.m_commissions)
+		pthread_create(&commission_thread, NULL, __commission_thread_main, &charger);
+	double duration = options.m_duration;
+	if (!options.m_ops)
+		pthread_create(&timer_thread, NULL, __timer_thread_main, &duration);
+
+	uint64_t start = __now_ns();
+	if (options.m_run_mode == RUN_THREADS) {
+		vector<pthread_t> threads(atms.size());
+		for (unsigned i = 0; i < atms.size(); ++i)
+			pthread_create(&threads[i], NULL, __atm_thread_main, atms[i]);
+		for (unsigned i = 0; i < atms.size(); ++i)
+			pthread_join(threads[i], NULL);
+	}
+	else {
+		vector<Fiber*> fibers;
+		Executor executor(options.m_num_workers);
+		for (unsigned i = 0; i < atms.size(); ++i) {
+			if (options.m_run_mode == RUN_FIBERS) {
+				fibers.push_back(new_method_fiber(atms[i], &bench_atm::FiberMain));
+				executor.Submit(fibers.back());
+			}
+			else
+				executor.Submit(atms[i]);
+		}
+		executor.Run();
+
+		for (unsigned i = 0; i < fibers.size(); ++i)
+			delete fibers[i];
+	}
+	double elapsed_sec = (__now_ns() - start) / 1e9;
+
+	commissions_done.store(true);
+	if (options.m_commissions)
+		pthread_join(commission_thread, NULL);
+	if (!options.m_ops)
+		pthread_join(timer_thread, NULL);
+
+	double checkpoint_sec = 0;
+	if (locked_bank && !options.m_checkpoint_path.empty()) {
+		uint64_t checkpoint_start = __now_ns();
+		locked_bank->Checkpoint();
+		checkpoint_sec = (__now_ns() - checkpoint_start) / 1e9;
+	}
+
+	__report(options, locked_bank, sharded_bank ? sharded_bank->NumShards() : 0, recovery_sec, setup_sec, elapsed_sec, checkpoint_sec);
+	if (options.m_lock_stats)
+		lock_stats_report(stderr);
+
+	for (unsigned i = 0; i < atms.size(); ++i)
+		delete atms[i];
+	delete locked_bank;
+	delete sharded_bank;
+}
+
+
+//**************************************Command files***************************
+
+/********************************************
+// function name: 	__generate
+// Description	: 	Writes an ATM command file of the workload: opens the accounts, and then the drawn commands
+// Parameters	: 	options - the parameters of the workload (m_generate_path, m_num_commands)
+// Returns		: 	bool - false in case the file couldn't be written
+// Exception	: 	None
+*/
+static bool __generate(bench_options const& options) {
+	FILE* file = fopen(options.m_generate_path.c_str(), "w");
+	if (!file)
+		return false;
+
+	account_picker picker(options.m_num_accounts, options.m_zipf_theta);
+	unsigned total_weight = 0;
+	for (unsigned op = 0; op < BENCH_NUM_OPS; ++op)
+		total_weight += options.m_weights[op];
+
+	bench_random random(options.m_seed);
+	for (unsigned account = 1; account <= options.m_num_accounts; ++account)
+		fprintf(file, "O %u %s %d\n", account, BENCH_PASSWORD, BENCH_INITIAL_BALANCE);
+
+	int next_new_account = options.m_num_accounts;
+	vector<int> opened;
+	for (uint64_t i = 0; i < options.m_num_commands; ++i) {
+		atm_opcode op = __pick_op(options, total_weight, random);
+		int account = picker.Pick(random);
+		int amount = 1 + (int)(random.Next() % BENCH_AMOUNT);
+		switch (op) {
+		case ATM_OP_OPEN:
+			opened.push_back(++next_new_account);
+			fprintf(file, "O %d %s %d\n", next_new_account, BENCH_PASSWORD, amount);
+			break;
+		case ATM_OP_DEPOSIT:
+		case ATM_OP_WITHDRAW:
+			fprintf(file, "%c %d %s %d\n", OP_LETTERS[op], account, BENCH_PASSWORD, amount);
+			break;
+		case ATM_OP_BALANCE:
+			fprintf(file, "B %d %s\n", account, BENCH_PASSWORD);
+			break;
+		case ATM_OP_CLOSE:
+			if (!opened.empty()) {
+				account = opened.back();
+				opened.pop_back();
+			}
+			fprintf(file, "Q %d %s\n", account, BENCH_PASSWORD);
+			break;
+		default: { //ATM_OP_TRANSFER
+			int target = picker.Pick(random);
+			if (target == account)
+				target = account % options.m_num_accounts + 1;
+			fprintf(file, "T %d %s %d %d\n", account, BENCH_PASSWORD, target, amount);
+			break;
+		}
+		}
+	}
+
+	return fclose(file) == 0;
+}
+
+/********************************************
+// function name: 	__load
+// Description	: 	Measures the loading of a command file - parses the whole file (with CommandFile, or with CommandStream
+//					in case of --stream) and reports the speed
+// Parameters	: 	options - the parameters of the run (m_load_path, m_stream)
+// Returns		: 	None
+// Exception	: 	Propagates std::ifstream::failure, in case the file can't be opened
+*/
+static void __load(bench_options const& options) {
+	struct stat file_stat;
+	uint64_t size = (stat(options.m_load_path.c_str(), &file_stat) == 0) ? file_stat.st_size : 0;
+
+	uint64_t start = __now_ns();
+	uint64_t commands = 0;
+	if (options.m_stream) {
+		CommandStream stream(options.m_load_path);
+		atm_command const* chunk;
+		password_table const* passwords;
+		for (size_t count = stream.Acquire(chunk, passwords); count > 0; count = stream.Acquire(chunk, passwords)) {
+			commands += count;
+			stream.Release();
+		}
+	}
+	else {
+		CommandFile file(options.m_load_path);
+		password_table passwords;
+		vector<atm_command> batch(BENCH_LOAD_BATCH);
+		for (size_t count = file.Read(&batch[0], batch.size(), passwords); count > 0; count = file.Read(&batch[0], batch.size(), passwords))
+			commands += count;
+	}
+	double elapsed_sec = (__now_ns() - start) / 1e9;
+
+	printf("{\"benchmark\":\"load\",\"loader\":\"%s\",\"bytes\":%llu,\"commands\":%llu,\"elapsed_sec\":%.3f,\"mb_per_sec\":%.1f,"
+		   "\"commands_per_sec\":%.1f}\n",
+		   options.m_stream ? "stream" : "preload", (unsigned long long)size, (unsigned long long)commands, elapsed_sec,
+		   size / 1e6 / elapsed_sec, commands / elapsed_sec);
+}
+
+//the bytes allocated from the heap so far (the small allocations, and the large ones that are mapped on their own)
+static size_t __heap_bytes() {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+/********************************************
+// function name: 	__scan
+// Description	: 	Compares the two account layouts - the objects of the bank (BankAccount, in an AccountDirectory and an AccountIndex)
+//					and the columns of an AccountStore. The same accounts are opened in both, the memory they take is measured (the
+//					heap for the objects, the footprint of the store for the columns), and then every layout runs the passes - a sum of
+//					the balances (the objects' balances are read at a snapshot, the way Bank::Snapshot reads them) and a commission pass.
+//					The sums of the two layouts must match after every pass
+// Parameters	: 	options - the parameters of the run (m_num_accounts, m_passes)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+static void __scan(bench_options const& options) {
+	unsigned num_accounts = options.m_num_accounts;
+	unsigned passes = options.m_passes ? options.m_passes : 1;
+	string password(BENCH_PASSWORD);
+
+	//the objects - the accounts, then the structures that look them up
+	version_manager versions;
+	size_t heap_start = __heap_bytes();
+	vector<BankAccount*> accounts(num_accounts);
+	for (unsigned i = 0; i < num_accounts; ++i)
+		accounts[i] = new BankAccount(i + 1, password, BENCH_INITIAL_BALANCE, &versions);
+	size_t heap_accounts = __heap_bytes();
+	AccountDirectory directory;
+	AccountIndex index;
+	for (unsigned i = 0; i < num_accounts; ++i) {
+		directory.Insert(accounts[i]); //the directory owns the accounts from now on
+		index.Insert(accounts[i]);
+	}
+	size_t heap_lookup = __heap_bytes();
+
+	//the columns
+	AccountStore store;
+	for (unsigned i = 0; i < num_accounts; ++i)
+		store.Open(i + 1, password, BENCH_INITIAL_BALANCE);
+	store_footprint footprint = store.Footprint();
+
+	uint64_t objects_sum_ns = 0, objects_charge_ns = 0, columns_sum_ns = 0, columns_charge_ns = 0;
+	bool match = true;
+	vector<BankAccount*> shard_accounts;
+	for (unsigned pass = 0; pass < passes; ++pass) {
+		uint64_t start = __now_ns();
+		int64_t objects_sum = 0;
+		uint32_t snapshot = versions.TakeSnapshot();
+		for (unsigned shard = 0; shard < directory.NumShards(); ++shard) {
+			shard_accounts.clear();
+			directory.Collect(shard, shard_accounts);
+			for (unsigned i = 0; i < shard_accounts.size(); ++i)
+				objects_sum += shard_accounts[i]->SnapshotBalance(snapshot);
+		}
+		versions.ReleaseSnapshot();
+		objects_sum_ns += __now_ns() - start;
+
+		start = __now_ns();
+		int64_t columns_sum = store.SumBalances();
+		columns_sum_ns += __now_ns() - start;
+		match = match && objects_sum == columns_sum;
+
+		start = __now_ns();
+		for (unsigned shard = 0; shard < directory.NumShards(); ++shard) {
+			shard_accounts.clear();
+			directory.Collect(shard, shard_accounts);
+			for (unsigned i = 0; i < shard_accounts.size(); ++i)
+				shard_accounts[i]->ChargeCommission(BENCH_SCAN_INTEREST);
+		}
+		objects_charge_ns += __now_ns() - start;
+
+		start = __now_ns();
+		store.ChargeCommission(BENCH_SCAN_INTEREST);
+		columns_charge_ns += __now_ns() - start;
+	}
+
+	double per_account = 1.0 / num_accounts, per_pass_account = 1.0 / ((double)passes * num_accounts);
+	size_t columns_total = footprint.m_columns + footprint.m_index + footprint.m_free_slots;
+	printf("{\"benchmark\":\"scan\",\"accounts\":%u,\"passes\":%u,\"sums_match\":%s,", num_accounts, passes, match ? "true" : "false");
+	printf("\"objects\":{\"bytes_per_account\":%.1f,\"account_bytes_per_account\":%.1f,\"lookup_bytes_per_account\":%.1f,"
+		   "\"sum_ns_per_account\":%.2f,\"charge_ns_per_account\":%.2f},",
+		   (heap_lookup - heap_start) * per_account, (heap_accounts - heap_start) * per_account, (heap_lookup - heap_accounts) * per_account,
+		   objects_sum_ns * per_pass_account, objects_charge_ns * per_pass_account);
+	printf("\"columns\":{\"bytes_per_account\":%.1f,\"column_bytes_per_account\":%.1f,\"lookup_bytes_per_account\":%.1f,"
+		   "\"arena_reserved_bytes\":%llu,\"slots\":%llu,\"sum_ns_per_account\":%.2f,\"charge_ns_per_account\":%.2f}}\n",
+		   columns_total * per_account, footprint.m_columns * per_account, footprint.m_index * per_account,
+		   (unsigned long long)footprint.m_arena_reserved, (unsigned long long)footprint.m_slots,
+		   columns_sum_ns * per_pass_account, columns_charge_ns * per_pass_account);
+}
+
+
+//**************************************Lookup***************************
+
+//runs a balance query of a uniformly drawn account for every one of num_ops lookups, and records the latency of every query in latency
+//(NULL - not recorded, a warm-up). The accounts are drawn from 1..num_accounts, or from the BENCH_LOOKUP_HOT_SET accounts spread over
+//the bank (every num_accounts / BENCH_LOOKUP_HOT_SET-th one) when hot is set
+static void __lookup_rounds(Bank& bank, unsigned num_accounts, bool hot, uint64_t num_ops, bench_random& random, string const& password,
+							latency_histogram* latency) {
+	unsigned stride = hot ? num_accounts / BENCH_LOOKUP_HOT_SET : 1;
+	unsigned drawn_accounts = hot ? BENCH_LOOKUP_HOT_SET : num_accounts;
+	for (uint64_t i = 0; i < num_ops; ++i) {
+		int account = 1 + (int)(random.Next() % drawn_accounts) * stride;
+		uint64_t start = __now_ns();
+		bank.Balance(account, password, 1);
+		if (latency)
+			latency->Record(__now_ns() - start);
+	}
+}
+
+/********************************************
+// function name: 	__lookup
+// Description	: 	Measures the latency of an account's lookup by the size of the bank - for 100, 1000, ... accounts (up to
+//					m_lookup_max_accounts), opens a Bank of that many accounts and runs m_ops balance queries of uniformly drawn accounts
+//					against it (after a tenth of that as a warm-up), on a single thread with the simulated delays off. A balance query is
+//					a lookup in the account directory, a read of the balance and a log record, so its latency follows the lookup's.
+//					The queries run twice - over all of the accounts, and over a hot set of BENCH_LOOKUP_HOT_SET accounts that stays in the
+//					cache. The hot set's latency is the cost of the lookup itself, the gap between the two is the cost of the cache misses
+//					of a bank that outgrows the cache
+// Parameters	: 	options - the parameters of the run (m_lookup_max_accounts, m_ops, m_seed, m_log_path)
+// Returns		: 	None
+// Exception	: 	std::ofstream::failure in case the log can't be opened, std::bad_alloc
+*/
+static void __lookup(bench_options const& options) {
+	fiber_set_delays(false);
+	uint64_t num_ops = options.m_ops ? options.m_ops : BENCH_LOOKUP_OPS;
+	string password(BENCH_PASSWORD);
+	system_options bank_options;
+	bank_options.m_log_path = options.m_log_path;
+
+	uint64_t first_p50[2] = {0, 0}, last_p50[2] = {0, 0}; //of all of the accounts, and of the hot set
+	printf("{\"benchmark\":\"lookup\",\"op\":\"B\",\"lookups_per_size\":%llu,\"results\":[", (unsigned long long)num_ops);
+	for (uint64_t num_accounts = BENCH_LOOKUP_HOT_SET; num_accounts <= options.m_lookup_max_accounts; num_accounts *= 10) {
+		Bank bank(bank_options);
+		uint64_t start = __now_ns();
+		for (unsigned account = 1; account <= num_accounts; ++account)
+			bank.OpenAccount(account, password, BENCH_INITIAL_BALANCE, 1);
+		double setup_sec = (__now_ns() - start) / 1e9;
+
+		printf("%s{\"accounts\":%llu,\"setup_sec\":%.3f", num_accounts > BENCH_LOOKUP_HOT_SET ? "," : "", (unsigned long long)num_accounts,
+			   setup_sec);
+		for (unsigned hot = 0; hot <= 1; ++hot) {
+			bench_random random(options.m_seed);
+			latency_histogram latency;
+			__lookup_rounds(bank, num_accounts, hot, num_ops / 10, random, password, NULL);
+			__lookup_rounds(bank, num_accounts, hot, num_ops, random, password, &latency);
+
+			last_p50[hot] = latency.Percentile(50);
+			if (!first_p50[hot])
+				first_p50[hot] = last_p50[hot];
+			printf(",\"%s\":{\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f}", hot ? "hot_set" : "all",
+				   latency.Mean() / 1000.0, latency.Percentile(50) / 1000.0, latency.Percentile(99) / 1000.0,
+				   latency.Percentile(99.9) / 1000.0, latency.Max() / 1000.0);
+		}
+		printf("}");
+		fflush(stdout);
+	}
+	printf("],\"all_p50_growth\":%.2f,\"hot_set_p50_growth\":%.2f}\n", first_p50[0] ? (double)last_p50[0] / first_p50[0] : 0,
+		   first_p50[1] ? (double)last_p50[1] / first_p50[1] : 0);
+}
+
+
+//**************************************Hot account***************************
+
+//the state of a thread of --hot (padded, so the threads don't share a line)
+struct alignas(CACHE_LINE_SIZE) hot_thread {
+	BankAccount* m_account;
+	uint64_t m_ops;
+	int64_t m_delta;	//the sum of the successful deposits, minus the sum of the successful withdrawals
+};
+
+static atomic<bool> s_hot_stop(false);
+
+//the main function of a thread of --hot - alternates deposits and withdrawals of 1 until it's stopped
+static void* __hot_thread_main(void* arg) {
+	hot_thread& thread = *reinterpret_cast<hot_thread*>(arg);
+	uint64_t ops = 0;
+	int64_t delta = 0;
+	while (!s_hot_stop.load(memory_order_relaxed)) {
+		if (ops & 1)
+			delta -= (thread.m_account->Withdraw(1, false) >= 0);
+		else
+			delta += (thread.m_account->Deposit(1, false) >= 0);
+		++ops;
+	}
+	thread.m_ops = ops;
+	thread.m_delta = delta;
+	return NULL;
+}
+
+//runs threads against a single account for a duration. Returns the operations per second, and sets consistent to whether the
+//final balance is the opening balance plus the changes the threads counted
+static double __hot_run(unsigned num_threads, bool lock_free, double duration, bool& consistent) {
+	version_manager versions;
+	BankAccount account(1, BENCH_PASSWORD, BENCH_INITIAL_BALANCE, &versions, NULL, lock_free);
+	vector<hot_thread> states(num_threads);
+	vector<pthread_t> threads(num_threads);
+
+	s_hot_stop.store(false);
+	uint64_t start = __now_ns();
+	for (unsigned i = 0; i < num_threads; ++i) {
+		states[i].m_account = &account;
+		pthread_create(&threads[i], NULL, __hot_thread_main, &states[i]);
+	}
+	usleep((useconds_t)(duration * 1000000));
+	s_hot_stop.store(true);
+
+	uint64_t ops = 0;
+	int64_t delta = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+		ops += states[i].m_ops;
+		delta += states[i].m_delta;
+	}
+	double elapsed_sec = (__now_ns() - start) / 1e9;
+
+	consistent = account.Balance(false) == BENCH_INITIAL_BALANCE + delta;
+	return ops / elapsed_sec;
+}
+
+/********************************************
+// function name: 	__hot
+// Description	: 	Measures the contention on a single hot account - 1, 2, 4, ... threads (up to m_max_threads) deposit to it and withdraw
+//					from it as fast as they can, once with the locked balance and once with the lock-free one (BankAccount's lock_free),
+//					for m_duration seconds each. The balance must match the operations the threads counted after every run
+// Parameters	: 	options - the parameters of the run (m_max_threads, m_duration)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+static void __hot(bench_options const& options) {
+	fiber_set_delays(false);
+	bool all_consistent = true;
+	printf("{\"benchmark\":\"hot_account\",\"duration_sec\":%.2f,\"results\":[", options.m_duration);
+	for (unsigned num_threads = 1; num_threads <= options.m_max_threads; num_threads *= 2) {
+		bool locked_consistent, lock_free_consistent;
+		double locked = __hot_run(num_threads, false, options.m_duration, locked_consistent);
+		double lock_free = __hot_run(num_threads, true, options.m_duration, lock_free_consistent);
+		all_consistent = all_consistent && locked_consistent && lock_free_consistent;
+		printf("%s{\"threads\":%u,\"locked_ops_per_sec\":%.0f,\"lock_free_ops_per_sec\":%.0f,\"speedup\":%.2f}",
+			   num_threads > 1 ? "," : "", num_threads, locked, lock_free, locked > 0 ? lock_free / locked : 0);
+		fflush(stdout);
+	}
+	printf("],\"consistent\":%s}\n", all_consistent ? "true" : "false");
+}
+
+
+//**************************************Metrics***************************
+
+//the state of a thread of --metrics
+struct metrics_thread {
+	bank_metrics* m_metrics; 		//NULL - count on m_shared instead
+	atomic<uint64_t>* m_shared;
+	int m_atm_id;
+};
+
+//the main function of a thread of --metrics - counts BENCH_METRICS_COUNTS outcomes, of every operation type in turn
+static void* __metrics_thread_main(void* arg) {
+	metrics_thread& thread = *reinterpret_cast<metrics_thread*>(arg);
+	for (unsigned i = 0; i < BENCH_METRICS_COUNTS; ++i) {
+		if (thread.m_metrics)
+			thread.m_metrics->Count((metric_op)(i % METRIC_NUM_OPS), (i & 7) ? OUTCOME_OK : OUTCOME_NOT_FOUND, thread.m_atm_id);
+		else
+			thread.m_shared->fetch_add(1, memory_order_relaxed);
+	}
+	return NULL;
+}
+
+//runs threads that count BENCH_METRICS_COUNTS outcomes each. Returns the time per count of a thread (the time is shared by the threads
+//that run on the same core), and sets consistent to whether the counters sum up to the counts
+static double __metrics_run(unsigned num_threads, bool sharded, bool& consistent) {
+	bank_metrics metrics;
+	metrics.SetNumAtms(num_threads);
+	atomic<uint64_t> shared(0);
+	vector<metrics_thread> states(num_threads);
+	vector<pthread_t> threads(num_threads);
+
+	uint64_t start = __now_ns();
+	for (unsigned i = 0; i < num_threads; ++i) {
+		metrics_thread state = {sharded ? &metrics : NULL, &shared, (int)i + 1};
+		states[i] = state;
+		pthread_create(&threads[i], NULL, __metrics_thread_main, &states[i]);
+	}
+	for (unsigned i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+	uint64_t elapsed_ns = __now_ns() - start;
+
+	uint64_t total = 0;
+	if (sharded) {
+		metrics_totals totals;
+		metrics.Read(totals);
+		for (unsigned op = 0; op < METRIC_NUM_OPS; ++op)
+			for (unsigned outcome = 0; outcome < METRIC_NUM_OUTCOMES; ++outcome)
+				total += totals.m_ops[op][outcome];
+		for (unsigned i = 0; i < num_threads; ++i)
+			consistent = consistent && totals.m_atm_succeeded[i] + totals.m_atm_failed[i] == BENCH_METRICS_COUNTS;
+	}
+	else
+		total = shared.load();
+	consistent = consistent && total == (uint64_t)num_threads * BENCH_METRICS_COUNTS;
+
+	unsigned cores = max(1l, sysconf(_SC_NPROCESSORS_ONLN));
+	return (double)elapsed_ns * min(num_threads, cores) / ((double)num_threads * BENCH_METRICS_COUNTS);
+}
+
+/********************************************
+// function name: 	__metrics
+// Description	: 	Measures the cost of counting an operation in the bank's metrics (bank_metrics::Count - a counter of the thread's
+//					own block and one of the ATM's) by 1, 2, 4, ... threads (up to m_max_threads), next to a single shared atomic
+//					counter. The counters must sum up to the counts after every run
+// Parameters	: 	options - the parameters of the run (m_max_threads)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+static void __metrics(bench_options const& options) {
+	bool consistent = true;
+	printf("{\"benchmark\":\"metrics\",\"counts_per_thread\":%u,\"results\":[", BENCH_METRICS_COUNTS);
+	for (unsigned num_threads = 1; num_threads <= options.m_max_threads; num_threads *= 2) {
+		double sharded = __metrics_run(num_threads, true, consistent);
+		double shared = __metrics_run(num_threads, false, consistent);
+		printf("%s{\"threads\":%u,\"sharded_ns_per_count\":%.2f,\"shared_atomic_ns_per_count\":%.2f}",
+			   num_threads > 1 ? "," : "", num_threads, sharded, shared);
+		fflush(stdout);
+	}
+	printf("],\"consistent\":%s}\n", consistent ? "true" : "false");
+}
+
+
+//**************************************Allocations***************************
+
+static thread_local uint64_t t_allocations = 0; 	//the heap allocations of the thread (counted by operator new)
+
+//the program's operator new - counts the allocations of the calling thread
+void* operator new(size_t size) {
+	++t_allocations;
+	void* memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+	free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+	free(memory);
+}
+
+//runs rounds of transactions against the bank - every round a deposit, a withdrawal, a transfer and a balance query that succeed,
+//and a withdrawal with a wrong password, a deposit to a missing account and a transfer of too much that fail
+static void __allocs_rounds(Bank& bank, uint64_t rounds, bench_random& random, string const& password, string const& wrong_password) {
+	for (uint64_t i = 0; i < rounds; ++i) {
+		int account = 1 + (int)(random.Next() % BENCH_ALLOCS_ACCOUNTS);
+		int target = 1 + (int)(random.Next() % BENCH_ALLOCS_ACCOUNTS);
+		int amount = 1 + (int)(random.Next() % BENCH_AMOUNT);
+		bank.Deposit(account, password, amount, 1);
+		bank.Withdraw(account, password, amount, 1);
+		bank.Transfer(account, password, target, amount, 1);
+		bank.Transfer(target, password, account, amount, 1);
+		bank.Balance(account, password, 1);
+		bank.Withdraw(account, wrong_password, amount, 1);
+		bank.Deposit(BENCH_ALLOCS_ACCOUNTS + 1, password, amount, 1);
+		bank.Transfer(account, password, target, INT_MAX, 1);
+	}
+}
+
+/********************************************
+// function name: 	__allocs
+// Description	: 	Counts the heap allocations of steady-state transactions - opens the accounts, runs BENCH_ALLOCS_WARMUP rounds of
+//					transactions (the thread's first transactions allocate its per-thread state - its log staging, its metrics block),
+//					and then m_ops rounds, whose allocations must be 0
+// Parameters	: 	options - the parameters of the run (m_ops, m_log_path)
+// Returns		: 	bool - true if the measured transactions made no allocation
+// Exception	: 	std::bad_alloc
+*/
+static bool __allocs(bench_options const& options) {
+	fiber_set_delays(false);
+	system_options bank_options;
+	bank_options.m_log_path = options.m_log_path;
+	Bank bank(bank_options);
+
+	string password(BENCH_PASSWORD), wrong_password(BENCH_PASSWORD "5");
+	for (int account = 1; account <= BENCH_ALLOCS_ACCOUNTS; ++account)
+		bank.OpenAccount(account, password, BENCH_INITIAL_BALANCE, 1);
+
+	bench_random random(options.m_seed);
+	__allocs_rounds(bank, BENCH_ALLOCS_WARMUP, random, password, wrong_password);
+
+	uint64_t rounds = options.m_ops ? options.m_ops : BENCH_ALLOCS_OPS;
+	uint64_t before = t_allocations;
+	uint64_t start = __now_ns();
+	__allocs_rounds(bank, rounds, random, password, wrong_password);
+	double elapsed_sec = (__now_ns() - start) / 1e9;
+	uint64_t allocations = t_allocations - before;
+
+	printf("{\"benchmark\":\"allocs\",\"transactions\":%llu,\"elapsed_sec\":%.3f,\"allocations\":%llu,\"allocations_per_transaction\":%.6f}\n",
+		   (unsigned long long)(rounds * 8), elapsed_sec, (unsigned long long)allocations, (double)allocations / (rounds * 8));
+	return allocations == 0;
+}
+
+
+//**************************************Socket server***************************
+
+//a connection of --connect. A request's slot (its tag modulo the pipeline) holds the time it was sent, its operation and its account
+struct client_connection {
+	int m_fd;
+	bool m_writing;			//whether the thread waits for the socket to be writable
+	uint32_t m_next_tag;
+	uint64_t m_sent_at[BENCH_MAX_PIPELINE];
+	uint8_t m_ops[BENCH_MAX_PIPELINE];
+	int m_accounts[BENCH_MAX_PIPELINE];
+	vector<int> m_opened;	//the accounts the connection has opened (and not closed yet) - Q closes them
+	size_t m_in_len;
+	size_t m_out_len;
+	char m_in[BENCH_MAX_PIPELINE * sizeof(wire_response)];
+	char m_out[BENCH_MAX_PIPELINE * sizeof(wire_request)];
+};
+
+//the state of a thread of --connect
+struct client_thread {
+	bench_options const* m_options;
+	account_picker const* m_picker;
+	unsigned m_total_weight;
+	unsigned m_id;
+	vector<client_connection*> m_connections;
+	uint64_t m_lost;	//the connections that have failed during the run
+};
+
+//fills a request of an operation (with the ATM's password)
+static void __fill_request(wire_request& request, uint32_t tag, atm_opcode op, int account, int amount, int target) {
+	memset(&request, 0, sizeof(request));
+	request.m_tag = tag;
+	request.m_op = op;
+	request.m_password_len = sizeof(BENCH_PASSWORD) - 1;
+	memcpy(request.m_password, BENCH_PASSWORD, sizeof(BENCH_PASSWORD) - 1);
+	request.m_account = account;
+	request.m_amount = amount;
+	request.m_target = target;
+}
+
+//draws the next operation of a connection, and appends its request to the connection's output
+static void __queue_request(client_thread& thread, client_connection& conn, bench_random& random) {
+	bench_options const& options = *thread.m_options;
+	atm_opcode op = __pick_op(options, thread.m_total_weight, random);
+	int account = thread.m_picker->Pick(random);
+	int amount = 1 + (int)(random.Next() % BENCH_AMOUNT);
+	int target = 0;
+	if (op == ATM_OP_OPEN)
+		account = ++s_next_new_account;
+	else if (op == ATM_OP_CLOSE) {
+		account = -1; //no such account
+		if (!conn.m_opened.empty()) {
+			account = conn.m_opened.back();
+			conn.m_opened.pop_back();
+		}
+	}
+	else if (op == ATM_OP_TRANSFER) {
+		target = thread.m_picker->Pick(random);
+		if (target == account)
+			target = account % options.m_num_accounts + 1;
+	}
+
+	uint32_t tag = conn.m_next_tag++;
+	unsigned slot = tag % options.m_pipeline;
+	wire_request request;
+	__fill_request(request, tag, op, account, amount, target);
+	memcpy(conn.m_out + conn.m_out_len, &request, sizeof(request));
+	conn.m_out_len += sizeof(request);
+	conn.m_ops[slot] = op;
+	conn.m_accounts[slot] = account;
+	conn.m_sent_at[slot] = __now_ns();
+}
+
+//sends the output of a connection, and watches it for writing while a part is left. Returns false in case the connection has failed
+static bool __flush_requests(int epoll_fd, client_connection& conn) {
+	size_t sent = 0;
+	while (sent < conn.m_out_len) {
+		ssize_t written = send(conn.m_fd, conn.m_out + sent, conn.m_out_len - sent, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return false;
+		}
+		sent += written;
+	}
+	memmove(conn.m_out, conn.m_out + sent, conn.m_out_len - sent);
+	conn.m_out_len -= sent;
+
+	bool writing = conn.m_out_len > 0;
+	if (writing != conn.m_writing) {
+		struct epoll_event event;
+		event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		event.data.ptr = &conn;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.m_fd, &event) != 0)
+			return false;
+		conn.m_writing = writing;
+	}
+	return true;
+}
+
+//reads the responses of a connection - records their latencies, and sends a new request for every one of them (until the run is
+//over). Returns false in case the connection has failed
+static bool __receive_responses(int epoll_fd, client_thread& thread, client_connection& conn, bench_random& random) {
+	ssize_t received = read(conn.m_fd, conn.m_in + conn.m_in_len, sizeof(conn.m_in) - conn.m_in_len);
+	if (received <= 0)
+		return received < 0 && (errno == EAGAIN || errno == EINTR);
+	conn.m_in_len += received;
+
+	uint64_t now = __now_ns();
+	bench_stats& stats = __thread_stats();
+	bool stopping = s_stop.load(memory_order_relaxed);
+	size_t consumed = 0;
+	for (; conn.m_in_len - consumed >= sizeof(wire_response); consumed += sizeof(wire_response)) {
+		wire_response response;
+		memcpy(&response, conn.m_in + consumed, sizeof(response));
+		unsigned slot = response.m_tag % thread.m_options->m_pipeline;
+		atm_opcode op = (atm_opcode)conn.m_ops[slot];
+		stats.m_latency[op].Record(now - conn.m_sent_at[slot]);
+		if (response.m_status != WIRE_OK)
+			++stats.m_failures[op];
+		else if (op == ATM_OP_OPEN)
+			conn.m_opened.push_back(conn.m_accounts[slot]);
+		if (!stopping)
+			__queue_request(thread, conn, random);
+	}
+	memmove(conn.m_in, conn.m_in + consumed, conn.m_in_len - consumed);
+	conn.m_in_len -= consumed;
+	return __flush_requests(epoll_fd, conn);
+}
+
+static void* __client_thread_main(void* arg) {
+	client_thread& thread = *reinterpret_cast<client_thread*>(arg);
+	bench_random random(thread.m_options->m_seed * 100003ull + thread.m_id);
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	//fill the pipelines
+	for (unsigned i = 0; i < thread.m_connections.size(); ++i) {
+		client_connection& conn = *thread.m_connections[i];
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = &conn;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.m_fd, &event);
+		for (unsigned j = 0; j < thread.m_options->m_pipeline; ++j)
+			__queue_request(thread, conn, random);
+		if (!__flush_requests(epoll_fd, conn))
+			++thread.m_lost;
+	}
+
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	while (!s_stop.load(memory_order_relaxed)) {
+		int num_events = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, BENCH_CONNECT_POLL);
+		for (int i = 0; i < num_events; ++i) {
+			client_connection& conn = *reinterpret_cast<client_connection*>(events[i].data.ptr);
+			bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+			if (alive && (events[i].events & EPOLLOUT))
+				alive = __flush_requests(epoll_fd, conn);
+			if (alive && (events[i].events & EPOLLIN))
+				alive = __receive_responses(epoll_fd, thread, conn, random);
+			if (!alive) {
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.m_fd, NULL);
+				++thread.m_lost;
+			}
+		}
+	}
+
+	close(epoll_fd);
+	return NULL;
+}
+
+//opens the accounts of the run over a connection of its own, a pipeline of requests at a time (accounts that exist already - of an
+//earlier run against the same server - are kept). Returns false in case the connection has failed
+static bool __open_server_accounts(bench_options const& options) {
+	int fd = server_connect(options.m_connect_address);
+	if (fd < 0 || fcntl(fd, F_SETFL, 0) != 0) //blocking
+		return false;
+
+	bool succeeded = true;
+	for (unsigned first = 1; first <= options.m_num_accounts && succeeded; first += BENCH_MAX_PIPELINE) {
+		unsigned count = min((unsigned)BENCH_MAX_PIPELINE, options.m_num_accounts - first + 1);
+		wire_request requests[BENCH_MAX_PIPELINE];
+		for (unsigned i = 0; i < count; ++i)
+			__fill_request(requests[i], i, ATM_OP_OPEN, first + i, BENCH_INITIAL_BALANCE, 0);
+
+		wire_response responses[BENCH_MAX_PIPELINE];
+		char* in = reinterpret_cast<char*>(responses);
+		size_t expected = count * sizeof(wire_response), received = 0;
+		succeeded = send(fd, requests, count * sizeof(wire_request), MSG_NOSIGNAL) == (ssize_t)(count * sizeof(wire_request));
+		while (succeeded && received < expected) {
+			ssize_t n = read(fd, in + received, expected - received);
+			succeeded = n > 0;
+			received += succeeded ? n : 0;
+		}
+	}
+	close(fd);
+	return succeeded;
+}
+
+/********************************************
+// function name: 	__connect
+// Description	: 	Loads the bank's socket server - opens the accounts, connects m_num_connections connections (spread over a thread per
+//					core, or m_num_workers threads), keeps m_pipeline requests in flight on every one of them for m_duration seconds, and
+//					reports the requests per second and the latency of every operation type
+// Parameters	: 	options - the parameters of the run (m_connect_address, m_num_connections, m_pipeline)
+// Returns		: 	bool - false in case the server can't be reached
+// Exception	: 	std::bad_alloc
+*/
+static bool __connect(bench_options const& options) {
+	unsigned fd_limit = server_raise_fd_limit();
+	unsigned num_threads = options.m_num_workers;
+	if (!num_threads)
+		num_threads = max(1l, sysconf(_SC_NPROCESSORS_ONLN));
+	num_threads = min(num_threads, options.m_num_connections);
+
+	uint64_t setup_start = __now_ns();
+	if (!__open_server_accounts(options))
+		return false;
+	s_next_new_account.store(options.m_num_accounts);
+
+	account_picker picker(options.m_num_accounts, options.m_zipf_theta);
+	unsigned total_weight = 0;
+	for (unsigned op = 0; op < BENCH_NUM_OPS; ++op)
+		total_weight += options.m_weights[op];
+
+	//connect, and deal the connections to the threads
+	vector<client_thread> threads(num_threads);
+	vector<client_connection*> connections;
+	for (unsigned i = 0; i < num_threads; ++i) {
+		client_thread state = {&options, &picker, total_weight, i + 1, vector<client_connection*>(), 0};
+		threads[i] = state;
+	}
+	for (unsigned i = 0; i < options.m_num_connections; ++i) {
+		int fd = server_connect(options.m_connect_address);
+		if (fd < 0) {
+			fprintf(stderr, "connection %u of %u failed: %s (the limit of open files is %u)\n", i + 1, options.m_num_connections,
+					strerror(errno), fd_limit);
+			break;
+		}
+
+		client_connection* conn = new client_connection;
+		conn->m_fd = fd;
+		conn->m_writing = false;
+		conn->m_next_tag = 0;
+		conn->m_in_len = conn->m_out_len = 0;
+		connections.push_back(conn);
+		threads[i % num_threads].m_connections.push_back(conn);
+	}
+	double setup_sec = (__now_ns() - setup_start) / 1e9;
+
+	double duration = options.m_duration;
+	pthread_t timer_thread;
+	vector<pthread_t> thread_ids(num_threads);
+	uint64_t start = __now_ns();
+	pthread_create(&timer_thread, NULL, __timer_thread_main, &duration);
+	for (unsigned i = 0; i < num_threads; ++i)
+		pthread_create(&thread_ids[i], NULL, __client_thread_main, &threads[i]);
+	uint64_t lost = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {
+		pthread_join(thread_ids[i], NULL);
+		lost += threads[i].m_lost;
+	}
+	double elapsed_sec = (__now_ns() - start) / 1e9;
+	pthread_join(timer_thread, NULL);
+
+	for (unsigned i = 0; i < connections.size(); ++i) {
+		close(connections[i]->m_fd);
+		delete connections[i];
+	}
+
+	latency_histogram latency[BENCH_NUM_OPS + 1];
+	uint64_t failures[BENCH_NUM_OPS + 1] = {0};
+	uint64_t total = __merge_stats(latency, failures);
+	printf("{\"benchmark\":\"server\",\"address\":\"%s\",\"connections\":%u,\"pipeline\":%u,\"threads\":%u,\"accounts\":%u,"
+		   "\"skew\":%.3f,\"seed\":%u,", options.m_connect_address.c_str(), (unsigned)connections.size(), options.m_pipeline,
+		   num_threads, options.m_num_accounts, options.m_zipf_theta, options.m_seed);
+	printf("\"setup_sec\":%.3f,\"elapsed_sec\":%.3f,\"requests\":%llu,\"requests_per_sec\":%.1f,\"lost_connections\":%llu,",
+		   setup_sec, elapsed_sec, (unsigned long long)total, total / elapsed_sec, (unsigned long long)lost);
+	__print_by_op(latency, failures, elapsed_sec);
+	printf("}\n");
+	return true;
+}
+
+
+//**************************************Main***************************
+
+//parses the operation mix (e.g. "D:50,W:50"). Returns false in case it's malformed
+static bool __parse_mix(char const* mix, unsigned weights[BENCH_NUM_OPS]) {
+	memset(weights, 0, BENCH_NUM_OPS * sizeof(unsigned));
+	unsigned total = 0;
+	while (*mix) {
+		char const* letter = strchr(OP_LETTERS, *mix);
+		if (!letter || letter - OP_LETTERS >= BENCH_NUM_OPS || mix[1] != ':')
+			return false;
+
+		char* end;
+		unsigned weight = strtoul(mix + 2, &end, 10);
+		if (end == mix + 2 || (*end != ',' && *end != '\0'))
+			return false;
+
+		weights[letter - OP_LETTERS] = weight;
+		total += weight;
+		mix = (*end == ',') ? end + 1 : end;
+	}
+	return total > 0;
+}
+
+//parses the flags. Returns false in case of an unknown (or malformed) flag
+static bool __parse_options(int argc, char** argv, bench_options& options) {
+	for (int i = 0; i < argc; ++i) {
+		string flag(argv[i]);
+		char const* value = strchr(argv[i], '=');
+		value = value ? value + 1 : "";
+
+		if (flag.compare(0, 7, "--atms=") == 0)
+			options.m_num_atms = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 11, "--accounts=") == 0)
+			options.m_num_accounts = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 6, "--mix=") == 0) {
+			if (!__parse_mix(value, options.m_weights))
+				return false;
+		}
+		else if (flag == "--skew=uniform")
+			options.m_zipf_theta = 0;
+		else if (flag == "--skew=zipf")
+			options.m_zipf_theta = 0.99;
+		else if (flag.compare(0, 12, "--skew=zipf:") == 0) {
+			options.m_zipf_theta = strtod(flag.c_str() + 12, NULL);
+			if (options.m_zipf_theta <= 0 || options.m_zipf_theta >= 1)
+				return false;
+		}
+		else if (flag.compare(0, 11, "--duration=") == 0)
+			options.m_duration = strtod(value, NULL);
+		else if (flag.compare(0, 6, "--ops=") == 0)
+			options.m_ops = strtoull(value, NULL, 10);
+		else if (flag == "--run=threads")
+			options.m_run_mode = RUN_THREADS;
+		else if (flag == "--run=executor")
+			options.m_run_mode = RUN_EXECUTOR;
+		else if (flag == "--run=fibers")
+			options.m_run_mode = RUN_FIBERS;
+		else if (flag.compare(0, 10, "--workers=") == 0)
+			options.m_num_workers = strtoul(value, NULL, 10);
+		else if (flag == "--commissions")
+			options.m_commissions = true;
+		else if (flag == "--lock-stats")
+			options.m_lock_stats = true;
+		else if (flag.compare(0, 7, "--seed=") == 0)
+			options.m_seed = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 6, "--log=") == 0)
+			options.m_log_path = value;
+		else if (flag.compare(0, 6, "--wal=") == 0)
+			options.m_wal_path = value;
+		else if (flag.compare(0, 13, "--checkpoint=") == 0)
+			options.m_checkpoint_path = value;
+		else if (flag == "--wal-mode=txn")
+			options.m_wal_mode = WAL_SYNC_TXN;
+		else if (flag == "--wal-mode=batch")
+			options.m_wal_mode = WAL_SYNC_BATCH;
+		else if (flag == "--wal-mode=async")
+			options.m_wal_mode = WAL_SYNC_ASYNC;
+		else if (flag.compare(0, 11, "--generate=") == 0)
+			options.m_generate_path = value;
+		else if (flag.compare(0, 11, "--commands=") == 0)
+			options.m_num_commands = strtoull(value, NULL, 10);
+		else if (flag.compare(0, 7, "--load=") == 0)
+			options.m_load_path = value;
+		else if (flag == "--stream")
+			options.m_stream = true;
+		else if (flag == "--scan")
+			options.m_scan = true;
+		else if (flag == "--hot")
+			options.m_hot = true;
+		else if (flag == "--metrics")
+			options.m_metrics = true;
+		else if (flag.compare(0, 10, "--threads=") == 0)
+			options.m_max_threads = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 9, "--passes=") == 0)
+			options.m_passes = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 10, "--connect=") == 0)
+			options.m_connect_address = value;
+		else if (flag.compare(0, 14, "--connections=") == 0)
+			options.m_num_connections = strtoul(value, NULL, 10);
+		else if (flag.compare(0, 11, "--pipeline=") == 0)
+			options.m_pipeline = strtoul(value, NULL, 10);
+		else if (flag == "--allocs")
+			options.m_allocs = true;
+		else if (flag == "--lookup")
+			options.m_lookup = true;
+		else if (flag.compare(0, 9, "--lookup=") == 0) {
+			options.m_lookup = true;
+			options.m_lookup_max_accounts = strtoul(value, NULL, 10);
+		}
+		else if (flag == "--shards")
+			options.m_sharded = true;
+		else if (flag.compare(0, 9, "--shards=") == 0) {
+			options.m_sharded = true;
+			options.m_num_shards = strtoul(value, NULL, 10);
+		}
+		else
+			return false;
+	}
+	return options.m_num_atms > 0 && options.m_num_accounts > 0 && options.m_num_connections > 0 && options.m_pipeline > 0 &&
+		   options.m_pipeline <= BENCH_MAX_PIPELINE && options.m_lookup_max_accounts > 0;
+}
+
+int main(int argc, char** argv) {
+	bench_options options;
+	if (!__parse_options(argc - 1, argv + 1, options)) {
+		fprintf(stderr, "illegal arguments\n");
+		return BENCH_ERROR;
+	}
+
+	try {
+		if (!options.m_load_path.empty())
+			__load(options);
+		else if (options.m_scan)
+			__scan(options);
+		else if (options.m_lookup)
+			__lookup(options);
+		else if (options.m_hot)
+			__hot(options);
+		else if (options.m_metrics)
+			__metrics(options);
+		else if (options.m_allocs) {
+			if (!__allocs(options)) {
+				fprintf(stderr, "steady-state transactions have allocated heap memory\n");
+				return BENCH_ERROR;
+			}
+		}
+		else if (!options.m_connect_address.empty()) {
+			if (!__connect(options)) {
+				perror(options.m_connect_address.c_str());
+				return BENCH_ERROR;
+			}
+		}
+		else if (!options.m_generate_path.empty()) {
+			if (!__generate(options)) {
+				perror(options.m_generate_path.c_str());
+				return BENCH_ERROR;
+			}
+		}
+		else
+			__run_workload(options);
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return BENCH_ERROR;
+	}
+	return EXIT_SUCCESS;
+}
@@ -16,6 +16,11 @@
 #define THREE_SEC 3000000
 #define ONE_SEC 1000000
 
+#define HIGHEST_INTEREST 0.04 //the range of the commissions' interest rates
+#define LOWEST_INTEREST 0.02
+
+#define CACHE_LINE_SIZE 64 //used for padding data that is written by different threads
+
 
 
 
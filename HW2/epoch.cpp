@@ -0,0 +1,258 @@
+/*
+ * epoch.cpp
+ *
+ *  Created on: Jun 4, 2017
+ *      Author: dror
+ *
+ *	An implementation of the epoch_manager class
+ */
+
+#include "epoch.h"
+#include "Fiber.h"
+
+/********************************************
+// function name: 	epoch_manager::epoch_manager
+// Description	: 	Constructor.
+//					Initializes the global epoch and the thread specific key
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+epoch_manager::epoch_manager() : m_global_epoch(1), m_records(NULL), m_fiber_key(-1) {
+	pthread_key_create(&m_record_key, __release_record);
+	m_fiber_key = fiber_key_create(__release_record);
+}
+
+/********************************************
+// function name: 	epoch_manager::~epoch_manager
+// Description	: 	Destructor.
+//					Deletes all the retired objects and the thread records. No thread may be inside a critical section
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+epoch_manager::~epoch_manager() {
+	pthread_key_delete(m_record_key);
+	if (m_fiber_key >= 0)
+		fiber_key_delete(m_fiber_key);
+
+	thread_record* record = m_records.load();
+	while (record) {
+		thread_record* next = record->m_next;
+		for (unsigned i = 0; i < NUM_EPOCH_BUCKETS; ++i)
+			__delete_limbo(record->m_limbo[i]);
+		delete record;
+		record = next;
+	}
+}
+
+/********************************************
+// function name: 	epoch_manager::Enter
+// Description	: 	Enters a critical section. Objects that are reachable at this point won't be deleted until Exit is called
+//					Critical sections may be nested
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	std::bad_alloc (first call of a new thread only)
+*/
+void epoch_manager::Enter() {
+	thread_record* record = __local_record();
+	if (record->m_nesting++ > 0)
+		return;
+
+	//announce the observed epoch before reading any shared object
+	record->m_epoch.store(m_global_epoch.load());
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/********************************************
+// function name: 	epoch_manager::Exit
+// Description	: 	Leaves a critical section
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void epoch_manager::Exit() {
+	thread_record* record = __local_record();
+	if (--record->m_nesting > 0)
+		return;
+
+	record->m_epoch.store(0, memory_order_release);
+}
+
+/********************************************
+// function name: 	epoch_manager::Reclaim
+// Description	: 	Tries to advance the global epoch, and deletes the objects the calling thread has retired that are safe to delete
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	std::bad_alloc (first call of a new thread only)
+*/
+void epoch_manager::Reclaim() {
+	__try_advance();
+	__reclaim(__thread_record());
+}
+
+/********************************************
+// function name: 	epoch_manager::__release_record
+// Description	: 	Releases the record of an exiting thread or an ending fiber (called as the destructor of the thread / fiber
+//					specific key), so it may be reused by another thread or fiber
+// Parameters	: 	record - the record of the exiting thread
+// Returns		: 	None
+// Exception	: 	None
+*/
+void epoch_manager::__release_record(void* record) {
+	thread_record* r = static_cast<thread_record*>(record);
+	r->m_nesting = 0;
+	r->m_epoch.store(0);
+	r->m_in_use.store(false);
+}
+
+/********************************************
+// function name: 	epoch_manager::__acquire_record
+// Description	: 	Takes a free record - a record of a thread (or a fiber) that has already exited is reused, otherwise a new one
+//					is allocated and pushed to the list of records
+// Parameters	: 	None
+// Returns		: 	thread_record* - the record, marked in use
+// Exception	: 	std::bad_alloc
+*/
+epoch_manager::thread_record* epoch_manager::__acquire_record() {
+	thread_record* record;
+	for (record = m_records.load(); record; record = record->m_next) {
+		bool in_use = false;
+		if (record->m_in_use.compare_exchange_strong(in_use, true))
+			return record;
+	}
+
+	record = new thread_record;
+	record->m_epoch.store(0);
+	record->m_in_use.store(true);
+	record->m_nesting = 0;
+	record->m_retirements = 0;
+	for (unsigned i = 0; i < NUM_EPOCH_BUCKETS; ++i)
+		record->m_limbo_epoch[i] = 0;
+
+	thread_record* head = m_records.load();
+	do record->m_next = head;
+	while (!m_records.compare_exchange_weak(head, record));
+
+	return record;
+}
+
+/********************************************
+// function name: 	epoch_manager::__thread_record
+// Description	: 	Returns the record of the calling thread (taken at the first call of the thread). It holds the thread's limbo lists
+// Parameters	: 	None
+// Returns		: 	thread_record* - the record of the thread
+// Exception	: 	std::bad_alloc
+*/
+epoch_manager::thread_record* epoch_manager::__thread_record() {
+	thread_record* record = static_cast<thread_record*>(pthread_getspecific(m_record_key));
+	if (record)
+		return record;
+
+	record = __acquire_record();
+	pthread_setspecific(m_record_key, record);
+	return record;
+}
+
+/********************************************
+// function name: 	epoch_manager::__local_record
+// Description	: 	Returns the record the critical sections of the caller are announced in - the record of the calling fiber
+//					(taken at its first critical section), or of the calling thread outside of a fiber
+// Parameters	: 	None
+// Returns		: 	thread_record* - the record
+// Exception	: 	std::bad_alloc
+*/
+epoch_manager::thread_record* epoch_manager::__local_record() {
+	if (m_fiber_key < 0 || !fiber_current())
+		return __thread_record();
+
+	thread_record* record = static_cast<thread_record*>(fiber_getspecific(m_fiber_key));
+	if (record)
+		return record;
+
+	record = __acquire_record();
+	fiber_setspecific(m_fiber_key, record);
+	return record;
+}
+
+/********************************************
+// function name: 	epoch_manager::__retire
+// Description	: 	Stores a retired object in the calling thread's limbo list of the current epoch (the list is emptied first,
+//					in case it still holds the objects of an older epoch - those are safe to delete by now).
+//					Every EPOCH_ADVANCE_PERIOD retirements, the thread also tries to advance the global epoch
+// Parameters	: 	object - the retired object
+//					deleter - the function that deletes the object
+// Returns		: 	None
+// Exception	: 	std::bad_alloc (first call of a new thread only)
+*/
+void epoch_manager::__retire(void* object, deleter_fn deleter) {
+	thread_record* record = __thread_record(); //the limbo lists are the thread's, also when a fiber retires
+	retired r = {object, deleter};
+
+	unsigned long epoch = m_global_epoch.load();
+	unsigned bucket = epoch % NUM_EPOCH_BUCKETS;
+	if (record->m_limbo_epoch[bucket] != epoch) {
+		__delete_limbo(record->m_limbo[bucket]); //retired in epoch - 3 or before
+		record->m_limbo_epoch[bucket] = epoch;
+	}
+	record->m_limbo[bucket].push_back(r);
+
+	if (++record->m_retirements < EPOCH_ADVANCE_PERIOD)
+		return;
+
+	record->m_retirements = 0;
+	__try_advance();
+	__reclaim(record);
+}
+
+/********************************************
+// function name: 	epoch_manager::__try_advance
+// Description	: 	Advances the global epoch in case every thread inside a critical section has observed it.
+//					The records are scanned without locking. In case several threads try to advance the same epoch, the
+//					compare-and-swap lets one of them do it (a thread that has entered meanwhile has observed the current epoch)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void epoch_manager::__try_advance() {
+	unsigned long epoch = m_global_epoch.load();
+
+	for (thread_record* record = m_records.load(); record; record = record->m_next) {
+		unsigned long observed = record->m_epoch.load();
+		if (observed != 0 && observed != epoch)
+			return; //a thread is still inside a critical section of an older epoch
+	}
+
+	m_global_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/********************************************
+// function name: 	epoch_manager::__reclaim
+// Description	: 	Deletes the objects of a record's limbo lists that are safe to delete - those that were retired at least two
+//					epochs before the global epoch
+// Parameters	: 	record - the record of the calling thread
+// Returns		: 	None
+// Exception	: 	None
+*/
+void epoch_manager::__reclaim(thread_record* record) {
+	unsigned long epoch = m_global_epoch.load();
+
+	for (unsigned i = 0; i < NUM_EPOCH_BUCKETS; ++i) {
+		if (!record->m_limbo[i].empty() && record->m_limbo_epoch[i] + 2 <= epoch)
+			__delete_limbo(record->m_limbo[i]);
+	}
+}
+
+/********************************************
+// function name: 	epoch_manager::__delete_limbo
+// Description	: 	Deletes the objects of a limbo list, and empties it (its memory is kept for the next epochs)
+// Parameters	: 	limbo - the limbo list
+// Returns		: 	None
+// Exception	: 	None
+*/
+void epoch_manager::__delete_limbo(vector<retired>& limbo) {
+	for (unsigned i = 0; i < limbo.size(); ++i)
+		limbo[i].m_deleter(limbo[i].m_object);
+
+	limbo.clear();
+}
@@ -0,0 +1,194 @@
+/*
+ * epoch.h
+ *
+ *  Created on: Jun 4, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : epoch
+	Description : An implementation of epoch-based memory reclamation (epoch_manager) and a scoped guard (epoch_guard).
+					A thread that reads a shared object which might be unlinked and deleted by another thread
+					enters a critical section (an epoch) before reading it, and leaves it when done.
+					An unlinked object is not deleted at once, it is retired, and it is deleted only after every thread
+					that could have seen it has left its critical section.
+	Main methods: 	Enter/Exit - enter or leave a critical section
+					Retire - hand an unlinked object to the manager, to be deleted when it is safe
+					Reclaim - try to advance the global epoch and delete the objects that are safe to delete
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+#define NUM_EPOCH_BUCKETS 3 		//objects retired in epoch e are safe to delete once the global epoch reaches e + 2
+#define EPOCH_ADVANCE_PERIOD 32 	//the number of retirements of a thread between its attempts to advance the global epoch
+
+
+/********************************************
+// 	class name	: 	epoch_manager
+// 	Description	: 	An epoch-based reclamation mechanism.
+//					Every thread that uses the manager gets a thread record, holding the epoch the thread observed when it
+//					entered its critical section (0 when the thread is outside a critical section). A fiber gets a record of
+//					its own for its critical sections (a fiber may sleep inside one while the other fibers of its worker enter and
+//					leave theirs), and returns it when it ends.
+//					The global epoch may advance only when all of the threads inside a critical section have observed it,
+//					so an object retired in epoch e can't be referenced anymore once the global epoch reaches e + 2.
+//					Entering and leaving a critical section never block, and never write to a shared cache line.
+//					Retiring never blocks either - every thread keeps the objects it has retired in limbo lists of its own record,
+//					and deletes them itself once they are safe. The global epoch is advanced with a compare-and-swap by any thread
+//					that has scanned the records and found that all of the threads inside a critical section have observed it.
+//
+//	Members		:	m_global_epoch - the global epoch (starts at 1, 0 means "not inside a critical section")
+//					m_records - a lock-free list of the thread records. Records are never freed before the manager is destroyed,
+//								a record of a thread that has exited is reused by the next thread (along with its limbo lists)
+//					m_record_key - a POSIX thread specific key that points to the thread's record
+//					m_fiber_key - a fiber specific key that points to the fiber's record (-1 if no fiber key was left -
+//								  the fibers then share the record of their worker)
+//
+//	Methods		:	Enter 	- enter a critical section (may be nested)
+//					Exit 	- leave a critical section
+//					Retire 	- retire an unlinked object
+//					Reclaim	- try to advance the global epoch, and delete the objects that are safe to delete
+*/
+class epoch_manager {
+public:
+	/********************************************
+	// function name: 	epoch_manager::epoch_manager
+	// Description	: 	Constructor.
+	//					Initializes the global epoch and the thread specific key
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	epoch_manager();
+
+	/********************************************
+	// function name: 	epoch_manager::~epoch_manager
+	// Description	: 	Destructor.
+	//					Deletes all the retired objects and the thread records. No thread may be inside a critical section
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	~epoch_manager();
+
+public: //API
+	/********************************************
+	// function name: 	epoch_manager::Enter
+	// Description	: 	Enters a critical section. Objects that are reachable at this point won't be deleted until Exit is called
+	//					Critical sections may be nested
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc (first call of a new thread only)
+	*/
+	void Enter();
+
+	/********************************************
+	// function name: 	epoch_manager::Exit
+	// Description	: 	Leaves a critical section
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Exit();
+
+	/********************************************
+	// function name: 	epoch_manager::Retire
+	// Description	: 	Retires an object that has been unlinked from every shared structure.
+	//					The object will be deleted (by the retiring thread) once no thread can reference it anymore
+	// Parameters	: 	object - the object to be deleted
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	template <class T> void Retire(T* object){
+		__retire(static_cast<void*>(object), __delete<T>);
+	}
+
+	/********************************************
+	// function name: 	epoch_manager::Reclaim
+	// Description	: 	Tries to advance the global epoch, and deletes the objects the calling thread has retired that are safe to delete
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc (first call of a new thread only)
+	*/
+	void Reclaim();
+
+private:
+	typedef void (*deleter_fn)(void*);
+
+	struct retired {
+		void* m_object;
+		deleter_fn m_deleter;
+	};
+
+	struct thread_record {
+		atomic<unsigned long> m_epoch;
+		atomic<bool> m_in_use;
+		thread_record* m_next;
+
+		//only accessed by the owner thread
+		unsigned m_nesting;
+		unsigned m_retirements; 								//counts up to EPOCH_ADVANCE_PERIOD
+		vector<retired> m_limbo[NUM_EPOCH_BUCKETS]; 			//the retired objects, by the epoch they were retired in
+		unsigned long m_limbo_epoch[NUM_EPOCH_BUCKETS]; 		//the epoch the objects of every limbo list were retired in
+	};
+
+	template <class T> static void __delete(void* object){
+		delete static_cast<T*>(object);
+	}
+
+	static void __release_record(void* record);
+
+	static void __delete_limbo(vector<retired>& limbo);
+
+	thread_record* __acquire_record();
+	thread_record* __thread_record();
+	thread_record* __local_record();
+	void __retire(void* object, deleter_fn deleter);
+	void __try_advance();
+	void __reclaim(thread_record* record);
+
+private: //do not allow the user to copy the object
+	epoch_manager(epoch_manager const&);
+	epoch_manager& operator=(epoch_manager const&);
+
+private:
+	atomic<unsigned long> m_global_epoch;
+	atomic<thread_record*> m_records;
+	pthread_key_t m_record_key;
+	int m_fiber_key;
+};
+
+
+/********************************************
+// 	class name	: 	epoch_guard
+// 	Description	: 	A scoped critical section - enters the epoch on construction and leaves it on destruction
+//
+//	Members		:	m_manager - the manager of the epoch
+*/
+class epoch_guard {
+public:
+	epoch_guard(epoch_manager& manager) : m_manager(manager) {
+		m_manager.Enter();
+	}
+
+	~epoch_guard(){
+		m_manager.Exit();
+	}
+
+private: //do not allow the user to copy the object
+	epoch_guard(epoch_guard const&);
+	epoch_guard& operator=(epoch_guard const&);
+
+private:
+	epoch_manager& m_manager;
+};
+
+
+#endif /* EPOCH_H_ */
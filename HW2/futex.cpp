@@ -0,0 +1,65 @@
+/*
+ * futex.cpp
+ *
+ *  Created on: Jun 6, 2017
+ *      Author: dror
+ *
+ *	An implementation of the futex wrappers
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "futex.h"
+
+/********************************************
+// function name: 	futex_wait
+// Description	: 	Puts the calling thread to sleep as long as word == expected.
+//					May return spuriously, so the caller must re-check its condition in a loop
+// Parameters	: 	word - the futex word
+//					expected - the value the word is expected to hold
+//					timeout - a relative timeout (default: NULL - wait forever)
+// Returns		: 	0 if woken up, -1 otherwise (errno is EAGAIN in case word != expected, ETIMEDOUT on timeout)
+// Exception	: 	None
+*/
+int futex_wait(atomic<uint32_t>& word, uint32_t expected, const struct timespec* timeout) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+/********************************************
+// function name: 	futex_wake
+// Description	: 	Wakes up to n threads sleeping on the word
+// Parameters	: 	word - the futex word
+//					n - the maximal number of threads to wake (FUTEX_WAKE_ALL to wake all of them)
+// Returns		: 	The number of threads woken up
+// Exception	: 	None
+*/
+int futex_wake(atomic<uint32_t>& word, int n) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/********************************************
+// function name: 	futex_wait_shared
+// Description	: 	Same as futex_wait, for a word in memory that is shared by several processes (the private futex operations only
+//					match the waiters and the wakers of a single process)
+// Parameters	: 	word - the futex word (in a shared mapping)
+//					expected - the value the word is expected to hold
+//					timeout - a relative timeout (default: NULL - wait forever)
+// Returns		: 	0 if woken up, -1 otherwise (errno is EAGAIN in case word != expected, ETIMEDOUT on timeout)
+// Exception	: 	None
+*/
+int futex_wait_shared(atomic<uint32_t>& word, uint32_t expected, const struct timespec* timeout) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+/********************************************
+// function name: 	futex_wake_shared
+// Description	: 	Wakes up to n threads, of any process, sleeping on a word in shared memory (see futex_wait_shared)
+// Parameters	: 	word - the futex word (in a shared mapping)
+//					n - the maximal number of threads to wake (FUTEX_WAKE_ALL to wake all of them)
+// Returns		: 	The number of threads woken up
+// Exception	: 	None
+*/
+int futex_wake_shared(atomic<uint32_t>& word, int n) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, n, NULL, NULL, 0);
+}
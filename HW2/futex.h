@@ -0,0 +1,90 @@
+/*
+ * futex.h
+ *
+ *  Created on: Jun 6, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : futex
+	Description : Thin wrappers around the Linux futex system call, used by the locks of the program to park (and wake)
+					waiting threads on a 32-bit atomic word, instead of a mutex + condition variable pair
+	Main methods: 	futex_wait - sleep as long as the word holds an expected value
+					futex_wake - wake threads sleeping on the word
+					futex_wait_shared / futex_wake_shared - same, for a word in memory shared by several processes
+					cpu_relax - a hint to the cpu inside spinning loops
+ */
+
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+using namespace std;
+
+#define FUTEX_WAKE_ALL 0x7fffffff
+
+
+/********************************************
+// function name: 	futex_wait
+// Description	: 	Puts the calling thread to sleep as long as word == expected.
+//					May return spuriously, so the caller must re-check its condition in a loop
+// Parameters	: 	word - the futex word
+//					expected - the value the word is expected to hold
+//					timeout - a relative timeout (default: NULL - wait forever)
+// Returns		: 	0 if woken up, -1 otherwise (errno is EAGAIN in case word != expected, ETIMEDOUT on timeout)
+// Exception	: 	None
+*/
+int futex_wait(atomic<uint32_t>& word, uint32_t expected, const struct timespec* timeout = NULL);
+
+/********************************************
+// function name: 	futex_wake
+// Description	: 	Wakes up to n threads sleeping on the word
+// Parameters	: 	word - the futex word
+//					n - the maximal number of threads to wake (FUTEX_WAKE_ALL to wake all of them)
+// Returns		: 	The number of threads woken up
+// Exception	: 	None
+*/
+int futex_wake(atomic<uint32_t>& word, int n);
+
+/********************************************
+// function name: 	futex_wait_shared
+// Description	: 	Same as futex_wait, for a word in memory that is shared by several processes (the private futex operations only
+//					match the waiters and the wakers of a single process)
+// Parameters	: 	word - the futex word (in a shared mapping)
+//					expected - the value the word is expected to hold
+//					timeout - a relative timeout (default: NULL - wait forever)
+// Returns		: 	0 if woken up, -1 otherwise (errno is EAGAIN in case word != expected, ETIMEDOUT on timeout)
+// Exception	: 	None
+*/
+int futex_wait_shared(atomic<uint32_t>& word, uint32_t expected, const struct timespec* timeout = NULL);
+
+/********************************************
+// function name: 	futex_wake_shared
+// Description	: 	Wakes up to n threads, of any process, sleeping on a word in shared memory (see futex_wait_shared)
+// Parameters	: 	word - the futex word (in a shared mapping)
+//					n - the maximal number of threads to wake (FUTEX_WAKE_ALL to wake all of them)
+// Returns		: 	The number of threads woken up
+// Exception	: 	None
+*/
+int futex_wake_shared(atomic<uint32_t>& word, int n);
+
+/********************************************
+// function name: 	cpu_relax
+// Description	: 	A hint to the cpu that the thread is spinning (lowers the power and the pressure on the memory bus)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+
+#endif /* FUTEX_H_ */
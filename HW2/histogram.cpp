@@ -0,0 +1,111 @@
+/*
+ * histogram.cpp
+ *
+ *  Created on: Jun 16, 2017
+ *      Author: dror
+ *
+ *	An implementation of the latency_histogram class
+ */
+
+#include "histogram.h"
+
+
+latency_histogram::latency_histogram() {
+	Reset();
+}
+
+/********************************************
+// function name: 	latency_histogram::Merge
+// Description	: 	Adds the samples of another histogram to this one
+// Parameters	: 	other - the other histogram
+// Returns		: 	None
+// Exception	: 	None
+*/
+void latency_histogram::Merge(latency_histogram const& other) {
+	for (unsigned i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i)
+		m_buckets[i].fetch_add(other.m_buckets[i].load(memory_order_relaxed), memory_order_relaxed);
+
+	m_sum.fetch_add(other.m_sum.load(memory_order_relaxed), memory_order_relaxed);
+
+	uint64_t other_max = other.Max();
+	uint64_t max = Max();
+	while (other_max > max && !m_max.compare_exchange_weak(max, other_max, memory_order_relaxed)) {}
+}
+
+/********************************************
+// function name: 	latency_histogram::Reset
+// Description	: 	Forgets all of the samples
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void latency_histogram::Reset() {
+	for (unsigned i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i)
+		m_buckets[i].store(0, memory_order_relaxed);
+
+	m_sum.store(0, memory_order_relaxed);
+	m_max.store(0, memory_order_relaxed);
+}
+
+/********************************************
+// function name: 	latency_histogram::Count
+// Description	: 	Returns the number of samples (the sum of the buckets - the samples are not counted apart, to keep Record cheap)
+// Parameters	: 	None
+// Returns		: 	uint64_t - the number of samples
+// Exception	: 	None
+*/
+uint64_t latency_histogram::Count() const {
+	uint64_t count = 0;
+	for (unsigned i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i)
+		count += m_buckets[i].load(memory_order_relaxed);
+	return count;
+}
+
+/********************************************
+// function name: 	latency_histogram::Percentile
+// Description	: 	Returns the value at a percentile - the highest value of the bucket in which the percentile's sample falls
+//					(so the value is never lower than the real one, and is higher by less than 1/HISTOGRAM_SUB_BUCKETS)
+// Parameters	: 	percentile - the percentile, between 0 and 100 (e.g. 99.9)
+// Returns		: 	uint64_t - the value (0 if there are no samples)
+// Exception	: 	None
+*/
+uint64_t latency_histogram::Percentile(double percentile) const {
+	//the buckets are copied first, so a histogram that is written meanwhile is still read consistently
+	uint64_t buckets[HISTOGRAM_NUM_BUCKETS];
+	uint64_t count = 0;
+	for (unsigned i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+		buckets[i] = m_buckets[i].load(memory_order_relaxed);
+		count += buckets[i];
+	}
+	if (count == 0)
+		return 0;
+
+	//the rank of the sample at the percentile (1-based, rounded up)
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+
+	uint64_t max = Max();
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			uint64_t top = __bucket_top(i);
+			return (max && top > max) ? max : top; //no sample is above the maximum
+		}
+	}
+
+	return max;
+}
+
+//the highest value counted in a bucket
+uint64_t latency_histogram::__bucket_top(unsigned bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	unsigned shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t lowest = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+	return lowest + ((uint64_t)1 << shift) - 1;
+}
@@ -0,0 +1,139 @@
+/*
+ * histogram.h
+ *
+ *  Created on: Jun 16, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : histogram
+	Description : A fixed-size log-linear histogram of latencies (or of any other non-negative integer samples).
+					Every power of 2 is split into HISTOGRAM_SUB_BUCKETS linear buckets, so a sample is counted with a relative error
+					of less than 1/HISTOGRAM_SUB_BUCKETS, whatever its magnitude - the tail percentiles (p99, p99.9) of millions of
+					samples are computed without storing the samples. Recording is a few arithmetic instructions and two atomic additions.
+					The counters are atomic, so several threads may record into the same histogram, and it may be read while it's written.
+	Main methods: 	latency_histogram::Record - count a sample
+					latency_histogram::Merge - add the counts of another histogram (e.g. of another thread)
+					latency_histogram::Percentile - the value below which a given fraction of the samples fall
+ */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+#include <atomic>
+
+using namespace std;
+
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)	//the linear buckets of every power of 2
+#define HISTOGRAM_MAX_BITS 40									//samples up to 2^40 (~18 minutes in nano-seconds) are counted exactly,
+																//larger samples are counted in the last bucket
+#define HISTOGRAM_NUM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+
+/********************************************
+// 	class name	: 	latency_histogram
+// 	Description	: 	A log-linear histogram. Thread-safe, but every counter is a shared cache line - a hot histogram should be split
+//					between the threads (a histogram per thread, or per shard of threads), and merged when the results are read
+//
+//	Members		:	m_buckets - the counts of the buckets. The first HISTOGRAM_SUB_BUCKETS buckets count the samples below
+//								HISTOGRAM_SUB_BUCKETS exactly, every following group of HISTOGRAM_SUB_BUCKETS buckets splits a power of 2
+//					m_sum / m_max - the sum of the samples and the largest one
+//
+//	Methods		:	Record - counts a sample
+//					Merge - adds the counts of another histogram
+//					Percentile - returns the value at a percentile
+//					Count / Mean / Max - the summary of the samples
+*/
+class latency_histogram {
+public:
+	latency_histogram();
+
+public: //API
+	/********************************************
+	// function name: 	latency_histogram::Record
+	// Description	: 	Counts a sample
+	// Parameters	: 	value - the sample
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Record(uint64_t value) {
+		m_buckets[__bucket(value)].fetch_add(1, memory_order_relaxed);
+		m_sum.fetch_add(value, memory_order_relaxed);
+
+		uint64_t max = m_max.load(memory_order_relaxed);
+		while (value > max && !m_max.compare_exchange_weak(max, value, memory_order_relaxed)) {}
+	}
+
+	/********************************************
+	// function name: 	latency_histogram::Merge
+	// Description	: 	Adds the samples of another histogram to this one
+	// Parameters	: 	other - the other histogram
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Merge(latency_histogram const& other);
+
+	/********************************************
+	// function name: 	latency_histogram::Reset
+	// Description	: 	Forgets all of the samples
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Reset();
+
+	/********************************************
+	// function name: 	latency_histogram::Percentile
+	// Description	: 	Returns the value at a percentile - the highest value of the bucket in which the percentile's sample falls
+	//					(so the value is never lower than the real one, and is higher by less than 1/HISTOGRAM_SUB_BUCKETS)
+	// Parameters	: 	percentile - the percentile, between 0 and 100 (e.g. 99.9)
+	// Returns		: 	uint64_t - the value (0 if there are no samples)
+	// Exception	: 	None
+	*/
+	uint64_t Percentile(double percentile) const;
+
+	/********************************************
+	// function name: 	latency_histogram::Count
+	// Description	: 	Returns the number of samples (the sum of the buckets - the samples are not counted apart, to keep Record cheap)
+	// Parameters	: 	None
+	// Returns		: 	uint64_t - the number of samples
+	// Exception	: 	None
+	*/
+	uint64_t Count() const;
+
+	uint64_t Mean() const {
+		uint64_t count = Count();
+		return count ? m_sum.load(memory_order_relaxed) / count : 0;
+	}
+
+	uint64_t Max() const {
+		return m_max.load(memory_order_relaxed);
+	}
+
+private:
+	//the bucket of a value - the position of its highest bit selects the group, the next HISTOGRAM_SUB_BUCKET_BITS bits select the bucket
+	static unsigned __bucket(uint64_t value) {
+		if (value < HISTOGRAM_SUB_BUCKETS)
+			return (unsigned)value;
+
+		unsigned shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKET_BITS;
+		unsigned bucket = (shift + 1) * HISTOGRAM_SUB_BUCKETS + (unsigned)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+		return bucket < HISTOGRAM_NUM_BUCKETS ? bucket : HISTOGRAM_NUM_BUCKETS - 1;
+	}
+
+	static uint64_t __bucket_top(unsigned bucket);
+
+private: //do not allow the user to copy the object
+	latency_histogram(latency_histogram const&);
+	latency_histogram& operator=(latency_histogram const&);
+
+private:
+	atomic<uint64_t> m_buckets[HISTOGRAM_NUM_BUCKETS];
+	atomic<uint64_t> m_sum;
+	atomic<uint64_t> m_max;
+};
+
+
+#endif /* HISTOGRAM_H_ */
@@ -0,0 +1,307 @@
+/*
+ * lockstat.cpp
+ *
+ *  Created on: Jun 17, 2017
+ *      Author: dror
+ *
+ *	An implementation of the lock sites, and of the reporting of their statistics
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "lockstat.h"
+
+#define LOCK_REPORT_SIGNAL SIGUSR1
+
+//the acquisition time of a shared lock held by the thread
+struct lock_hold {
+	void const* m_lock;
+	uint64_t m_acquired;
+};
+
+static atomic<bool> s_enabled(false);
+static uint64_t s_start = 0; 										//the time the instrumentation was enabled
+static pthread_mutex_t s_sites_lock = PTHREAD_MUTEX_INITIALIZER; 	//protects s_sites (and serializes the reports)
+static vector<lock_site*> s_sites;
+static atomic<unsigned> s_next_shard(0);
+static unsigned s_sample_period = LOCK_SAMPLE_PERIOD;
+
+static thread_local int t_shard = -1;
+static thread_local unsigned t_until_sample = 0; 					//the acquisitions of the thread until the next sampled one
+static thread_local lock_hold t_holds[LOCK_HOLD_STACK_DEPTH];
+static thread_local unsigned t_num_holds = 0;
+
+
+//*****************************************************lock_site*****************************************************
+
+lock_site::lock_site(const char* name) : m_name(name) {
+	for (unsigned i = 0; i < LOCK_SITE_SHARDS; ++i) {
+		for (unsigned mode = 0; mode < LOCK_NUM_MODES; ++mode)
+			m_shards[i].m_acquisitions[mode].store(0);
+	}
+}
+
+//the shard of the calling thread (the threads are dealt to the shards in turn)
+unsigned lock_site::__my_shard() {
+	if (t_shard < 0)
+		t_shard = (int)(s_next_shard++ % LOCK_SITE_SHARDS);
+	return (unsigned)t_shard;
+}
+
+/********************************************
+// function name: 	lock_site::Acquire
+// Description	: 	Counts an acquisition of a lock of the site (before the lock is acquired)
+// Parameters	: 	mode - shared / exclusive
+// Returns		: 	bool - true if the acquisition is sampled - it should be timed, and recorded by RecordAcquire / RecordHold
+// Exception	: 	None
+*/
+bool lock_site::Acquire(lock_mode mode) {
+	m_shards[__my_shard()].m_acquisitions[mode].fetch_add(1, memory_order_relaxed);
+	if (t_until_sample > 0) {
+		--t_until_sample;
+		return false;
+	}
+
+	t_until_sample = s_sample_period - 1;
+	return true;
+}
+
+/********************************************
+// function name: 	lock_site::RecordAcquire
+// Description	: 	Records a sampled acquisition of a lock of the site
+// Parameters	: 	mode - shared / exclusive
+//					wait - the time the thread waited for the lock (nano-seconds)
+//					depth - the number of threads (of the same mode) that were waiting for the lock when the thread arrived
+// Returns		: 	None
+// Exception	: 	None
+*/
+void lock_site::RecordAcquire(lock_mode mode, uint64_t wait, uint32_t depth) {
+	shard& s = m_shards[__my_shard()];
+	s.m_wait[mode].Record(wait);
+	s.m_depth[mode].Record(depth);
+}
+
+/********************************************
+// function name: 	lock_site::RecordHold
+// Description	: 	Records the release of a sampled acquisition
+// Parameters	: 	mode - shared / exclusive
+//					hold - the time the thread held the lock (nano-seconds)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void lock_site::RecordHold(lock_mode mode, uint64_t hold) {
+	m_shards[__my_shard()].m_hold[mode].Record(hold);
+}
+
+/********************************************
+// function name: 	lock_site::Report
+// Description	: 	Prints the statistics of the site (since the start of the run) as a JSON line
+// Parameters	: 	out - the stream to print to
+//					elapsed_sec - the time since the instrumentation was enabled
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void lock_site::Report(FILE* out, double elapsed_sec) const {
+	static const char* MODES[LOCK_NUM_MODES] = {"shared", "exclusive"};
+	char buffer[512];
+	string line;
+
+	snprintf(buffer, sizeof(buffer), "{\"lock_site\":\"%s\",\"elapsed_sec\":%.3f", m_name, elapsed_sec);
+	line += buffer;
+
+	for (unsigned mode = 0; mode < LOCK_NUM_MODES; ++mode) {
+		//the merged histograms are large (a few KB each), so they are kept on the heap
+		latency_histogram* merged = new latency_histogram[3];
+		latency_histogram& wait = merged[0];
+		latency_histogram& hold = merged[1];
+		latency_histogram& depth = merged[2];
+		uint64_t acquisitions = 0;
+		for (unsigned i = 0; i < LOCK_SITE_SHARDS; ++i) {
+			acquisitions += m_shards[i].m_acquisitions[mode].load(memory_order_relaxed);
+			wait.Merge(m_shards[i].m_wait[mode]);
+			hold.Merge(m_shards[i].m_hold[mode]);
+			depth.Merge(m_shards[i].m_depth[mode]);
+		}
+
+		snprintf(buffer, sizeof(buffer),
+				 ",\"%s\":{\"acquisitions\":%llu,\"acquisitions_per_sec\":%.1f,\"sampled\":%llu,"
+				 "\"wait_mean_us\":%.3f,\"wait_p50_us\":%.3f,\"wait_p99_us\":%.3f,\"wait_p999_us\":%.3f,\"wait_max_us\":%.3f,"
+				 "\"hold_mean_us\":%.3f,\"hold_p50_us\":%.3f,\"hold_p99_us\":%.3f,\"hold_p999_us\":%.3f,\"hold_max_us\":%.3f,"
+				 "\"queue_p50\":%llu,\"queue_p99\":%llu,\"queue_max\":%llu}",
+				 MODES[mode], (unsigned long long)acquisitions, elapsed_sec > 0 ? acquisitions / elapsed_sec : 0.0,
+				 (unsigned long long)wait.Count(),
+				 wait.Mean() / 1000.0, wait.Percentile(50) / 1000.0, wait.Percentile(99) / 1000.0, wait.Percentile(99.9) / 1000.0,
+				 wait.Max() / 1000.0,
+				 hold.Mean() / 1000.0, hold.Percentile(50) / 1000.0, hold.Percentile(99) / 1000.0, hold.Percentile(99.9) / 1000.0,
+				 hold.Max() / 1000.0,
+				 (unsigned long long)depth.Percentile(50), (unsigned long long)depth.Percentile(99), (unsigned long long)depth.Max());
+		line += buffer;
+		delete[] merged;
+	}
+
+	line += "}\n";
+	fwrite(line.data(), 1, line.size(), out); //a single write, so the lines of concurrent reports don't interleave
+}
+
+
+//*****************************************************The holding times of shared locks*****************************************************
+
+/********************************************
+// function name: 	lock_hold_push
+// Description	: 	Keeps the acquisition time of a sampled shared lock the calling thread has acquired
+// Parameters	: 	lock - the lock
+//					acquired - the time the lock was acquired
+// Returns		: 	None
+// Exception	: 	None
+*/
+void lock_hold_push(void const* lock, uint64_t acquired) {
+	if (t_num_holds == LOCK_HOLD_STACK_DEPTH)
+		return; //the holding time of this acquisition is not measured
+
+	t_holds[t_num_holds].m_lock = lock;
+	t_holds[t_num_holds].m_acquired = acquired;
+	++t_num_holds;
+}
+
+/********************************************
+// function name: 	lock_hold_pop
+// Description	: 	Returns (and forgets) the acquisition time of a shared lock the calling thread releases.
+//					The locks are usually released in the reverse order, so the search starts at the top of the stack
+// Parameters	: 	lock - the lock
+// Returns		: 	uint64_t - the time the lock was acquired, 0 if it's unknown (not sampled, or too many locks were held at once)
+// Exception	: 	None
+*/
+uint64_t lock_hold_pop(void const* lock) {
+	for (int i = (int)t_num_holds - 1; i >= 0; --i) {
+		if (t_holds[i].m_lock != lock)
+			continue;
+
+		uint64_t acquired = t_holds[i].m_acquired;
+		for (unsigned j = i + 1; j < t_num_holds; ++j)
+			t_holds[j - 1] = t_holds[j];
+		--t_num_holds;
+		return acquired;
+	}
+
+	return 0;
+}
+
+
+//*****************************************************Enabling and reporting*****************************************************
+
+/********************************************
+// function name: 	__reporter_main
+// Description	: 	The routine of the reporting thread. Prints the statistics every period, and whenever SIGUSR1 arrives
+// Parameters	: 	period - the reporting period in seconds, cast to a void* (0 - only on SIGUSR1)
+// Returns		: 	void* (never returns)
+// Exception	: 	None
+*/
+static void* __reporter_main(void* period) {
+	unsigned report_period = (unsigned)(uintptr_t)period;
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, LOCK_REPORT_SIGNAL);
+
+	while (true) {
+		if (report_period) {
+			struct timespec timeout = {(time_t)report_period, 0};
+			sigtimedwait(&signals, NULL, &timeout); //returns on the signal, or once the period is over
+		}
+		else {
+			int signal;
+			sigwait(&signals, &signal);
+		}
+
+		lock_stats_report(stderr);
+	}
+	return NULL;
+}
+
+/********************************************
+// function name: 	lock_stats_enable
+// Description	: 	Turns the instrumentation on - the locks created from now on get lock sites. Starts a reporting thread that
+//					prints the statistics every period, and whenever the process gets SIGUSR1 (SIGUSR1 is blocked in the calling
+//					thread, so it must be called before the other threads of the program are created - they inherit the mask)
+// Parameters	: 	report_period - the reporting period in seconds (0 - report only on SIGUSR1)
+//					sample_period - one of every sample_period acquisitions of a thread is timed (default: LOCK_SAMPLE_PERIOD,
+//									1 - every acquisition)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void lock_stats_enable(unsigned report_period, unsigned sample_period) {
+	if (s_enabled.exchange(true))
+		return;
+	s_start = lock_clock();
+	s_sample_period = sample_period ? sample_period : 1;
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, LOCK_REPORT_SIGNAL);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	pthread_t reporter;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&reporter, &attr, __reporter_main, (void*)(uintptr_t)report_period);
+	pthread_attr_destroy(&attr);
+}
+
+/********************************************
+// function name: 	lock_stats_enabled
+// Description	: 	Tells whether the instrumentation is on
+// Parameters	: 	None
+// Returns		: 	bool - true if lock_stats_enable was called
+// Exception	: 	None
+*/
+bool lock_stats_enabled() {
+	return s_enabled.load();
+}
+
+/********************************************
+// function name: 	lock_site_get
+// Description	: 	Returns the lock site of a name (created on the first call)
+// Parameters	: 	name - the name of the site (a string literal - it's not copied)
+// Returns		: 	lock_site* - the site, NULL while the instrumentation is off
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+lock_site* lock_site_get(const char* name) {
+	if (!s_enabled.load())
+		return NULL;
+
+	lock_site* site = NULL;
+	pthread_mutex_lock(&s_sites_lock);
+	for (unsigned i = 0; i < s_sites.size() && !site; ++i) {
+		if (strcmp(s_sites[i]->Name(), name) == 0)
+			site = s_sites[i];
+	}
+	if (!site) {
+		site = new lock_site(name);
+		s_sites.push_back(site);
+	}
+	pthread_mutex_unlock(&s_sites_lock);
+
+	return site;
+}
+
+/********************************************
+// function name: 	lock_stats_report
+// Description	: 	Prints the statistics of all of the sites, a JSON line per site
+// Parameters	: 	out - the stream to print to
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+void lock_stats_report(FILE* out) {
+	double elapsed_sec = (lock_clock() - s_start) / 1e9;
+
+	pthread_mutex_lock(&s_sites_lock);
+	for (unsigned i = 0; i < s_sites.size(); ++i)
+		s_sites[i]->Report(out, elapsed_sec);
+	fflush(out);
+	pthread_mutex_unlock(&s_sites_lock);
+}
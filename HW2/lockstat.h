@@ -0,0 +1,195 @@
+/*
+ * lockstat.h
+ *
+ *  Created on: Jun 17, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : lockstat
+	Description : Contention statistics of the program's locks, by named lock sites.
+					A lock site is a family of locks (e.g. "account" - the locks of all of the accounts). An instrumented rwlock
+					counts every acquisition at its site, and times one of every sampling period acquisitions of a thread: the time
+					it waited for the lock, the number of threads that were already waiting for the same lock when it arrived (its
+					queue depth), and - when it unlocks - the time it held the lock. Shared and exclusive acquisitions are counted apart.
+					The statistics of a site are split between LOCK_SITE_SHARDS shards (a thread always records into the same shard),
+					so the threads rarely share a cache line. With the default sampling, the instrumentation costs an uncontended
+					acquisition a couple of atomic additions - cheap enough to be left on.
+					The instrumentation is off unless lock_stats_enable is called (before the locks are created) - the locks are
+					then left without a site, and cost a single branch. When it's on, the statistics are printed (a JSON line per site,
+					to stderr) every reporting period, whenever the process gets SIGUSR1, and at the end of the run.
+	Main methods: 	1. lock_stats_enable - turns the instrumentation on, and starts the reporting thread
+					2. lock_site_get - returns the site of a name (NULL while the instrumentation is off)
+					3. lock_stats_report - prints the statistics of all of the sites
+ */
+
+#ifndef LOCKSTAT_H_
+#define LOCKSTAT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "histogram.h"
+
+#define LOCK_SITE_SHARDS 16 			//the shards of the statistics of a site
+#define LOCK_HOLD_STACK_DEPTH 8 		//the sampled shared locks a thread may hold at once and still have their holding time measured
+#define LOCK_SAMPLE_PERIOD 16 			//the default sampling period - one of every 16 acquisitions of a thread is timed
+
+//the mode of an acquisition
+typedef enum {
+	LOCK_SHARED,
+	LOCK_EXCLUSIVE,
+	LOCK_NUM_MODES
+} lock_mode;
+
+
+/********************************************
+// 	class name	: 	lock_site
+// 	Description	: 	The contention statistics of a family of locks. Created by lock_site_get, and never destroyed
+//
+//	Members		:	m_name - the name of the site
+//					m_shards - the statistics, split between shards of threads. Every shard holds, per mode, the number of acquisitions
+//							   and the histograms of the sampled waiting times, holding times (nano-seconds) and queue depths
+//
+//	Methods		:	Acquire - counts an acquisition, and tells whether to time it
+//					RecordAcquire / RecordHold - record a timed acquisition / release
+//					Report - prints the statistics of the site
+*/
+class lock_site {
+public:
+	lock_site(const char* name);
+
+public: //API
+	/********************************************
+	// function name: 	lock_site::Acquire
+	// Description	: 	Counts an acquisition of a lock of the site (before the lock is acquired)
+	// Parameters	: 	mode - shared / exclusive
+	// Returns		: 	bool - true if the acquisition is sampled - it should be timed, and recorded by RecordAcquire / RecordHold
+	// Exception	: 	None
+	*/
+	bool Acquire(lock_mode mode);
+
+	/********************************************
+	// function name: 	lock_site::RecordAcquire
+	// Description	: 	Records a sampled acquisition of a lock of the site
+	// Parameters	: 	mode - shared / exclusive
+	//					wait - the time the thread waited for the lock (nano-seconds)
+	//					depth - the number of threads (of the same mode) that were waiting for the lock when the thread arrived
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void RecordAcquire(lock_mode mode, uint64_t wait, uint32_t depth);
+
+	/********************************************
+	// function name: 	lock_site::RecordHold
+	// Description	: 	Records the release of a sampled acquisition
+	// Parameters	: 	mode - shared / exclusive
+	//					hold - the time the thread held the lock (nano-seconds)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void RecordHold(lock_mode mode, uint64_t hold);
+
+	/********************************************
+	// function name: 	lock_site::Report
+	// Description	: 	Prints the statistics of the site (since the start of the run) as a JSON line
+	// Parameters	: 	out - the stream to print to
+	//					elapsed_sec - the time since the instrumentation was enabled
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void Report(FILE* out, double elapsed_sec) const;
+
+	const char* Name() const {
+		return m_name;
+	}
+
+private:
+	struct shard {
+		atomic<uint64_t> m_acquisitions[LOCK_NUM_MODES];
+		latency_histogram m_wait[LOCK_NUM_MODES];
+		latency_histogram m_hold[LOCK_NUM_MODES];
+		latency_histogram m_depth[LOCK_NUM_MODES];
+	};
+
+	static unsigned __my_shard();
+
+private: //do not allow the user to copy the object
+	lock_site(lock_site const&);
+	lock_site& operator=(lock_site const&);
+
+private:
+	const char* m_name;
+	shard m_shards[LOCK_SITE_SHARDS];
+};
+
+
+/********************************************
+// function name: 	lock_clock
+// Description	: 	The clock of the instrumentation (monotonic, in nano-seconds)
+// Parameters	: 	None
+// Returns		: 	uint64_t - the time
+// Exception	: 	None
+*/
+inline uint64_t lock_clock() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/********************************************
+// function name: 	lock_hold_push / lock_hold_pop
+// Description	: 	Keep the acquisition times of the sampled shared locks the calling thread holds (a shared lock has many holders,
+//					so the time can't be kept in the lock itself). Up to LOCK_HOLD_STACK_DEPTH locks at once
+// Parameters	: 	lock - the lock
+//					acquired - the time the lock was acquired
+// Returns		: 	lock_hold_pop - the time the lock was acquired, 0 if it's unknown (not sampled, or too many locks were held at once)
+// Exception	: 	None
+*/
+void lock_hold_push(void const* lock, uint64_t acquired);
+uint64_t lock_hold_pop(void const* lock);
+
+/********************************************
+// function name: 	lock_stats_enable
+// Description	: 	Turns the instrumentation on - the locks created from now on get lock sites. Starts a reporting thread that
+//					prints the statistics every period, and whenever the process gets SIGUSR1 (SIGUSR1 is blocked in the calling
+//					thread, so it must be called before the other threads of the program are created - they inherit the mask)
+// Parameters	: 	report_period - the reporting period in seconds (0 - report only on SIGUSR1)
+//					sample_period - one of every sample_period acquisitions of a thread is timed (default: LOCK_SAMPLE_PERIOD,
+//									1 - every acquisition)
+// Returns		: 	None
+// Exception	: 	None
+*/
+void lock_stats_enable(unsigned report_period, unsigned sample_period = LOCK_SAMPLE_PERIOD);
+
+/********************************************
+// function name: 	lock_stats_enabled
+// Description	: 	Tells whether the instrumentation is on
+// Parameters	: 	None
+// Returns		: 	bool - true if lock_stats_enable was called
+// Exception	: 	None
+*/
+bool lock_stats_enabled();
+
+/********************************************
+// function name: 	lock_site_get
+// Description	: 	Returns the lock site of a name (created on the first call)
+// Parameters	: 	name - the name of the site (a string literal - it's not copied)
+// Returns		: 	lock_site* - the site, NULL while the instrumentation is off
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+lock_site* lock_site_get(const char* name);
+
+/********************************************
+// function name: 	lock_stats_report
+// Description	: 	Prints the statistics of all of the sites, a JSON line per site
+// Parameters	: 	out - the stream to print to
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+void lock_stats_report(FILE* out);
+
+
+#endif /* LOCKSTAT_H_ */
@@ -16,15 +16,88 @@
 #include <typeinfo>
 #include <vector>
 #include "System.h"
+#include "Options.h"
 
 
-#define ATM_FILES_START 2
 
 using namespace std;
 
 typedef enum {NOT_ENOUGH_FILES = -1, BAD_FILE = -2, BAD_ALLOC = -3} ERR_;
 typedef void* (*thread_fn)(void*);
 
+//helper function, parses the flags at the beginning of the arguments into the system's options.
+//returns the number of arguments that were consumed, -1 in case of an unknown flag
+int __parse_options(int argc, char** argv, system_options& options){
+	int i = 0;
+	for (; i < argc && argv[i][0] == '-'; ++i) {
+		string flag(argv[i]);
+		if (flag == "-s" || flag == "--stream")
+			options.m_load_mode = ATM_LOAD_STREAM;
+		else if (flag == "-w")
+			options.m_run_mode = ATM_RUN_EXECUTOR;
+		else if (flag == "-f" || flag == "--fibers")
+			options.m_run_mode = ATM_RUN_FIBERS;
+		else if (flag == "-v" || flag == "--virtual-clock")
+			options.m_run_mode = ATM_RUN_VIRTUAL_CLOCK;
+		else if (flag == "--lock-stats")
+			options.m_lock_stats = true;
+		else if (flag.compare(0, 13, "--lock-stats=") == 0) {
+			options.m_lock_stats = true;
+			options.m_lock_stats_period = strtoul(flag.c_str() + 13, NULL, 10);
+		}
+		else if (flag.compare(0, 7, "--seed=") == 0)
+			options.m_seed = strtoul(flag.c_str() + 7, NULL, 10);
+		else if (flag.compare(0, 15, "--log-interval=") == 0)
+			options.m_log_interval = strtoul(flag.c_str() + 15, NULL, 10);
+		else if (flag == "--log-sync")
+			options.m_log_sync = true;
+		else if (flag.compare(0, 6, "--wal=") == 0)
+			options.m_wal_path = flag.substr(6);
+		else if (flag == "--wal-mode=txn")
+			options.m_wal_mode = WAL_SYNC_TXN;
+		else if (flag == "--wal-mode=batch")
+			options.m_wal_mode = WAL_SYNC_BATCH;
+		else if (flag == "--wal-mode=async")
+			options.m_wal_mode = WAL_SYNC_ASYNC;
+		else if (flag.compare(0, 15, "--wal-interval=") == 0)
+			options.m_wal_interval = strtoul(flag.c_str() + 15, NULL, 10);
+		else if (flag.compare(0, 13, "--checkpoint=") == 0)
+			options.m_checkpoint_path = flag.substr(13);
+		else if (flag.compare(0, 20, "--checkpoint-period=") == 0)
+			options.m_checkpoint_period = strtoul(flag.c_str() + 20, NULL, 10);
+		else if (flag == "--lock-free")
+			options.m_lock_free = true;
+		else if (flag == "--metrics")
+			options.m_metrics = true;
+		else if (flag == "-p" || flag == "--processes")
+			options.m_run_mode = ATM_RUN_PROCESSES;
+		else if (flag.compare(0, 6, "--shm=") == 0)
+			options.m_shm_name = flag.substr(6);
+		else if (flag.compare(0, 9, "--attach=") == 0) {
+			options.m_attach = true;
+			options.m_shm_name = flag.substr(9);
+		}
+		else if (flag.compare(0, 9, "--atm-id=") == 0)
+			options.m_first_atm_id = atoi(flag.c_str() + 9);
+		else if (flag.compare(0, 8, "--serve=") == 0)
+			options.m_serve_address = flag.substr(8);
+		else if (flag == "--shards")
+			options.m_sharded = true;
+		else if (flag.compare(0, 9, "--shards=") == 0) {
+			options.m_sharded = true;
+			options.m_num_shards = strtoul(flag.c_str() + 9, NULL, 10);
+		}
+		else if (flag.compare(0, 10, "--workers=") == 0) {
+			if (options.m_run_mode == ATM_RUN_THREADS)
+				options.m_run_mode = ATM_RUN_EXECUTOR;
+			options.m_num_workers = atoi(flag.c_str() + 10);
+		}
+		else
+			return -1;
+	}
+	return i;
+}
+
 //helper function, reorganizes the main arguments passed from the command line into managable (iterable) structure
 void __create_atm_files(int num_atms, char** argv, vector<string>& atm_files){
 	atm_files.clear();
@@ -36,12 +109,15 @@ void __create_atm_files(int num_atms, char** argv, vector<string>& atm_files){
 
 //main thread
 int main(int argc, char** argv) {
-	if(argc == 1){
+	system_options options;
+	int num_flags = __parse_options(argc - 1, argv + 1, options);
+	if(num_flags < 0 || argc == 1 + num_flags){
 		cerr << "illegal commands" << endl;
 		return NOT_ENOUGH_FILES;
 	}
-	int num_atms = atoi(argv[1]);
-	if (num_atms != argc - 2){ // -2 means the name of the program + the string that tells the number of ATMs
+	int atm_files_start = 2 + num_flags; //the name of the program + the flags + the string that tells the number of ATMs
+	int num_atms = atoi(argv[atm_files_start - 1]);
+	if (num_atms != argc - atm_files_start){
 		//at this point of the program the cerr global stream is being written only from the main thread
 		//because there are not any other threads attached to the program, so no need to protect cerr
 		cerr << "illegal arguments" << endl;
@@ -51,14 +127,14 @@ int main(int argc, char** argv) {
 
 	//create the atm files list
 	vector<string> atm_files;
-	__create_atm_files(num_atms, argv + ATM_FILES_START, atm_files);
+	__create_atm_files(num_atms, argv + atm_files_start, atm_files);
 
 	//NOTICE: the constructor of the bank and the ATM_manager are spawned from the main thread
 	//but each one of them launches independent threads that deploy the ATMs and the bank methods
 
 	try {
 		//create the system
-		System sys(atm_files);
+		System sys(atm_files, options);
 
 		//run the entire system
 		sys.Main();
@@ -0,0 +1,178 @@
+/*
+ * metrics.cpp
+ *
+ *  Created on: Jun 22, 2017
+ *      Author: dror
+ *
+ *	An implementation of the bank_metrics class
+ */
+
+#include <string.h>
+#include <string>
+#include "metrics.h"
+
+static atomic<uint64_t> s_next_id(1); //the ids of the bank_metrics objects (0 - the empty cache of a thread)
+
+thread_local bank_metrics::thread_cache bank_metrics::t_cache = {0, NULL};
+
+/********************************************
+// function name: 	metric_outcome_of
+// Description	: 	Returns the outcome a message of the bank reports
+// Parameters	: 	message - the message of an ATM operation
+// Returns		: 	metric_outcome - the outcome
+// Exception	: 	None
+*/
+metric_outcome metric_outcome_of(bank_message message) {
+	switch (message) {
+	case MSG_WRONG_PASSWORD:
+	case MSG_WITHDRAW_WRONG_PASSWORD:
+		return OUTCOME_WRONG_PASSWORD;
+	case MSG_WITHDRAW_LOW_BALANCE:
+	case MSG_TRANSFER_LOW_BALANCE:
+		return OUTCOME_INSUFFICIENT_FUNDS;
+	case MSG_NO_ACCOUNT:
+	case MSG_NO_TARGET:
+		return OUTCOME_NOT_FOUND;
+	case MSG_ACCOUNT_EXISTS:
+		return OUTCOME_EXISTS;
+	default:
+		return OUTCOME_OK;
+	}
+}
+
+
+bank_metrics::bank_metrics() : m_id(s_next_id++), m_threads(NULL), m_atms(NULL), m_num_atms(0) {
+}
+
+bank_metrics::~bank_metrics() {
+	thread_counters* counters = m_threads.load();
+	while (counters) {
+		thread_counters* next = counters->m_next;
+		delete counters;
+		counters = next;
+	}
+	delete[] m_atms;
+}
+
+/********************************************
+// function name: 	bank_metrics::SetNumAtms
+// Description	: 	Allocates the counters of the ATMs. Must be called before the ATMs run
+// Parameters	: 	num_atms - the number of ATMs (their ids are 1 .. num_atms)
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+*/
+void bank_metrics::SetNumAtms(unsigned num_atms) {
+	atm_counters* atms = new atm_counters[num_atms];
+	for (unsigned i = 0; i < num_atms; ++i) {
+		atms[i].m_succeeded.store(0);
+		atms[i].m_failed.store(0);
+	}
+
+	delete[] m_atms;
+	m_atms = atms;
+	m_num_atms = num_atms;
+}
+
+/********************************************
+// function name: 	bank_metrics::Read
+// Description	: 	Sums the counters of all of the threads. The counters keep running meanwhile, so the sum is not a snapshot
+//					(every counter is read atomically)
+// Parameters	: 	totals - set to the sums
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+void bank_metrics::Read(metrics_totals& totals) const {
+	memset(totals.m_ops, 0, sizeof(totals.m_ops));
+	totals.m_num_threads = 0;
+	for (thread_counters* counters = m_threads.load(); counters; counters = counters->m_next) {
+		for (unsigned op = 0; op < METRIC_NUM_OPS; ++op)
+			for (unsigned outcome = 0; outcome < METRIC_NUM_OUTCOMES; ++outcome)
+				totals.m_ops[op][outcome] += counters->m_counts[op][outcome].load(memory_order_relaxed);
+		++totals.m_num_threads;
+	}
+
+	totals.m_atm_succeeded.resize(m_num_atms);
+	totals.m_atm_failed.resize(m_num_atms);
+	for (unsigned i = 0; i < m_num_atms; ++i) {
+		totals.m_atm_succeeded[i] = m_atms[i].m_succeeded.load(memory_order_relaxed);
+		totals.m_atm_failed[i] = m_atms[i].m_failed.load(memory_order_relaxed);
+	}
+}
+
+/********************************************
+// function name: 	bank_metrics::Report
+// Description	: 	Prints the sums of the counters as a JSON line - per operation type and outcome, the failures per class, and
+//					the successes and failures of every ATM
+// Parameters	: 	out - the stream to print to
+// Returns		: 	None
+// Exception	: 	std::bad_alloc
+// Thread-safety:	Yes
+*/
+void bank_metrics::Report(FILE* out) const {
+	static const char* OPS[METRIC_NUM_OPS] = {"open", "close", "deposit", "withdraw", "balance", "transfer"};
+	static const char* OUTCOMES[METRIC_NUM_OUTCOMES] = {"ok", "wrong_password", "insufficient_funds", "not_found", "exists"};
+	metrics_totals totals;
+	Read(totals);
+
+	char buffer[128];
+	string line;
+	uint64_t failures[METRIC_NUM_OUTCOMES] = {0};
+	snprintf(buffer, sizeof(buffer), "{\"metrics\":{\"threads\":%u,\"ops\":{", totals.m_num_threads);
+	line += buffer;
+	for (unsigned op = 0; op < METRIC_NUM_OPS; ++op) {
+		snprintf(buffer, sizeof(buffer), "%s\"%s\":{", op ? "," : "", OPS[op]);
+		line += buffer;
+		for (unsigned outcome = 0; outcome < METRIC_NUM_OUTCOMES; ++outcome) {
+			snprintf(buffer, sizeof(buffer), "%s\"%s\":%llu", outcome ? "," : "", OUTCOMES[outcome],
+					 (unsigned long long)totals.m_ops[op][outcome]);
+			line += buffer;
+			failures[outcome] += totals.m_ops[op][outcome];
+		}
+		line += "}";
+	}
+
+	line += "},\"failures\":{";
+	for (unsigned outcome = OUTCOME_OK + 1; outcome < METRIC_NUM_OUTCOMES; ++outcome) {
+		snprintf(buffer, sizeof(buffer), "%s\"%s\":%llu", outcome > OUTCOME_OK + 1 ? "," : "", OUTCOMES[outcome],
+				 (unsigned long long)failures[outcome]);
+		line += buffer;
+	}
+
+	line += "},\"atms\":[";
+	for (unsigned i = 0; i < totals.m_atm_succeeded.size(); ++i) {
+		snprintf(buffer, sizeof(buffer), "%s{\"atm\":%u,\"succeeded\":%llu,\"failed\":%llu}", i ? "," : "", i + 1,
+				 (unsigned long long)totals.m_atm_succeeded[i], (unsigned long long)totals.m_atm_failed[i]);
+		line += buffer;
+	}
+
+	line += "]}}\n";
+	fwrite(line.data(), 1, line.size(), out); //a single write, so the line doesn't interleave with other reports
+}
+
+//finds (or creates) the calling thread's block, and caches it. A thread that counts for several bank_metrics in turn finds its block
+//in the list again, instead of creating another one
+bank_metrics::thread_counters* bank_metrics::__register() {
+	pthread_t self = pthread_self();
+	thread_counters* counters = m_threads.load();
+	while (counters && !pthread_equal(counters->m_owner, self))
+		counters = counters->m_next;
+
+	if (!counters) {
+		counters = new thread_counters;
+		for (unsigned op = 0; op < METRIC_NUM_OPS; ++op)
+			for (unsigned outcome = 0; outcome < METRIC_NUM_OUTCOMES; ++outcome)
+				counters->m_counts[op][outcome].store(0, memory_order_relaxed);
+		counters->m_owner = self;
+
+		//push the block onto the list
+		thread_counters* head = m_threads.load();
+		do {
+			counters->m_next = head;
+		} while (!m_threads.compare_exchange_weak(head, counters));
+	}
+
+	t_cache.m_id = m_id;
+	t_cache.m_counters = counters;
+	return counters;
+}
@@ -0,0 +1,189 @@
+/*
+ * metrics.h
+ *
+ *  Created on: Jun 22, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : metrics
+	Description : Operation counters of the bank - the successes and the failures of every ATM operation type, split by the class of
+					the failure (wrong password, insufficient funds, account not found, account exists), and of every ATM.
+					The counters are sharded by thread - every thread that counts gets a block of counters of its own (padded, so no two
+					threads write the same cache line), and bumps them with a plain load and store (no lock, no atomic read-modify-write,
+					as nobody else writes them). The blocks are summed only when the counters are read, so counting costs a few
+					nano-seconds whatever the number of threads, and reading costs a pass over the threads' blocks.
+					The counters of an ATM are written by the thread that runs the ATM (its operations are issued one at a time).
+	Main methods: 	1. bank_metrics::Count - counts the outcome of an operation
+					2. bank_metrics::Read - sums the counters
+					3. bank_metrics::Report - prints the counters as a JSON line
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+#include "defs.h"
+#include "Message.h"
+
+using namespace std;
+
+//the ATM operation types that are counted
+typedef enum {
+	METRIC_OPEN,
+	METRIC_CLOSE,
+	METRIC_DEPOSIT,
+	METRIC_WITHDRAW,
+	METRIC_BALANCE,
+	METRIC_TRANSFER,
+	METRIC_NUM_OPS
+} metric_op;
+
+//the outcome of an operation - a success, or the class of its failure
+typedef enum {
+	OUTCOME_OK,
+	OUTCOME_WRONG_PASSWORD,
+	OUTCOME_INSUFFICIENT_FUNDS,
+	OUTCOME_NOT_FOUND,		//the account (or the target account of a transfer) doesn't exist
+	OUTCOME_EXISTS,			//an account with the same number already exists
+	METRIC_NUM_OUTCOMES
+} metric_outcome;
+
+//the sums of the counters, as read by bank_metrics::Read
+struct metrics_totals {
+	uint64_t m_ops[METRIC_NUM_OPS][METRIC_NUM_OUTCOMES];
+	vector<uint64_t> m_atm_succeeded; //indexed by the ATM's id - 1
+	vector<uint64_t> m_atm_failed;
+	unsigned m_num_threads; //the number of threads that have counted
+};
+
+
+/********************************************
+// function name: 	metric_outcome_of
+// Description	: 	Returns the outcome a message of the bank reports
+// Parameters	: 	message - the message of an ATM operation
+// Returns		: 	metric_outcome - the outcome
+// Exception	: 	None
+*/
+metric_outcome metric_outcome_of(bank_message message);
+
+
+/********************************************
+// 	class name	: 	bank_metrics
+// 	Description	: 	The operation counters of a bank. A thread finds its block through a thread-local cache (keyed by the id of the
+//					bank_metrics, so a thread may count for several of them), and registers a new block - pushed onto a lock-free
+//					list - the first time it counts. The blocks are freed with the bank_metrics
+//
+//	Members		:	m_id - a unique id of the object (the key of the threads' caches)
+//					m_threads - the list of the threads' blocks
+//					m_atms / m_num_atms - the counters of the ATMs (a cache line each)
+//
+//	Methods		:	SetNumAtms - allocates the counters of the ATMs
+//					Count - counts the outcome of an operation
+//					Read - sums the counters
+//					Report - prints the counters
+*/
+class bank_metrics {
+public:
+	bank_metrics();
+	~bank_metrics();
+
+public: //API
+	/********************************************
+	// function name: 	bank_metrics::SetNumAtms
+	// Description	: 	Allocates the counters of the ATMs. Must be called before the ATMs run
+	// Parameters	: 	num_atms - the number of ATMs (their ids are 1 .. num_atms)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	*/
+	void SetNumAtms(unsigned num_atms);
+
+	/********************************************
+	// function name: 	bank_metrics::Count
+	// Description	: 	Counts the outcome of an operation, in the calling thread's block and in the ATM's counters
+	// Parameters	: 	op - the operation type
+	//					outcome - the outcome
+	//					atm_id - the ATM that issued the operation (an id out of 1 .. num_atms is counted by type only)
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc (only on the first count of a thread)
+	// Thread-safety:	Yes
+	*/
+	void Count(metric_op op, metric_outcome outcome, int atm_id) {
+		thread_counters* counters = (t_cache.m_id == m_id) ? t_cache.m_counters : __register();
+		__bump(counters->m_counts[op][outcome]);
+
+		if (atm_id > 0 && (unsigned)atm_id <= m_num_atms)
+			__bump(outcome == OUTCOME_OK ? m_atms[atm_id - 1].m_succeeded : m_atms[atm_id - 1].m_failed);
+	}
+
+	/********************************************
+	// function name: 	bank_metrics::Read
+	// Description	: 	Sums the counters of all of the threads. The counters keep running meanwhile, so the sum is not a snapshot
+	//					(every counter is read atomically)
+	// Parameters	: 	totals - set to the sums
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	void Read(metrics_totals& totals) const;
+
+	/********************************************
+	// function name: 	bank_metrics::Report
+	// Description	: 	Prints the sums of the counters as a JSON line - per operation type and outcome, the failures per class, and
+	//					the successes and failures of every ATM
+	// Parameters	: 	out - the stream to print to
+	// Returns		: 	None
+	// Exception	: 	std::bad_alloc
+	// Thread-safety:	Yes
+	*/
+	void Report(FILE* out) const;
+
+private:
+	//the block of a thread
+	struct thread_counters {
+		atomic<uint64_t> m_counts[METRIC_NUM_OPS][METRIC_NUM_OUTCOMES];
+		pthread_t m_owner;
+		thread_counters* m_next;
+		char m_pad[CACHE_LINE_SIZE]; //keep the next allocation away from this thread's counters
+	};
+
+	//the counters of an ATM
+	struct atm_counters {
+		atomic<uint64_t> m_succeeded;
+		atomic<uint64_t> m_failed;
+		char m_pad[CACHE_LINE_SIZE - 2 * sizeof(atomic<uint64_t>)];
+	};
+
+	//the thread-local cache of the block of the last bank_metrics the thread counted for
+	struct thread_cache {
+		uint64_t m_id;
+		thread_counters* m_counters;
+	};
+
+	//a counter that has a single writer - a plain increment, no read-modify-write instruction
+	static void __bump(atomic<uint64_t>& counter) {
+		counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+
+	//finds (or creates) the calling thread's block, and caches it
+	thread_counters* __register();
+
+private: //do not allow the user to copy the object
+	bank_metrics(bank_metrics const&);
+	bank_metrics& operator=(bank_metrics const&);
+
+private:
+	static thread_local thread_cache t_cache;
+
+	uint64_t m_id;
+	atomic<thread_counters*> m_threads;
+	atm_counters* m_atms;
+	unsigned m_num_atms;
+};
+
+
+#endif /* METRICS_H_ */
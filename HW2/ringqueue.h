@@ -0,0 +1,190 @@
+/*
+ * ringqueue.h
+ *
+ *  Created on: Jun 23, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : ringqueue
+	Description : Bounded lock-free queues of fixed-size messages, over a ring of a power of 2 slots.
+					spsc_queue has a single producer and a single consumer - each of them owns its own index, so a push and a pop are a
+					plain store of the slot and a release store of the index (no read-modify-write instruction). Each side caches the
+					other side's index, and reads it again only when the ring looks full (or empty) by the cached one.
+					mpsc_queue has many producers and a single consumer - a producer claims a slot with a compare-and-swap of the tail,
+					and publishes it through the slot's sequence number (the slot's sequence tells whether it's free, or published, for
+					the current lap of the ring), so the consumer never waits for a producer that has claimed a slot before it.
+					Neither queue blocks - a push into a full queue (or a pop from an empty one) fails, and the caller decides how to wait.
+	Main methods: 	1. TryPush - pushes a message, unless the queue is full
+					2. TryPop - pops the oldest message, unless the queue is empty
+ */
+
+#ifndef RINGQUEUE_H_
+#define RINGQUEUE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include "defs.h"
+
+using namespace std;
+
+//rounds a capacity up to a power of 2
+inline uint64_t ring_capacity(uint64_t capacity) {
+	uint64_t rounded = 1;
+	while (rounded < capacity)
+		rounded <<= 1;
+	return rounded;
+}
+
+
+/********************************************
+// 	class name	: 	spsc_queue
+// 	Description	: 	A bounded queue of a single producer and a single consumer (wait-free)
+//
+//	Members		:	m_slots / m_mask - the ring and its capacity - 1
+//					m_head - the position of the next message to pop (written by the consumer only)
+//					m_tail - the position of the next message to push (written by the producer only)
+//					m_cached_tail / m_cached_head - the consumer's copy of the tail, and the producer's copy of the head
+//
+//	Methods		:	TryPush - pushes a message (the producer)
+//					TryPop - pops a message (the consumer)
+//					Empty - whether the queue looks empty (to the consumer)
+*/
+template <class T> class spsc_queue {
+public:
+	spsc_queue(uint64_t capacity) : m_mask(ring_capacity(capacity) - 1), m_head(0), m_cached_tail(0), m_tail(0), m_cached_head(0) {
+		m_slots = new T[m_mask + 1];
+	}
+
+	~spsc_queue() {
+		delete[] m_slots;
+	}
+
+	bool TryPush(T const& message) {
+		uint64_t tail = m_tail.load(memory_order_relaxed);
+		if (tail - m_cached_head > m_mask) {
+			m_cached_head = m_head.load(memory_order_acquire);
+			if (tail - m_cached_head > m_mask)
+				return false;
+		}
+		m_slots[tail & m_mask] = message;
+		m_tail.store(tail + 1, memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& message) {
+		uint64_t head = m_head.load(memory_order_relaxed);
+		if (head == m_cached_tail) {
+			m_cached_tail = m_tail.load(memory_order_acquire);
+			if (head == m_cached_tail)
+				return false;
+		}
+		message = m_slots[head & m_mask];
+		m_head.store(head + 1, memory_order_release);
+		return true;
+	}
+
+	bool Empty() const {
+		return m_head.load(memory_order_relaxed) == m_tail.load(memory_order_acquire);
+	}
+
+private: //do not allow the user to copy the object
+	spsc_queue(spsc_queue const&);
+	spsc_queue& operator=(spsc_queue const&);
+
+private:
+	T* m_slots;
+	uint64_t m_mask;
+	char m_pad0[CACHE_LINE_SIZE];
+	atomic<uint64_t> m_head; 	//the consumer's line
+	uint64_t m_cached_tail;
+	char m_pad1[CACHE_LINE_SIZE];
+	atomic<uint64_t> m_tail; 	//the producer's line
+	uint64_t m_cached_head;
+	char m_pad2[CACHE_LINE_SIZE];
+};
+
+
+/********************************************
+// 	class name	: 	mpsc_queue
+// 	Description	: 	A bounded queue of many producers and a single consumer (a producer is lock-free, the consumer is wait-free)
+//
+//	Members		:	m_slots / m_mask - the ring and its capacity - 1. A slot's sequence is its position when it's free for the producers
+//								   of the position's lap, and the position + 1 once the message of the position is published
+//					m_head - the position of the next message to pop (written by the consumer only)
+//					m_tail - the position of the next slot to claim (advanced by the producers)
+//
+//	Methods		:	TryPush - pushes a message (any thread)
+//					TryPop - pops a message (the consumer)
+//					Empty - whether the queue looks empty (to the consumer)
+*/
+template <class T> class mpsc_queue {
+public:
+	mpsc_queue(uint64_t capacity) : m_mask(ring_capacity(capacity) - 1), m_head(0), m_tail(0) {
+		m_slots = new slot[m_mask + 1];
+		for (uint64_t i = 0; i <= m_mask; ++i)
+			m_slots[i].m_seq.store(i, memory_order_relaxed);
+	}
+
+	~mpsc_queue() {
+		delete[] m_slots;
+	}
+
+	bool TryPush(T const& message) {
+		uint64_t tail = m_tail.load(memory_order_relaxed);
+		while (true) {
+			slot& claimed = m_slots[tail & m_mask];
+			int64_t lag = (int64_t)(claimed.m_seq.load(memory_order_acquire) - tail);
+			if (lag == 0) {
+				if (m_tail.compare_exchange_weak(tail, tail + 1, memory_order_relaxed)) {
+					claimed.m_message = message;
+					claimed.m_seq.store(tail + 1, memory_order_release);
+					return true;
+				}
+			}
+			else if (lag < 0)
+				return false; //the slot still holds the message of the previous lap - the queue is full
+			else
+				tail = m_tail.load(memory_order_relaxed); //another producer has claimed the slot
+		}
+	}
+
+	bool TryPop(T& message) {
+		uint64_t head = m_head.load(memory_order_relaxed);
+		slot& next = m_slots[head & m_mask];
+		if (next.m_seq.load(memory_order_acquire) != head + 1)
+			return false; //empty, or the message of the position isn't published yet
+
+		message = next.m_message;
+		next.m_seq.store(head + m_mask + 1, memory_order_release); //free for the next lap
+		m_head.store(head + 1, memory_order_relaxed);
+		return true;
+	}
+
+	bool Empty() const {
+		uint64_t head = m_head.load(memory_order_relaxed);
+		return m_slots[head & m_mask].m_seq.load(memory_order_acquire) != head + 1;
+	}
+
+private:
+	struct slot {
+		atomic<uint64_t> m_seq;
+		T m_message;
+	};
+
+private: //do not allow the user to copy the object
+	mpsc_queue(mpsc_queue const&);
+	mpsc_queue& operator=(mpsc_queue const&);
+
+private:
+	slot* m_slots;
+	uint64_t m_mask;
+	char m_pad0[CACHE_LINE_SIZE];
+	atomic<uint64_t> m_head; 	//the consumer's line
+	char m_pad1[CACHE_LINE_SIZE];
+	atomic<uint64_t> m_tail; 	//the producers' line
+	char m_pad2[CACHE_LINE_SIZE];
+};
+
+
+#endif /* RINGQUEUE_H_ */
@@ -7,6 +7,7 @@
 
 
 #include "rwlock.h"
+#include "Fiber.h"
 
 /*
  * rwlock.cpp
@@ -15,136 +16,404 @@
  *      Author: dror
  */
 
+#define RW_WRITER 		0x80000000u //set in the state of a lock while a writer holds it
+#define RW_READERS_MASK 0x7fffffffu //the number of readers that hold the lock
+
+#define PF_READER_INC 	0x100u 	//the increment of m_rin / m_rout per reader
+#define PF_WRITER_BITS 	0x3u 	//the low bits of m_rin, announcing a writer
+#define PF_PRESENT 		0x2u 	//a writer is present
+#define PF_PHASE_ID 	0x1u 	//the phase of the present writer
+
+//*****************************************************Helpers*****************************************************
+
 /********************************************
-// function name: 	rwlock::rwlock
-// Description	: 	Constructor.
-//					Initializes the mutex and the condition variables
-// Parameters	: 	sleep period - the amount of mili-seconds to sleep (default: 0)
-//					num_readers - maximum number of readers allowed (default : INT_MAX)
-//					num_writers - maximum number of writers allowed (default : 1)
+// function name: 	lock_wait
+// Description	: 	Waits for a futex word to change. A fiber is suspended for a while instead (the caller checks the lock again,
+//					as it does after a spurious wake up), so a waiting fiber never blocks its worker
+// Parameters	: 	word - the futex word
+//					expected - the value the word is expected to hold
+// Returns		: 	None
+// Exception	: 	None
+*/
+static void lock_wait(atomic<uint32_t>& word, uint32_t expected){
+	if (!fiber_park())
+		futex_wait(word, expected);
+}
+
+/********************************************
+// function name: 	park
+// Description	: 	Parks the calling thread on a futex word, in case the word still holds the expected value.
+//					The parked counter is raised before the word is checked again, so an unlocking thread that
+//					changed the word either sees the parked thread (and wakes it) or the parked thread sees the change
+// Parameters	: 	word - the futex word
+//					expected - the value read from the word before the waiting condition was checked
+//					parked - the counter of threads parked on the word
+// Returns		: 	None
+// Exception	: 	None
+*/
+static void park(atomic<uint32_t>& word, uint32_t expected, atomic<uint32_t>& parked){
+	++parked;
+	lock_wait(word, expected);
+	--parked;
+}
+
+/********************************************
+// function name: 	wake
+// Description	: 	Bumps a sequence word and wakes up to n threads parked on it (only if there are parked threads)
+// Parameters	: 	seq - the futex (sequence) word
+//					parked - the counter of threads parked on the word
+//					n - the maximal number of threads to wake
 // Returns		: 	None
 // Exception	: 	None
 */
-rwlock::rwlock(unsigned usleep_period, int num_readers, int num_writers) : 	m_sleep_period(usleep_period),
-																			m_n_readers(num_readers),
-																			m_n_rd_waiters(0),
-																			m_max_n_readers(num_readers),
-																			m_n_writers(num_writers),
-																			m_n_wr_waiters(0) {
-	pthread_mutex_init(&m_lock, NULL);
-	pthread_cond_init(&m_read_unblock, NULL);
-	pthread_cond_init(&m_write_unblock, NULL);
+static void wake(atomic<uint32_t>& seq, atomic<uint32_t>& parked, int n){
+	if (parked.load() == 0)
+		return;
+
+	++seq;
+	futex_wake(seq, n);
 }
 
+/********************************************
+// function name: 	spin_until_changed
+// Description	: 	Spins (up to RWLOCK_SPIN_COUNT times) as long as a word holds a certain value, then parks on it.
+// Parameters	: 	word - the futex word
+//					value - the value the thread waits to change
+//					parked - the counter of threads parked on the word
+// Returns		: 	None (may return spuriously, the caller checks its condition again)
+// Exception	: 	None
+*/
+static void spin_until_changed(atomic<uint32_t>& word, uint32_t value, atomic<uint32_t>& parked){
+	for (unsigned i = 0; i < RWLOCK_SPIN_COUNT; ++i) {
+		if (word.load() != value)
+			return;
+		cpu_relax();
+	}
+
+	park(word, value, parked);
+}
+
+
+//*****************************************************writer_preferring*****************************************************
 
 /********************************************
-// function name: 	rwlock::~rwlock
-// Description	: 	Destructor.
-//					Destroys the mutex. 
-//					The destructor doesn't use pthread_cond_destroy because helgrind throws false positive errors ('destruction of an unknown contidion variable')
+// function name: 	writer_preferring::writer_preferring
+// Description	: 	Constructor.
+//					Initializes a free lock
+// Parameters	: 	max_readers - maximum number of readers allowed
+// Returns		: 	None
+// Exception	: 	None
+*/
+writer_preferring::writer_preferring(int max_readers) : 	m_state(0),
+															m_wr_waiting(0),
+															m_max_readers(max_readers > 0 ? (uint32_t)max_readers & RW_READERS_MASK : RW_READERS_MASK),
+															m_rd_seq(0),
+															m_wr_seq(0),
+															m_rd_parked(0),
+															m_wr_parked(0) {
+
+}
+
+/********************************************
+// function name: 	writer_preferring::LockShared
+// Description	: 	Acquire a shared lock. Waits as long as a writer holds the lock, or waits for it
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
-rwlock::~rwlock() {
-	//pthread_cond_destroy(&m_write_unblock); For some reason helgrind shouts "Destruction of an unknown condition variable" so we removed it
-	//pthread_cond_destroy(&m_read_unblock); For some reason helgrind shouts "Destruction of an unknown condition variable" so we removed it
-	pthread_mutex_destroy(&m_lock);
+void writer_preferring::LockShared() {
+	for (unsigned spins = 0; ; ++spins) {
+		uint32_t state = m_state.load();
+		bool blocked = (state & RW_WRITER) or m_wr_waiting.load() > 0 or (state & RW_READERS_MASK) >= m_max_readers;
+
+		if (!blocked) {
+			if (m_state.compare_exchange_weak(state, state + 1))
+				return;
+			continue;
+		}
+
+		if (spins < RWLOCK_SPIN_COUNT) {
+			cpu_relax();
+			continue;
+		}
+
+		//park until a writer releases the lock (or a reader, in case the maximum amount of readers is reached)
+		uint32_t seq = m_rd_seq.load();
+		++m_rd_parked;
+		state = m_state.load();
+		if ((state & RW_WRITER) or m_wr_waiting.load() > 0 or (state & RW_READERS_MASK) >= m_max_readers)
+			lock_wait(m_rd_seq, seq);
+		--m_rd_parked;
+	}
 }
 
+/********************************************
+// function name: 	writer_preferring::UnlockShared
+// Description	: 	Release a shared lock. The last reader wakes a parked writer
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void writer_preferring::UnlockShared() {
+	uint32_t readers = (m_state.fetch_sub(1) - 1) & RW_READERS_MASK;
+
+	if (readers == 0 and m_wr_waiting.load() > 0)
+		wake(m_wr_seq, m_wr_parked, 1);
+	else if (readers + 1 == m_max_readers)
+		wake(m_rd_seq, m_rd_parked, 1); //a reader may be waiting for a free reader's slot
+}
 
 /********************************************
-// function name: 	rwlock::ReadLock
-// Description	: 	Acquire a shared lock
-//					Waits until a unique lock is released
+// function name: 	writer_preferring::LockExclusive
+// Description	: 	Acquire a unique lock. Announces the writer as waiting (blocking new readers), and waits for the lock to be free
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
-void rwlock::ReadLock() {
-	pthread_mutex_lock (&m_lock);
+void writer_preferring::LockExclusive() {
+	++m_wr_waiting;
+
+	for (unsigned spins = 0; ; ++spins) {
+		uint32_t state = m_state.load();
+		if (state == 0) {
+			if (m_state.compare_exchange_weak(state, RW_WRITER))
+				break;
+			continue;
+		}
 
-	if(m_n_writers == 0 or m_n_wr_waiters > 0) {
-		++m_n_rd_waiters;
-		do pthread_cond_wait(&m_read_unblock, &m_lock);
-		while(m_n_writers == 0 or m_n_wr_waiters > 0);
-		--m_n_rd_waiters;
+		if (spins < RWLOCK_SPIN_COUNT) {
+			cpu_relax();
+			continue;
+		}
+
+		uint32_t seq = m_wr_seq.load();
+		++m_wr_parked;
+		if (m_state.load() != 0)
+			lock_wait(m_wr_seq, seq);
+		--m_wr_parked;
 	}
 
-	--m_n_readers;
-	pthread_mutex_unlock(&m_lock);
+	--m_wr_waiting;
+}
+
+/********************************************
+// function name: 	writer_preferring::UnlockExclusive
+// Description	: 	Release a unique lock. In case there are waiting writers, wake one of them.
+//					Else, in case there are parked readers, wake all of them.
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void writer_preferring::UnlockExclusive() {
+	m_state.store(0);
+
+	if (m_wr_waiting.load() > 0)
+		wake(m_wr_seq, m_wr_parked, 1);
+	else
+		wake(m_rd_seq, m_rd_parked, FUTEX_WAKE_ALL);
 }
 
 
+//*****************************************************reader_preferring*****************************************************
+
 /********************************************
-// function name: 	rwlock::ReadUnlock
-// Description	: 	Release a shared mutex from a single thread
-//					In case all readers have released the lock, signal a waiting writing thread
-// Parameters	: 	is_sleep - tells the lock to sleep (true) or not (false) before unlocking. (default: true)
+// function name: 	reader_preferring::reader_preferring
+// Description	: 	Constructor.
+//					Initializes a free lock
+// Parameters	: 	max_readers - maximum number of readers allowed
 // Returns		: 	None
 // Exception	: 	None
 */
-void rwlock::ReadUnlock(bool is_usleep) {
-	//usleep in case told so
-	if(is_usleep) usleep(m_sleep_period);
+reader_preferring::reader_preferring(int max_readers) : 	m_state(0),
+															m_max_readers(max_readers > 0 ? (uint32_t)max_readers & RW_READERS_MASK : RW_READERS_MASK),
+															m_rd_seq(0),
+															m_wr_seq(0),
+															m_rd_parked(0),
+															m_wr_parked(0) {
 
+}
 
-	pthread_mutex_lock (&m_lock);
-	++m_n_readers;
+/********************************************
+// function name: 	reader_preferring::LockShared
+// Description	: 	Acquire a shared lock. Waits only as long as a writer holds the lock
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void reader_preferring::LockShared() {
+	for (unsigned spins = 0; ; ++spins) {
+		uint32_t state = m_state.load();
+		bool blocked = (state & RW_WRITER) or (state & RW_READERS_MASK) >= m_max_readers;
 
-	if (m_n_wr_waiters > 0)
-		pthread_cond_broadcast(&m_write_unblock);
-	else
-		pthread_cond_broadcast(&m_read_unblock);
+		if (!blocked) {
+			if (m_state.compare_exchange_weak(state, state + 1))
+				return;
+			continue;
+		}
 
-	pthread_mutex_unlock(&m_lock);
+		if (spins < RWLOCK_SPIN_COUNT) {
+			cpu_relax();
+			continue;
+		}
 
+		uint32_t seq = m_rd_seq.load();
+		++m_rd_parked;
+		state = m_state.load();
+		if ((state & RW_WRITER) or (state & RW_READERS_MASK) >= m_max_readers)
+			lock_wait(m_rd_seq, seq);
+		--m_rd_parked;
+	}
 }
 
 /********************************************
-// function name: 	rwlock::WriteLock
-// Description	: 	Acquire a unique lock
-//					Waits until all reading threads release a shared lock or a writing thread releases a unique lock
+// function name: 	reader_preferring::UnlockShared
+// Description	: 	Release a shared lock. The last reader wakes a parked writer
 // Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
-*/	
-void rwlock::WriteLock() {
-	pthread_mutex_lock(&m_lock);
-	while (m_n_readers < m_max_n_readers or m_n_writers == 0) {
-		++m_n_wr_waiters;
-		do pthread_cond_wait(&m_write_unblock, &m_lock);
-		while((m_n_writers == 0) or (m_n_readers < m_max_n_readers));
-		//pthread_cond_wait(&no_readers, &mutex);
-		--m_n_wr_waiters;
+*/
+void reader_preferring::UnlockShared() {
+	uint32_t readers = (m_state.fetch_sub(1) - 1) & RW_READERS_MASK;
+
+	if (readers == 0)
+		wake(m_wr_seq, m_wr_parked, 1);
+	else if (readers + 1 == m_max_readers)
+		wake(m_rd_seq, m_rd_parked, 1); //a reader may be waiting for a free reader's slot
+}
+
+/********************************************
+// function name: 	reader_preferring::LockExclusive
+// Description	: 	Acquire a unique lock. Waits until no reader and no writer hold the lock
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void reader_preferring::LockExclusive() {
+	for (unsigned spins = 0; ; ++spins) {
+		uint32_t state = m_state.load();
+		if (state == 0) {
+			if (m_state.compare_exchange_weak(state, RW_WRITER))
+				return;
+			continue;
+		}
+
+		if (spins < RWLOCK_SPIN_COUNT) {
+			cpu_relax();
+			continue;
+		}
+
+		uint32_t seq = m_wr_seq.load();
+		++m_wr_parked;
+		if (m_state.load() != 0)
+			lock_wait(m_wr_seq, seq);
+		--m_wr_parked;
 	}
-	--m_n_writers;
-	pthread_mutex_unlock(&m_lock);
 }
 
 /********************************************
-// function name: 	rwlock::WriteLock
-// Description	: 	Release a unique lock
-//					In case there is writing threads waiting, signal one of them.
-//					Else, in case there are reading threads waiting, signal all of them (broadcast).
-// Parameters	: 	is_sleep - tells the lock to sleep (true) or not (false) before unlocking. (default: true)
+// function name: 	reader_preferring::UnlockExclusive
+// Description	: 	Release a unique lock. In case there are parked readers, wake all of them. Else, wake a single writer
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void reader_preferring::UnlockExclusive() {
+	m_state.store(0);
+
+	if (m_rd_parked.load() > 0)
+		wake(m_rd_seq, m_rd_parked, FUTEX_WAKE_ALL);
+	else
+		wake(m_wr_seq, m_wr_parked, 1);
+}
+
+
+//*****************************************************phase_fair*****************************************************
+
+/********************************************
+// function name: 	phase_fair::phase_fair
+// Description	: 	Constructor.
+//					Initializes a free lock
+// Parameters	: 	max_readers - maximum number of readers allowed (ignored by this policy)
+// Returns		: 	None
+// Exception	: 	None
+*/
+phase_fair::phase_fair(int max_readers) : 	m_rin(0),
+											m_rout(0),
+											m_win(0),
+											m_wout(0),
+											m_rin_parked(0),
+											m_rout_parked(0),
+											m_wout_parked(0) {
+
+}
+
+/********************************************
+// function name: 	phase_fair::LockShared
+// Description	: 	Acquire a shared lock. In case a writer is present, waits until the writing phase ends
+// Parameters	: 	None
 // Returns		: 	None
 // Exception	: 	None
 */
-void rwlock::WriteUnlock(bool is_usleep) {
-	//usleep in case told so
-	if(is_usleep) usleep(m_sleep_period);
-	//perform unlocking
-	pthread_mutex_lock (&m_lock);
-	++m_n_writers;
-	//if there are waiting writers, signal them first
-	if(m_n_wr_waiters > 0)
-		pthread_cond_broadcast(&m_write_unblock);
-	else if(m_n_rd_waiters  > 0) //else if there are wait readers, signal them instead
-		pthread_cond_broadcast(&m_read_unblock);
+void phase_fair::LockShared() {
+	uint32_t writer = m_rin.fetch_add(PF_READER_INC) & PF_WRITER_BITS;
+	if (writer == 0)
+		return;
 
-	pthread_mutex_unlock(&m_lock);
+	//wait for the writing phase to end (the writer bits of m_rin change)
+	uint32_t rin;
+	while (((rin = m_rin.load()) & PF_WRITER_BITS) == writer)
+		spin_until_changed(m_rin, rin, m_rin_parked);
+}
+
+/********************************************
+// function name: 	phase_fair::UnlockShared
+// Description	: 	Release a shared lock. Wakes the present writer, that waits for the readers to drain
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void phase_fair::UnlockShared() {
+	m_rout.fetch_add(PF_READER_INC);
 
+	if (m_rout_parked.load() > 0)
+		futex_wake(m_rout, 1); //only the present writer waits on m_rout
 }
 
+/********************************************
+// function name: 	phase_fair::LockExclusive
+// Description	: 	Acquire a unique lock. Takes a ticket and waits for the writers before it, then blocks new readers
+//					and waits for the readers of the current reading phase to drain
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void phase_fair::LockExclusive() {
+	//wait for my turn among the writers
+	uint32_t ticket = m_win.fetch_add(1);
+	uint32_t wout;
+	while ((wout = m_wout.load()) != ticket)
+		spin_until_changed(m_wout, wout, m_wout_parked);
+
+	//announce the writer (and its phase) to the readers, and wait for the readers that entered before
+	uint32_t readers = m_rin.fetch_add(PF_PRESENT | (ticket & PF_PHASE_ID)) & ~PF_WRITER_BITS;
+	uint32_t rout;
+	while ((rout = m_rout.load()) != readers)
+		spin_until_changed(m_rout, rout, m_rout_parked);
+}
 
+/********************************************
+// function name: 	phase_fair::UnlockExclusive
+// Description	: 	Release a unique lock. Ends the writing phase (releasing the readers that wait for it), and serves the next writer
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void phase_fair::UnlockExclusive() {
+	m_rin.fetch_and(~PF_WRITER_BITS);
+	if (m_rin_parked.load() > 0)
+		futex_wake(m_rin, FUTEX_WAKE_ALL);
+
+	m_wout.fetch_add(1);
+	if (m_wout_parked.load() > 0)
+		futex_wake(m_wout, FUTEX_WAKE_ALL);
+}
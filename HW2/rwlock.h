@@ -7,191 +7,279 @@
 
  /*
 	Module Name : rwlock
-	Description : An implementation of a read-write mechanism (rwlock) and a thread-safe counter (thread_safe_counter)
+	Description : An implementation of a read-write mechanism (rwlock)
+					The read-write lock is a template (basic_rwlock) over a fairness policy. The policies are built on atomic
+					words and futexes - a waiting thread spins for a short while, and only then parks inside the kernel.
+					An unlocking thread wakes a single writer, or all the readers, and only when someone is actually parked.
+					A lock that is given a lock site (SetSite) also records its contention statistics (see lockstat.h).
 	Main methods: 	ReadLock/WriteLock - acquiring shared (Read) or unique (Write) lock on the mutex
 					ReadUnlock/WriteUnlock - unlocking the lock
  */
- 
+
 #ifndef RWLOCK_H_
 #define RWLOCK_H_
 
 #include <pthread.h>
 #include <limits.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <atomic>
+#include "futex.h"
+#include "Fiber.h"
+#include "lockstat.h"
+
+using namespace std;
+
+#define RWLOCK_SPIN_COUNT 128 //number of spinning iterations before parking a waiting thread
+
 
 /********************************************
-// 	class name	: 	rwlock
-// 	Description	: 	An implementation of a read-write lock mechanism
-//					The lock prioritises writers over readers because of the Bank system requirments (don't want to halt execution of printing and commission charging)
+// 	class name	: 	writer_preferring
+// 	Description	: 	A fairness policy of basic_rwlock that prioritises writers over readers - a reader doesn't acquire the lock
+//					as long as a writer is waiting for it (this was the behaviour of the original rwlock, because of the Bank system
+//					requirments - we don't want to halt execution of printing and commission charging)
 //
+//	Members		:	m_state - bit 31 is set while a writer holds the lock, bits 0-30 count the readers holding the lock
+//					m_wr_waiting - the number of writers that wait for the lock (spinning or parked)
+//					m_max_readers - the maximum amount of simultanous readers allowed
+//					m_rd_seq / m_wr_seq - futex words the readers / writers park on. Incremented by the unlocking thread before a wake up
+//					m_rd_parked / m_wr_parked - the number of parked readers / writers (the unlocking thread skips the system call if 0)
+*/
+class writer_preferring {
+public:
+	writer_preferring(int max_readers);
+
+	void LockShared();
+	void UnlockShared();
+	void LockExclusive();
+	void UnlockExclusive();
+
+private:
+	atomic<uint32_t> m_state;
+	atomic<uint32_t> m_wr_waiting;
+	const uint32_t m_max_readers;
+	atomic<uint32_t> m_rd_seq;
+	atomic<uint32_t> m_wr_seq;
+	atomic<uint32_t> m_rd_parked;
+	atomic<uint32_t> m_wr_parked;
+};
+
+
+/********************************************
+// 	class name	: 	reader_preferring
+// 	Description	: 	A fairness policy of basic_rwlock that prioritises readers over writers - a reader acquires the lock
+//					whenever no writer holds it (writers may starve under a constant stream of readers)
 //
-//	Members		:	m_n_readers - the number of threads that currently a shared lock (read lock)
-//					m_n_rd_waiters - the number of threads that currently wait for the shared lock (waiting in case a unique lock has been acquired)
-//					m_max_n_readers - the maximum amount of simultanous readers allowed in the system
-//					m_n_writers - the number of writers currently hold the unique lock (0 or 1)
-//					m_n_wr_waiters - the number of writers currently waiting to acquire the unique lock
-//					m_lock - a POSIX mutex lock
-//					m_read_unblock - a POSIX condition variable. Reading threads will wait to be signaled on this variable
-//					m_write_unblock - a POSIX condition variable. Writing threads will wait to be signaled on this variable
-//					m_sleep_period - upon unlocking the lock, the lock will sleep the prescribed amount of time (in mili-seconds), before unlocking
-			
+//	Members		:	same as writer_preferring, without the count of waiting writers
+*/
+class reader_preferring {
+public:
+	reader_preferring(int max_readers);
+
+	void LockShared();
+	void UnlockShared();
+	void LockExclusive();
+	void UnlockExclusive();
+
+private:
+	atomic<uint32_t> m_state;
+	const uint32_t m_max_readers;
+	atomic<uint32_t> m_rd_seq;
+	atomic<uint32_t> m_wr_seq;
+	atomic<uint32_t> m_rd_parked;
+	atomic<uint32_t> m_wr_parked;
+};
+
+
+/********************************************
+// 	class name	: 	phase_fair
+// 	Description	: 	A phase-fair (ticket based) policy of basic_rwlock (Brandenburg & Anderson).
+//					Reading and writing phases alternate - a writer waits at most for one reading phase, and a reader waits
+//					at most for one writing phase, so neither readers nor writers starve.
+//					The maximum amount of simultanous readers is not supported by this policy (ignored)
+//
+//	Members		:	m_rin / m_rout - count the readers that entered / left (in units of PF_READER_INC). The low bits of m_rin
+//									 announce a present writer, and the phase it belongs to
+//					m_win / m_wout - writers' tickets: the next ticket to hand, and the ticket currently served
+//					m_rin_parked / m_rout_parked / m_wout_parked - the number of threads parked on each of the words
+*/
+class phase_fair {
+public:
+	phase_fair(int max_readers);
+
+	void LockShared();
+	void UnlockShared();
+	void LockExclusive();
+	void UnlockExclusive();
+
+private:
+	atomic<uint32_t> m_rin;
+	atomic<uint32_t> m_rout;
+	atomic<uint32_t> m_win;
+	atomic<uint32_t> m_wout;
+	atomic<uint32_t> m_rin_parked;
+	atomic<uint32_t> m_rout_parked;
+	atomic<uint32_t> m_wout_parked;
+};
+
+
+/********************************************
+// 	class name	: 	basic_rwlock
+// 	Description	: 	An implementation of a read-write lock mechanism, parameterized by a fairness policy
+//					(writer_preferring, reader_preferring or phase_fair). The policy does the actual locking,
+//					this class adds the sleeping period the Bank system requires before unlocking, and the optional instrumentation.
+//
+//	Members		:	m_sleep_period - upon unlocking the lock, the lock will sleep the prescribed amount of time (in micro-seconds), before unlocking
+//					m_policy - the fairness policy, holds the state of the lock
+//					m_site - the lock site the statistics are recorded to (NULL - not instrumented)
+//					m_rd_waiting / m_wr_waiting - the number of readers / writers currently waiting for the lock (instrumented only)
+//					m_wr_acquired - the time the current writer acquired the lock (instrumented and sampled only, 0 otherwise)
+
 //	Methods:		ReadLock - Acquire a shared lock
 //					ReadUnlock - Release a shared lock (sleep before, if told so)
 //					WriteLock - Acquire a unique lock
 //					WriteUnlock - Release a unique lock (sleep before, if told so)
+//					SetSite - instrument the lock
 */
-class rwlock {
+template <class Policy> class basic_rwlock {
 public:
 	/********************************************
-	// function name: 	rwlock::rwlock
+	// function name: 	basic_rwlock::basic_rwlock
 	// Description	: 	Constructor.
-	//					Initializes the mutex and the condition variables
-	// Parameters	: 	sleep period - the amount of mili-seconds to sleep (default: 0)
+	//					Initializes the state of the lock
+	// Parameters	: 	sleep period - the amount of micro-seconds to sleep (default: 0)
 	//					num_readers - maximum number of readers allowed (default : INT_MAX)
-	//					num_writers - maximum number of writers allowed (default : 1)
+	//					num_writers - maximum number of writers allowed (default : 1). Only a single writer is supported,
+	//								  the parameter is kept for compatibility
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	rwlock(unsigned sleep_period = 0, int num_readers = INT_MAX, int num_writers = 1);
+	basic_rwlock(unsigned sleep_period = 0, int num_readers = INT_MAX, int num_writers = 1) :	m_sleep_period(sleep_period),
+																								m_policy(num_readers),
+																								m_site(NULL),
+																								m_rd_waiting(0),
+																								m_wr_waiting(0),
+																								m_wr_acquired(0) {
 
-	/********************************************
-	// function name: 	rwlock::~rwlock
-	// Description	: 	Destructor.
-	//					Destroys the mutex. 
-	//					The destructor doesn't use pthread_cond_destroy because helgrind throws false positive errors ('destruction of an unknown contidion variable')
-	// Parameters	: 	None
-	// Returns		: 	None
-	// Exception	: 	None
-	*/
-	~rwlock();
+	}
 
 public: //API
 	/********************************************
-	// function name: 	rwlock::ReadLock
+	// function name: 	basic_rwlock::ReadLock
 	// Description	: 	Acquire a shared lock
 	//					Waits until a unique lock is released
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void ReadLock();
+	void ReadLock(){
+		if (!m_site) {
+			m_policy.LockShared();
+			return;
+		}
+
+		bool sampled = m_site->Acquire(LOCK_SHARED);
+		uint32_t depth = m_rd_waiting.fetch_add(1, memory_order_relaxed);
+		uint64_t start = sampled ? lock_clock() : 0;
+		m_policy.LockShared();
+		m_rd_waiting.fetch_sub(1, memory_order_relaxed);
+
+		if (sampled) {
+			uint64_t acquired = lock_clock();
+			m_site->RecordAcquire(LOCK_SHARED, acquired - start, depth);
+			lock_hold_push(this, acquired);
+		}
+	}
 
 	/********************************************
-	// function name: 	rwlock::ReadUnlock
+	// function name: 	basic_rwlock::ReadUnlock
 	// Description	: 	Release a shared mutex from a single thread
-	//					In case all readers have released the lock, signal a waiting writing thread
+	//					In case all readers have released the lock, wake a waiting writing thread
 	// Parameters	: 	is_sleep - tells the lock to sleep (true) or not (false) before unlocking. (default: true)
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void ReadUnlock(bool is_sleep = true);
+	void ReadUnlock(bool is_sleep = true){
+		//sleep in case told so
+		if(is_sleep) fiber_sleep(m_sleep_period); //a fiber is suspended instead
+		if (m_site) {
+			uint64_t acquired = lock_hold_pop(this);
+			if (acquired)
+				m_site->RecordHold(LOCK_SHARED, lock_clock() - acquired);
+		}
+		m_policy.UnlockShared();
+	}
 
 	/********************************************
-	// function name: 	rwlock::WriteLock
+	// function name: 	basic_rwlock::WriteLock
 	// Description	: 	Acquire a unique lock
 	//					Waits until all reading threads release a shared lock or a writing thread releases a unique lock
 	// Parameters	: 	None
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void WriteLock();
-
-	/********************************************
-	// function name: 	rwlock::WriteLock
-	// Description	: 	Release a unique lock
-	//					In case there is writing threads waiting, signal one of them.
-	//					Else, in case there are reading threads waiting, signal all of them (broadcast).
-	// Parameters	: 	is_sleep - tells the lock to sleep (true) or not (false) before unlocking. (default: true)
-	// Returns		: 	None
-	// Exception	: 	None
-	*/
-	void WriteUnlock(bool is_sleep = true);
-
-private:
-	unsigned m_sleep_period;
-	int m_n_readers;
-	int m_n_rd_waiters;
-	const int m_max_n_readers;
-	int m_n_writers;
-	int m_n_wr_waiters;
-	pthread_mutex_t m_lock;
-	pthread_cond_t m_read_unblock;
-	pthread_cond_t m_write_unblock;
-
-};
-
-
-/********************************************
-// 	class name	: 	thread_safe_counter
-// 	Description	: 	an implemetation of a thread safe counter 
-//
-//	Members		:	m_counter - the counter of the class
-//					m_top - the upper bound of the counter
-//					m_lock - a read-write mechanism that makes this counter thread-safe
-//					
-//	Methods		:	operator++ - increases the counter by 1 (thread-safe)
-					Count - returns the value of the counter
-					HasReachedTop - gives an indication that the counter is equal the upper bound
-					SetTop - set the counter upper bound
-*/
-class thread_safe_counter {
-public:
-	/********************************************
-	// function name: 	thread_safe_counter::thread_safe_counter
-	// Description	: 	Constructor
-	//					Initializes the upper bound (default: INT_MAX), the counter to 0, and the lock with 0 mili-second sleeping time
-	// Returns		: 	None
-	// Exception	: 	None
-	*/
-	thread_safe_counter(int top = INT_MAX) : m_counter(0), m_top(top), m_lock(0) {
+	void WriteLock(){
+		if (!m_site) {
+			m_policy.LockExclusive();
+			return;
+		}
 
-	}
+		bool sampled = m_site->Acquire(LOCK_EXCLUSIVE);
+		uint32_t depth = m_wr_waiting.fetch_add(1, memory_order_relaxed);
+		uint64_t start = sampled ? lock_clock() : 0;
+		m_policy.LockExclusive();
+		m_wr_waiting.fetch_sub(1, memory_order_relaxed);
 
-	/********************************************
-	// function name: 	thread_safe_counter::operator++
-	// Description	: 	Increases the counter by one (thread-safe)
-	// Returns		: 	thread_safe_counter& - a reference to self
-	// Exception	: 	None
-	*/
-	thread_safe_counter& operator++(){
-		m_lock.WriteLock();
-		++m_counter;
-		m_lock.WriteUnlock(false);
-
-		return *this;
+		m_wr_acquired = 0;
+		if (sampled) {
+			m_wr_acquired = lock_clock();
+			m_site->RecordAcquire(LOCK_EXCLUSIVE, m_wr_acquired - start, depth);
+		}
 	}
 
 	/********************************************
-	// function name: 	thread_safe_counter::HasReachedTop
-	// Description	: 	Checks if the counter has reached the upper bound (thread-safe)
-	// Returns		: 	bool. true if counter is equal or greater than the upper bound, false otherwise
+	// function name: 	basic_rwlock::WriteUnlock
+	// Description	: 	Release a unique lock
+	//					Wakes the waiting threads that are next in line according to the policy
+	// Parameters	: 	is_sleep - tells the lock to sleep (true) or not (false) before unlocking. (default: true)
+	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	bool HasReachedTop() const{
-		bool cond;
-		m_lock.ReadLock();
-		cond = (m_counter == m_top);
-		m_lock.ReadUnlock(false); //do not sleep
-		return cond;
+	void WriteUnlock(bool is_sleep = true){
+		//sleep in case told so
+		if(is_sleep) fiber_sleep(m_sleep_period); //a fiber is suspended instead
+		if (m_site && m_wr_acquired)
+			m_site->RecordHold(LOCK_EXCLUSIVE, lock_clock() - m_wr_acquired);
+		m_policy.UnlockExclusive();
 	}
 
 	/********************************************
-	// function name: 	thread_safe_counter::SetTop
-	// Description	: 	Sets the counter's upper bound (thread-safe)
+	// function name: 	basic_rwlock::SetSite
+	// Description	: 	Instruments the lock - its acquisitions, waits, holds and queue depths are recorded to a lock site.
+	//					Must be called before the lock is used
+	// Parameters	: 	site - the lock site (NULL - not instrumented, e.g. while the instrumentation is off)
 	// Returns		: 	None
 	// Exception	: 	None
 	*/
-	void SetTop(int top){
-		m_lock.WriteLock();
-		m_top = top;
-		m_lock.WriteUnlock(false);//do not sleep
+	void SetSite(lock_site* site){
+		m_site = site;
 	}
 
+private: //do not allow the user to copy the object
+	basic_rwlock(basic_rwlock const&);
+	basic_rwlock& operator=(basic_rwlock const&);
+
 private:
-	int m_counter;
-	int m_top;
-	mutable rwlock m_lock;
+	unsigned m_sleep_period;
+	Policy m_policy;
+	lock_site* m_site;
+	atomic<uint32_t> m_rd_waiting;
+	atomic<uint32_t> m_wr_waiting;
+	uint64_t m_wr_acquired;
 };
 
+//the default lock of the program - writers are prioritised over readers
+typedef basic_rwlock<writer_preferring> rwlock;
+
 
 #endif /* RWLOCK_H_ */
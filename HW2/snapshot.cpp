@@ -0,0 +1,100 @@
+/*
+ * snapshot.cpp
+ *
+ *  Created on: Jun 9, 2017
+ *      Author: dror
+ *
+ *	An implementation of the version_manager class
+ */
+
+#include <sched.h>
+#include "snapshot.h"
+#include "futex.h"
+
+#define SNAPSHOT_SPIN_COUNT 128 //number of spinning iterations before yielding the cpu, while waiting for the writers
+
+
+/********************************************
+// function name: 	version_manager::version_manager
+// Description	: 	Constructor.
+//					Initializes the version to 1 (values that exist since ever are tagged with 0) and the snapshot lock
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+version_manager::version_manager() : m_version(1) {
+	m_writers[0].m_count.store(0);
+	m_writers[1].m_count.store(0);
+	pthread_mutex_init(&m_snapshot_lock, NULL);
+}
+
+version_manager::~version_manager() {
+	pthread_mutex_destroy(&m_snapshot_lock);
+}
+
+/********************************************
+// function name: 	version_manager::BeginWrite
+// Description	: 	Registers a writer. The written values must be tagged with the returned version
+// Parameters	: 	None
+// Returns		: 	uint32_t - the version of the write
+// Exception	: 	None
+*/
+uint32_t version_manager::BeginWrite() {
+	while (true) {
+		uint32_t version = m_version.load();
+		m_writers[version & 1].m_count.fetch_add(1);
+
+		//a snapshot that advanced the version before it saw the registration won't wait for us - retry with the new version
+		if (m_version.load() == version)
+			return version;
+
+		m_writers[version & 1].m_count.fetch_sub(1);
+	}
+}
+
+/********************************************
+// function name: 	version_manager::EndWrite
+// Description	: 	Unregisters a writer (the window between BeginWrite and EndWrite should be short - a snapshot waits for it)
+// Parameters	: 	version - the version returned by BeginWrite
+// Returns		: 	None
+// Exception	: 	None
+*/
+void version_manager::EndWrite(uint32_t version) {
+	m_writers[version & 1].m_count.fetch_sub(1, memory_order_release);
+}
+
+/********************************************
+// function name: 	version_manager::TakeSnapshot
+// Description	: 	Takes a snapshot - advances the version, and waits for the writes of the old version to finish
+// Parameters	: 	None
+// Returns		: 	uint32_t - the version of the snapshot. Every write tagged with it (or an older version) is visible,
+//					every write tagged with a newer version isn't
+// Exception	: 	None
+*/
+uint32_t version_manager::TakeSnapshot() {
+	pthread_mutex_lock(&m_snapshot_lock);
+
+	uint32_t snapshot = m_version.load();
+	m_version.store(snapshot + 1);
+
+	//wait for the writers that have been tagging their values with the snapshot's version
+	for (unsigned spins = 0; m_writers[snapshot & 1].m_count.load(memory_order_acquire) != 0; ++spins) {
+		if (spins < SNAPSHOT_SPIN_COUNT)
+			cpu_relax();
+		else
+			sched_yield();
+	}
+
+	return snapshot;
+}
+
+/********************************************
+// function name: 	version_manager::ReleaseSnapshot
+// Description	: 	Releases the snapshot (its values may not be read anymore)
+// Parameters	: 	None
+// Returns		: 	None
+// Exception	: 	None
+*/
+void version_manager::ReleaseSnapshot() {
+	pthread_mutex_unlock(&m_snapshot_lock);
+}
@@ -0,0 +1,269 @@
+/*
+ * snapshot.h
+ *
+ *  Created on: Jun 9, 2017
+ *      Author: dror
+ */
+
+ /*
+	Module Name : snapshot
+	Description : Multi-version values and consistent point-in-time snapshots.
+					Every write of a versioned value is tagged with the current global version. A snapshot advances the global version
+					and waits for the writes tagged with the old version to finish - from then on, the value of every versioned
+					object at the snapshot is its newest version that is not newer than the snapshot.
+					Writers never wait for readers, and a reader of a snapshot never blocks a writer.
+	Main methods: 	version_manager::BeginWrite/EndWrite - surround a write of a versioned value
+					version_manager::TakeSnapshot/ReleaseSnapshot - surround the reading of a snapshot
+					versioned_int::Store/Load - write a value / read the newest value or the value at a snapshot
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include "defs.h"
+
+using namespace std;
+
+#define VERSIONED_HELD (1ull << 63) //the bit of a versioned_int's word that is set while a locked write holds it (see versioned_int::Hold)
+
+
+/********************************************
+// 	class name	: 	version_manager
+// 	Description	: 	Hands versions to writers and takes snapshots.
+//					A writer registers itself in the counter of the version it has read (by its parity), and re-checks the version,
+//					so a snapshot that advanced the version can wait for all of the writers of the old version.
+//					Only one snapshot may be taken at a time, and the version doesn't advance until it is released - so the
+//					previous version of a value is always enough to read it at the snapshot.
+//
+//	Members		:	m_version - the current version (starts at 1)
+//					m_writers - the number of writers currently writing with a version of each parity (padded, one per cache line)
+//					m_snapshot_lock - a POSIX mutex held from taking a snapshot until it is released
+//
+//	Methods		:	BeginWrite / EndWrite - surround a write. Both must be called under the lock protecting the written value
+//					TakeSnapshot / ReleaseSnapshot - take a snapshot and release it
+*/
+class version_manager {
+public:
+	version_manager();
+	~version_manager();
+
+public: //API
+	/********************************************
+	// function name: 	version_manager::BeginWrite
+	// Description	: 	Registers a writer. The written values must be tagged with the returned version
+	// Parameters	: 	None
+	// Returns		: 	uint32_t - the version of the write
+	// Exception	: 	None
+	*/
+	uint32_t BeginWrite();
+
+	/********************************************
+	// function name: 	version_manager::EndWrite
+	// Description	: 	Unregisters a writer (the window between BeginWrite and EndWrite should be short - a snapshot waits for it)
+	// Parameters	: 	version - the version returned by BeginWrite
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void EndWrite(uint32_t version);
+
+	/********************************************
+	// function name: 	version_manager::TakeSnapshot
+	// Description	: 	Takes a snapshot - advances the version, and waits for the writes of the old version to finish
+	// Parameters	: 	None
+	// Returns		: 	uint32_t - the version of the snapshot. Every write tagged with it (or an older version) is visible,
+	//					every write tagged with a newer version isn't
+	// Exception	: 	None
+	*/
+	uint32_t TakeSnapshot();
+
+	/********************************************
+	// function name: 	version_manager::ReleaseSnapshot
+	// Description	: 	Releases the snapshot (its values may not be read anymore)
+	// Parameters	: 	None
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void ReleaseSnapshot();
+
+private: //do not allow the user to copy the object
+	version_manager(version_manager const&);
+	version_manager& operator=(version_manager const&);
+
+private:
+	struct writers_counter {
+		atomic<uint32_t> m_count;
+		char m_pad[CACHE_LINE_SIZE - sizeof(atomic<uint32_t>)];
+	};
+
+	atomic<uint32_t> m_version;
+	writers_counter m_writers[2];
+	pthread_mutex_t m_snapshot_lock;
+};
+
+
+/********************************************
+// 	class name	: 	versioned_int
+// 	Description	: 	An integer with its two newest versions. The version and the value are packed into a single 64-bit atomic word,
+//					so a reader never sees a torn version. Only one thread may write the value at a time (the caller's lock), except
+//					for CompareStore - a lock-free write that keeps the version of the value (so the previous version isn't touched).
+//					A locked writer that shares the value with lock-free writers holds the word while it's locked (Hold / Release) -
+//					the top bit of the version is set, so every CompareStore fails until it is released
+//
+//	Members		:	m_current - the newest version of the value (and the held bit)
+//					m_previous - the version before it (older than the oldest snapshot that may still read the value)
+//
+//	Methods		:	Store - write a new value, tagged with the version of the write
+//					Load - read the newest value, or the value at a snapshot
+//					Word / CompareStore - read the packed word / replace it by a new value of the same version, if it hasn't changed
+//					Hold / Release - exclude the lock-free writers / let them in again
+*/
+class versioned_int {
+public:
+	/********************************************
+	// function name: 	versioned_int::versioned_int
+	// Description	: 	Constructor.
+	// Parameters	: 	value - the initial value
+	//					version - the version of the initial value (a write's version, or 0 if the value exists since ever)
+	//					before - the value seen by snapshots older than version (default: 0)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	versioned_int(int value, uint32_t version, int before = 0) : m_current(__pack(value, version)), m_previous(__pack(before, 0)) {}
+
+	/********************************************
+	// function name: 	versioned_int::Store
+	// Description	: 	Writes a new value. The previous version is kept in case the value changes for the first time since the last snapshot
+	// Parameters	: 	value - the new value
+	//					version - the version of the write (from version_manager::BeginWrite)
+	// Returns		: 	None
+	// Exception	: 	None
+	*/
+	void Store(int value, uint32_t version) {
+		uint64_t current = m_current.load(memory_order_relaxed);
+		if (__version(current) != version)
+			m_previous.store(current & ~VERSIONED_HELD, memory_order_release);
+		m_current.store(__pack(value, version) | (current & VERSIONED_HELD), memory_order_release); //still held by the writer
+	}
+
+	/********************************************
+	// function name: 	versioned_int::CompareStore
+	// Description	: 	Replaces the value by a new one of the same version, in case the word is still the expected one (a CAS).
+	//					The caller must have registered a write of that version, and the word must not be held
+	// Parameters	: 	expected - the word the new value replaces. Set to the current word in case it has changed
+	//					value - the new value
+	// Returns		: 	bool - true if the value was replaced
+	// Exception	: 	None
+	*/
+	bool CompareStore(uint64_t& expected, int value) {
+		return m_current.compare_exchange_weak(expected, __pack(value, Version(expected)), memory_order_acq_rel, memory_order_acquire);
+	}
+
+	uint64_t Word() const {
+		return m_current.load(memory_order_acquire);
+	}
+
+	//sets / clears the held bit
+	void Hold() {
+		m_current.fetch_or(VERSIONED_HELD, memory_order_acq_rel);
+	}
+
+	void Release() {
+		m_current.fetch_and(~VERSIONED_HELD, memory_order_release);
+	}
+
+	static bool IsHeld(uint64_t word) {
+		return (word & VERSIONED_HELD) != 0;
+	}
+
+	static uint32_t Version(uint64_t word) {
+		return __version(word);
+	}
+
+	static int Value(uint64_t word) {
+		return __value(word);
+	}
+
+	/********************************************
+	// function name: 	versioned_int::Load
+	// Description	: 	Reads the newest value
+	// Parameters	: 	None
+	// Returns		: 	int - the value
+	// Exception	: 	None
+	*/
+	int Load() const {
+		return __value(m_current.load(memory_order_acquire));
+	}
+
+	/********************************************
+	// function name: 	versioned_int::Load
+	// Description	: 	Reads the value at a snapshot (lock-free). Must be called before the snapshot is released
+	// Parameters	: 	snapshot - the version of the snapshot
+	// Returns		: 	int - the value at the snapshot
+	// Exception	: 	None
+	*/
+	int Load(uint32_t snapshot) const {
+		uint64_t current = m_current.load(memory_order_acquire);
+		if (__version(current) <= snapshot)
+			return __value(current);
+
+		//written after the snapshot - the previous version is the one seen by the snapshot (it can't change until the snapshot is released)
+		return __value(m_previous.load(memory_order_acquire));
+	}
+
+private:
+	static uint64_t __pack(int value, uint32_t version) {
+		return (static_cast<uint64_t>(version) << 32) | static_cast<uint32_t>(value);
+	}
+
+	static uint32_t __version(uint64_t word) {
+		return static_cast<uint32_t>((word & ~VERSIONED_HELD) >> 32);
+	}
+
+	static int __value(uint64_t word) {
+		return static_cast<int>(static_cast<uint32_t>(word));
+	}
+
+private: //do not allow the user to copy the object
+	versioned_int(versioned_int const&);
+	versioned_int& operator=(versioned_int const&);
+
+private:
+	atomic<uint64_t> m_current;
+	atomic<uint64_t> m_previous;
+};
+
+
+/********************************************
+// 	class name	: 	version_write_guard
+// 	Description	: 	A scoped write - registers a writer on construction and unregisters it on destruction.
+//					A guard without a manager writes with version 0 (values that are never read by snapshots)
+//
+//	Members		:	m_manager - the version manager (may be NULL)
+//					m_version - the version of the write
+*/
+class version_write_guard {
+public:
+	version_write_guard(version_manager* manager) : m_manager(manager), m_version(manager ? manager->BeginWrite() : 0) {}
+
+	~version_write_guard(){
+		if (m_manager) m_manager->EndWrite(m_version);
+	}
+
+	uint32_t Version() const {
+		return m_version;
+	}
+
+private: //do not allow the user to copy the object
+	version_write_guard(version_write_guard const&);
+	version_write_guard& operator=(version_write_guard const&);
+
+private:
+	version_manager* m_manager;
+	uint32_t m_version;
+};
+
+
+#endif /* SNAPSHOT_H_ */